@@ -0,0 +1,180 @@
+#include "Animation.hpp"
+#include "MeshLoader.hpp"
+#include "parallel_helper.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define ANIMATION_SSE
+#endif
+
+void AnimationSet::clear() {
+	clips.clear();
+	channels.clear();
+	keyTimes.clear();
+	keyValues.clear();
+	skins.clear();
+	jointNodes.clear();
+	inverseBindMatrices.clear();
+}
+
+void computeJointMatrices(const AnimationSet& animations, const SceneHierarchy& hierarchy, uint32_t skin, uint32_t meshNode, glm::mat4* dst) {
+	const Skin& s = animations.skins[skin];
+	const glm::mat4 meshNodeInverse = glm::inverse(hierarchy.getWorldMatrix(meshNode));
+	for (uint32_t j = 0; j < s.jointCount; j++) {
+		dst[j] = meshNodeInverse
+			* hierarchy.getWorldMatrix(animations.jointNodes[s.firstJoint + j])
+			* animations.inverseBindMatrices[s.firstJoint + j];
+	}
+}
+
+Bounds skinnedBounds(const Bounds& meshBounds, const glm::mat4& transform, const glm::mat4* jointMatrices, uint32_t jointCount) {
+	glm::vec3 aabbMin(std::numeric_limits<float>::max());
+	glm::vec3 aabbMax(-std::numeric_limits<float>::max());
+	for (uint32_t j = 0; j < jointCount; j++) {
+		Bounds moved = transformBounds(meshBounds, transform * jointMatrices[j]);
+		aabbMin = glm::min(aabbMin, glm::vec3(moved.aabbMin));
+		aabbMax = glm::max(aabbMax, glm::vec3(moved.aabbMax));
+	}
+	if (jointCount == 0)
+		return transformBounds(meshBounds, transform);
+
+	Bounds bounds;
+	bounds.aabbMin = glm::vec4(aabbMin, 0.f);
+	bounds.aabbMax = glm::vec4(aabbMax, 0.f);
+	glm::vec3 center = (aabbMin + aabbMax) * 0.5f;
+	bounds.sphere = glm::vec4(center, glm::length(aabbMax - center));
+	return bounds;
+}
+
+namespace {
+	//a * (1 - t) + b * t on all four components
+	inline glm::vec4 lerp4(const glm::vec4& a, const glm::vec4& b, float t) {
+#ifdef ANIMATION_SSE
+		__m128 va = _mm_loadu_ps(&a.x);
+		__m128 vb = _mm_loadu_ps(&b.x);
+		__m128 result = _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), _mm_set1_ps(t)));
+		glm::vec4 out;
+		_mm_storeu_ps(&out.x, result);
+		return out;
+#else
+		return a + (b - a) * t;
+#endif
+	}
+
+	//normalized lerp along the shorter arc, close to slerp for the key spacing animations use
+	inline glm::vec4 nlerpQuat(const glm::vec4& a, glm::vec4 b, float t) {
+		if (glm::dot(a, b) < 0.f)
+			b = -b;
+		return glm::normalize(lerp4(a, b, t));
+	}
+
+	//cubic hermite spline between two keys, tangents are scaled by the key spacing
+	inline glm::vec4 hermite(const glm::vec4& v0, const glm::vec4& out0, const glm::vec4& in1, const glm::vec4& v1, float t, float keySpacing) {
+		float t2 = t * t;
+		float t3 = t2 * t;
+		float h00 = 2.f * t3 - 3.f * t2 + 1.f;
+		float h10 = (t3 - 2.f * t2 + t) * keySpacing;
+		float h01 = -2.f * t3 + 3.f * t2;
+		float h11 = (t3 - t2) * keySpacing;
+#ifdef ANIMATION_SSE
+		__m128 result = _mm_mul_ps(_mm_loadu_ps(&v0.x), _mm_set1_ps(h00));
+		result = _mm_add_ps(result, _mm_mul_ps(_mm_loadu_ps(&out0.x), _mm_set1_ps(h10)));
+		result = _mm_add_ps(result, _mm_mul_ps(_mm_loadu_ps(&v1.x), _mm_set1_ps(h01)));
+		result = _mm_add_ps(result, _mm_mul_ps(_mm_loadu_ps(&in1.x), _mm_set1_ps(h11)));
+		glm::vec4 out;
+		_mm_storeu_ps(&out.x, result);
+		return out;
+#else
+		return v0 * h00 + out0 * h10 + v1 * h01 + in1 * h11;
+#endif
+	}
+}
+
+glm::vec4 AnimationPlayer::sampleChannel(const AnimationChannel& channel, float time) const {
+	const float* times = animations.keyTimes.data() + channel.firstKey;
+	const glm::vec4* values = animations.keyValues.data() + channel.firstValue;
+	const bool cubic = channel.interpolation == AnimationInterpolation::cubicSpline;
+	//cubic splines store in tangent, value, out tangent per key
+	auto value = [&](uint32_t key) { return cubic ? values[3 * key + 1] : values[key]; };
+
+	if (channel.keyCount == 1 || time <= times[0])
+		return value(0);
+	if (time >= times[channel.keyCount - 1])
+		return value(channel.keyCount - 1);
+
+	uint32_t next = (uint32_t)(std::upper_bound(times, times + channel.keyCount, time) - times);
+	uint32_t key = next - 1;
+	float keySpacing = times[next] - times[key];
+	float t = keySpacing > 0.f ? (time - times[key]) / keySpacing : 0.f;
+
+	glm::vec4 result;
+	switch (channel.interpolation) {
+	case AnimationInterpolation::step:
+		return values[key];
+	case AnimationInterpolation::cubicSpline:
+		result = hermite(values[3 * key + 1], values[3 * key + 2], values[3 * next], values[3 * next + 1], t, keySpacing);
+		return channel.path == AnimationPath::rotation ? glm::normalize(result) : result;
+	default:
+		if (channel.path == AnimationPath::rotation)
+			return nlerpQuat(values[key], values[next], t);
+		return lerp4(values[key], values[next], t);
+	}
+}
+
+void AnimationPlayer::setAnimations(AnimationSet animations) {
+	this->animations = std::move(animations);
+	clipTimes.assign(this->animations.clips.size(), 0.f);
+	clipPlaying.assign(this->animations.clips.size(), 0);
+	if (!clipPlaying.empty())
+		clipPlaying[0] = 1;
+}
+
+void AnimationPlayer::advance(float deltaTime, SceneHierarchy& hierarchy) {
+	if (!playing)
+		return;
+
+	activeChannels.clear();
+	channelTimes.clear();
+	for (uint32_t c = 0; c < animations.clips.size(); c++) {
+		if (!clipPlaying[c])
+			continue;
+		const AnimationClip& clip = animations.clips[c];
+		clipTimes[c] += deltaTime * speed;
+		if (clip.duration > 0.f) {
+			clipTimes[c] = std::fmod(clipTimes[c], clip.duration);
+			if (clipTimes[c] < 0.f)
+				clipTimes[c] += clip.duration;
+		}
+		for (uint32_t i = clip.firstChannel; i < clip.firstChannel + clip.channelCount; i++) {
+			activeChannels.push_back(i);
+			channelTimes.push_back(clipTimes[c]);
+		}
+	}
+
+	//sampling only reads, so channels are split across threads, writing the hierarchy is not thread safe
+	sampledValues.resize(activeChannels.size());
+	parallelFor(activeChannels.size(), chunkSize, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			sampledValues[i] = sampleChannel(animations.channels[activeChannels[i]], channelTimes[i]);
+		});
+
+	for (size_t i = 0; i < activeChannels.size(); i++) {
+		const AnimationChannel& channel = animations.channels[activeChannels[i]];
+		const glm::vec4& v = sampledValues[i];
+		switch (channel.path) {
+		case AnimationPath::translation:
+			hierarchy.setTranslation(channel.node, glm::vec3(v));
+			break;
+		case AnimationPath::rotation:
+			hierarchy.setRotation(channel.node, glm::quat(v.w, v.x, v.y, v.z));
+			break;
+		case AnimationPath::scale:
+			hierarchy.setScale(channel.node, glm::vec3(v));
+			break;
+		}
+	}
+}
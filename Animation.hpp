@@ -0,0 +1,106 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "SceneHierarchy.hpp"
+
+struct Bounds;
+
+//keyframe animations and skins of a model
+//channels write sampled trs into SceneHierarchy nodes, its dirty propagation then moves instances and joints
+//vertices are skinned on the gpu from the joint matrices computed here
+
+enum class AnimationPath : uint32_t {
+	translation = 0,
+	rotation = 1,
+	scale = 2
+};
+
+enum class AnimationInterpolation : uint32_t {
+	linear = 0,
+	step = 1,
+	cubicSpline = 2
+};
+
+struct AnimationChannel {
+	//SceneHierarchy node
+	uint32_t node;
+	AnimationPath path;
+	AnimationInterpolation interpolation;
+	//keyTimes[firstKey, firstKey + keyCount)
+	uint32_t firstKey;
+	uint32_t keyCount;
+	//one keyValue per key, cubic splines have in tangent, value and out tangent per key
+	uint32_t firstValue;
+};
+
+struct AnimationClip {
+	std::string name;
+	//channels[firstChannel, firstChannel + channelCount)
+	uint32_t firstChannel;
+	uint32_t channelCount;
+	//last key time of any of its channels
+	float duration;
+};
+
+struct Skin {
+	//jointNodes and inverseBindMatrices [firstJoint, firstJoint + jointCount)
+	uint32_t firstJoint;
+	uint32_t jointCount;
+};
+
+struct AnimationSet {
+	std::vector<AnimationClip> clips;
+	std::vector<AnimationChannel> channels;
+	std::vector<float> keyTimes;
+	//translations and scales in xyz, rotations as quaternion xyzw, all in renderer space
+	std::vector<glm::vec4> keyValues;
+
+	std::vector<Skin> skins;
+	std::vector<uint32_t> jointNodes;
+	std::vector<glm::mat4> inverseBindMatrices;
+
+	void clear();
+};
+
+//joint matrices take bind pose vertices of a mesh to where its skin puts them, relative to the instance's node
+//so the instance transform still applies on top like for any other mesh
+void computeJointMatrices(const AnimationSet& animations, const SceneHierarchy& hierarchy, uint32_t skin, uint32_t meshNode, glm::mat4* dst);
+//world space box around the mesh bounds moved by every joint, skinned vertices are blends of those so they stay inside
+Bounds skinnedBounds(const Bounds& meshBounds, const glm::mat4& transform, const glm::mat4* jointMatrices, uint32_t jointCount);
+
+class AnimationPlayer {
+	AnimationSet animations;
+	std::vector<float> clipTimes;
+	std::vector<uint8_t> clipPlaying;
+	//one per channel of the playing clips, in the order they are applied
+	std::vector<uint32_t> activeChannels;
+	std::vector<float> channelTimes;
+	std::vector<glm::vec4> sampledValues;
+
+	glm::vec4 sampleChannel(const AnimationChannel& channel, float time) const;
+
+public:
+	//channels per parallel chunk when sampling
+	inline static const size_t chunkSize = 256;
+
+	float speed = 1.f;
+	bool playing = true;
+
+	//all clips start at 0, only the first one playing since clips of a file often drive the same nodes
+	void setAnimations(AnimationSet animations);
+	const AnimationSet& getAnimations() const { return animations; }
+
+	size_t clipCount() const { return animations.clips.size(); }
+	const AnimationClip& getClip(uint32_t clip) const { return animations.clips[clip]; }
+	bool isClipPlaying(uint32_t clip) const { return clipPlaying[clip] != 0; }
+	void setClipPlaying(uint32_t clip, bool play) { clipPlaying[clip] = play; }
+	float getClipTime(uint32_t clip) const { return clipTimes[clip]; }
+
+	//moves playing clips forward by deltaTime and writes their channels into the hierarchy, clips loop
+	//does nothing while paused, so the hierarchy stays clean
+	void advance(float deltaTime, SceneHierarchy& hierarchy);
+};
@@ -0,0 +1,517 @@
+#include "BlockCompression.hpp"
+#include "parallel_helper.hpp"
+#include "simd_helper.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace {
+	//a 4x4 block as rgba channels one after another, channels the source doesn't have are 0 and alpha 255
+	struct Block {
+		alignas(32) int32_t c[4][16];
+	};
+
+	//blocks below this are compressed on the calling thread
+	constexpr size_t parallelBlockThreshold = 4096;
+	constexpr size_t blocksPerChunk = 1024;
+	constexpr int refineIterations = 2;
+
+	void gatherBlock(const unsigned char* pixels, int width, int height, int channels, int blockX, int blockY, Block& block) {
+		for (int y = 0; y < 4; y++) {
+			int sy = std::min(blockY * 4 + y, height - 1);
+			for (int x = 0; x < 4; x++) {
+				int sx = std::min(blockX * 4 + x, width - 1);
+				const unsigned char* src = pixels + ((size_t)sy * width + sx) * channels;
+				int i = y * 4 + x;
+				block.c[0][i] = block.c[1][i] = block.c[2][i] = 0;
+				block.c[3][i] = 255;
+				for (int c = 0; c < std::min(channels, 4); c++)
+					block.c[c][i] = src[c];
+			}
+		}
+	}
+
+	//ends of the block's colors projected on their principal axis, found by power iteration on the covariance
+	template<int N>
+	void principalEndpoints(const Block& block, int firstChannel, float lo[N], float hi[N]) {
+		const int32_t* channel[N];
+		for (int c = 0; c < N; c++)
+			channel[c] = block.c[firstChannel + c];
+
+		float mean[N] = {};
+		for (int i = 0; i < 16; i++)
+			for (int c = 0; c < N; c++)
+				mean[c] += channel[c][i];
+		for (int c = 0; c < N; c++)
+			mean[c] /= 16.f;
+
+		float cov[N][N] = {};
+		for (int i = 0; i < 16; i++) {
+			float d[N];
+			for (int c = 0; c < N; c++)
+				d[c] = channel[c][i] - mean[c];
+			for (int a = 0; a < N; a++)
+				for (int b = 0; b < N; b++)
+					cov[a][b] += d[a] * d[b];
+		}
+
+		//the column of the widest channel can't be orthogonal to the principal axis unlike a fixed start
+		int widest = 0;
+		for (int c = 1; c < N; c++)
+			if (cov[c][c] > cov[widest][widest])
+				widest = c;
+		float axis[N];
+		for (int c = 0; c < N; c++)
+			axis[c] = cov[c][widest];
+
+		for (int iteration = 0; iteration < 8; iteration++) {
+			float next[N] = {};
+			for (int a = 0; a < N; a++)
+				for (int b = 0; b < N; b++)
+					next[a] += cov[a][b] * axis[b];
+			float length = 0.f;
+			for (int c = 0; c < N; c++)
+				length += next[c] * next[c];
+			length = std::sqrt(length);
+			if (length < 1e-6f)
+				break;
+			for (int c = 0; c < N; c++)
+				axis[c] = next[c] / length;
+		}
+
+		float axisLength = 0.f;
+		for (int c = 0; c < N; c++)
+			axisLength += axis[c] * axis[c];
+		if (axisLength < 1e-12f) {
+			//flat block
+			for (int c = 0; c < N; c++)
+				lo[c] = hi[c] = mean[c];
+			return;
+		}
+
+		float tMin = 1e30f, tMax = -1e30f;
+		for (int i = 0; i < 16; i++) {
+			float t = 0.f;
+			for (int c = 0; c < N; c++)
+				t += (channel[c][i] - mean[c]) * axis[c];
+			tMin = std::min(tMin, t);
+			tMax = std::max(tMax, t);
+		}
+		for (int c = 0; c < N; c++) {
+			lo[c] = std::clamp(mean[c] + axis[c] * tMin, 0.f, 255.f);
+			hi[c] = std::clamp(mean[c] + axis[c] * tMax, 0.f, 255.f);
+		}
+	}
+
+	//corners of the bounding box on the diagonal the colors lie along, pulled in by a sixteenth of the range
+	//the diagonal is picked by the sign of each channel's covariance with the widest one
+	template<int N>
+	void boundingEndpoints(const Block& block, int firstChannel, float lo[N], float hi[N]) {
+		const int32_t* channel[N];
+		int minimum[N], maximum[N];
+		float mean[N] = {};
+		for (int c = 0; c < N; c++) {
+			channel[c] = block.c[firstChannel + c];
+			minimum[c] = maximum[c] = channel[c][0];
+			for (int i = 0; i < 16; i++) {
+				minimum[c] = std::min(minimum[c], channel[c][i]);
+				maximum[c] = std::max(maximum[c], channel[c][i]);
+				mean[c] += channel[c][i];
+			}
+			mean[c] /= 16.f;
+		}
+
+		int widest = 0;
+		for (int c = 1; c < N; c++)
+			if (maximum[c] - minimum[c] > maximum[widest] - minimum[widest])
+				widest = c;
+
+		for (int c = 0; c < N; c++) {
+			float inset = (maximum[c] - minimum[c]) / 16.f;
+			lo[c] = minimum[c] + inset;
+			hi[c] = maximum[c] - inset;
+			if (c == widest)
+				continue;
+			float cov = 0.f;
+			for (int i = 0; i < 16; i++)
+				cov += (channel[c][i] - mean[c]) * (channel[widest][i] - mean[widest]);
+			if (cov < 0.f)
+				std::swap(lo[c], hi[c]);
+		}
+	}
+
+	//least squares endpoints for the block's current indices, weights[index] is how far toward e1 the index is
+	//false if every pixel uses the same weight and the endpoints can't be separated
+	template<int N>
+	bool refineEndpoints(const Block& block, int firstChannel, const int indices[16], const float* weights, float e0[N], float e1[N]) {
+		float a = 0.f, b = 0.f, c = 0.f;
+		float d0[N] = {}, d1[N] = {};
+		for (int i = 0; i < 16; i++) {
+			float w = weights[indices[i]];
+			a += (1.f - w) * (1.f - w);
+			b += (1.f - w) * w;
+			c += w * w;
+			for (int ch = 0; ch < N; ch++) {
+				float x = (float)block.c[firstChannel + ch][i];
+				d0[ch] += (1.f - w) * x;
+				d1[ch] += w * x;
+			}
+		}
+		float det = a * c - b * b;
+		if (std::abs(det) < 1e-6f)
+			return false;
+		for (int ch = 0; ch < N; ch++) {
+			e0[ch] = std::clamp((c * d0[ch] - b * d1[ch]) / det, 0.f, 255.f);
+			e1[ch] = std::clamp((a * d1[ch] - b * d0[ch]) / det, 0.f, 255.f);
+		}
+		return true;
+	}
+
+#ifdef SIMD_HELPER_AVX2
+	//two registers of eight pixels, compared against one palette entry at a time
+	AVX2_FUNCTION int nearestIndicesAvx2(const Block& block, int firstChannel, int channelCount, const int palette[][4], int paletteSize, int indices[16]) {
+		__m256i best[2], bestIndex[2];
+		for (int h = 0; h < 2; h++) {
+			best[h] = _mm256_set1_epi32(INT32_MAX);
+			bestIndex[h] = _mm256_setzero_si256();
+		}
+		for (int p = 0; p < paletteSize; p++) {
+			const __m256i index = _mm256_set1_epi32(p);
+			for (int h = 0; h < 2; h++) {
+				__m256i distance = _mm256_setzero_si256();
+				for (int c = 0; c < channelCount; c++) {
+					__m256i value = _mm256_load_si256(reinterpret_cast<const __m256i*>(block.c[firstChannel + c] + h * 8));
+					__m256i d = _mm256_sub_epi32(value, _mm256_set1_epi32(palette[p][c]));
+					distance = _mm256_add_epi32(distance, _mm256_mullo_epi32(d, d));
+				}
+				//strictly closer, ties keep the lower index like the scalar path
+				__m256i closer = _mm256_cmpgt_epi32(best[h], distance);
+				best[h] = _mm256_min_epi32(best[h], distance);
+				bestIndex[h] = _mm256_blendv_epi8(bestIndex[h], index, closer);
+			}
+		}
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(indices), bestIndex[0]);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(indices + 8), bestIndex[1]);
+
+		alignas(32) int32_t errors[8];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(errors), _mm256_add_epi32(best[0], best[1]));
+		int error = 0;
+		for (int i = 0; i < 8; i++)
+			error += errors[i];
+		return error;
+	}
+#endif
+
+	//index of the nearest palette entry for every pixel, palette[p][c] is compared with channel firstChannel + c
+	//returns the summed squared error of the block
+	int nearestIndices(const Block& block, int firstChannel, int channelCount, const int palette[][4], int paletteSize, int indices[16]) {
+#ifdef SIMD_HELPER_AVX2
+		if (hasAvx2())
+			return nearestIndicesAvx2(block, firstChannel, channelCount, palette, paletteSize, indices);
+#endif
+		int error = 0;
+		for (int i = 0; i < 16; i++) {
+			int best = 0;
+			int bestDistance = INT32_MAX;
+			for (int p = 0; p < paletteSize; p++) {
+				int distance = 0;
+				for (int c = 0; c < channelCount; c++) {
+					int d = block.c[firstChannel + c][i] - palette[p][c];
+					distance += d * d;
+				}
+				if (distance < bestDistance) {
+					bestDistance = distance;
+					best = p;
+				}
+			}
+			indices[i] = best;
+			error += bestDistance;
+		}
+		return error;
+	}
+
+	uint16_t to565(const float color[3]) {
+		int r = (int)std::lround(color[0] * 31.f / 255.f);
+		int g = (int)std::lround(color[1] * 63.f / 255.f);
+		int b = (int)std::lround(color[2] * 31.f / 255.f);
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+
+	void expand565(uint16_t packed, int color[4]) {
+		int r = (packed >> 11) & 31;
+		int g = (packed >> 5) & 63;
+		int b = packed & 31;
+		color[0] = (r << 3) | (r >> 2);
+		color[1] = (g << 2) | (g >> 4);
+		color[2] = (b << 3) | (b >> 2);
+		color[3] = 0;
+	}
+
+	//every encoder writes its block from the endpoints e0 and e1 and returns the squared error
+	//when it swaps the endpoints to pick a mode it swaps e0 and e1 too, indices always go from e0 to e1
+	typedef int (*EncodeFn)(const Block& block, int firstChannel, float* e0, float* e1, uint8_t* dst, int indices[16]);
+
+	const float bc1Weights[4] = { 0.f, 1.f, 1.f / 3.f, 2.f / 3.f };
+
+	int encodeBC1(const Block& block, int firstChannel, float* e0, float* e1, uint8_t* dst, int indices[16]) {
+		uint16_t color0 = to565(e0);
+		uint16_t color1 = to565(e1);
+
+		//color0 > color1 picks the four color mode, equal endpoints decode to color0 everywhere
+		if (color0 < color1) {
+			std::swap(color0, color1);
+			for (int c = 0; c < 3; c++)
+				std::swap(e0[c], e1[c]);
+		}
+		int palette[4][4];
+		expand565(color0, palette[0]);
+		expand565(color1, palette[1]);
+		for (int c = 0; c < 3; c++) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		int error = nearestIndices(block, firstChannel, 3, palette, color0 != color1 ? 4 : 1, indices);
+
+		uint32_t packed = 0;
+		for (int i = 0; i < 16; i++)
+			packed |= (uint32_t)indices[i] << (2 * i);
+		dst[0] = color0 & 0xFF;
+		dst[1] = color0 >> 8;
+		dst[2] = color1 & 0xFF;
+		dst[3] = color1 >> 8;
+		memcpy(dst + 4, &packed, 4);
+		return error;
+	}
+
+	const float bc4Weights[8] = { 0.f, 1.f, 1.f / 7.f, 2.f / 7.f, 3.f / 7.f, 4.f / 7.f, 5.f / 7.f, 6.f / 7.f };
+
+	int encodeBC4(const Block& block, int firstChannel, float* e0, float* e1, uint8_t* dst, int indices[16]) {
+		int hi = std::clamp((int)std::lround(e0[0]), 0, 255);
+		int lo = std::clamp((int)std::lround(e1[0]), 0, 255);
+		//hi > lo picks the eight value mode
+		if (hi < lo) {
+			std::swap(hi, lo);
+			std::swap(e0[0], e1[0]);
+		}
+		dst[0] = (uint8_t)hi;
+		dst[1] = (uint8_t)lo;
+
+		int palette[8][4] = {};
+		palette[0][0] = hi;
+		palette[1][0] = lo;
+		for (int i = 2; i < 8; i++)
+			palette[i][0] = ((8 - i) * hi + (i - 1) * lo) / 7;
+		int error = nearestIndices(block, firstChannel, 1, palette, hi != lo ? 8 : 1, indices);
+
+		uint64_t packed = 0;
+		for (int i = 0; i < 16; i++)
+			packed |= (uint64_t)indices[i] << (3 * i);
+		for (int b = 0; b < 6; b++)
+			dst[2 + b] = (uint8_t)(packed >> (8 * b));
+		return error;
+	}
+
+	//a bc7 block is 128 bits filled from the lowest, kept in two words until finish writes them out
+	class BitWriter {
+		uint64_t words[2] = {};
+		int position = 0;
+
+	public:
+		void write(uint32_t value, int bits) {
+			uint64_t v = value & ((1ull << bits) - 1);
+			if (position < 64) {
+				words[0] |= v << position;
+				if (position + bits > 64)
+					words[1] |= v >> (64 - position);
+			}
+			else {
+				words[1] |= v << (position - 64);
+			}
+			position += bits;
+		}
+
+		void finish(uint8_t* dst) const {
+			for (int b = 0; b < 16; b++)
+				dst[b] = (uint8_t)(words[b >> 3] >> (8 * (b & 7)));
+		}
+	};
+
+	const int bc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+	const float bc7Weights[16] = {
+		0.f / 64.f, 4.f / 64.f, 9.f / 64.f, 13.f / 64.f, 17.f / 64.f, 21.f / 64.f, 26.f / 64.f, 30.f / 64.f,
+		34.f / 64.f, 38.f / 64.f, 43.f / 64.f, 47.f / 64.f, 51.f / 64.f, 55.f / 64.f, 60.f / 64.f, 64.f / 64.f
+	};
+
+	int encodeBC7(const Block& block, int firstChannel, float* e0, float* e1, uint8_t* dst, int indices[16]) {
+		//7 bits per channel plus a p bit shared by the endpoint's channels, the p bit with less error wins
+		int quantized[2][4];
+		int pBits[2];
+		for (int e = 0; e < 2; e++) {
+			const float* value = e == 0 ? e0 : e1;
+			float bestError = 1e30f;
+			for (int p = 0; p < 2; p++) {
+				int q[4];
+				float error = 0.f;
+				for (int c = 0; c < 4; c++) {
+					q[c] = std::clamp((int)std::lround((value[c] - p) * 0.5f), 0, 127);
+					float d = (float)(q[c] * 2 + p) - value[c];
+					error += d * d;
+				}
+				if (error < bestError) {
+					bestError = error;
+					pBits[e] = p;
+					memcpy(quantized[e], q, sizeof(q));
+				}
+			}
+		}
+
+		int endpoints[2][4];
+		for (int e = 0; e < 2; e++)
+			for (int c = 0; c < 4; c++)
+				endpoints[e][c] = quantized[e][c] * 2 + pBits[e];
+		int palette[16][4];
+		for (int w = 0; w < 16; w++)
+			for (int c = 0; c < 4; c++)
+				palette[w][c] = ((64 - bc7Weights4[w]) * endpoints[0][c] + bc7Weights4[w] * endpoints[1][c] + 32) >> 6;
+		int error = nearestIndices(block, firstChannel, 4, palette, 16, indices);
+
+		//the first index is stored without its top bit, swapping the endpoints clears it
+		if (indices[0] & 8) {
+			std::swap(quantized[0], quantized[1]);
+			std::swap(pBits[0], pBits[1]);
+			for (int c = 0; c < 4; c++)
+				std::swap(e0[c], e1[c]);
+			for (int i = 0; i < 16; i++)
+				indices[i] = 15 - indices[i];
+		}
+
+		BitWriter writer;
+		writer.write(1 << 6, 7);
+		for (int c = 0; c < 4; c++) {
+			writer.write(quantized[0][c], 7);
+			writer.write(quantized[1][c], 7);
+		}
+		writer.write(pBits[0], 1);
+		writer.write(pBits[1], 1);
+		writer.write(indices[0], 3);
+		for (int i = 1; i < 16; i++)
+			writer.write(indices[i], 4);
+		writer.finish(dst);
+		return error;
+	}
+
+	//fast takes the bounding box, normal the principal axis, high refines that while the error goes down
+	template<int N>
+	void encodeBlock(const Block& block, int firstChannel, BlockQuality quality, EncodeFn encode, const float* weights, uint32_t bytes, uint8_t* dst) {
+		float lo[N], hi[N];
+		if (quality == BlockQuality::fast)
+			boundingEndpoints<N>(block, firstChannel, lo, hi);
+		else
+			principalEndpoints<N>(block, firstChannel, lo, hi);
+
+		int indices[16];
+		int error = encode(block, firstChannel, hi, lo, dst, indices);
+		if (quality != BlockQuality::high)
+			return;
+
+		float e0[N], e1[N];
+		memcpy(e0, hi, sizeof(e0));
+		memcpy(e1, lo, sizeof(e1));
+		for (int iteration = 0; iteration < refineIterations && error > 0; iteration++) {
+			if (!refineEndpoints<N>(block, firstChannel, indices, weights, e0, e1))
+				break;
+			uint8_t candidate[16];
+			int candidateIndices[16];
+			int candidateError = encode(block, firstChannel, e0, e1, candidate, candidateIndices);
+			if (candidateError >= error)
+				break;
+			error = candidateError;
+			memcpy(dst, candidate, bytes);
+			memcpy(indices, candidateIndices, sizeof(indices));
+		}
+	}
+
+	void compressRows(BlockFormat format, BlockQuality quality, const unsigned char* pixels, int width, int height, int channels, unsigned char* dst, int firstRow, int endRow) {
+		const int blocksX = (width + 3) / 4;
+		const uint32_t bytes = blockBytes(format);
+		Block block;
+		for (int by = firstRow; by < endRow; by++) {
+			for (int bx = 0; bx < blocksX; bx++) {
+				gatherBlock(pixels, width, height, channels, bx, by, block);
+				uint8_t* out = dst + ((size_t)by * blocksX + bx) * bytes;
+				switch (format) {
+				case BlockFormat::bc1:
+					encodeBlock<3>(block, 0, quality, encodeBC1, bc1Weights, 8, out);
+					break;
+				case BlockFormat::bc4:
+					encodeBlock<1>(block, 0, quality, encodeBC4, bc4Weights, 8, out);
+					break;
+				case BlockFormat::bc5:
+					encodeBlock<1>(block, 0, quality, encodeBC4, bc4Weights, 8, out);
+					encodeBlock<1>(block, 1, quality, encodeBC4, bc4Weights, 8, out + 8);
+					break;
+				case BlockFormat::bc7:
+					encodeBlock<4>(block, 0, quality, encodeBC7, bc7Weights, 16, out);
+					break;
+				}
+			}
+		}
+	}
+}
+
+uint32_t blockBytes(BlockFormat format) {
+	return format == BlockFormat::bc1 || format == BlockFormat::bc4 ? 8 : 16;
+}
+
+size_t compressedSize(BlockFormat format, int width, int height) {
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+void compressBlocks(BlockFormat format, const unsigned char* pixels, int width, int height, int channels, unsigned char* dst, BlockQuality quality) {
+	const size_t blocksX = (width + 3) / 4;
+	const size_t blocksY = (height + 3) / 4;
+	if (blocksX * blocksY < parallelBlockThreshold) {
+		//spawning threads costs more than a small mip
+		compressRows(format, quality, pixels, width, height, channels, dst, 0, (int)blocksY);
+		return;
+	}
+	//block rows are independent, each chunk writes its own range of dst
+	parallelFor(blocksY, std::max<size_t>(blocksPerChunk / blocksX, 1), [&](size_t begin, size_t end) {
+		compressRows(format, quality, pixels, width, height, channels, dst, (int)begin, (int)end);
+		});
+}
+
+void benchmarkBlockCompression(int width, int height) {
+	//smooth gradients with a little noise, closer to real textures than pure noise
+	std::vector<unsigned char> pixels((size_t)width * height * 4);
+	uint32_t seed = 1;
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			unsigned char* p = &pixels[((size_t)y * width + x) * 4];
+			seed = seed * 1664525u + 1013904223u;
+			int noise = (seed >> 24) & 15;
+			p[0] = (unsigned char)std::min(255, x * 255 / width + noise);
+			p[1] = (unsigned char)(y * 255 / height);
+			p[2] = (unsigned char)(128 + 100 * std::sin((x + y) * 0.05f));
+			p[3] = (unsigned char)((x ^ y) & 255);
+		}
+	}
+
+	const char* formatNames[] = { "bc1", "bc4", "bc5", "bc7" };
+	const char* qualityNames[] = { "fast", "normal", "high" };
+	std::vector<unsigned char> dst(compressedSize(BlockFormat::bc7, width, height));
+	std::cout << "Block compression " << width << "x" << height << (hasAvx2() ? " avx2" : " scalar") << ", " << workerThreadCount() << " threads" << std::endl;
+	for (uint32_t f = 0; f < 4; f++) {
+		for (uint32_t q = 0; q < 3; q++) {
+			auto start = std::chrono::high_resolution_clock::now();
+			compressBlocks((BlockFormat)f, pixels.data(), width, height, 4, dst.data(), (BlockQuality)q);
+			auto end = std::chrono::high_resolution_clock::now();
+			double seconds = std::chrono::duration<double>(end - start).count();
+			std::cout << "  " << formatNames[f] << " " << qualityNames[q] << ": " << (double)width * height / 1e6 / seconds << " MP/s" << std::endl;
+		}
+	}
+}
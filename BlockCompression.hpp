@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+//cpu encoders for the bc block formats textures are cooked into
+//every format stores 4x4 pixel blocks, rows of blocks top to bottom
+
+enum class BlockFormat : uint32_t {
+	//rgb, 565 endpoints and 2 bit indices, alpha is dropped
+	bc1 = 0,
+	//one channel, 8 bit endpoints and 3 bit indices
+	bc4 = 1,
+	//two bc4 blocks, first and second channel
+	bc5 = 2,
+	//rgba, encoded in mode 6 only: one subset, 7 bit endpoints with a shared bit and 4 bit indices
+	bc7 = 3
+};
+
+//fast fits endpoints to the block's bounding box, normal to its principal axis and high refines those by least squares
+//cooking offline uses high, compressing on load fast
+enum class BlockQuality : uint32_t {
+	fast = 0,
+	normal = 1,
+	high = 2
+};
+
+uint32_t blockBytes(BlockFormat format);
+size_t compressedSize(BlockFormat format, int width, int height);
+
+//pixels are width * height * channels bytes, bc1 and bc7 read up to four channels, bc4 the first and bc5 the first two
+//blocks over the edge of the image repeat its last row and column
+//large images are split into rows of blocks compressed on all cores
+void compressBlocks(BlockFormat format, const unsigned char* pixels, int width, int height, int channels, unsigned char* dst, BlockQuality quality = BlockQuality::normal);
+
+//compresses a generated image in every format and quality and prints megapixels per second
+void benchmarkBlockCompression(int width = 2048, int height = 2048);
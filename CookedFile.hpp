@@ -0,0 +1,82 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+#include "storage_helper.hpp"
+
+//what every cooked file in the Store starts with, the cookers put it first in their own header
+//blobs after the header start on cookedBlobAlignment so they can be used in place from the mapping
+
+constexpr uint64_t cookedBlobAlignment = 16;
+
+struct CookedFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceHash;
+	//size of the whole cooked file, catches truncated writes
+	uint64_t fileSize;
+};
+
+inline uint64_t alignUp(uint64_t value, uint64_t alignment = cookedBlobAlignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+inline CookedFileHeader makeCookedFileHeader(uint32_t magic, uint32_t version, const char* filepath) {
+	CookedFileHeader header{};
+	header.magic = magic;
+	header.version = version;
+	header.sourceHash = sourceFileHash(filepath);
+	return header;
+}
+
+//prefix and the hash of the absolute source path and the settings the item was cooked with
+template<typename... Settings>
+inline std::string cookedStoreName(const char* prefix, const char* filepath, const Settings&... settings) {
+	std::error_code ec;
+	std::string pathStr = fs::absolute(filepath, ec).generic_string();
+	uint64_t hash = hashBytes(pathStr.data(), pathStr.size());
+	((hash = hashBytes(&settings, sizeof(settings), hash)), ...);
+	std::stringstream name;
+	name << prefix << "_" << std::hex << std::setw(16) << std::setfill('0') << hash;
+	return name.str();
+}
+
+//copies the header out of a mapped cooked file, false if the file is too small or the common part is stale
+template<typename Header>
+inline bool readCookedHeader(const unsigned char* base, size_t size, uint32_t magic, uint32_t version, uint64_t sourceHash, Header& header) {
+	static_assert(std::is_trivially_copyable<Header>::value, "cooked structs are written as raw bytes");
+	if (size < sizeof(Header))
+		return false;
+	memcpy(&header, base, sizeof(header));
+	const CookedFileHeader& file = header.file;
+	return file.magic == magic && file.version == version && file.sourceHash == sourceHash && file.fileSize == size;
+}
+
+class CookedWriter {
+	//writes sequentially, padding with zeroes up to requested offsets
+public:
+	std::ofstream& file;
+	uint64_t position = 0;
+
+	CookedWriter(std::ofstream& file) : file(file) {}
+
+	void write(const void* data, uint64_t size) {
+		file.write(reinterpret_cast<const char*>(data), size);
+		position += size;
+	}
+
+	void padTo(uint64_t offset) {
+		assert(offset >= position);
+		static const char zeroes[cookedBlobAlignment] = {};
+		while (position < offset) {
+			uint64_t count = std::min<uint64_t>(offset - position, cookedBlobAlignment);
+			write(zeroes, count);
+		}
+	}
+};
@@ -0,0 +1,135 @@
+#include "FrustumCuller.hpp"
+#include "parallel_helper.hpp"
+#include "simd_helper.hpp"
+
+#include <cmath>
+
+Frustum Frustum::fromProjView(const glm::mat4& projView) {
+	Frustum frustum;
+	glm::mat4 m = glm::transpose(projView);
+	frustum.planes[0] = m[3] + m[0];	//left
+	frustum.planes[1] = m[3] - m[0];	//right
+	frustum.planes[2] = m[3] + m[1];	//bottom
+	frustum.planes[3] = m[3] - m[1];	//top
+	frustum.planes[4] = m[2];			//near
+	frustum.planes[5] = m[3] - m[2];	//far
+	for (glm::vec4& plane : frustum.planes)
+		plane /= glm::length(glm::vec3(plane));
+	return frustum;
+}
+
+namespace {
+#ifdef SIMD_HELPER_AVX2
+	struct BoxArrays {
+		const float* centerX; const float* centerY; const float* centerZ;
+		const float* extentX; const float* extentY; const float* extentZ;
+	};
+
+	//returns where it stopped, the last boxes that don't fill a register are left to the caller
+	AVX2_FUNCTION size_t cullRangeAvx2(const Frustum& frustum, const BoxArrays& boxes, size_t begin, size_t end, std::vector<uint32_t>& visible) {
+		__m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+		__m256 absX[6], absY[6], absZ[6];
+		for (int p = 0; p < 6; p++) {
+			const glm::vec4& plane = frustum.planes[p];
+			planeX[p] = _mm256_set1_ps(plane.x);
+			planeY[p] = _mm256_set1_ps(plane.y);
+			planeZ[p] = _mm256_set1_ps(plane.z);
+			planeW[p] = _mm256_set1_ps(plane.w);
+			absX[p] = _mm256_set1_ps(std::abs(plane.x));
+			absY[p] = _mm256_set1_ps(std::abs(plane.y));
+			absZ[p] = _mm256_set1_ps(std::abs(plane.z));
+		}
+		const __m256 zero = _mm256_setzero_ps();
+
+		size_t i = begin;
+		for (; i + 8 <= end; i += 8) {
+			__m256 cx = _mm256_loadu_ps(boxes.centerX + i);
+			__m256 cy = _mm256_loadu_ps(boxes.centerY + i);
+			__m256 cz = _mm256_loadu_ps(boxes.centerZ + i);
+			__m256 ex = _mm256_loadu_ps(boxes.extentX + i);
+			__m256 ey = _mm256_loadu_ps(boxes.extentY + i);
+			__m256 ez = _mm256_loadu_ps(boxes.extentZ + i);
+
+			//a box is outside if its most positive corner is behind any plane
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < 6; p++) {
+				__m256 distance = _mm256_add_ps(_mm256_mul_ps(planeX[p], cx), planeW[p]);
+				distance = _mm256_add_ps(distance, _mm256_mul_ps(planeY[p], cy));
+				distance = _mm256_add_ps(distance, _mm256_mul_ps(planeZ[p], cz));
+				__m256 radius = _mm256_mul_ps(absX[p], ex);
+				radius = _mm256_add_ps(radius, _mm256_mul_ps(absY[p], ey));
+				radius = _mm256_add_ps(radius, _mm256_mul_ps(absZ[p], ez));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_GE_OQ));
+			}
+
+			unsigned int mask = (unsigned int)_mm256_movemask_ps(inside);
+			while (mask != 0) {
+				unsigned int bit = 0;
+				while (((mask >> bit) & 1) == 0)
+					bit++;
+				visible.push_back((uint32_t)(i + bit));
+				mask &= mask - 1;
+			}
+		}
+
+		return i;
+	}
+#endif
+}
+
+void FrustumCuller::setBounds(const std::vector<Bounds>& bounds) {
+	size_t count = bounds.size();
+	for (auto* arr : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ })
+		arr->resize(count);
+	updateBounds(bounds, 0, count);
+}
+
+void FrustumCuller::updateBounds(const std::vector<Bounds>& bounds, size_t first, size_t count) {
+	for (size_t i = first; i < first + count; i++) {
+		glm::vec3 center = (glm::vec3(bounds[i].aabbMin) + glm::vec3(bounds[i].aabbMax)) * 0.5f;
+		glm::vec3 extent = (glm::vec3(bounds[i].aabbMax) - glm::vec3(bounds[i].aabbMin)) * 0.5f;
+		centerX[i] = center.x; centerY[i] = center.y; centerZ[i] = center.z;
+		extentX[i] = extent.x; extentY[i] = extent.y; extentZ[i] = extent.z;
+	}
+}
+
+void FrustumCuller::cullRange(const Frustum& frustum, size_t begin, size_t end, std::vector<uint32_t>& visible) const {
+#ifdef SIMD_HELPER_AVX2
+	if (hasAvx2()) {
+		BoxArrays boxes{ centerX.data(), centerY.data(), centerZ.data(), extentX.data(), extentY.data(), extentZ.data() };
+		begin = cullRangeAvx2(frustum, boxes, begin, end, visible);
+	}
+#endif
+	for (size_t i = begin; i < end; i++) {
+		bool inside = true;
+		for (int p = 0; p < 6 && inside; p++) {
+			const glm::vec4& plane = frustum.planes[p];
+			float distance = plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w;
+			float radius = std::abs(plane.x) * extentX[i] + std::abs(plane.y) * extentY[i] + std::abs(plane.z) * extentZ[i];
+			inside = distance + radius >= 0;
+		}
+		if (inside)
+			visible.push_back((uint32_t)i);
+	}
+}
+
+void FrustumCuller::cull(const Frustum& frustum, std::vector<uint32_t>& visible) {
+	visible.clear();
+	const size_t count = instanceCount();
+	if (count <= chunkSize) {
+		//spawning workers costs more than culling a few thousand boxes
+		cullRange(frustum, 0, count, visible);
+		return;
+	}
+
+	const size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+	chunkVisible.resize(chunkCount);
+	parallelFor(chunkCount, 1, [&](size_t begin, size_t end) {
+		for (size_t chunk = begin; chunk < end; chunk++) {
+			chunkVisible[chunk].clear();
+			cullRange(frustum, chunk * chunkSize, std::min(count, (chunk + 1) * chunkSize), chunkVisible[chunk]);
+		}
+		});
+	for (auto& chunk : chunkVisible)
+		visible.insert(visible.end(), chunk.begin(), chunk.end());
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "MeshLoader.hpp"
+
+//cpu culling of whole instances against the view frustum, run before recording the draws
+//boxes are kept as structure of arrays so 8 of them are tested per avx2 iteration
+
+struct Frustum {
+	//xyz normal pointing inside, w distance, normalized so distances are in world units
+	//left, right, bottom, top, near, far
+	glm::vec4 planes[6];
+
+	//gribb hartmann planes of a projView with 0 to 1 depth
+	static Frustum fromProjView(const glm::mat4& projView);
+};
+
+class FrustumCuller {
+	//world space boxes as center and extent, one array per component
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+	//per chunk results, concatenated in order so the visible list keeps instance order
+	std::vector<std::vector<uint32_t>> chunkVisible;
+
+	void cullRange(const Frustum& frustum, size_t begin, size_t end, std::vector<uint32_t>& visible) const;
+
+public:
+	//instances per parallel chunk, below one chunk culling stays on the calling thread
+	inline static const size_t chunkSize = 4096;
+
+	//call again whenever instance bounds change
+	void setBounds(const std::vector<Bounds>& bounds);
+	//copies bounds[first, first + count) after those instances moved, the instance count stays the same
+	void updateBounds(const std::vector<Bounds>& bounds, size_t first, size_t count);
+
+	size_t instanceCount() const { return centerX.size(); }
+
+	//fills visible with the indices of instances intersecting the frustum, in increasing order
+	void cull(const Frustum& frustum, std::vector<uint32_t>& visible);
+};
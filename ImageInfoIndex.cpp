@@ -0,0 +1,212 @@
+#include "ImageInfoIndex.hpp"
+#include "parallel_helper.hpp"
+#include "storage_helper.hpp"
+
+#include "stb_image.h"
+
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+	constexpr uint32_t indexMagic = 0x58444949; //"IIDX"
+
+	struct IndexHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t entryCount;
+	};
+
+	//followed by pathLength bytes of path
+	struct StoredEntry {
+		ImageInfo info;
+		uint32_t pathLength;
+	};
+
+	//false if the file is not an image stb_image can read
+	//the file is mapped, stb_image only touches the pages of the header
+	bool readInfo(const char* filepath, ImageInfo& info) {
+		std::shared_ptr<MappedFile> file;
+		try {
+			file = MappedFile::open(filepath);
+		}
+		catch (const std::exception&) {
+			return false;
+		}
+		if (file->size() > (size_t)std::numeric_limits<int>::max())
+			return false;
+		const int size = (int)file->size();
+		if (!stbi_info_from_memory(file->data(), size, &info.width, &info.height, &info.channels))
+			return false;
+		info.isHdr = stbi_is_hdr_from_memory(file->data(), size) ? 1 : 0;
+		info.contentHash = 0;
+		return true;
+	}
+
+	//0 if the file can't be read
+	uint64_t hashFile(const char* filepath) {
+		std::shared_ptr<MappedFile> file;
+		try {
+			file = MappedFile::open(filepath);
+		}
+		catch (const std::exception&) {
+			return 0;
+		}
+		uint64_t hash = hashContents(file->data(), file->size());
+		//0 stands for not hashed yet
+		return hash != 0 ? hash : 1;
+	}
+}
+
+std::string ImageInfoIndex::key(const char* filepath) {
+	std::error_code ec;
+	return fs::absolute(filepath, ec).generic_string();
+}
+
+ImageInfoIndex::ImageInfoIndex() {
+	if (!Store::itemInStore(storeName))
+		return;
+
+	unsigned int size = 0;
+	std::unique_ptr<char[]> bytes;
+	try {
+		bytes = Store::fetchBytes(storeName, &size);
+	}
+	catch (const std::exception& err) {
+		std::cerr << err.what() << std::endl;
+		return;
+	}
+
+	IndexHeader header;
+	if (size < sizeof(header))
+		return;
+	memcpy(&header, bytes.get(), sizeof(header));
+	if (header.magic != indexMagic || header.version != version) {
+		std::cout << "Image info index is stale" << std::endl;
+		return;
+	}
+
+	size_t pos = sizeof(header);
+	for (uint64_t i = 0; i < header.entryCount; i++) {
+		StoredEntry stored;
+		if (pos + sizeof(stored) > size)
+			break;
+		memcpy(&stored, bytes.get() + pos, sizeof(stored));
+		pos += sizeof(stored);
+		if (pos + stored.pathLength > size)
+			break;
+		std::string path(bytes.get() + pos, stored.pathLength);
+		pos += stored.pathLength;
+		entries[std::move(path)] = Entry{ stored.info, false };
+	}
+}
+
+void ImageInfoIndex::prefetch(const std::vector<std::string>& paths) {
+	struct Check {
+		std::string key;
+		uint64_t sourceHash;
+		ImageInfo info;
+		bool fresh;
+		bool readable;
+	};
+	std::vector<Check> checks(paths.size());
+	for (size_t i = 0; i < paths.size(); i++)
+		checks[i].key = key(paths[i].c_str());
+
+	//entries is only read in here
+	parallelFor(paths.size(), 8, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			Check& check = checks[i];
+			check.sourceHash = sourceFileHash(paths[i].c_str());
+			auto it = entries.find(check.key);
+			check.fresh = it != entries.end() && it->second.info.sourceHash == check.sourceHash;
+			check.readable = check.fresh || readInfo(paths[i].c_str(), check.info);
+			check.info.sourceHash = check.sourceHash;
+		}
+		});
+
+	for (Check& check : checks) {
+		if (check.fresh) {
+			entries[check.key].checked = true;
+		}
+		else if (check.readable) {
+			entries[check.key] = Entry{ check.info, true };
+			changed = true;
+		}
+	}
+}
+
+ImageInfo ImageInfoIndex::get(const char* filepath) {
+	std::string path = key(filepath);
+	auto it = entries.find(path);
+	if (it != entries.end() && it->second.checked)
+		return it->second.info;
+
+	uint64_t sourceHash = sourceFileHash(filepath);
+	if (it != entries.end() && it->second.info.sourceHash == sourceHash) {
+		it->second.checked = true;
+		return it->second.info;
+	}
+
+	ImageInfo info;
+	if (!readInfo(filepath, info))
+		throw std::runtime_error("Image: " + std::string(filepath) + " could not be read");
+	info.sourceHash = sourceHash;
+	entries[path] = Entry{ info, true };
+	changed = true;
+	return info;
+}
+
+void ImageInfoIndex::hashContents(const std::vector<std::string>& paths, const std::function<bool()>& stop) {
+	//entries that changed since the prefetch are left for the next one to check
+	std::vector<const std::string*> pendingPaths;
+	std::vector<Entry*> pendingEntries;
+	for (const std::string& path : paths) {
+		auto it = entries.find(key(path.c_str()));
+		if (it != entries.end() && it->second.checked && it->second.info.contentHash == 0) {
+			pendingPaths.push_back(&path);
+			pendingEntries.push_back(&it->second);
+		}
+	}
+
+	//entries is only read in here
+	std::vector<uint64_t> hashes(pendingPaths.size(), 0);
+	parallelFor(pendingPaths.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end && !stop(); i++)
+			hashes[i] = hashFile(pendingPaths[i]->c_str());
+		});
+
+	for (size_t i = 0; i < pendingEntries.size(); i++) {
+		if (hashes[i] != 0) {
+			pendingEntries[i]->info.contentHash = hashes[i];
+			changed = true;
+		}
+	}
+}
+
+void ImageInfoIndex::save() {
+	if (!changed)
+		return;
+
+	IndexHeader header{};
+	header.magic = indexMagic;
+	header.version = version;
+	header.entryCount = entries.size();
+
+	std::ofstream file = Store::openForWriting(storeName);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	for (const auto& [path, entry] : entries) {
+		StoredEntry stored{};
+		stored.info = entry.info;
+		stored.pathLength = (uint32_t)path.size();
+		file.write(reinterpret_cast<const char*>(&stored), sizeof(stored));
+		file.write(path.data(), path.size());
+	}
+
+	if (!file) {
+		std::cerr << "Failed to write image info index" << std::endl;
+		return;
+	}
+	changed = false;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//what the header of an image file says, enough to create the image before it is decoded
+struct ImageInfo {
+	int32_t width = 0;
+	int32_t height = 0;
+	int32_t channels = 0;
+	//floating point pixels like radiance .hdr, stbi_is_hdr
+	uint32_t isHdr = 0;
+	//sourceFileHash, the path, size and last write time of the file the info was read from
+	uint64_t sourceHash = 0;
+	//hashContents of the whole file, equal for copies of an image under different paths
+	//0 until ImageInfoIndex::hashContents got to the file
+	uint64_t contentHash = 0;
+};
+
+//image headers and content hashes read once and kept in the Store, so creating the images of a model doesn't open every file
+//entries are keyed by absolute path and go stale when the file's size or last write time changes
+//only used from one thread, prefetch and hashContents spread their own work over all cores
+class ImageInfoIndex {
+private:
+	struct Entry {
+		ImageInfo info;
+		//sourceHash was compared with the file since the index was loaded
+		bool checked;
+	};
+
+	std::unordered_map<std::string, Entry> entries;
+	//entries were added or replaced since the last save
+	bool changed = false;
+
+	static std::string key(const char* filepath);
+
+public:
+	//bump whenever the layout of the stored index changes
+	inline static const uint32_t version = 3;
+	inline static const char* storeName = "imageInfoIndex";
+
+	//loads the index from the Store, starts empty if there is none or it is unreadable
+	ImageInfoIndex();
+
+	//checks the given files against their entries and reads the headers of new and changed ones in parallel
+	//only the header of a file is read, files that can't be read get no entry
+	void prefetch(const std::vector<std::string>& paths);
+
+	//reads the whole of the given files prefetch checked that have no content hash yet and hashes them in parallel
+	//stops early once stop returns true, the files it didn't get to are hashed by a later call
+	void hashContents(const std::vector<std::string>& paths, const std::function<bool()>& stop);
+
+	//entries checked by prefetch are returned without touching the file,
+	//anything else is checked or read on the calling thread, throws if the file is not a readable image
+	ImageInfo get(const char* filepath);
+
+	//writes the index to the Store if it changed
+	void save();
+
+	inline size_t size() const { return entries.size(); }
+};
@@ -1,5 +1,8 @@
 #include "ImageLoader.hpp"
+#include "RadianceDecoder.hpp"
 #include <stdexcept>
+#include <cassert>
+#include <cstring>
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -112,6 +115,32 @@ ImagePtr loadImageFromFile(const char* filepath, bool isSRGB, int desiredCompone
 	return std::make_unique<ImageData>(filepath, isSRGB, desiredComponents);
 }
 
+void loadImageInto(const char* filepath, bool isSRGB, int desiredComponents, glm::ivec2 resolution, unsigned char* dst) {
+	assert(desiredComponents > 0);
+	//stb_image always decodes into its own allocation, it is freed as soon as the pixels are in dst
+	int width, height, fileComponents;
+	std::unique_ptr<unsigned char, void(*)(void*)> data(
+		stbi_load(filepath, &width, &height, &fileComponents, desiredComponents),
+		stbi_image_free
+	);
+	if (!data) {
+		throw std::runtime_error("Image: " + std::string(filepath) + " could not be loaded successfully");
+	}
+
+	if (width == resolution.x && height == resolution.y) {
+		memcpy(dst, data.get(), (size_t)width * height * desiredComponents);
+		return;
+	}
+	//resized straight into dst, no second full size image
+	stbir_pixel_layout pixelLayout = numComponentsToLayout(desiredComponents);
+	if (isSRGB) {
+		stbir_resize_uint8_srgb(data.get(), width, height, 0, dst, resolution.x, resolution.y, 0, pixelLayout);
+	}
+	else {
+		stbir_resize_uint8_linear(data.get(), width, height, 0, dst, resolution.x, resolution.y, 0, pixelLayout);
+	}
+}
+
 
 FloatImageData::FloatImageData(
 	float* data,
@@ -121,6 +150,16 @@ FloatImageData::FloatImageData(
 ) : data(data), width(width), height(height), numComponents(numComponents) {}
 
 FloatImageData::FloatImageData(const char* filepath, int desiredComponents) {
+	//radiance images decode on all cores, stb_image takes everything the decoder doesn't handle
+	if (auto radiance = RadianceDecoder::open(filepath)) {
+		this->width = radiance->getWidth();
+		this->height = radiance->getHeight();
+		this->numComponents = desiredComponents != 0 ? desiredComponents : 3;
+		this->data = (float*)STBI_MALLOC(getSizeInBytes());
+		radiance->decode(this->numComponents, this->data);
+		return;
+	}
+
 	this->data = stbi_loadf(
 		filepath,
 		&width,
@@ -143,7 +182,7 @@ FloatImageData::~FloatImageData() {
 std::unique_ptr<FloatImageData> FloatImageData::resize(int newWidth, int newHeight) {
 	stbir_pixel_layout pixelLayout = numComponentsToLayout(numComponents);
 	
-	float* newImageData = (float*)STBI_MALLOC(sizeof(unsigned char) * newWidth * newHeight * numComponents);
+	float* newImageData = (float*)STBI_MALLOC(sizeof(float) * newWidth * newHeight * numComponents);
 	
 	stbir_resize_float_linear(data, width, height, 0, newImageData, newWidth, newHeight, 0, pixelLayout);
 	
@@ -188,3 +227,31 @@ size_t FloatImageData::getSizeInBytes() {
 FloatImagePtr loadFloatImageFromFile(const char* filepath, int desiredComponents) {
 	return std::make_unique<FloatImageData>(filepath, desiredComponents);
 }
+
+void loadFloatImageInto(const char* filepath, int desiredComponents, glm::ivec2 resolution, float* dst) {
+	assert(desiredComponents > 0);
+	if (auto radiance = RadianceDecoder::open(filepath)) {
+		if (radiance->getWidth() == resolution.x && radiance->getHeight() == resolution.y) {
+			radiance->decode(desiredComponents, dst);
+			return;
+		}
+		FloatImageData image(filepath, desiredComponents);
+		stbir_resize_float_linear(image.getData(), image.getWidth(), image.getHeight(), 0, dst, resolution.x, resolution.y, 0, numComponentsToLayout(desiredComponents));
+		return;
+	}
+
+	int width, height, fileComponents;
+	std::unique_ptr<float, void(*)(void*)> data(
+		stbi_loadf(filepath, &width, &height, &fileComponents, desiredComponents),
+		stbi_image_free
+	);
+	if (!data) {
+		throw std::runtime_error("Image: " + std::string(filepath) + " could not be loaded successfully");
+	}
+
+	if (width == resolution.x && height == resolution.y) {
+		memcpy(dst, data.get(), (size_t)width * height * desiredComponents * sizeof(float));
+		return;
+	}
+	stbir_resize_float_linear(data.get(), width, height, 0, dst, resolution.x, resolution.y, 0, numComponentsToLayout(desiredComponents));
+}
@@ -35,6 +35,9 @@ public:
 
 typedef std::unique_ptr<ImageData> ImagePtr;
 ImagePtr loadImageFromFile(const char* filepath, bool isSRGB, int desiredComponents);
+//decodes straight into dst, resized to resolution if the file differs, dst holds resolution * desiredComponents bytes
+//throws like ImageData when the file can't be decoded
+void loadImageInto(const char* filepath, bool isSRGB, int desiredComponents, glm::ivec2 resolution, unsigned char* dst);
 
 class FloatImageData {
 private:
@@ -63,3 +66,5 @@ public:
 
 typedef std::unique_ptr<FloatImageData> FloatImagePtr;
 FloatImagePtr loadFloatImageFromFile(const char* filepath, int desiredComponents);
+//float version of loadImageInto, dst holds resolution * desiredComponents floats
+void loadFloatImageInto(const char* filepath, int desiredComponents, glm::ivec2 resolution, float* dst);
@@ -0,0 +1,396 @@
+#include "InstanceBvh.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <utility>
+
+namespace {
+	float surfaceArea(glm::vec3 aabbMin, glm::vec3 aabbMax) {
+		glm::vec3 size = glm::max(aabbMax - aabbMin, glm::vec3(0));
+		return size.x * size.y + size.y * size.z + size.z * size.x;
+	}
+
+	//entry distance of the ray into the box, infinity on a miss
+	float intersectBox(glm::vec3 origin, glm::vec3 inverseDirection, glm::vec3 aabbMin, glm::vec3 aabbMax, float maxDistance) {
+		glm::vec3 t1 = (aabbMin - origin) * inverseDirection;
+		glm::vec3 t2 = (aabbMax - origin) * inverseDirection;
+		glm::vec3 tNear = glm::min(t1, t2);
+		glm::vec3 tFar = glm::max(t1, t2);
+		float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.f));
+		float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+		return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+	}
+
+	//squared distance from the point to the closest point of the box
+	float distanceSquared(glm::vec3 point, glm::vec3 aabbMin, glm::vec3 aabbMax) {
+		glm::vec3 d = glm::max(glm::max(aabbMin - point, point - aabbMax), glm::vec3(0));
+		return glm::dot(d, d);
+	}
+
+	float farthestDistanceSquared(glm::vec3 point, glm::vec3 aabbMin, glm::vec3 aabbMax) {
+		glm::vec3 d = glm::max(glm::abs(aabbMin - point), glm::abs(aabbMax - point));
+		return glm::dot(d, d);
+	}
+
+	bool overlaps(glm::vec3 aMin, glm::vec3 aMax, glm::vec3 bMin, glm::vec3 bMax) {
+		return glm::all(glm::lessThanEqual(aMin, bMax)) && glm::all(glm::lessThanEqual(bMin, aMax));
+	}
+
+	bool contains(glm::vec3 outerMin, glm::vec3 outerMax, glm::vec3 innerMin, glm::vec3 innerMax) {
+		return glm::all(glm::lessThanEqual(outerMin, innerMin)) && glm::all(glm::lessThanEqual(innerMax, outerMax));
+	}
+}
+
+void InstanceBvh::updateNodeBounds(uint32_t nodeIndex) {
+	BvhNode& node = nodes[nodeIndex];
+	glm::vec3 aabbMin(std::numeric_limits<float>::max());
+	glm::vec3 aabbMax(-std::numeric_limits<float>::max());
+	if (node.leftChild != 0) {
+		const BvhNode& left = nodes[node.leftChild];
+		const BvhNode& right = nodes[node.leftChild + 1];
+		aabbMin = glm::min(left.aabbMin, right.aabbMin);
+		aabbMax = glm::max(left.aabbMax, right.aabbMax);
+	}
+	else {
+		for (uint32_t i = node.firstInstance; i < node.firstInstance + node.instanceCount; i++) {
+			const Box& box = boxes[i];
+			aabbMin = glm::min(aabbMin, box.aabbMin);
+			aabbMax = glm::max(aabbMax, box.aabbMax);
+		}
+	}
+	node.aabbMin = aabbMin;
+	node.aabbMax = aabbMax;
+}
+
+void InstanceBvh::split(uint32_t nodeIndex, std::vector<uint32_t>& stack) {
+	const uint32_t first = nodes[nodeIndex].firstInstance;
+	const uint32_t count = nodes[nodeIndex].instanceCount;
+	if (count <= 1)
+		return;
+
+	glm::vec3 centroidMin(std::numeric_limits<float>::max());
+	glm::vec3 centroidMax(-std::numeric_limits<float>::max());
+	for (uint32_t i = first; i < first + count; i++) {
+		centroidMin = glm::min(centroidMin, centroids[i]);
+		centroidMax = glm::max(centroidMax, centroids[i]);
+	}
+
+	struct Bin {
+		glm::vec3 aabbMin = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 aabbMax = glm::vec3(-std::numeric_limits<float>::max());
+		uint32_t count = 0;
+	};
+
+	//sah with unit cost per box test and per traversal step
+	float bestCost = std::numeric_limits<float>::max();
+	int bestAxis = -1;
+	uint32_t bestBin = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		float extent = centroidMax[axis] - centroidMin[axis];
+		if (extent <= 0)
+			continue;
+		float binScale = binCount / extent;
+		Bin bins[binCount];
+		for (uint32_t i = first; i < first + count; i++) {
+			uint32_t b = std::min(binCount - 1, (uint32_t)((centroids[i][axis] - centroidMin[axis]) * binScale));
+			bins[b].count++;
+			bins[b].aabbMin = glm::min(bins[b].aabbMin, boxes[i].aabbMin);
+			bins[b].aabbMax = glm::max(bins[b].aabbMax, boxes[i].aabbMax);
+		}
+
+		//sweep from the right first so the left sweep can evaluate every plane in one pass
+		float rightArea[binCount - 1];
+		uint32_t rightCount[binCount - 1];
+		Bin right;
+		for (uint32_t b = binCount - 1; b > 0; b--) {
+			right.aabbMin = glm::min(right.aabbMin, bins[b].aabbMin);
+			right.aabbMax = glm::max(right.aabbMax, bins[b].aabbMax);
+			right.count += bins[b].count;
+			rightArea[b - 1] = surfaceArea(right.aabbMin, right.aabbMax);
+			rightCount[b - 1] = right.count;
+		}
+		Bin left;
+		for (uint32_t b = 0; b < binCount - 1; b++) {
+			left.aabbMin = glm::min(left.aabbMin, bins[b].aabbMin);
+			left.aabbMax = glm::max(left.aabbMax, bins[b].aabbMax);
+			left.count += bins[b].count;
+			if (left.count == 0 || rightCount[b] == 0)
+				continue;
+			float cost = left.count * surfaceArea(left.aabbMin, left.aabbMax) + rightCount[b] * rightArea[b];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = b;
+			}
+		}
+	}
+
+	const BvhNode& node = nodes[nodeIndex];
+	float nodeArea = surfaceArea(node.aabbMin, node.aabbMax);
+	float leafCost = (float)count;
+	float splitCost = nodeArea > 0 ? 1.f + bestCost / nodeArea : 1.f + count;
+
+	uint32_t leftCount;
+	if (bestAxis >= 0 && (splitCost < leafCost || count > maxLeafInstances)) {
+		float binScale = binCount / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+		auto isLeft = [&](uint32_t i) {
+			return std::min(binCount - 1, (uint32_t)((centroids[i][bestAxis] - centroidMin[bestAxis]) * binScale)) <= bestBin;
+		};
+		//boxes and centroids move with their instance so every pass reads memory in order
+		uint32_t i = first, j = first + count;
+		while (i < j) {
+			if (isLeft(i)) {
+				i++;
+				continue;
+			}
+			j--;
+			std::swap(instanceIndices[i], instanceIndices[j]);
+			std::swap(boxes[i], boxes[j]);
+			std::swap(centroids[i], centroids[j]);
+		}
+		leftCount = i - first;
+	}
+	else if (count > maxLeafInstances) {
+		//every centroid is the same point, any halving is as good
+		leftCount = count / 2;
+	}
+	else {
+		return;
+	}
+
+	uint32_t leftChild = (uint32_t)nodes.size();
+	nodes.push_back({ glm::vec3(0), first, glm::vec3(0), leftCount, 0 });
+	nodes.push_back({ glm::vec3(0), first + leftCount, glm::vec3(0), count - leftCount, 0 });
+	parents.push_back(nodeIndex);
+	parents.push_back(nodeIndex);
+	nodes[nodeIndex].leftChild = leftChild;
+	updateNodeBounds(leftChild);
+	updateNodeBounds(leftChild + 1);
+	stack.push_back(leftChild);
+	stack.push_back(leftChild + 1);
+}
+
+void InstanceBvh::build(const std::vector<Bounds>& bounds) {
+	const uint32_t count = (uint32_t)bounds.size();
+	boxes.resize(count);
+	centroids.resize(count);
+	for (uint32_t i = 0; i < count; i++) {
+		boxes[i] = { glm::vec3(bounds[i].aabbMin), glm::vec3(bounds[i].aabbMax) };
+		centroids[i] = (boxes[i].aabbMin + boxes[i].aabbMax) * 0.5f;
+	}
+	instanceIndices.resize(count);
+	std::iota(instanceIndices.begin(), instanceIndices.end(), 0);
+
+	nodes.clear();
+	parents.clear();
+	if (count == 0)
+		return;
+	nodes.reserve(2 * (size_t)count);
+	parents.reserve(2 * (size_t)count);
+	nodes.push_back({ glm::vec3(0), 0, glm::vec3(0), count, 0 });
+	parents.push_back(0);
+	updateNodeBounds(0);
+
+	//children are always appended after their parent, refit relies on it
+	std::vector<uint32_t> stack = { 0 };
+	while (!stack.empty()) {
+		uint32_t nodeIndex = stack.back();
+		stack.pop_back();
+		split(nodeIndex, stack);
+	}
+
+	centroids.clear();
+	centroids.shrink_to_fit();
+
+	instanceSlots.resize(count);
+	slotLeaves.resize(count);
+	for (uint32_t n = 0; n < nodes.size(); n++) {
+		if (nodes[n].leftChild != 0)
+			continue;
+		for (uint32_t i = nodes[n].firstInstance; i < nodes[n].firstInstance + nodes[n].instanceCount; i++) {
+			instanceSlots[instanceIndices[i]] = i;
+			slotLeaves[i] = n;
+		}
+	}
+}
+
+void InstanceBvh::updateInstance(uint32_t instance, const Bounds& bounds) {
+	uint32_t slot = instanceSlots[instance];
+	boxes[slot] = { glm::vec3(bounds.aabbMin), glm::vec3(bounds.aabbMax) };
+	uint32_t nodeIndex = slotLeaves[slot];
+	while (true) {
+		glm::vec3 oldMin = nodes[nodeIndex].aabbMin;
+		glm::vec3 oldMax = nodes[nodeIndex].aabbMax;
+		updateNodeBounds(nodeIndex);
+		if (nodeIndex == 0 || (oldMin == nodes[nodeIndex].aabbMin && oldMax == nodes[nodeIndex].aabbMax))
+			break;
+		nodeIndex = parents[nodeIndex];
+	}
+}
+
+void InstanceBvh::refit(const std::vector<Bounds>& bounds) {
+	for (size_t i = 0; i < boxes.size(); i++) {
+		const Bounds& instanceBounds = bounds[instanceIndices[i]];
+		boxes[i] = { glm::vec3(instanceBounds.aabbMin), glm::vec3(instanceBounds.aabbMax) };
+	}
+	for (size_t n = nodes.size(); n-- > 0;)
+		updateNodeBounds((uint32_t)n);
+}
+
+void InstanceBvh::appendSubtree(const BvhNode& node, std::vector<uint32_t>& out) const {
+	out.insert(
+		out.end(),
+		instanceIndices.begin() + node.firstInstance,
+		instanceIndices.begin() + node.firstInstance + node.instanceCount
+	);
+}
+
+void InstanceBvh::cullFrustum(const Frustum& frustum, std::vector<uint32_t>& visible) const {
+	visible.clear();
+	if (nodes.empty())
+		return;
+
+	//bit per plane the box still straddles, children of a box fully inside a plane skip it
+	auto classify = [&frustum](glm::vec3 aabbMin, glm::vec3 aabbMax, uint32_t& planeMask) {
+		glm::vec3 center = (aabbMin + aabbMax) * 0.5f;
+		glm::vec3 extent = (aabbMax - aabbMin) * 0.5f;
+		for (uint32_t p = 0; p < 6; p++) {
+			if ((planeMask & (1u << p)) == 0)
+				continue;
+			const glm::vec4& plane = frustum.planes[p];
+			float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+			float radius = glm::dot(glm::abs(glm::vec3(plane)), extent);
+			if (distance + radius < 0)
+				return false;
+			if (distance - radius >= 0)
+				planeMask &= ~(1u << p);
+		}
+		return true;
+	};
+
+	std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0u, 0x3Fu } };
+	while (!stack.empty()) {
+		auto [nodeIndex, planeMask] = stack.back();
+		stack.pop_back();
+		const BvhNode& node = nodes[nodeIndex];
+		if (!classify(node.aabbMin, node.aabbMax, planeMask))
+			continue;
+		if (planeMask == 0) {
+			appendSubtree(node, visible);
+		}
+		else if (node.leftChild == 0) {
+			for (uint32_t i = node.firstInstance; i < node.firstInstance + node.instanceCount; i++) {
+				uint32_t instanceMask = planeMask;
+				const Box& box = boxes[i];
+				if (classify(box.aabbMin, box.aabbMax, instanceMask))
+					visible.push_back(instanceIndices[i]);
+			}
+		}
+		else {
+			stack.push_back({ node.leftChild + 1, planeMask });
+			stack.push_back({ node.leftChild, planeMask });
+		}
+	}
+}
+
+std::optional<BvhRayHit> InstanceBvh::raycast(glm::vec3 origin, glm::vec3 direction, float maxDistance) const {
+	if (nodes.empty())
+		return std::nullopt;
+
+	glm::vec3 inverseDirection = 1.f / direction;
+	std::optional<BvhRayHit> hit;
+	float closest = maxDistance;
+
+	//nodes are pushed with their entry distance, the nearer child is visited first
+	std::vector<std::pair<uint32_t, float>> stack;
+	float rootDistance = intersectBox(origin, inverseDirection, nodes[0].aabbMin, nodes[0].aabbMax, closest);
+	if (std::isinf(rootDistance))
+		return std::nullopt;
+	stack.push_back({ 0u, rootDistance });
+	while (!stack.empty()) {
+		auto [nodeIndex, entry] = stack.back();
+		stack.pop_back();
+		if (entry > closest)
+			continue;
+		const BvhNode& node = nodes[nodeIndex];
+		if (node.leftChild == 0) {
+			for (uint32_t i = node.firstInstance; i < node.firstInstance + node.instanceCount; i++) {
+				const Box& box = boxes[i];
+				float distance = intersectBox(origin, inverseDirection, box.aabbMin, box.aabbMax, closest);
+				if (distance < closest) {
+					closest = distance;
+					hit = BvhRayHit{ instanceIndices[i], distance };
+				}
+			}
+			continue;
+		}
+
+		uint32_t nearChild = node.leftChild, farChild = node.leftChild + 1;
+		float nearDistance = intersectBox(origin, inverseDirection, nodes[nearChild].aabbMin, nodes[nearChild].aabbMax, closest);
+		float farDistance = intersectBox(origin, inverseDirection, nodes[farChild].aabbMin, nodes[farChild].aabbMax, closest);
+		if (farDistance < nearDistance) {
+			std::swap(nearChild, farChild);
+			std::swap(nearDistance, farDistance);
+		}
+		if (!std::isinf(farDistance))
+			stack.push_back({ farChild, farDistance });
+		if (!std::isinf(nearDistance))
+			stack.push_back({ nearChild, nearDistance });
+	}
+	return hit;
+}
+
+void InstanceBvh::overlapSphere(glm::vec3 center, float radius, std::vector<uint32_t>& out) const {
+	if (nodes.empty())
+		return;
+	const float radiusSquared = radius * radius;
+	std::vector<uint32_t> stack = { 0 };
+	while (!stack.empty()) {
+		const BvhNode& node = nodes[stack.back()];
+		stack.pop_back();
+		if (distanceSquared(center, node.aabbMin, node.aabbMax) > radiusSquared)
+			continue;
+		if (farthestDistanceSquared(center, node.aabbMin, node.aabbMax) <= radiusSquared) {
+			appendSubtree(node, out);
+		}
+		else if (node.leftChild == 0) {
+			for (uint32_t i = node.firstInstance; i < node.firstInstance + node.instanceCount; i++) {
+				const Box& box = boxes[i];
+				if (distanceSquared(center, box.aabbMin, box.aabbMax) <= radiusSquared)
+					out.push_back(instanceIndices[i]);
+			}
+		}
+		else {
+			stack.push_back(node.leftChild + 1);
+			stack.push_back(node.leftChild);
+		}
+	}
+}
+
+void InstanceBvh::overlapBox(glm::vec3 aabbMin, glm::vec3 aabbMax, std::vector<uint32_t>& out) const {
+	if (nodes.empty())
+		return;
+	std::vector<uint32_t> stack = { 0 };
+	while (!stack.empty()) {
+		const BvhNode& node = nodes[stack.back()];
+		stack.pop_back();
+		if (!overlaps(aabbMin, aabbMax, node.aabbMin, node.aabbMax))
+			continue;
+		if (contains(aabbMin, aabbMax, node.aabbMin, node.aabbMax)) {
+			appendSubtree(node, out);
+		}
+		else if (node.leftChild == 0) {
+			for (uint32_t i = node.firstInstance; i < node.firstInstance + node.instanceCount; i++) {
+				const Box& box = boxes[i];
+				if (overlaps(aabbMin, aabbMax, box.aabbMin, box.aabbMax))
+					out.push_back(instanceIndices[i]);
+			}
+		}
+		else {
+			stack.push_back(node.leftChild + 1);
+			stack.push_back(node.leftChild);
+		}
+	}
+}
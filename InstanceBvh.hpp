@@ -0,0 +1,76 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "MeshLoader.hpp"
+#include "FrustumCuller.hpp"
+
+//bounding volume hierarchy over the world space boxes of all instances
+//built once per model with binned sah, refit when instance bounds move
+//used for frustum culling, picking rays and overlap queries
+
+struct BvhNode {
+	glm::vec3 aabbMin;
+	//instances of the subtree are instanceIndices[firstInstance, firstInstance + instanceCount)
+	uint32_t firstInstance;
+	glm::vec3 aabbMax;
+	uint32_t instanceCount;
+	//children are leftChild and leftChild + 1, 0 for leaves since the root is never a child
+	uint32_t leftChild;
+};
+
+struct BvhRayHit {
+	uint32_t instance;
+	//along the ray to the entry of the instance box, 0 if the origin is inside it
+	float distance;
+};
+
+class InstanceBvh {
+	struct Box {
+		glm::vec3 aabbMin;
+		glm::vec3 aabbMax;
+	};
+
+	std::vector<BvhNode> nodes;
+	//instances in tree order, boxes[i] belongs to instanceIndices[i] so leaves read boxes in order
+	std::vector<uint32_t> instanceIndices;
+	std::vector<Box> boxes;
+	//only alive during build
+	std::vector<glm::vec3> centroids;
+	//for incremental refits
+	std::vector<uint32_t> parents;
+	std::vector<uint32_t> instanceSlots;
+	std::vector<uint32_t> slotLeaves;
+
+	void updateNodeBounds(uint32_t nodeIndex);
+	void split(uint32_t nodeIndex, std::vector<uint32_t>& stack);
+	void appendSubtree(const BvhNode& node, std::vector<uint32_t>& out) const;
+
+public:
+	//instances per leaf above which a split is always attempted
+	inline static const uint32_t maxLeafInstances = 4;
+	//centroid bins per axis the sah cost is evaluated on
+	inline static const uint32_t binCount = 12;
+
+	void build(const std::vector<Bounds>& bounds);
+
+	//moves one instance and refits its ancestors, stops as soon as an ancestor doesn't change
+	//tree quality degrades after large motions, rebuild then
+	void updateInstance(uint32_t instance, const Bounds& bounds);
+	//refits every node bottom up, cheaper than many updateInstance calls
+	void refit(const std::vector<Bounds>& bounds);
+
+	size_t instanceCount() const { return boxes.size(); }
+	size_t nodeCount() const { return nodes.size(); }
+
+	//fills visible with instances intersecting the frustum, in tree order
+	void cullFrustum(const Frustum& frustum, std::vector<uint32_t>& visible) const;
+	//nearest instance box hit by the ray, direction doesn't need to be normalized
+	std::optional<BvhRayHit> raycast(glm::vec3 origin, glm::vec3 direction, float maxDistance) const;
+	//appends instances whose box intersects the sphere or box
+	void overlapSphere(glm::vec3 center, float radius, std::vector<uint32_t>& out) const;
+	void overlapBox(glm::vec3 aabbMin, glm::vec3 aabbMax, std::vector<uint32_t>& out) const;
+};
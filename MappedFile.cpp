@@ -0,0 +1,99 @@
+#include "MappedFile.hpp"
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::filesystem::path& path) {
+	std::shared_ptr<MappedFile> file(new MappedFile());
+
+	HANDLE handle = CreateFileW(
+		path.c_str(),
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+		NULL
+	);
+	if (handle == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error("MappedFile: could not open " + path.generic_string());
+	}
+	file->fileHandle = handle;
+
+	LARGE_INTEGER size{};
+	GetFileSizeEx(handle, &size);
+	file->length = (size_t)size.QuadPart;
+	if (file->length == 0) {
+		//empty files cannot be mapped
+		return file;
+	}
+
+	HANDLE mapping = CreateFileMappingW(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) {
+		throw std::runtime_error("MappedFile: could not create mapping for " + path.generic_string());
+	}
+	file->mappingHandle = mapping;
+
+	file->ptr = reinterpret_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (file->ptr == nullptr) {
+		throw std::runtime_error("MappedFile: could not map " + path.generic_string());
+	}
+	return file;
+}
+
+MappedFile::~MappedFile() {
+	if (ptr)
+		UnmapViewOfFile(ptr);
+	if (mappingHandle)
+		CloseHandle(mappingHandle);
+	if (fileHandle)
+		CloseHandle(fileHandle);
+}
+
+#else
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::filesystem::path& path) {
+	std::shared_ptr<MappedFile> file(new MappedFile());
+
+	file->fd = ::open(path.c_str(), O_RDONLY);
+	if (file->fd == -1) {
+		throw std::runtime_error("MappedFile: could not open " + path.generic_string());
+	}
+
+	struct stat st {};
+	fstat(file->fd, &st);
+	file->length = (size_t)st.st_size;
+	if (file->length == 0) {
+		//empty files cannot be mapped
+		return file;
+	}
+
+	void* mapped = mmap(nullptr, file->length, PROT_READ, MAP_PRIVATE, file->fd, 0);
+	if (mapped == MAP_FAILED) {
+		throw std::runtime_error("MappedFile: could not map " + path.generic_string());
+	}
+	madvise(mapped, file->length, MADV_SEQUENTIAL);
+	file->ptr = reinterpret_cast<const unsigned char*>(mapped);
+	return file;
+}
+
+MappedFile::~MappedFile() {
+	if (ptr)
+		munmap(const_cast<unsigned char*>(ptr), length);
+	if (fd != -1)
+		close(fd);
+}
+
+#endif
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <filesystem>
+
+//read only view of a whole file mapped into the address space
+//the os pages data in lazily, so nothing is read or copied until it is touched
+class MappedFile {
+private:
+	MappedFile() = default;
+
+	const unsigned char* ptr = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#else
+	int fd = -1;
+#endif
+
+public:
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	//throws if the file could not be opened or mapped
+	static std::shared_ptr<MappedFile> open(const std::filesystem::path& path);
+
+	inline const unsigned char* data() const { return ptr; }
+	inline size_t size() const { return length; }
+};
@@ -10,7 +10,9 @@
 #include <any>
 #include <filesystem>
 #include <set>
+#include <unordered_map>
 #include <optional>
+#include <limits>
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/quaternion.hpp"
@@ -18,7 +20,13 @@
 #include <glm/gtx/string_cast.hpp>
 #include <glm/gtx/matrix_decompose.hpp>
 
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MESH_LOADER_SSE
+#endif
+
 #include "MeshLoader.hpp"
+#include "MappedFile.hpp"
 
 #define CGLTF_IMPLEMENTATION
 #include "cgltf/cgltf.h"
@@ -105,9 +113,192 @@ inline glm::vec2 coordinateSystemCorrection(glm::vec2 vec) {
 }
 
 
-std::vector<std::vector<std::pair<MeshData<Vertex3>, int>>> loadMeshes(ModelInterface& model) {
-	std::vector<std::vector<std::pair<MeshData<Vertex3>, int>>> meshes;
-	size_t num_total_primitives = 0;
+#ifdef MESH_LOADER_SSE
+inline __m128 loadPosition(const unsigned char* position, bool last) {
+	//positions are 12 bytes, the 4 bytes after one belong to the next vertex except for the last
+	//w is garbage and masked out by the callers
+	if (!last)
+		return _mm_loadu_ps(reinterpret_cast<const float*>(position));
+	float xyz[4] = {};
+	memcpy(xyz, position, sizeof(glm::vec3));
+	return _mm_loadu_ps(xyz);
+}
+#endif
+
+void positionsMinMax(const unsigned char* positions, size_t stride, size_t count, glm::vec3& outMin, glm::vec3& outMax) {
+#ifdef MESH_LOADER_SSE
+	__m128 minV = _mm_set1_ps(std::numeric_limits<float>::max());
+	__m128 maxV = _mm_set1_ps(-std::numeric_limits<float>::max());
+	for (size_t i = 0; i < count; i++) {
+		__m128 p = loadPosition(positions + i * stride, i + 1 == count);
+		minV = _mm_min_ps(minV, p);
+		maxV = _mm_max_ps(maxV, p);
+	}
+	float minF[4], maxF[4];
+	_mm_storeu_ps(minF, minV);
+	_mm_storeu_ps(maxF, maxV);
+	outMin = glm::vec3(minF[0], minF[1], minF[2]);
+	outMax = glm::vec3(maxF[0], maxF[1], maxF[2]);
+#else
+	outMin = glm::vec3(std::numeric_limits<float>::max());
+	outMax = glm::vec3(-std::numeric_limits<float>::max());
+	for (size_t i = 0; i < count; i++) {
+		glm::vec3 p;
+		memcpy(&p, positions + i * stride, sizeof(glm::vec3));
+		outMin = glm::min(outMin, p);
+		outMax = glm::max(outMax, p);
+	}
+#endif
+}
+
+float positionsMaxDistance(const unsigned char* positions, size_t stride, size_t count, glm::vec3 center) {
+#ifdef MESH_LOADER_SSE
+	const __m128 c = _mm_setr_ps(center.x, center.y, center.z, 0.f);
+	const __m128 xyzMask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+	__m128 maxV = _mm_setzero_ps();
+	for (size_t i = 0; i < count; i++) {
+		__m128 d = _mm_and_ps(_mm_sub_ps(loadPosition(positions + i * stride, i + 1 == count), c), xyzMask);
+		d = _mm_mul_ps(d, d);
+		//horizontal add of the squared components
+		__m128 sum = _mm_add_ps(d, _mm_movehl_ps(d, d));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+		maxV = _mm_max_ss(maxV, sum);
+	}
+	return std::sqrt(_mm_cvtss_f32(maxV));
+#else
+	float maxDistance2 = 0;
+	for (size_t i = 0; i < count; i++) {
+		glm::vec3 p;
+		memcpy(&p, positions + i * stride, sizeof(glm::vec3));
+		glm::vec3 d = p - center;
+		maxDistance2 = std::max(maxDistance2, glm::dot(d, d));
+	}
+	return std::sqrt(maxDistance2);
+#endif
+}
+
+inline Bounds boundsFromBox(const unsigned char* positions, size_t stride, size_t count, glm::vec3 min, glm::vec3 max) {
+	Bounds bounds;
+	bounds.aabbMin = glm::vec4(min, 0.f);
+	bounds.aabbMax = glm::vec4(max, 0.f);
+	glm::vec3 center = (min + max) * 0.5f;
+	bounds.sphere = glm::vec4(center, positionsMaxDistance(positions, stride, count, center));
+	return bounds;
+}
+
+Bounds computeBounds(const unsigned char* positions, size_t stride, size_t count) {
+	if (count == 0)
+		return Bounds();
+	glm::vec3 min, max;
+	positionsMinMax(positions, stride, count, min, max);
+	return boundsFromBox(positions, stride, count, min, max);
+}
+
+Bounds transformBounds(const Bounds& bounds, const glm::mat4& transform) {
+	//the box is transformed as center and extent, the extent through the absolute matrix
+	glm::vec3 center = (glm::vec3(bounds.aabbMin) + glm::vec3(bounds.aabbMax)) * 0.5f;
+	glm::vec3 extent = (glm::vec3(bounds.aabbMax) - glm::vec3(bounds.aabbMin)) * 0.5f;
+	glm::mat3 basis = glm::mat3(transform);
+	glm::mat3 absBasis(glm::abs(basis[0]), glm::abs(basis[1]), glm::abs(basis[2]));
+	glm::vec3 worldCenter = glm::vec3(transform * glm::vec4(center, 1.f));
+	glm::vec3 worldExtent = absBasis * extent;
+
+	float scale = std::max({ glm::length(basis[0]), glm::length(basis[1]), glm::length(basis[2]) });
+	Bounds world;
+	world.aabbMin = glm::vec4(worldCenter - worldExtent, 0.f);
+	world.aabbMax = glm::vec4(worldCenter + worldExtent, 0.f);
+	world.sphere = glm::vec4(glm::vec3(transform * glm::vec4(glm::vec3(bounds.sphere), 1.f)), bounds.sphere.w * scale);
+	return world;
+}
+
+inline Bounds coordinateSystemCorrection(const Bounds& bounds) {
+	//mirroring y swaps the y extremes
+	Bounds corrected = bounds;
+	corrected.aabbMin.y = -bounds.aabbMax.y;
+	corrected.aabbMax.y = -bounds.aabbMin.y;
+	corrected.sphere.y = -bounds.sphere.y;
+	return corrected;
+}
+
+void GltfPrimitiveView::writeVertices(Vertex3* dst) const {
+	const unsigned char* pos = position;
+	const unsigned char* norm = normal;
+	const unsigned char* tex = uv;
+	for (size_t i = 0; i < vertexCount; ++i) {
+		Vertex3 curr;
+		memcpy(&curr.pos, pos, sizeof(glm::vec3));
+		pos += positionStride;
+		memcpy(&curr.norm, norm, sizeof(glm::vec3));
+		norm += normalStride;
+		memcpy(&curr.uv, tex, sizeof(glm::vec2));
+		tex += uvStride;
+
+		curr.pos = coordinateSystemCorrection(curr.pos);
+		curr.norm = coordinateSystemCorrection(curr.norm);
+		//curr.uv = coordinateSystemCorrection(curr.uv);
+
+		dst[i] = curr;
+	}
+}
+
+template<typename Index>
+inline void gatherIndices(const GltfPrimitiveView& view, Index* dst) {
+	if (view.indexData == nullptr) {
+		//non indexed primitive, every vertex is used once in order
+		for (size_t i = 0; i < view.indexCount; i++)
+			dst[i] = (Index)i;
+		return;
+	}
+	if (view.indexComponentSize == sizeof(Index) && view.indexStride == sizeof(Index)) {
+		//layout already matches, copy straight out of the gltf buffer
+		memcpy(dst, view.indexData, sizeof(Index) * view.indexCount);
+		return;
+	}
+	const unsigned char* dataPtr = view.indexData;
+	for (size_t i = 0; i < view.indexCount; i++) {
+		uint32_t curr = 0;
+		if (view.indexComponentSize == 1) {
+			curr = *dataPtr;
+		}
+		else if (view.indexComponentSize == 2) {
+			uint16_t curr16;
+			memcpy(&curr16, dataPtr, sizeof(uint16_t));
+			curr = curr16;
+		}
+		else {
+			memcpy(&curr, dataPtr, sizeof(uint32_t));
+		}
+		dst[i] = (Index)curr;
+		dataPtr += view.indexStride;
+	}
+}
+
+void GltfPrimitiveView::writeIndices(uint32_t* dst) const {
+	gatherIndices(*this, dst);
+}
+
+void GltfPrimitiveView::writeIndices(uint16_t* dst) const {
+	gatherIndices(*this, dst);
+}
+
+void GltfPrimitiveView::writeSkinVertices(SkinVertex* dst) const {
+	for (size_t i = 0; i < vertexCount; i++) {
+		cgltf_uint jointIndices[4] = {};
+		glm::vec4 w(0.f);
+		cgltf_accessor_read_uint(joints, i, jointIndices, 4);
+		cgltf_accessor_read_float(weights, i, &w.x, 4);
+		//exporters quantize weights, the shader expects them to sum to 1
+		float sum = w.x + w.y + w.z + w.w;
+		SkinVertex curr{};
+		curr.weights = sum > 0.f ? w / sum : glm::vec4(1, 0, 0, 0);
+		curr.joints[0] = (jointIndices[0] & 0xFFFF) | (jointIndices[1] << 16);
+		curr.joints[1] = (jointIndices[2] & 0xFFFF) | (jointIndices[3] << 16);
+		dst[i] = curr;
+	}
+}
+
+std::vector<std::vector<std::pair<GltfPrimitiveView, int>>> loadMeshes(ModelInterface& model) {
+	std::vector<std::vector<std::pair<GltfPrimitiveView, int>>> meshes;
 	meshes.reserve(model.meshes.size());	
 	//std::array<std::string, 3> required = { "POSITION", "NORMAL", "TEXCOORD_0" };
 	
@@ -130,7 +321,7 @@ std::vector<std::vector<std::pair<MeshData<Vertex3>, int>>> loadMeshes(ModelInte
 		meshes.back().reserve(mesh.primitives_count);
 		for (size_t mesh_primitive_index = 0; mesh_primitive_index < mesh.primitives_count; mesh_primitive_index++) {
 			auto& primitive = mesh.primitives[mesh_primitive_index];
-			MeshData<Vertex3> data;
+			GltfPrimitiveView view;
 			// todo make sure primitive mode = 4 (TRIANGLES)
 			if (primitive.type != cgltf_primitive_type_triangles) {
 				//! panic
@@ -161,101 +352,91 @@ std::vector<std::vector<std::pair<MeshData<Vertex3>, int>>> loadMeshes(ModelInte
 					}
 			}
 
-			unsigned char* position = accessorsInfo[0].data +
+			view.position = accessorsInfo[0].data +
 				accessorsInfo[0].bufferView.offset +
 				accessorsInfo[0].accessor.offset;
-			int position_stride = accessorsInfo[0].bufferView.stride == 0
+			view.positionStride = accessorsInfo[0].bufferView.stride == 0
 				? sizeof(glm::vec3)
 				: accessorsInfo[0].bufferView.stride;
 
-			unsigned char* normal = accessorsInfo[1].data +
+			view.normal = accessorsInfo[1].data +
 				accessorsInfo[1].bufferView.offset +
 				accessorsInfo[1].accessor.offset;
-			int normal_stride = accessorsInfo[1].bufferView.stride == 0
+			view.normalStride = accessorsInfo[1].bufferView.stride == 0
 				? sizeof(glm::vec3)
 				: accessorsInfo[1].bufferView.stride;
 
-			unsigned char* uv = accessorsInfo[2].data +
+			view.uv = accessorsInfo[2].data +
 				accessorsInfo[2].bufferView.offset +
 				accessorsInfo[2].accessor.offset;
-			int uv_stride = accessorsInfo[2].bufferView.stride == 0
+			view.uvStride = accessorsInfo[2].bufferView.stride == 0
 				? sizeof(glm::vec2)
 				: accessorsInfo[2].bufferView.stride;
 
-			data.vertices.reserve(accessorsInfo.front().accessor.count);
-			for (int i = 0; i < accessorsInfo.front().accessor.count; ++i) {
-				Vertex3 curr;
-				memcpy(&curr.pos, position, sizeof(glm::vec3));
-				position += position_stride;
-				memcpy(&curr.norm, normal, sizeof(glm::vec3));
-				normal += normal_stride;
-				memcpy(&curr.uv, uv, sizeof(glm::vec2));
-				uv += uv_stride;
-
-				curr.pos = coordinateSystemCorrection(curr.pos);
-				curr.norm = coordinateSystemCorrection(curr.norm);
-				//curr.uv = coordinateSystemCorrection(curr.uv);
-
-				data.vertices.push_back(curr);
+			view.vertexCount = accessorsInfo.front().accessor.count;
+
+			//only the first set of joints and weights is used, four influences per vertex
+			for (size_t j = 0; j < primitive.attributes_count; j++) {
+				const cgltf_attribute& attribute = primitive.attributes[j];
+				if (attribute.index != 0 || attribute.data->count != view.vertexCount)
+					continue;
+				if (attribute.type == cgltf_attribute_type_joints)
+					view.joints = attribute.data;
+				else if (attribute.type == cgltf_attribute_type_weights)
+					view.weights = attribute.data;
+			}
+			if (view.joints == nullptr || view.weights == nullptr)
+				view.joints = view.weights = nullptr;
+
+			//exporters are required to write min and max for positions, but some don't
+			const cgltf_accessor& positionAccessor = accessorsInfo[0].accessor;
+			if (positionAccessor.has_min && positionAccessor.has_max) {
+				view.bounds = boundsFromBox(
+					view.position, view.positionStride, view.vertexCount,
+					glm::make_vec3(positionAccessor.min), glm::make_vec3(positionAccessor.max)
+				);
+			}
+			else {
+				view.bounds = computeBounds(view.position, view.positionStride, view.vertexCount);
+			}
+			view.bounds = coordinateSystemCorrection(view.bounds);
+
+			if (primitive.indices == NULL) {
+				//indices are generated while gathering, welding can shrink it later
+				view.indexCount = view.vertexCount;
+				meshes.back().push_back(
+					std::make_pair(
+						view,
+						primitive.material - model.materials.begin()
+					)
+				);
+				continue;
 			}
 
 			auto indicesAccessorInfo = loadAccessor(model, primitive.indices);
 
-			if (indicesAccessorInfo.accessor.component_type == cgltf_component_type_r_8u) {
-
-				uint32_t indicesStride = indicesAccessorInfo.accessor.buffer_view->stride == 0 ?
-					indicesAccessorInfo.accessor.stride : indicesAccessorInfo.accessor.buffer_view->stride;
+			view.indexStride = indicesAccessorInfo.accessor.buffer_view->stride == 0 ?
+				indicesAccessorInfo.accessor.stride : indicesAccessorInfo.accessor.buffer_view->stride;
+			view.indexData = indicesAccessorInfo.data + indicesAccessorInfo.bufferView.offset + indicesAccessorInfo.accessor.offset;
+			view.indexCount = indicesAccessorInfo.accessor.count;
 
-				unsigned char* dataPtr = (
-					indicesAccessorInfo.data + indicesAccessorInfo.bufferView.offset + indicesAccessorInfo.accessor.offset
-					);
-
-				data.indices = std::vector<unsigned int>(indicesAccessorInfo.accessor.count);
-				for (unsigned int i = 0; i < indicesAccessorInfo.accessor.count; i++) {
-					unsigned int curr = *dataPtr;
-					data.indices[i] = curr;
-					dataPtr += indicesStride;
-				}
+			if (indicesAccessorInfo.accessor.component_type == cgltf_component_type_r_8u) {
+				view.indexComponentSize = sizeof(uint8_t);
 			}
 			else if (indicesAccessorInfo.accessor.component_type == cgltf_component_type_r_16u) {
-				uint32_t indicesStride = indicesAccessorInfo.accessor.buffer_view->stride == 0 ?
-					indicesAccessorInfo.accessor.stride : indicesAccessorInfo.accessor.buffer_view->stride;
-
-				unsigned char* dataPtr = (
-					indicesAccessorInfo.data + indicesAccessorInfo.bufferView.offset + indicesAccessorInfo.accessor.offset
-					);
-
-				data.indices = std::vector<unsigned int>(indicesAccessorInfo.accessor.count);
-				for (unsigned int i = 0; i < indicesAccessorInfo.accessor.count; i++) {
-					unsigned int curr;
-					memcpy(&curr, dataPtr, sizeof(uint16_t));
-					data.indices[i] = curr;
-					dataPtr += indicesStride;
-				}
+				view.indexComponentSize = sizeof(uint16_t);
 			}
 			else if (indicesAccessorInfo.accessor.component_type == cgltf_component_type_r_32u) {
-				uint32_t indicesStride = indicesAccessorInfo.accessor.buffer_view->stride == 0 ?
-					indicesAccessorInfo.accessor.stride : indicesAccessorInfo.accessor.buffer_view->stride;
-
-				unsigned char* dataPtr = (
-					indicesAccessorInfo.data + indicesAccessorInfo.bufferView.offset + indicesAccessorInfo.accessor.offset
-					);
-
-				data.indices = std::vector<unsigned int>(indicesAccessorInfo.accessor.count);
-				for (unsigned int i = 0; i < indicesAccessorInfo.accessor.count; i++) {
-					unsigned int curr;
-					memcpy(&curr, dataPtr, sizeof(uint32_t));
-					data.indices[i] = curr;
-					dataPtr += indicesStride;
-				}
+				view.indexComponentSize = sizeof(uint32_t);
 			}
 			else {
 				// invalid component type for indices !panic
+				view.indexCount = 0;
 			}
 
 			meshes.back().push_back(
 				std::make_pair(
-					std::move(data),
+					view,
 					primitive.material - model.materials.begin()
 				)
 			);
@@ -289,6 +470,7 @@ std::vector<MaterialPBR> loadMaterials(std::string mPath, const ModelInterface&
 	materials.reserve(model.materials.size());
 	for (auto& material : model.materials) {
 		MaterialPBR pbrMaterial;
+		pbrMaterial.doubleSided = material.double_sided;
 		
 		if (hasTexture(material.normal_texture)) {
 			pbrMaterial.normalScale = material.normal_texture.scale;
@@ -356,120 +538,188 @@ inline glm::quat getNodeRotation(cgltf_node* node) {
 		glm::quat();
 }
 
-glm::mat4 getNodeLocalTransform(cgltf_node* node) {
-	//returns local transformation of a node
-	glm::mat4 localTransform;
+uint32_t addNodeToHierarchy(SceneHierarchy& hierarchy, int32_t parent, cgltf_node* node) {
+	//appends the node with its local transform in renderer space
 	if (node->has_matrix) {
-		//todo still havent figured out how to convert matrix
-		throw std::runtime_error("it had matrix your honor");
-		localTransform = glm::make_mat4x4(node->matrix);
-		//glm::vec3 translation, scale, skew;
-		//glm::vec4 perspective;
-		//glm::quat rotation;
-		//glm::decompose(localTransform, scale, rotation, translation, skew, perspective);
-		//
-		//translation = coordinateSystemCorrection(translation);
-		//rotation.w -= rotation.w;
-		//rotation.y -= rotation.y;
-
-		//localTransform = (
-		//	glm::translate(
-		//		glm::mat4(1.f),
-		//		translation
-		//	)
-		//	* glm::mat4(rotation)
-		//	* glm::scale(
-		//		glm::mat4(1.f),
-		//		scale
-		//	)
-		//	);
+		//mirroring y on both sides converts a whole matrix the same way trs is converted piecewise
+		const glm::mat4 mirrorY = glm::scale(glm::mat4(1.f), glm::vec3(1, -1, 1));
+		return hierarchy.addNode(parent, mirrorY * glm::make_mat4x4(node->matrix) * mirrorY);
 	}
-	else {
-		localTransform = glm::mat4(1.0f);
-		if (node->has_translation) {
-			glm::vec3 translation = getNodeTranslation(node);
-			localTransform = glm::translate(localTransform, translation);
-		}
-		if (node->has_rotation) {
-			glm::quat q = getNodeRotation(node);
-			localTransform *= glm::mat4(q);
-		}
-		if (node->has_scale) {
-			glm::vec3 scale = getNodeScale(node);
-			localTransform *= glm::scale(glm::mat4(1.f), scale);
-		}
-		//TRS order
-	}
-	return localTransform;
+	return hierarchy.addNode(parent, getNodeTranslation(node), getNodeRotation(node), getNodeScale(node));
 }
 
-glm::mat4 getNodeGlobalTransform(cgltf_node* node) {
-	//returns global transformation of a node
-	//todo can optimize by caching global transform somewhere too if possible
 
-	glm::mat4 globalTransform = getNodeLocalTransform(node);
-	cgltf_node* curr = node->parent;
-	while (curr != NULL) {
-		globalTransform = getNodeLocalTransform(curr) * globalTransform;
-		curr = curr->parent;
-	}
-	return globalTransform;
+inline glm::vec4 animationValueCorrection(glm::vec4 value, cgltf_animation_path_type path) {
+	//same conversions as getNodeTranslation and getNodeRotation, they are linear so spline tangents convert alike
+	if (path == cgltf_animation_path_type_translation)
+		return glm::vec4(value.x, -value.y, value.z, 0.f);
+	if (path == cgltf_animation_path_type_rotation)
+		return glm::vec4(value.x, -value.y, value.z, -value.w);
+	return glm::vec4(value.x, value.y, value.z, 0.f);
 }
 
-glm::vec3 getNodeGlobalTranslation(cgltf_node* node) {
-	//returns global translation of a node
-	glm::vec3 globalTranslation = getNodeTranslation(node);
-	cgltf_node* curr = node->parent;
-	while (curr != NULL) {
-		globalTranslation += getNodeTranslation(curr);
-		curr = curr->parent;
+AnimationSet loadAnimations(ModelInterface& model, const std::unordered_map<const cgltf_node*, uint32_t>& nodeIndices) {
+	AnimationSet animations;
+	const glm::mat4 mirrorY = glm::scale(glm::mat4(1.f), glm::vec3(1, -1, 1));
+
+	for (auto& skin : model.skins) {
+		Skin loaded{ (uint32_t)animations.jointNodes.size(), (uint32_t)skin.joints_count };
+		for (size_t j = 0; j < skin.joints_count; j++) {
+			auto found = nodeIndices.find(skin.joints[j]);
+			if (found == nodeIndices.end()) {
+				//a joint outside the scene can't be posed, instances using the skin are drawn unskinned
+				std::cerr << "Skin " << (skin.name ? skin.name : "") << " has joints outside the scene" << std::endl;
+				animations.jointNodes.resize(loaded.firstJoint);
+				animations.inverseBindMatrices.resize(loaded.firstJoint);
+				loaded.jointCount = 0;
+				break;
+			}
+			glm::mat4 inverseBind(1.f);
+			if (skin.inverse_bind_matrices != NULL)
+				cgltf_accessor_read_float(skin.inverse_bind_matrices, j, &inverseBind[0][0], 16);
+			animations.jointNodes.push_back(found->second);
+			animations.inverseBindMatrices.push_back(mirrorY * inverseBind * mirrorY);
+		}
+		animations.skins.push_back(loaded);
 	}
-	return globalTranslation;
-}
 
-glm::vec3 getNodeGlobalScale(cgltf_node* node) {
-	//returns global scale of a node
-	glm::vec3 globalScale = getNodeScale(node);
-	cgltf_node* curr = node->parent;
-	while (curr != NULL) {
-		globalScale *= getNodeScale(curr);
-		curr = curr->parent;
+	for (auto& animation : model.animations) {
+		AnimationClip clip{ animation.name ? animation.name : "", (uint32_t)animations.channels.size(), 0, 0.f };
+		for (size_t c = 0; c < animation.channels_count; c++) {
+			const cgltf_animation_channel& channel = animation.channels[c];
+			auto found = nodeIndices.find(channel.target_node);
+			//morph target weights are not supported
+			if (found == nodeIndices.end() || channel.target_path == cgltf_animation_path_type_weights || channel.target_path == cgltf_animation_path_type_invalid)
+				continue;
+
+			const cgltf_animation_sampler& sampler = *channel.sampler;
+			bool cubic = sampler.interpolation == cgltf_interpolation_type_cubic_spline;
+			size_t keyCount = sampler.input->count;
+			if (keyCount == 0 || sampler.output->count != (cubic ? 3 : 1) * keyCount)
+				continue;
+
+			AnimationChannel loaded;
+			loaded.node = found->second;
+			loaded.path =
+				channel.target_path == cgltf_animation_path_type_translation ? AnimationPath::translation :
+				channel.target_path == cgltf_animation_path_type_rotation ? AnimationPath::rotation :
+				AnimationPath::scale;
+			loaded.interpolation =
+				cubic ? AnimationInterpolation::cubicSpline :
+				sampler.interpolation == cgltf_interpolation_type_step ? AnimationInterpolation::step :
+				AnimationInterpolation::linear;
+			loaded.firstKey = (uint32_t)animations.keyTimes.size();
+			loaded.keyCount = (uint32_t)keyCount;
+			loaded.firstValue = (uint32_t)animations.keyValues.size();
+
+			for (size_t k = 0; k < keyCount; k++) {
+				float time = 0.f;
+				cgltf_accessor_read_float(sampler.input, k, &time, 1);
+				animations.keyTimes.push_back(time);
+				clip.duration = std::max(clip.duration, time);
+			}
+			size_t componentCount = channel.target_path == cgltf_animation_path_type_rotation ? 4 : 3;
+			for (size_t v = 0; v < sampler.output->count; v++) {
+				glm::vec4 value(0.f);
+				cgltf_accessor_read_float(sampler.output, v, &value.x, componentCount);
+				animations.keyValues.push_back(animationValueCorrection(value, channel.target_path));
+			}
+			animations.channels.push_back(loaded);
+		}
+		clip.channelCount = (uint32_t)animations.channels.size() - clip.firstChannel;
+		if (clip.channelCount > 0)
+			animations.clips.push_back(clip);
 	}
-	return globalScale;
+	return animations;
 }
 
-glm::quat getNodeGlobalRotation(cgltf_node* node) {
-	glm::quat globalRot = getNodeRotation(node);
-	cgltf_node* curr = node->parent;
-	while (curr != NULL) {
-		globalRot = getNodeRotation(curr) * globalRot;
-		curr = curr->parent;
+
+struct GltfFile {
+	cgltf_data* data = NULL;
+	//the gltf/glb file itself and any external buffers, cgltf data points into these
+	std::vector<std::shared_ptr<MappedFile>> mappings;
+
+	GltfFile() = default;
+	GltfFile(const GltfFile&) = delete;
+	GltfFile& operator=(const GltfFile&) = delete;
+
+	bool isMapped(const void* ptr) const {
+		for (auto& mapping : mappings) {
+			const unsigned char* p = reinterpret_cast<const unsigned char*>(ptr);
+			if (p >= mapping->data() && p < mapping->data() + mapping->size())
+				return true;
+		}
+		return false;
 	}
-	return globalRot;
-}
 
+	~GltfFile() {
+		if (data == NULL)
+			return;
+		//cgltf must not free memory it does not own
+		for (size_t i = 0; i < data->buffers_count; i++) {
+			if (data->buffers[i].data != NULL && isMapped(data->buffers[i].data))
+				data->buffers[i].data = NULL;
+		}
+		cgltf_free(data);
+	}
+};
 
-std::optional<ModelData> loadGLTF(const char* filepath) {
+inline bool isExternalBuffer(const cgltf_buffer& buffer) {
+	return buffer.data == NULL && buffer.uri != NULL && strncmp(buffer.uri, "data:", 5) != 0;
+}
+
+std::optional<MappedModelData> loadGLTFMapped(const char* filepath) {
 	cgltf_options options{};
 	memset(&options, 0, sizeof(cgltf_options));
-	cgltf_data* data = NULL;
 
-	cgltf_result result = cgltf_parse_file(&options, filepath, &data);
+	auto gltf = std::make_shared<GltfFile>();
+	std::shared_ptr<MappedFile> mainFile;
+	try {
+		mainFile = MappedFile::open(filepath);
+	}
+	catch (std::runtime_error& e) {
+		std::cerr << e.what() << std::endl;
+		return std::nullopt;
+	}
+	gltf->mappings.push_back(mainFile);
+
+	//for .glb files the binary chunk is used in place from the mapping
+	cgltf_result result = cgltf_parse(&options, mainFile->data(), mainFile->size(), &gltf->data);
 	if (result != cgltf_result_success) {
 		return std::nullopt;
 	}
+	cgltf_data* data = gltf->data;
+
+	//cgltf_load_buffers skips buffers that already have data, so map external .bin files ourselves
+	for (size_t i = 0; i < data->buffers_count; i++) {
+		cgltf_buffer& buffer = data->buffers[i];
+		if (!isExternalBuffer(buffer))
+			continue;
+		try {
+			auto mapping = MappedFile::open(std::filesystem::path(filepath).parent_path() / buffer.uri);
+			if (mapping->size() < buffer.size)
+				continue;
+			buffer.data = const_cast<unsigned char*>(mapping->data());
+			gltf->mappings.push_back(mapping);
+		}
+		catch (std::runtime_error&) {
+			//leave it to cgltf, it also handles percent encoded uris
+		}
+	}
 
 	result = cgltf_load_buffers(&options, data, filepath);
 	if (result != cgltf_result_success) {
 		return std::nullopt;
 	}
 
-	/* TODO make awesome stuff */
 	ModelInterface model = ModelInterface(data);
 	auto loadedMeshes = loadMeshes(model);
-	std::set<cgltf_mesh*> addedMeshes;
+	//index of the first primitive of a gltf mesh in modelData.meshData.meshes
+	//primitives are only added once, every node using the mesh shares them
+	std::unordered_map<cgltf_mesh*, uint32_t> addedMeshes;
 
-	ModelData modelData;
+	MappedModelData modelData;
+	modelData.file = gltf;
 
 	//for (auto& matID : modelData.meshData.matIndex) {
 	//	std::cout << "confirm " << (model.materials.end() - 1 - matID)->name << std::endl;
@@ -479,60 +729,123 @@ std::optional<ModelData> loadGLTF(const char* filepath) {
 	modelData.meshData.meshes.reserve(loadedMeshes.size());
 	modelData.meshData.transforms.reserve(loadedMeshes.size());
 	modelData.meshData.matIndex.reserve(loadedMeshes.size());
+	modelData.meshData.meshIndex.reserve(loadedMeshes.size());
+	modelData.meshData.nodeIndex.reserve(loadedMeshes.size());
+	modelData.meshData.skinIndex.reserve(loadedMeshes.size());
+	modelData.meshData.bounds.reserve(loadedMeshes.size());
 	modelData.pointLights.reserve(model.lights.size());
 
-	std::vector<cgltf_node*> nodesQueue;
+	//depth first so every subtree is contiguous in the hierarchy, instances are added in node order
+	std::vector<std::pair<cgltf_node*, int32_t>> nodesQueue;
 	nodesQueue.reserve(model.nodes.size());
 	for (int i = 0; i < data->scene->nodes_count; i++) {
-		nodesQueue.push_back(data->scene->nodes[i]);
+		nodesQueue.push_back({ data->scene->nodes[i], SceneHierarchy::noParent });
 	}
 
-
+	std::vector<std::pair<cgltf_node*, uint32_t>> lightNodes;
+	std::unordered_map<const cgltf_node*, uint32_t> nodeIndices;
 	while(!nodesQueue.empty()){
-		cgltf_node& node = *nodesQueue.back();
-		if (node.light != nullptr) {
-			if (node.light->type == cgltf_light_type_point) {
-				modelData.pointLights.push_back(
-					getLightInfo(
-						getNodeGlobalTranslation(&node),
-						*node.light
-					)
-				);
-			}
-			else if (node.light->type == cgltf_light_type_directional) {
-				modelData.directionalLight.color = glm::make_vec3(node.light->color);
-				modelData.directionalLight.intensity = node.light->intensity;
-				modelData.directionalLight.direction = (
-						getNodeGlobalRotation(&node) * glm::vec3(0, 0, -1)
-					);
-				modelData.directionalLight.waste = -1.9872612;
-			}
-		}
+		cgltf_node& node = *nodesQueue.back().first;
+		uint32_t nodeIndex = addNodeToHierarchy(modelData.hierarchy, nodesQueue.back().second, &node);
+		nodeIndices[&node] = nodeIndex;
+		if (node.light != nullptr)
+			lightNodes.push_back({ &node, nodeIndex });
 		if (node.mesh != nullptr) {
-			glm::mat4 transform = getNodeGlobalTransform(&node);
 			int mIndex = node.mesh - model.meshes.begin();
-			addedMeshes.insert(node.mesh);
-			for (auto& primitive : loadedMeshes[mIndex]) {
-				modelData.meshData.meshes.push_back(primitive.first);
-				modelData.meshData.matIndex.push_back(primitive.second);
-				modelData.meshData.transforms.push_back(transform);
+			auto added = addedMeshes.find(node.mesh);
+			if (added == addedMeshes.end()) {
+				added = addedMeshes.emplace(node.mesh, (uint32_t)modelData.meshData.meshes.size()).first;
+				for (auto& primitive : loadedMeshes[mIndex]) {
+					modelData.meshData.meshes.push_back(primitive.first);
+				}
+			}
+			for (uint32_t i = 0; i < loadedMeshes[mIndex].size(); i++) {
+				modelData.meshData.meshIndex.push_back(added->second + i);
+				modelData.meshData.matIndex.push_back(loadedMeshes[mIndex][i].second);
+				modelData.meshData.nodeIndex.push_back(nodeIndex);
+				bool skinned = node.skin != NULL && loadedMeshes[mIndex][i].first.isSkinned();
+				modelData.meshData.skinIndex.push_back(skinned ? (int32_t)(node.skin - model.skins.begin()) : -1);
 			}
 		}
 		
 		nodesQueue.pop_back();
 		for (int i = 0; i < node.children_count; i++)
 		{
-			nodesQueue.push_back(node.children[i]);
+			nodesQueue.push_back({ node.children[i], (int32_t)nodeIndex });
+		}
+	}
+
+	modelData.animations = loadAnimations(model, nodeIndices);
+	for (int32_t& skin : modelData.meshData.skinIndex) {
+		if (skin >= 0 && modelData.animations.skins[skin].jointCount == 0)
+			skin = -1;
+	}
+
+	//every world matrix in one pass instead of walking the parents of each node
+	modelData.hierarchy.update();
+	for (size_t i = 0; i < modelData.meshData.nodeIndex.size(); i++) {
+		const glm::mat4& transform = modelData.hierarchy.getWorldMatrix(modelData.meshData.nodeIndex[i]);
+		modelData.meshData.transforms.push_back(transform);
+		modelData.meshData.bounds.push_back(
+			transformBounds(modelData.meshData.meshes[modelData.meshData.meshIndex[i]].bounds, transform)
+		);
+	}
+	for (auto& [lightNode, nodeIndex] : lightNodes) {
+		const glm::mat4& world = modelData.hierarchy.getWorldMatrix(nodeIndex);
+		if (lightNode->light->type == cgltf_light_type_point) {
+			modelData.pointLights.push_back(
+				getLightInfo(
+					glm::vec3(world[3]),
+					*lightNode->light
+				)
+			);
+		}
+		else if (lightNode->light->type == cgltf_light_type_directional) {
+			modelData.directionalLight.color = glm::make_vec3(lightNode->light->color);
+			modelData.directionalLight.intensity = lightNode->light->intensity;
+			modelData.directionalLight.direction = glm::normalize(
+					glm::mat3(world) * glm::vec3(0, 0, -1)
+				);
+			modelData.directionalLight.waste = -1.9872612;
 		}
 	}
 
-	cgltf_free(data);
+	return modelData;
+}
+
+std::optional<ModelData> loadGLTF(const char* filepath) {
+	auto mapped = loadGLTFMapped(filepath);
+	if (!mapped.has_value()) {
+		return std::nullopt;
+	}
 
-	int tricount = 0, vertexcount = 0;
-	for (auto& mesh : modelData.meshData.meshes) {
-		vertexcount += mesh.vertices.size();
-		tricount += mesh.indices.size() / 3;
+	ModelData modelData;
+	modelData.meshData.transforms = std::move(mapped->meshData.transforms);
+	modelData.meshData.matIndex = std::move(mapped->meshData.matIndex);
+	modelData.meshData.meshIndex = std::move(mapped->meshData.meshIndex);
+	modelData.meshData.nodeIndex = std::move(mapped->meshData.nodeIndex);
+	modelData.meshData.skinIndex = std::move(mapped->meshData.skinIndex);
+	modelData.meshData.bounds = std::move(mapped->meshData.bounds);
+	modelData.materials = std::move(mapped->materials);
+	modelData.hierarchy = std::move(mapped->hierarchy);
+	modelData.animations = std::move(mapped->animations);
+	modelData.pointLights = std::move(mapped->pointLights);
+	modelData.directionalLight = mapped->directionalLight;
+
+	modelData.meshData.meshes.reserve(mapped->meshData.meshes.size());
+	for (const GltfPrimitiveView& view : mapped->meshData.meshes) {
+		MeshData<Vertex3> data;
+		data.vertices.resize(view.vertexCount);
+		view.writeVertices(data.vertices.data());
+		data.indices.resize(view.indexCount);
+		view.writeIndices(data.indices.data());
+		if (view.isSkinned()) {
+			data.skinVertices.resize(view.vertexCount);
+			view.writeSkinVertices(data.skinVertices.data());
+		}
+		data.bounds = view.bounds;
+		modelData.meshData.meshes.push_back(std::move(data));
 	}
 
 	return modelData;
-}
\ No newline at end of file
+}
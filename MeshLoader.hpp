@@ -1,15 +1,66 @@
 #pragma once
 #include <any>
+#include <cstdint>
+#include <cstring>
+#include <memory>
 #include <string>
 #include <vector>
 #include <optional>
 
 #include <glm/glm.hpp>
 
+#include "SceneHierarchy.hpp"
+#include "Animation.hpp"
+
+//one level of detail, a range of the mesh indices drawn with the same vertices
+struct MeshLod {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	//simplification error relative to the bounding sphere radius of the mesh
+	float error;
+};
+
+//axis aligned box and sphere of the same geometry, laid out to be uploaded as is
+struct Bounds {
+	//w unused
+	glm::vec4 aabbMin = glm::vec4(0);
+	glm::vec4 aabbMax = glm::vec4(0);
+	//xyz center and w radius
+	glm::vec4 sphere = glm::vec4(0);
+};
+
+//cluster of lod 0 triangles that is culled as a whole, laid out to be uploaded as is
+struct Meshlet {
+	//xyz center and w radius, in mesh space
+	glm::vec4 boundingSphere;
+	//xyz axis of the normal cone and w sine of its half angle, w > 1 if the cone can't be used
+	//a meshlet is back facing when dot(normalize(center - camera), axis) >= w
+	glm::vec4 coneAxis_cutoff;
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t waste[2];
+};
+
+//joint influences of one vertex, laid out as the skinning shader reads it
+struct SkinVertex {
+	glm::vec4 weights;
+	//four 16 bit indices into the joints of the instance's skin, two per uint
+	uint32_t joints[2];
+	uint32_t waste[2];
+};
+
 template<typename T>
 struct MeshData {
 	std::vector<T> vertices;
+	//empty unless the mesh is skinned, one per vertex otherwise
+	std::vector<SkinVertex> skinVertices;
 	std::vector<unsigned int> indices;
+	//empty if indices are a single lod, otherwise lod 0 is the full detail mesh
+	std::vector<MeshLod> lods;
+	//empty if the mesh was not split, otherwise covers the lod 0 indices
+	std::vector<Meshlet> meshlets;
+	//mesh space, conservative for the lod 0 vertices
+	Bounds bounds;
 	std::optional<std::any> other;
 	MeshData() = default;
 	MeshData(std::vector<T> vertices, std::vector<unsigned int> indices) : vertices(vertices), indices(indices) {};
@@ -22,6 +73,100 @@ struct Vertex3
 	glm::vec2 uv;
 };
 
+//box from min/max over the positions, sphere around the box center enclosing every position
+Bounds computeBounds(const unsigned char* positions, size_t stride, size_t count);
+inline Bounds computeBounds(const Vertex3* vertices, size_t count) {
+	return computeBounds(reinterpret_cast<const unsigned char*>(vertices), sizeof(Vertex3), count);
+}
+//bounds of the transformed box and sphere, the sphere radius is scaled by the largest axis scale
+Bounds transformBounds(const Bounds& bounds, const glm::mat4& transform);
+
+//non owning view of mesh data, either over a MeshData or over a cooked model mapping
+struct MeshDataView {
+	const Vertex3* vertices = nullptr;
+	size_t vertexCount = 0;
+	const unsigned int* indices = nullptr;
+	size_t indexCount = 0;
+	const MeshLod* lods = nullptr;
+	size_t lodCount = 0;
+	const Meshlet* meshlets = nullptr;
+	size_t meshletCount = 0;
+	//null unless the mesh is skinned, vertexCount entries otherwise
+	const SkinVertex* skinVertices = nullptr;
+	Bounds bounds;
+
+	MeshDataView() = default;
+	MeshDataView(const Vertex3* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount, const MeshLod* lods = nullptr, size_t lodCount = 0, const Meshlet* meshlets = nullptr, size_t meshletCount = 0)
+		: vertices(vertices), vertexCount(vertexCount), indices(indices), indexCount(indexCount), lods(lods), lodCount(lodCount), meshlets(meshlets), meshletCount(meshletCount) {};
+	MeshDataView(const MeshData<Vertex3>& data)
+		: MeshDataView(data.vertices.data(), data.vertices.size(), data.indices.data(), data.indices.size(), data.lods.data(), data.lods.size(), data.meshlets.data(), data.meshlets.size()) {
+		bounds = data.bounds;
+		skinVertices = data.skinVertices.empty() ? nullptr : data.skinVertices.data();
+	};
+
+	inline bool isSkinned() const {
+		return skinVertices != nullptr;
+	}
+	inline void writeSkinVertices(SkinVertex* dst) const {
+		memcpy(dst, skinVertices, sizeof(SkinVertex) * vertexCount);
+	}
+
+	//mesh sources write their data into caller provided memory, usually mapped staging memory
+	inline void writeVertices(Vertex3* dst) const {
+		memcpy(dst, vertices, sizeof(Vertex3) * vertexCount);
+	}
+	inline void writeIndices(uint32_t* dst) const {
+		memcpy(dst, indices, sizeof(uint32_t) * indexCount);
+	}
+	inline void writeIndices(uint16_t* dst) const {
+		for (size_t i = 0; i < indexCount; i++)
+			dst[i] = (uint16_t)indices[i];
+	}
+};
+
+struct cgltf_accessor;
+
+//non owning view of a gltf primitive, reads attributes straight from the gltf buffers
+//which are memory mapped for .glb files and external .bin buffers
+struct GltfPrimitiveView {
+	const unsigned char* position = nullptr;
+	const unsigned char* normal = nullptr;
+	const unsigned char* uv = nullptr;
+	uint32_t positionStride = 0;
+	uint32_t normalStride = 0;
+	uint32_t uvStride = 0;
+	size_t vertexCount = 0;
+
+	//null for non indexed primitives, sequential indices are generated instead
+	const unsigned char* indexData = nullptr;
+	uint32_t indexStride = 0;
+	//size of one index in the gltf buffer, 1, 2 or 4
+	uint32_t indexComponentSize = 0;
+	size_t indexCount = 0;
+
+	//gltf primitives are a single lod and are not split into meshlets
+	const MeshLod* lods = nullptr;
+	size_t lodCount = 0;
+	const Meshlet* meshlets = nullptr;
+	size_t meshletCount = 0;
+
+	//mesh space after the coordinate system correction
+	Bounds bounds;
+
+	//JOINTS_0 and WEIGHTS_0, both null unless the primitive is skinned
+	//they come in several component types, so they are read through cgltf
+	const cgltf_accessor* joints = nullptr;
+	const cgltf_accessor* weights = nullptr;
+
+	//applies the coordinate system correction while gathering
+	void writeVertices(Vertex3* dst) const;
+	void writeIndices(uint32_t* dst) const;
+	void writeIndices(uint16_t* dst) const;
+	bool isSkinned() const { return joints != nullptr; }
+	//weights are renormalized to sum to 1
+	void writeSkinVertices(SkinVertex* dst) const;
+};
+
 struct MetallicRoughnessMat {
 	std::string metallicRoughnessTex = "";
 	float metallic_factor = 1.0;
@@ -54,6 +199,8 @@ struct MaterialPBR {
 	bool isMetallicRoughness = true;
 	std::string normalMap = "";
 	float normalScale = 1.0;
+	//back facing meshlets are only culled for single sided materials
+	bool doubleSided = false;
 };
 
 struct PointLightInfo {
@@ -72,14 +219,59 @@ struct DirectionalLightInfo {
 
 struct ModelData {
 	struct {
-		//all of same length
+		//one per unique primitive, shared between instances
 		std::vector<MeshData<Vertex3>> meshes;
+
+		//one per instance, all of same length
+		std::vector<glm::mat4> transforms;
+		std::vector<int> matIndex;
+		std::vector<uint32_t> meshIndex;
+		//hierarchy node the instance is attached to, nondecreasing
+		std::vector<uint32_t> nodeIndex;
+		//AnimationSet skin deforming the instance, -1 if its mesh is not skinned
+		std::vector<int32_t> skinIndex;
+		//world space
+		std::vector<Bounds> bounds;
+	} meshData;
+	//transforms are the world matrices of the instance nodes after loading
+	SceneHierarchy hierarchy;
+	//channels and joints refer to hierarchy nodes
+	AnimationSet animations;
+	std::vector<MaterialPBR> materials;
+	std::vector<PointLightInfo> pointLights;
+	DirectionalLightInfo directionalLight;
+};
+
+//parsed gltf along with the mappings backing its buffers
+struct GltfFile;
+
+struct MappedModelData {
+	//keeps the primitive views alive
+	std::shared_ptr<GltfFile> file;
+	struct {
+		//one per unique primitive, shared between instances
+		std::vector<GltfPrimitiveView> meshes;
+
+		//one per instance, all of same length
 		std::vector<glm::mat4> transforms;
 		std::vector<int> matIndex;
+		std::vector<uint32_t> meshIndex;
+		//hierarchy node the instance is attached to, nondecreasing
+		std::vector<uint32_t> nodeIndex;
+		//AnimationSet skin deforming the instance, -1 if its mesh is not skinned
+		std::vector<int32_t> skinIndex;
+		//world space
+		std::vector<Bounds> bounds;
 	} meshData;
+	//transforms are the world matrices of the instance nodes after loading
+	SceneHierarchy hierarchy;
+	//channels and joints refer to hierarchy nodes
+	AnimationSet animations;
 	std::vector<MaterialPBR> materials;
 	std::vector<PointLightInfo> pointLights;
 	DirectionalLightInfo directionalLight;
 };
 
+//vertex data is left in the mapped gltf buffers, nothing is copied
+std::optional<MappedModelData> loadGLTFMapped(const char* filepath);
 std::optional<ModelData> loadGLTF(const char* filepath);
\ No newline at end of file
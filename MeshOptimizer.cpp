@@ -0,0 +1,730 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+
+#include <glm/glm.hpp>
+
+namespace {
+	//cell of the tolerance grid the value falls in, clamped so llround stays defined for huge values
+	inline int64_t quantize(float value, float tolerance) {
+		constexpr double maxCell = 4.0e18;
+		return std::llround(std::clamp((double)value / tolerance, -maxCell, maxCell));
+	}
+
+	//values within the tolerance are at most one cell apart, values that can't be quantized use their bits
+	inline int64_t positionCell(float value, float tolerance) {
+		if (tolerance > 0 && std::isfinite(value))
+			return quantize(value, tolerance);
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(float));
+		return bits;
+	}
+
+	inline uint64_t hashCell(const int64_t cell[3]) {
+		uint64_t hash = 0x9E3779B97F4A7C15ull;
+		for (int i = 0; i < 3; i++) {
+			hash ^= (uint64_t)cell[i];
+			hash *= 0xFF51AFD7ED558CCDull;
+			hash ^= hash >> 32;
+		}
+		return hash;
+	}
+
+	//bit identical for a 0 tolerance or non finite values
+	inline bool withinTolerance(float a, float b, float tolerance) {
+		if (tolerance > 0 && std::isfinite(a) && std::isfinite(b))
+			return std::abs(a - b) <= tolerance;
+		return memcmp(&a, &b, sizeof(float)) == 0;
+	}
+
+	//skin weights and joints have to be identical, vertices only weld if they deform the same way
+	inline bool canWeld(const Vertex3& a, const Vertex3& b, const SkinVertex* skinA, const SkinVertex* skinB, const WeldTolerance& tolerance) {
+		for (int i = 0; i < 3; i++) {
+			if (!withinTolerance(a.pos[i], b.pos[i], tolerance.position) || !withinTolerance(a.norm[i], b.norm[i], tolerance.normal))
+				return false;
+		}
+		for (int i = 0; i < 2; i++) {
+			if (!withinTolerance(a.uv[i], b.uv[i], tolerance.uv))
+				return false;
+		}
+		return skinA == nullptr || memcmp(skinA, skinB, sizeof(SkinVertex)) == 0;
+	}
+}
+
+size_t MeshOptimizer::weldVertices(MeshData<Vertex3>& mesh, const WeldTolerance& tolerance) {
+	const size_t vertexCount = mesh.vertices.size();
+	if (mesh.indices.empty()) {
+		mesh.indices.resize(vertexCount);
+		std::iota(mesh.indices.begin(), mesh.indices.end(), 0);
+	}
+	if (vertexCount == 0)
+		return 0;
+
+	//kept vertices by position cell, chained through nextInCell
+	const unsigned int empty = std::numeric_limits<unsigned int>::max();
+	std::unordered_map<uint64_t, unsigned int> cellHeads;
+	cellHeads.reserve(vertexCount);
+	std::vector<unsigned int> nextInCell;
+	nextInCell.reserve(vertexCount);
+
+	std::vector<Vertex3> vertices;
+	vertices.reserve(vertexCount);
+	std::vector<unsigned int> remap(vertexCount);
+	const bool skinned = !mesh.skinVertices.empty();
+	std::vector<SkinVertex> skinVertices;
+	skinVertices.reserve(skinned ? vertexCount : 0);
+	//a vertex near a cell border can weld with one in the neighbouring cell
+	const int64_t reach = tolerance.position > 0 ? 1 : 0;
+
+	for (size_t v = 0; v < vertexCount; v++) {
+		const Vertex3& vertex = mesh.vertices[v];
+		const SkinVertex* skin = skinned ? &mesh.skinVertices[v] : nullptr;
+		int64_t cell[3];
+		for (int i = 0; i < 3; i++)
+			cell[i] = positionCell(vertex.pos[i], tolerance.position);
+
+		unsigned int match = empty;
+		for (int64_t dz = -reach; dz <= reach && match == empty; dz++) {
+			for (int64_t dy = -reach; dy <= reach && match == empty; dy++) {
+				for (int64_t dx = -reach; dx <= reach && match == empty; dx++) {
+					const int64_t neighbour[3] = { cell[0] + dx, cell[1] + dy, cell[2] + dz };
+					auto head = cellHeads.find(hashCell(neighbour));
+					if (head == cellHeads.end())
+						continue;
+					//hash collisions only add candidates, every one is checked against the tolerance
+					for (unsigned int k = head->second; k != empty && match == empty; k = nextInCell[k]) {
+						if (canWeld(vertices[k], vertex, skinned ? &skinVertices[k] : nullptr, skin, tolerance))
+							match = k;
+					}
+				}
+			}
+		}
+
+		if (match == empty) {
+			match = (unsigned int)vertices.size();
+			auto head = cellHeads.try_emplace(hashCell(cell), empty).first;
+			nextInCell.push_back(head->second);
+			head->second = match;
+			vertices.push_back(vertex);
+			if (skinned)
+				skinVertices.push_back(*skin);
+		}
+		remap[v] = match;
+	}
+
+	for (unsigned int& index : mesh.indices)
+		index = remap[index];
+
+	size_t removed = vertexCount - vertices.size();
+	mesh.vertices = std::move(vertices);
+	mesh.skinVertices = std::move(skinVertices);
+	return removed;
+}
+
+VertexCacheStats MeshOptimizer::analyzeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount, uint32_t cacheSize) {
+	//simulates a fifo cache, a vertex is in the cache if it was added less than cacheSize misses ago
+	VertexCacheStats stats;
+	std::vector<size_t> addedAt(vertexCount, 0);
+	std::vector<bool> referenced(vertexCount, false);
+	size_t timestamp = cacheSize + 1;
+
+	for (unsigned int index : indices) {
+		if (timestamp - addedAt[index] > cacheSize) {
+			addedAt[index] = timestamp++;
+			stats.misses++;
+		}
+		if (!referenced[index]) {
+			referenced[index] = true;
+			stats.vertices++;
+		}
+	}
+	stats.triangles = indices.size() / 3;
+	stats.acmr = stats.triangles == 0 ? 0 : (float)stats.misses / stats.triangles;
+	stats.atvr = stats.vertices == 0 ? 0 : (float)stats.misses / stats.vertices;
+	return stats;
+}
+
+std::vector<uint32_t> MeshOptimizer::optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount, uint32_t cacheSize) {
+	//Sander, Nehab, Barczak - Fast Triangle Reordering for Vertex Locality and Reduced Overdraw
+	const size_t triangleCount = indices.size() / 3;
+	std::vector<uint32_t> hardBoundaries;
+	if (triangleCount == 0)
+		return hardBoundaries;
+
+	//vertex to triangle adjacency, as offsets into one flat array
+	std::vector<uint32_t> liveTriangles(vertexCount, 0);
+	for (unsigned int index : indices)
+		liveTriangles[index]++;
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++)
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+	std::vector<uint32_t> adjacency(indices.size());
+	{
+		std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t t = 0; t < triangleCount; t++)
+			for (int k = 0; k < 3; k++)
+				adjacency[fill[indices[t * 3 + k]]++] = (uint32_t)t;
+	}
+
+	std::vector<size_t> cacheTime(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> deadEnd;
+	std::vector<uint32_t> candidates;
+	deadEnd.reserve(indices.size());
+	std::vector<unsigned int> output;
+	output.reserve(indices.size());
+
+	size_t timestamp = cacheSize + 1;
+	size_t cursor = 0;
+	int64_t fanning = 0;
+	bool fromDeadEnd = true;
+
+	while (fanning >= 0) {
+		if (fromDeadEnd && (hardBoundaries.empty() || hardBoundaries.back() != output.size() / 3))
+			hardBoundaries.push_back((uint32_t)(output.size() / 3));
+
+		candidates.clear();
+		for (uint32_t a = adjacencyOffsets[fanning]; a < adjacencyOffsets[fanning + 1]; a++) {
+			uint32_t t = adjacency[a];
+			if (emitted[t])
+				continue;
+			for (int k = 0; k < 3; k++) {
+				unsigned int v = indices[t * 3 + k];
+				output.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				liveTriangles[v]--;
+				if (timestamp - cacheTime[v] > cacheSize)
+					cacheTime[v] = timestamp++;
+			}
+			emitted[t] = true;
+		}
+
+		//pick the candidate that is still in the cache after its remaining triangles are fanned, and is oldest
+		int64_t next = -1;
+		size_t bestPriority = 0;
+		for (uint32_t v : candidates) {
+			if (liveTriangles[v] == 0)
+				continue;
+			size_t priority = 0;
+			if (timestamp - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+				priority = timestamp - cacheTime[v];
+			if (next == -1 || priority > bestPriority) {
+				bestPriority = priority;
+				next = v;
+			}
+		}
+
+		fromDeadEnd = next == -1;
+		if (next == -1) {
+			//dead end, go back to recently used vertices
+			while (!deadEnd.empty()) {
+				uint32_t v = deadEnd.back();
+				deadEnd.pop_back();
+				if (liveTriangles[v] > 0) {
+					next = v;
+					break;
+				}
+			}
+		}
+		if (next == -1) {
+			//nothing recent left, scan forward for any vertex with triangles left
+			while (cursor < vertexCount && liveTriangles[cursor] == 0)
+				cursor++;
+			if (cursor < vertexCount)
+				next = cursor;
+		}
+		fanning = next;
+	}
+
+	indices = std::move(output);
+	return hardBoundaries;
+}
+
+void MeshOptimizer::optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex3>& vertices, const std::vector<uint32_t>& hardBoundaries, float threshold, uint32_t cacheSize) {
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0 || hardBoundaries.empty())
+		return;
+
+	//split hard clusters further at points where the cache restarts anyway and the acmr stays under the threshold
+	const float targetAcmr = analyzeVertexCache(indices, vertices.size(), cacheSize).acmr * threshold;
+	std::vector<uint32_t> clusters;
+	{
+		std::vector<size_t> cacheTime(vertices.size(), 0);
+		size_t timestamp = cacheSize + 1;
+		size_t boundary = 0;
+		size_t clusterMisses = 0, clusterStart = 0;
+		for (size_t t = 0; t < triangleCount; t++) {
+			if (boundary < hardBoundaries.size() && hardBoundaries[boundary] == t) {
+				clusters.push_back((uint32_t)t);
+				clusterStart = t;
+				clusterMisses = 0;
+				boundary++;
+			}
+			size_t triangleMisses = 0;
+			for (int k = 0; k < 3; k++) {
+				unsigned int v = indices[t * 3 + k];
+				if (timestamp - cacheTime[v] > cacheSize) {
+					cacheTime[v] = timestamp++;
+					triangleMisses++;
+				}
+			}
+			//a triangle with three misses means the cache was effectively flushed
+			if (triangleMisses == 3 && t > clusterStart) {
+				float acmr = (float)clusterMisses / (t - clusterStart);
+				if (acmr <= targetAcmr) {
+					clusters.push_back((uint32_t)t);
+					clusterStart = t;
+					clusterMisses = 0;
+				}
+			}
+			clusterMisses += triangleMisses;
+		}
+	}
+
+	glm::vec3 meshCentroid(0);
+	for (const Vertex3& vertex : vertices)
+		meshCentroid += vertex.pos;
+	meshCentroid /= (float)std::max<size_t>(vertices.size(), 1);
+
+	//occlusion potential, clusters far out along their own normal are drawn first
+	std::vector<float> sortKey(clusters.size());
+	for (size_t c = 0; c < clusters.size(); c++) {
+		size_t begin = clusters[c];
+		size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+		glm::vec3 centroid(0), normal(0);
+		float area = 0;
+		for (size_t t = begin; t < end; t++) {
+			const glm::vec3& p0 = vertices[indices[t * 3 + 0]].pos;
+			const glm::vec3& p1 = vertices[indices[t * 3 + 1]].pos;
+			const glm::vec3& p2 = vertices[indices[t * 3 + 2]].pos;
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float a = glm::length(n);
+			centroid += (p0 + p1 + p2) * (a / 3.f);
+			normal += n;
+			area += a;
+		}
+		centroid = area > 0 ? centroid / area : vertices[indices[begin * 3]].pos;
+		float normalLength = glm::length(normal);
+		normal = normalLength > 0 ? normal / normalLength : glm::vec3(0);
+		sortKey[c] = glm::dot(centroid - meshCentroid, normal);
+	}
+
+	std::vector<uint32_t> order(clusters.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&sortKey](uint32_t a, uint32_t b) { return sortKey[a] > sortKey[b]; });
+
+	std::vector<unsigned int> output;
+	output.reserve(indices.size());
+	for (uint32_t c : order) {
+		size_t begin = clusters[c];
+		size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+		output.insert(output.end(), indices.begin() + begin * 3, indices.begin() + end * 3);
+	}
+	indices = std::move(output);
+}
+
+void MeshOptimizer::optimizeVertexFetch(MeshData<Vertex3>& mesh) {
+	const unsigned int unused = std::numeric_limits<unsigned int>::max();
+	std::vector<unsigned int> remap(mesh.vertices.size(), unused);
+	std::vector<Vertex3> vertices;
+	vertices.reserve(mesh.vertices.size());
+	const bool skinned = !mesh.skinVertices.empty();
+	std::vector<SkinVertex> skinVertices;
+	skinVertices.reserve(skinned ? mesh.vertices.size() : 0);
+
+	for (unsigned int& index : mesh.indices) {
+		if (remap[index] == unused) {
+			remap[index] = (unsigned int)vertices.size();
+			vertices.push_back(mesh.vertices[index]);
+			if (skinned)
+				skinVertices.push_back(mesh.skinVertices[index]);
+		}
+		index = remap[index];
+	}
+	mesh.vertices = std::move(vertices);
+	mesh.skinVertices = std::move(skinVertices);
+}
+
+std::pair<VertexCacheStats, VertexCacheStats> MeshOptimizer::optimize(MeshData<Vertex3>& mesh) {
+	VertexCacheStats before = analyzeVertexCache(mesh.indices, mesh.vertices.size());
+
+	auto hardBoundaries = optimizeVertexCache(mesh.indices, mesh.vertices.size());
+	optimizeOverdraw(mesh.indices, mesh.vertices, hardBoundaries);
+	optimizeVertexFetch(mesh);
+
+	VertexCacheStats after = analyzeVertexCache(mesh.indices, mesh.vertices.size());
+	return { before, after };
+}
+
+glm::vec4 MeshOptimizer::boundingSphere(const Vertex3* vertices, size_t vertexCount) {
+	if (vertexCount == 0)
+		return glm::vec4(0);
+
+	//start from the two points farthest apart along one of the axes
+	size_t minIndex[3] = { 0, 0, 0 }, maxIndex[3] = { 0, 0, 0 };
+	for (size_t i = 0; i < vertexCount; i++) {
+		for (int axis = 0; axis < 3; axis++) {
+			if (vertices[i].pos[axis] < vertices[minIndex[axis]].pos[axis]) minIndex[axis] = i;
+			if (vertices[i].pos[axis] > vertices[maxIndex[axis]].pos[axis]) maxIndex[axis] = i;
+		}
+	}
+	int widest = 0;
+	float widestDistance = -1;
+	for (int axis = 0; axis < 3; axis++) {
+		float distance = glm::distance(vertices[minIndex[axis]].pos, vertices[maxIndex[axis]].pos);
+		if (distance > widestDistance) {
+			widestDistance = distance;
+			widest = axis;
+		}
+	}
+
+	glm::vec3 center = (vertices[minIndex[widest]].pos + vertices[maxIndex[widest]].pos) * 0.5f;
+	float radius = widestDistance * 0.5f;
+
+	//grow to cover any point left outside
+	for (size_t i = 0; i < vertexCount; i++) {
+		float distance = glm::distance(vertices[i].pos, center);
+		if (distance > radius) {
+			float newRadius = (radius + distance) * 0.5f;
+			center += (vertices[i].pos - center) * ((newRadius - radius) / distance);
+			radius = newRadius;
+		}
+	}
+	return glm::vec4(center, radius);
+}
+
+namespace {
+	struct Quadric {
+		//symmetric 4x4 matrix of the plane equations, weighted by triangle area
+		double a2 = 0, ab = 0, ac = 0, ad = 0;
+		double b2 = 0, bc = 0, bd = 0;
+		double c2 = 0, cd = 0;
+		double d2 = 0;
+		double weight = 0;
+
+		static Quadric fromPlane(glm::dvec3 normal, double d, double weight) {
+			Quadric q;
+			q.a2 = normal.x * normal.x * weight; q.ab = normal.x * normal.y * weight; q.ac = normal.x * normal.z * weight; q.ad = normal.x * d * weight;
+			q.b2 = normal.y * normal.y * weight; q.bc = normal.y * normal.z * weight; q.bd = normal.y * d * weight;
+			q.c2 = normal.z * normal.z * weight; q.cd = normal.z * d * weight;
+			q.d2 = d * d * weight;
+			q.weight = weight;
+			return q;
+		}
+
+		Quadric& operator+=(const Quadric& other) {
+			a2 += other.a2; ab += other.ab; ac += other.ac; ad += other.ad;
+			b2 += other.b2; bc += other.bc; bd += other.bd;
+			c2 += other.c2; cd += other.cd;
+			d2 += other.d2;
+			weight += other.weight;
+			return *this;
+		}
+
+		//squared distance to the planes, averaged by weight
+		double error(glm::dvec3 p) const {
+			double e =
+				a2 * p.x * p.x + 2 * ab * p.x * p.y + 2 * ac * p.x * p.z + 2 * ad * p.x +
+				b2 * p.y * p.y + 2 * bc * p.y * p.z + 2 * bd * p.y +
+				c2 * p.z * p.z + 2 * cd * p.z +
+				d2;
+			return weight > 0 ? std::abs(e) / weight : 0;
+		}
+	};
+
+	struct Collapse {
+		unsigned int from;
+		unsigned int to;
+		double error;
+	};
+}
+
+std::vector<unsigned int> MeshOptimizer::simplify(const std::vector<unsigned int>& indices, const std::vector<Vertex3>& vertices, size_t targetIndexCount, float targetError, float* resultError) {
+	const size_t vertexCount = vertices.size();
+	std::vector<unsigned int> result = indices;
+	double maxError = 0;
+
+	//work in units of the bounding sphere radius so errors are relative
+	glm::vec4 sphere = boundingSphere(vertices.data(), vertexCount);
+	const double scale = sphere.w > 0 ? 1.0 / sphere.w : 1.0;
+	std::vector<glm::dvec3> positions(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+		positions[v] = (glm::dvec3(vertices[v].pos) - glm::dvec3(sphere)) * scale;
+
+	//vertices sharing a position with another vertex sit on an attribute seam
+	std::vector<bool> locked(vertexCount, false);
+	{
+		std::vector<unsigned int> byPosition(vertexCount);
+		std::iota(byPosition.begin(), byPosition.end(), 0);
+		auto less = [&vertices](unsigned int x, unsigned int y) {
+			const glm::vec3& p = vertices[x].pos;
+			const glm::vec3& q = vertices[y].pos;
+			return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z < q.z;
+		};
+		std::sort(byPosition.begin(), byPosition.end(), less);
+		for (size_t i = 1; i < vertexCount; i++) {
+			if (vertices[byPosition[i - 1]].pos == vertices[byPosition[i]].pos) {
+				locked[byPosition[i - 1]] = true;
+				locked[byPosition[i]] = true;
+			}
+		}
+	}
+	//vertices on an edge used by only one triangle are on a border
+	{
+		std::unordered_map<uint64_t, uint32_t> edgeUses;
+		edgeUses.reserve(result.size());
+		for (size_t i = 0; i < result.size(); i += 3) {
+			for (int k = 0; k < 3; k++) {
+				uint64_t a = result[i + k], b = result[i + (k + 1) % 3];
+				edgeUses[std::min(a, b) << 32 | std::max(a, b)]++;
+			}
+		}
+		for (auto& edge : edgeUses) {
+			if (edge.second == 1) {
+				locked[edge.first >> 32] = true;
+				locked[edge.first & 0xFFFFFFFFull] = true;
+			}
+		}
+	}
+
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t i = 0; i < result.size(); i += 3) {
+		const glm::dvec3& p0 = positions[result[i]];
+		const glm::dvec3& p1 = positions[result[i + 1]];
+		const glm::dvec3& p2 = positions[result[i + 2]];
+		glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+		double area = glm::length(normal);
+		if (area <= 0)
+			continue;
+		normal /= area;
+		Quadric q = Quadric::fromPlane(normal, -glm::dot(normal, p0), area);
+		for (int k = 0; k < 3; k++)
+			quadrics[result[i + k]] += q;
+	}
+
+	const double targetErrorSquared = (double)targetError * targetError;
+	std::vector<Collapse> collapses;
+	std::vector<unsigned int> remap(vertexCount);
+	std::vector<bool> touched(vertexCount);
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+	std::vector<uint32_t> adjacency;
+
+	while (result.size() > targetIndexCount) {
+		//vertex to triangle adjacency of the current result
+		std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+		for (unsigned int index : result)
+			adjacencyOffsets[index + 1]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+		adjacency.resize(result.size());
+		{
+			std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (size_t i = 0; i < result.size(); i++)
+				adjacency[fill[result[i]]++] = (uint32_t)(i / 3);
+		}
+
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i += 3) {
+			for (int k = 0; k < 3; k++) {
+				unsigned int a = result[i + k], b = result[i + (k + 1) % 3];
+				if (a > b)
+					continue;
+				Quadric q = quadrics[a];
+				q += quadrics[b];
+				double toB = locked[a] ? std::numeric_limits<double>::max() : q.error(positions[b]);
+				double toA = locked[b] ? std::numeric_limits<double>::max() : q.error(positions[a]);
+				if (toB == std::numeric_limits<double>::max() && toA == std::numeric_limits<double>::max())
+					continue;
+				if (toB <= toA)
+					collapses.push_back({ a, b, toB });
+				else
+					collapses.push_back({ b, a, toA });
+			}
+		}
+		if (collapses.empty())
+			break;
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.error < y.error; });
+
+		//every collapse removes about two triangles
+		size_t trianglesToRemove = (result.size() - targetIndexCount) / 3;
+		size_t collapseLimit = std::max<size_t>(trianglesToRemove / 2, 1);
+		size_t collapsed = 0;
+
+		for (size_t v = 0; v < vertexCount; v++)
+			remap[v] = (unsigned int)v;
+		std::fill(touched.begin(), touched.end(), false);
+
+		for (const Collapse& collapse : collapses) {
+			if (collapsed >= collapseLimit || collapse.error > targetErrorSquared)
+				break;
+			if (touched[collapse.from] || touched[collapse.to])
+				continue;
+
+			//reject collapses that flip a remaining triangle around the removed vertex
+			bool flips = false;
+			for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1] && !flips; a++) {
+				size_t t = adjacency[a] * 3;
+				glm::dvec3 before[3], after[3];
+				bool hasTo = false;
+				for (int k = 0; k < 3; k++) {
+					unsigned int v = result[t + k];
+					hasTo |= v == collapse.to;
+					before[k] = positions[v];
+					after[k] = v == collapse.from ? positions[collapse.to] : positions[v];
+				}
+				if (hasTo)
+					continue;
+				glm::dvec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+				glm::dvec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+				flips = glm::dot(normalBefore, normalAfter) <= 0;
+			}
+			if (flips)
+				continue;
+
+			//neighbours are touched too so the flip checks of this pass stay valid
+			for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1]; a++) {
+				size_t t = adjacency[a] * 3;
+				for (int k = 0; k < 3; k++)
+					touched[result[t + k]] = true;
+			}
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to] += quadrics[collapse.from];
+			maxError = std::max(maxError, collapse.error);
+			collapsed++;
+		}
+		if (collapsed == 0)
+			break;
+
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3) {
+			unsigned int a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+			if (a == b || b == c || c == a)
+				continue;
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+	}
+
+	if (resultError)
+		*resultError = (float)std::sqrt(maxError);
+	return result;
+}
+
+void MeshOptimizer::generateLods(MeshData<Vertex3>& mesh, uint32_t lodCount) {
+	mesh.lods.clear();
+	mesh.lods.push_back({ 0, (uint32_t)mesh.indices.size(), 0.f });
+
+	std::vector<unsigned int> current = mesh.indices;
+	float error = 0;
+	float budget = lodErrorBudget;
+	for (uint32_t lod = 1; lod < lodCount; lod++, budget *= 2) {
+		size_t target = (size_t)(current.size() / 3 * lodReduction) * 3;
+		float lodError = 0;
+		std::vector<unsigned int> next = simplify(current, mesh.vertices, target, budget, &lodError);
+		//stop once simplification stalls within the budget, everything cheap to collapse is gone or locked
+		if (next.empty() || next.size() > current.size() * 0.9f)
+			break;
+
+		optimizeVertexCache(next, mesh.vertices.size());
+		//errors of chained lods add up at most
+		error += lodError;
+		mesh.lods.push_back({ (uint32_t)mesh.indices.size(), (uint32_t)next.size(), error });
+		mesh.indices.insert(mesh.indices.end(), next.begin(), next.end());
+		current = std::move(next);
+	}
+
+	if (mesh.lods.size() == 1)
+		mesh.lods.clear();
+}
+
+namespace {
+	Meshlet finishMeshlet(const MeshData<Vertex3>& mesh, uint32_t firstIndex, uint32_t indexCount, std::vector<Vertex3>& scratch) {
+		Meshlet meshlet{};
+		meshlet.firstIndex = firstIndex;
+		meshlet.indexCount = indexCount;
+		meshlet.boundingSphere = MeshOptimizer::boundingSphere(scratch.data(), scratch.size());
+
+		//face normals are oriented by the vertex normals so the winding of the source does not matter
+		std::vector<glm::vec3> normals;
+		normals.reserve(indexCount / 3);
+		glm::vec3 axis(0);
+		for (uint32_t i = firstIndex; i < firstIndex + indexCount; i += 3) {
+			const Vertex3& a = mesh.vertices[mesh.indices[i + 0]];
+			const Vertex3& b = mesh.vertices[mesh.indices[i + 1]];
+			const Vertex3& c = mesh.vertices[mesh.indices[i + 2]];
+			glm::vec3 normal = glm::cross(b.pos - a.pos, c.pos - a.pos);
+			float length = glm::length(normal);
+			if (length == 0)
+				continue;
+			normal /= length;
+			if (glm::dot(normal, a.norm + b.norm + c.norm) < 0)
+				normal = -normal;
+			normals.push_back(normal);
+			axis += normal;
+		}
+
+		//a cutoff above 1 never passes the back facing test
+		meshlet.coneAxis_cutoff = glm::vec4(0, 0, 0, 2);
+		float axisLength = glm::length(axis);
+		if (normals.empty() || axisLength < 1e-6f)
+			return meshlet;
+		axis /= axisLength;
+
+		float minDot = 1;
+		for (const glm::vec3& normal : normals)
+			minDot = std::min(minDot, glm::dot(normal, axis));
+		if (minDot < MeshOptimizer::minMeshletConeDot)
+			return meshlet;
+
+		//sine of the half angle, the cone has to be entirely behind the view direction
+		meshlet.coneAxis_cutoff = glm::vec4(axis, std::sqrt(1 - minDot * minDot));
+		return meshlet;
+	}
+}
+
+void MeshOptimizer::buildMeshlets(MeshData<Vertex3>& mesh, uint32_t maxVertices, uint32_t maxTriangles) {
+	mesh.meshlets.clear();
+	const size_t indexCount = (mesh.lods.empty() ? mesh.indices.size() : mesh.lods[0].indexCount) / 3 * 3;
+
+	//index of the meshlet a vertex was last added to
+	std::vector<uint32_t> owner(mesh.vertices.size(), std::numeric_limits<uint32_t>::max());
+	std::vector<Vertex3> scratch;
+	scratch.reserve(maxVertices);
+	uint32_t firstIndex = 0;
+
+	for (uint32_t i = 0; i < indexCount; i += 3) {
+		const unsigned int* tri = &mesh.indices[i];
+		uint32_t current = (uint32_t)mesh.meshlets.size();
+		uint32_t newVertices = 0;
+		for (int k = 0; k < 3; k++) {
+			bool repeated = (k > 0 && tri[k] == tri[0]) || (k > 1 && tri[k] == tri[1]);
+			if (owner[tri[k]] != current && !repeated)
+				newVertices++;
+		}
+
+		uint32_t triangleCount = (i - firstIndex) / 3;
+		if (scratch.size() + newVertices > maxVertices || triangleCount + 1 > maxTriangles) {
+			mesh.meshlets.push_back(finishMeshlet(mesh, firstIndex, i - firstIndex, scratch));
+			scratch.clear();
+			firstIndex = i;
+			current++;
+		}
+
+		for (int k = 0; k < 3; k++) {
+			if (owner[tri[k]] != current) {
+				owner[tri[k]] = current;
+				scratch.push_back(mesh.vertices[tri[k]]);
+			}
+		}
+	}
+	if (firstIndex < indexCount)
+		mesh.meshlets.push_back(finishMeshlet(mesh, firstIndex, (uint32_t)indexCount - firstIndex, scratch));
+}
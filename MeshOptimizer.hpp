@@ -0,0 +1,90 @@
+#pragma once
+#include <vector>
+
+#include "MeshLoader.hpp"
+
+//post load optimization of triangle lists
+//welds duplicate vertices, reorders indices for the post transform vertex cache and for overdraw, then reorders vertices for fetch locality
+//also simplifies meshes into lod chains that share the vertex buffer
+
+struct VertexCacheStats {
+	//average cache miss ratio, transformed vertices per triangle, 0.5 is ideal, 3 is worst
+	float acmr = 0;
+	//average transformed to vertex ratio, 1 is ideal
+	float atvr = 0;
+	size_t misses = 0;
+	size_t triangles = 0;
+	size_t vertices = 0;
+
+	VertexCacheStats& operator+=(const VertexCacheStats& other) {
+		misses += other.misses;
+		triangles += other.triangles;
+		vertices += other.vertices;
+		acmr = triangles == 0 ? 0 : (float)misses / triangles;
+		atvr = vertices == 0 ? 0 : (float)misses / vertices;
+		return *this;
+	}
+};
+
+//largest difference per component of vertices that weld, 0 only welds bit identical values
+struct WeldTolerance {
+	float position = 0;
+	float normal = 0;
+	float uv = 0;
+};
+
+class MeshOptimizer {
+public:
+	//fifo cache size used for tipsify and the stats, close to what most gpus behave like
+	inline static const uint32_t cacheSize = 16;
+	//clusters are only split for overdraw where the acmr stays within this factor of the cache optimized acmr
+	inline static const float overdrawThreshold = 1.05f;
+	//positions in model units, normals are unit length, uvs a fraction of the texture
+	inline static const WeldTolerance weldTolerance = { 1e-5f, 1e-3f, 1e-5f };
+
+	//merges each vertex into an earlier kept one whose attributes are all within the tolerance, bit identical vertices by default
+	//generates indices if the mesh has none, returns the number of vertices removed
+	static size_t weldVertices(MeshData<Vertex3>& mesh, const WeldTolerance& tolerance = {});
+
+	static VertexCacheStats analyzeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount, uint32_t cacheSize = MeshOptimizer::cacheSize);
+
+	//tipsify, returns the first triangle of each cluster it could not continue from the cache
+	static std::vector<uint32_t> optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount, uint32_t cacheSize = MeshOptimizer::cacheSize);
+
+	//reorders clusters so ones likely to occlude others are drawn first
+	static void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex3>& vertices, const std::vector<uint32_t>& hardBoundaries, float threshold = MeshOptimizer::overdrawThreshold, uint32_t cacheSize = MeshOptimizer::cacheSize);
+
+	//reorders vertices by first use and remaps indices, unused vertices are dropped
+	static void optimizeVertexFetch(MeshData<Vertex3>& mesh);
+
+	//runs all passes, returns stats before and after
+	static std::pair<VertexCacheStats, VertexCacheStats> optimize(MeshData<Vertex3>& mesh);
+
+	//lod 0 plus up to this many - 1 simplified lods
+	inline static const uint32_t maxLodCount = 4;
+	//each lod aims for this fraction of the triangles of the previous one
+	inline static const float lodReduction = 0.5f;
+	//error the first lod may add relative to the bounding sphere radius, so it scales with the mesh extent
+	//every further lod may add twice as much as the one before
+	inline static const float lodErrorBudget = 0.01f;
+
+	//ritter bounding sphere, xyz center and w radius
+	static glm::vec4 boundingSphere(const Vertex3* vertices, size_t vertexCount);
+
+	//quadric error edge collapse onto existing vertices, so the result indexes the same vertex buffer
+	//borders and attribute seams are locked, error is relative to the bounding sphere radius
+	static std::vector<unsigned int> simplify(const std::vector<unsigned int>& indices, const std::vector<Vertex3>& vertices, size_t targetIndexCount, float targetError, float* resultError = nullptr);
+
+	//appends simplified lods to mesh.indices and fills mesh.lods, run after optimize since vertices are not reordered
+	static void generateLods(MeshData<Vertex3>& mesh, uint32_t lodCount = MeshOptimizer::maxLodCount);
+
+	//meshlet limits, the same ones mesh shading hardware prefers so meshlets can later be fed to it as is
+	inline static const uint32_t maxMeshletVertices = 64;
+	inline static const uint32_t maxMeshletTriangles = 124;
+	//normal cones wider than this are not worth testing, acos(0.1) is about 84 degrees
+	inline static const float minMeshletConeDot = 0.1f;
+
+	//splits the lod 0 indices into consecutive runs that stay within the meshlet limits and fills mesh.meshlets
+	//indices are not reordered, so run after optimize to get spatially coherent meshlets
+	static void buildMeshlets(MeshData<Vertex3>& mesh, uint32_t maxVertices = MeshOptimizer::maxMeshletVertices, uint32_t maxTriangles = MeshOptimizer::maxMeshletTriangles);
+};
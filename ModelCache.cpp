@@ -0,0 +1,559 @@
+#include "ModelCache.hpp"
+#include "CookedFile.hpp"
+#include "MeshOptimizer.hpp"
+#include "parallel_helper.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+#include <numeric>
+
+namespace {
+	constexpr uint32_t cookedMagic = 0x444D4346; //"FCMD"
+
+	struct CookedString {
+		//offset is relative to the start of the string table
+		uint32_t offset;
+		uint32_t length;
+	};
+
+	struct CookedHeader {
+		CookedFileHeader file;
+
+		uint32_t meshCount;
+		uint32_t instanceCount;
+		uint32_t materialCount;
+		uint32_t pointLightCount;
+		//ModelCache flags the model was cooked with
+		uint32_t flags;
+		uint32_t lodCount;
+		uint32_t meshletCount;
+		uint32_t nodeCount;
+		uint32_t clipCount;
+		uint32_t channelCount;
+		uint32_t keyTimeCount;
+		uint32_t keyValueCount;
+		uint32_t skinCount;
+		uint32_t jointCount;
+
+		uint64_t meshTableOffset;
+		uint64_t instanceTableOffset;
+		uint64_t materialTableOffset;
+		uint64_t pointLightOffset;
+		uint64_t stringTableOffset;
+		uint64_t stringTableSize;
+		uint64_t lodTableOffset;
+		uint64_t meshletTableOffset;
+		uint64_t nodeTableOffset;
+		uint64_t clipTableOffset;
+		uint64_t channelTableOffset;
+		uint64_t keyTimeOffset;
+		uint64_t keyValueOffset;
+		uint64_t skinTableOffset;
+		//joint nodes, then inverse bind matrices at jointMatrixOffset
+		uint64_t jointNodeOffset;
+		uint64_t jointMatrixOffset;
+
+		DirectionalLightInfo directionalLight;
+	};
+
+	struct CookedMesh {
+		//offsets are from the start of the file
+		uint64_t vertexOffset;
+		uint64_t indexOffset;
+		//one SkinVertex per vertex, 0 if the mesh is not skinned
+		uint64_t skinOffset;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		//range of the lod table, every mesh has at least one lod
+		uint32_t firstLod;
+		uint32_t lodCount;
+		//range of the meshlet table, empty if the mesh was not split
+		uint32_t firstMeshlet;
+		uint32_t meshletCount;
+		//mesh space
+		Bounds bounds;
+	};
+
+	struct CookedInstance {
+		glm::mat4 transform;
+		int32_t matIndex;
+		uint32_t meshIndex;
+		uint32_t nodeIndex;
+		//-1 if not skinned
+		int32_t skinIndex;
+		//world space
+		Bounds bounds;
+	};
+
+	struct CookedNode {
+		//used instead of trs when hasMatrix is set
+		glm::mat4 localMatrix;
+		glm::quat rotation;
+		glm::vec3 translation;
+		//SceneHierarchy::noParent for roots
+		int32_t parent;
+		glm::vec3 scale;
+		uint32_t hasMatrix;
+	};
+
+	struct CookedClip {
+		CookedString name;
+		uint32_t firstChannel;
+		uint32_t channelCount;
+		float duration;
+	};
+
+	struct CookedMaterial {
+		uint32_t isMetallicRoughness;
+		uint32_t doubleSided;
+		float metallicFactor;
+		float roughnessFactor;
+		float normalScale;
+		glm::vec4 baseColorFactor;
+		glm::vec4 diffuseFactor;
+		glm::vec3 specularFactor;
+		float glossinessFactor;
+
+		CookedString metallicRoughnessTex;
+		CookedString baseColorTex;
+		CookedString diffuseTex;
+		CookedString specularGlossTex;
+		CookedString normalMap;
+	};
+
+	static_assert(std::is_trivially_copyable<CookedNode>::value, "cooked structs are written as raw bytes");
+	static_assert(std::is_trivially_copyable<CookedMaterial>::value, "cooked structs are written as raw bytes");
+	static_assert(std::is_trivially_copyable<PointLightInfo>::value, "cooked structs are written as raw bytes");
+	static_assert(std::is_trivially_copyable<AnimationChannel>::value, "cooked structs are written as raw bytes");
+	static_assert(std::is_trivially_copyable<Skin>::value, "cooked structs are written as raw bytes");
+	static_assert(sizeof(SkinVertex) % 16 == 0, "skin vertices are uploaded straight from the cooked file");
+	static_assert(sizeof(Meshlet) % 16 == 0, "meshlets are uploaded straight from the cooked file");
+
+	class StringTableBuilder {
+	public:
+		std::string bytes;
+		CookedString add(const std::string& str) {
+			CookedString cooked{ (uint32_t)bytes.size(), (uint32_t)str.size() };
+			bytes += str;
+			return cooked;
+		}
+	};
+
+	inline std::string readString(const unsigned char* stringTable, CookedString str) {
+		return std::string(reinterpret_cast<const char*>(stringTable) + str.offset, str.length);
+	}
+}
+
+uint64_t ModelCache::sourceHash(const char* filepath) {
+	return sourceFileHash(filepath);
+}
+
+std::string ModelCache::storeName(const char* filepath) {
+	return cookedStoreName("model", filepath);
+}
+
+namespace {
+	inline MeshDataView meshSource(const MeshData<Vertex3>& mesh) {
+		return MeshDataView(mesh);
+	}
+	inline const GltfPrimitiveView& meshSource(const GltfPrimitiveView& mesh) {
+		return mesh;
+	}
+
+	template<typename Model>
+	void cookModel(const char* filepath, const Model& model, uint32_t flags) {
+		//Model is ModelData or MappedModelData, both have the same layout
+		const auto& meshData = model.meshData;
+		assert(meshData.transforms.size() == meshData.matIndex.size() && meshData.transforms.size() == meshData.meshIndex.size() && meshData.transforms.size() == meshData.bounds.size());
+		assert(meshData.transforms.size() == meshData.nodeIndex.size() && meshData.transforms.size() == meshData.skinIndex.size());
+		const AnimationSet& animations = model.animations;
+
+		CookedHeader header{};
+		header.file = makeCookedFileHeader(cookedMagic, ModelCache::version, filepath);
+		header.flags = flags;
+		header.meshCount = (uint32_t)meshData.meshes.size();
+		header.instanceCount = (uint32_t)meshData.transforms.size();
+		header.materialCount = (uint32_t)model.materials.size();
+		header.pointLightCount = (uint32_t)model.pointLights.size();
+		header.nodeCount = (uint32_t)model.hierarchy.nodeCount();
+		header.clipCount = (uint32_t)animations.clips.size();
+		header.channelCount = (uint32_t)animations.channels.size();
+		header.keyTimeCount = (uint32_t)animations.keyTimes.size();
+		header.keyValueCount = (uint32_t)animations.keyValues.size();
+		header.skinCount = (uint32_t)animations.skins.size();
+		header.jointCount = (uint32_t)animations.jointNodes.size();
+		header.directionalLight = model.directionalLight;
+
+		StringTableBuilder strings;
+		std::vector<CookedMaterial> materials;
+		materials.reserve(model.materials.size());
+		for (const MaterialPBR& mat : model.materials) {
+			CookedMaterial cooked{};
+			cooked.isMetallicRoughness = mat.isMetallicRoughness;
+			cooked.doubleSided = mat.doubleSided;
+			cooked.metallicFactor = mat.metallicRoughness.metallic_factor;
+			cooked.roughnessFactor = mat.metallicRoughness.roughness_factor;
+			cooked.normalScale = mat.normalScale;
+			cooked.baseColorFactor = mat.metallicRoughness.baseColorFactor;
+			cooked.diffuseFactor = mat.diffuseSpecular.diffuseFactor;
+			cooked.specularFactor = mat.diffuseSpecular.specularFactor;
+			cooked.glossinessFactor = mat.diffuseSpecular.glossinessFactor;
+			cooked.metallicRoughnessTex = strings.add(mat.metallicRoughness.metallicRoughnessTex);
+			cooked.baseColorTex = strings.add(mat.metallicRoughness.baseColorTex);
+			cooked.diffuseTex = strings.add(mat.diffuseSpecular.diffuseTex);
+			cooked.specularGlossTex = strings.add(mat.diffuseSpecular.specularGlossTex);
+			cooked.normalMap = strings.add(mat.normalMap);
+			materials.push_back(cooked);
+		}
+		std::vector<CookedClip> clips;
+		clips.reserve(animations.clips.size());
+		for (const AnimationClip& clip : animations.clips)
+			clips.push_back({ strings.add(clip.name), clip.firstChannel, clip.channelCount, clip.duration });
+
+		std::vector<CookedInstance> instances(header.instanceCount);
+		for (uint32_t i = 0; i < header.instanceCount; i++) {
+			instances[i].transform = meshData.transforms[i];
+			instances[i].matIndex = meshData.matIndex[i];
+			instances[i].meshIndex = meshData.meshIndex[i];
+			instances[i].nodeIndex = meshData.nodeIndex[i];
+			instances[i].skinIndex = meshData.skinIndex[i];
+			instances[i].bounds = meshData.bounds[i];
+		}
+
+		std::vector<CookedNode> nodes(header.nodeCount);
+		for (uint32_t i = 0; i < header.nodeCount; i++) {
+			const SceneHierarchy& hierarchy = model.hierarchy;
+			nodes[i].parent = hierarchy.getParent(i);
+			nodes[i].hasMatrix = hierarchy.hasLocalMatrix(i);
+			nodes[i].localMatrix = hierarchy.hasLocalMatrix(i) ? hierarchy.getLocalMatrix(i) : glm::mat4(1.f);
+			nodes[i].translation = hierarchy.getTranslation(i);
+			nodes[i].rotation = hierarchy.getRotation(i);
+			nodes[i].scale = hierarchy.getScale(i);
+		}
+
+		//lay out the whole file first so the header can be written up front
+		uint64_t offset = sizeof(CookedHeader);
+		header.meshTableOffset = offset = alignUp(offset);
+		offset += sizeof(CookedMesh) * header.meshCount;
+		header.instanceTableOffset = offset = alignUp(offset);
+		offset += sizeof(CookedInstance) * header.instanceCount;
+		header.materialTableOffset = offset = alignUp(offset);
+		offset += sizeof(CookedMaterial) * header.materialCount;
+		header.pointLightOffset = offset = alignUp(offset);
+		offset += sizeof(PointLightInfo) * header.pointLightCount;
+		header.nodeTableOffset = offset = alignUp(offset);
+		offset += sizeof(CookedNode) * header.nodeCount;
+		header.clipTableOffset = offset = alignUp(offset);
+		offset += sizeof(CookedClip) * header.clipCount;
+		header.channelTableOffset = offset = alignUp(offset);
+		offset += sizeof(AnimationChannel) * header.channelCount;
+		header.keyTimeOffset = offset = alignUp(offset);
+		offset += sizeof(float) * header.keyTimeCount;
+		header.keyValueOffset = offset = alignUp(offset);
+		offset += sizeof(glm::vec4) * header.keyValueCount;
+		header.skinTableOffset = offset = alignUp(offset);
+		offset += sizeof(Skin) * header.skinCount;
+		header.jointNodeOffset = offset = alignUp(offset);
+		offset += sizeof(uint32_t) * header.jointCount;
+		header.jointMatrixOffset = offset = alignUp(offset);
+		offset += sizeof(glm::mat4) * header.jointCount;
+		header.stringTableOffset = offset = alignUp(offset);
+		header.stringTableSize = strings.bytes.size();
+		offset += header.stringTableSize;
+
+		std::vector<CookedMesh> meshes(header.meshCount);
+		std::vector<MeshLod> lods;
+		std::vector<Meshlet> meshlets;
+		for (uint32_t i = 0; i < header.meshCount; i++) {
+			const auto& mesh = meshSource(meshData.meshes[i]);
+			meshes[i].vertexCount = (uint32_t)mesh.vertexCount;
+			meshes[i].indexCount = (uint32_t)mesh.indexCount;
+			meshes[i].bounds = mesh.bounds;
+			meshes[i].firstLod = (uint32_t)lods.size();
+			if (mesh.lodCount == 0)
+				lods.push_back({ 0, (uint32_t)mesh.indexCount, 0.f });
+			else
+				lods.insert(lods.end(), mesh.lods, mesh.lods + mesh.lodCount);
+			meshes[i].lodCount = (uint32_t)lods.size() - meshes[i].firstLod;
+			meshes[i].firstMeshlet = (uint32_t)meshlets.size();
+			meshes[i].meshletCount = (uint32_t)mesh.meshletCount;
+			meshlets.insert(meshlets.end(), mesh.meshlets, mesh.meshlets + mesh.meshletCount);
+		}
+		header.lodCount = (uint32_t)lods.size();
+		header.lodTableOffset = offset = alignUp(offset);
+		offset += sizeof(MeshLod) * lods.size();
+		header.meshletCount = (uint32_t)meshlets.size();
+		header.meshletTableOffset = offset = alignUp(offset);
+		offset += sizeof(Meshlet) * meshlets.size();
+
+		for (uint32_t i = 0; i < header.meshCount; i++) {
+			const auto& mesh = meshSource(meshData.meshes[i]);
+			meshes[i].vertexOffset = offset = alignUp(offset);
+			offset += sizeof(Vertex3) * mesh.vertexCount;
+			meshes[i].indexOffset = offset = alignUp(offset);
+			offset += sizeof(uint32_t) * mesh.indexCount;
+			meshes[i].skinOffset = 0;
+			if (mesh.isSkinned()) {
+				meshes[i].skinOffset = offset = alignUp(offset);
+				offset += sizeof(SkinVertex) * mesh.vertexCount;
+			}
+		}
+		header.file.fileSize = offset;
+
+		std::string name = ModelCache::storeName(filepath);
+		std::ofstream file = Store::openForWriting(name.c_str());
+		CookedWriter writer(file);
+
+		writer.write(&header, sizeof(header));
+		writer.padTo(header.meshTableOffset);
+		writer.write(meshes.data(), sizeof(CookedMesh) * meshes.size());
+		writer.padTo(header.instanceTableOffset);
+		writer.write(instances.data(), sizeof(CookedInstance) * instances.size());
+		writer.padTo(header.materialTableOffset);
+		writer.write(materials.data(), sizeof(CookedMaterial) * materials.size());
+		writer.padTo(header.pointLightOffset);
+		writer.write(model.pointLights.data(), sizeof(PointLightInfo) * model.pointLights.size());
+		writer.padTo(header.nodeTableOffset);
+		writer.write(nodes.data(), sizeof(CookedNode) * nodes.size());
+		writer.padTo(header.clipTableOffset);
+		writer.write(clips.data(), sizeof(CookedClip) * clips.size());
+		writer.padTo(header.channelTableOffset);
+		writer.write(animations.channels.data(), sizeof(AnimationChannel) * animations.channels.size());
+		writer.padTo(header.keyTimeOffset);
+		writer.write(animations.keyTimes.data(), sizeof(float) * animations.keyTimes.size());
+		writer.padTo(header.keyValueOffset);
+		writer.write(animations.keyValues.data(), sizeof(glm::vec4) * animations.keyValues.size());
+		writer.padTo(header.skinTableOffset);
+		writer.write(animations.skins.data(), sizeof(Skin) * animations.skins.size());
+		writer.padTo(header.jointNodeOffset);
+		writer.write(animations.jointNodes.data(), sizeof(uint32_t) * animations.jointNodes.size());
+		writer.padTo(header.jointMatrixOffset);
+		writer.write(animations.inverseBindMatrices.data(), sizeof(glm::mat4) * animations.inverseBindMatrices.size());
+		writer.padTo(header.stringTableOffset);
+		writer.write(strings.bytes.data(), strings.bytes.size());
+		writer.padTo(header.lodTableOffset);
+		writer.write(lods.data(), sizeof(MeshLod) * lods.size());
+		writer.padTo(header.meshletTableOffset);
+		writer.write(meshlets.data(), sizeof(Meshlet) * meshlets.size());
+		//scratch only ever holds one primitive, never the whole model
+		std::vector<Vertex3> vertexScratch;
+		std::vector<uint32_t> indexScratch;
+		std::vector<SkinVertex> skinScratch;
+		for (uint32_t i = 0; i < header.meshCount; i++) {
+			const auto& mesh = meshSource(meshData.meshes[i]);
+			vertexScratch.resize(mesh.vertexCount);
+			mesh.writeVertices(vertexScratch.data());
+			writer.padTo(meshes[i].vertexOffset);
+			writer.write(vertexScratch.data(), sizeof(Vertex3) * mesh.vertexCount);
+			indexScratch.resize(mesh.indexCount);
+			mesh.writeIndices(indexScratch.data());
+			writer.padTo(meshes[i].indexOffset);
+			writer.write(indexScratch.data(), sizeof(uint32_t) * mesh.indexCount);
+			if (mesh.isSkinned()) {
+				skinScratch.resize(mesh.vertexCount);
+				mesh.writeSkinVertices(skinScratch.data());
+				writer.padTo(meshes[i].skinOffset);
+				writer.write(skinScratch.data(), sizeof(SkinVertex) * mesh.vertexCount);
+			}
+		}
+		assert(writer.position == header.file.fileSize);
+
+		if (!file)
+			throw std::runtime_error("Failed to write cooked model for " + std::string(filepath));
+	}
+}
+
+void ModelCache::cook(const char* filepath, const ModelData& model, uint32_t flags) {
+	cookModel(filepath, model, flags);
+}
+
+void ModelCache::cook(const char* filepath, const MappedModelData& model, uint32_t flags) {
+	cookModel(filepath, model, flags);
+}
+
+std::optional<CookedModel> ModelCache::loadCooked(const char* filepath, uint32_t flags) {
+	std::string name = storeName(filepath);
+	if (!Store::itemInStore(name.c_str()))
+		return std::nullopt;
+
+	CookedModel cooked;
+	cooked.file = Store::mapBytes(name.c_str());
+	const unsigned char* base = cooked.file->data();
+	const size_t size = cooked.file->size();
+
+	CookedHeader header;
+	if (!readCookedHeader(base, size, cookedMagic, ModelCache::version, sourceHash(filepath), header) || header.flags != flags) {
+		std::cout << "Cooked model for " << filepath << " is stale" << std::endl;
+		return std::nullopt;
+	}
+
+	//header values are trusted from here on, fileSize matching guards against truncation
+	const CookedMesh* meshes = reinterpret_cast<const CookedMesh*>(base + header.meshTableOffset);
+	const MeshLod* lods = reinterpret_cast<const MeshLod*>(base + header.lodTableOffset);
+	const Meshlet* meshlets = reinterpret_cast<const Meshlet*>(base + header.meshletTableOffset);
+	cooked.meshes.reserve(header.meshCount);
+	for (uint32_t i = 0; i < header.meshCount; i++) {
+		cooked.meshes.push_back(MeshDataView(
+			reinterpret_cast<const Vertex3*>(base + meshes[i].vertexOffset),
+			meshes[i].vertexCount,
+			reinterpret_cast<const unsigned int*>(base + meshes[i].indexOffset),
+			meshes[i].indexCount,
+			lods + meshes[i].firstLod,
+			meshes[i].lodCount,
+			meshlets + meshes[i].firstMeshlet,
+			meshes[i].meshletCount
+		));
+		cooked.meshes.back().bounds = meshes[i].bounds;
+		if (meshes[i].skinOffset != 0)
+			cooked.meshes.back().skinVertices = reinterpret_cast<const SkinVertex*>(base + meshes[i].skinOffset);
+	}
+
+	const CookedInstance* instances = reinterpret_cast<const CookedInstance*>(base + header.instanceTableOffset);
+	cooked.transforms.reserve(header.instanceCount);
+	cooked.matIndex.reserve(header.instanceCount);
+	cooked.meshIndex.reserve(header.instanceCount);
+	cooked.nodeIndex.reserve(header.instanceCount);
+	cooked.skinIndex.reserve(header.instanceCount);
+	cooked.bounds.reserve(header.instanceCount);
+	for (uint32_t i = 0; i < header.instanceCount; i++) {
+		cooked.transforms.push_back(instances[i].transform);
+		cooked.matIndex.push_back(instances[i].matIndex);
+		cooked.meshIndex.push_back(instances[i].meshIndex);
+		cooked.nodeIndex.push_back(instances[i].nodeIndex);
+		cooked.skinIndex.push_back(instances[i].skinIndex);
+		cooked.bounds.push_back(instances[i].bounds);
+	}
+
+	const unsigned char* stringTable = base + header.stringTableOffset;
+	const CookedMaterial* materials = reinterpret_cast<const CookedMaterial*>(base + header.materialTableOffset);
+	cooked.materials.reserve(header.materialCount);
+	for (uint32_t i = 0; i < header.materialCount; i++) {
+		const CookedMaterial& mat = materials[i];
+		MaterialPBR pbr;
+		pbr.isMetallicRoughness = mat.isMetallicRoughness;
+		pbr.doubleSided = mat.doubleSided;
+		pbr.normalScale = mat.normalScale;
+		pbr.normalMap = readString(stringTable, mat.normalMap);
+		pbr.metallicRoughness.metallic_factor = mat.metallicFactor;
+		pbr.metallicRoughness.roughness_factor = mat.roughnessFactor;
+		pbr.metallicRoughness.baseColorFactor = mat.baseColorFactor;
+		pbr.metallicRoughness.metallicRoughnessTex = readString(stringTable, mat.metallicRoughnessTex);
+		pbr.metallicRoughness.baseColorTex = readString(stringTable, mat.baseColorTex);
+		pbr.diffuseSpecular.diffuseFactor = mat.diffuseFactor;
+		pbr.diffuseSpecular.specularFactor = mat.specularFactor;
+		pbr.diffuseSpecular.glossinessFactor = mat.glossinessFactor;
+		pbr.diffuseSpecular.diffuseTex = readString(stringTable, mat.diffuseTex);
+		pbr.diffuseSpecular.specularGlossTex = readString(stringTable, mat.specularGlossTex);
+		cooked.materials.push_back(pbr);
+	}
+
+	//nodes were cooked depth first, adding them in order keeps the subtrees intact
+	const CookedNode* nodes = reinterpret_cast<const CookedNode*>(base + header.nodeTableOffset);
+	for (uint32_t i = 0; i < header.nodeCount; i++) {
+		if (nodes[i].hasMatrix)
+			cooked.hierarchy.addNode(nodes[i].parent, nodes[i].localMatrix);
+		else
+			cooked.hierarchy.addNode(nodes[i].parent, nodes[i].translation, nodes[i].rotation, nodes[i].scale);
+	}
+	cooked.hierarchy.update();
+
+	//animation tables are small, they are copied so the player can own them
+	auto readTable = [base](auto& dst, uint64_t offset, uint32_t count) {
+		dst.resize(count);
+		memcpy(dst.data(), base + offset, sizeof(dst[0]) * count);
+	};
+	const CookedClip* clips = reinterpret_cast<const CookedClip*>(base + header.clipTableOffset);
+	cooked.animations.clips.reserve(header.clipCount);
+	for (uint32_t i = 0; i < header.clipCount; i++)
+		cooked.animations.clips.push_back({ readString(stringTable, clips[i].name), clips[i].firstChannel, clips[i].channelCount, clips[i].duration });
+	readTable(cooked.animations.channels, header.channelTableOffset, header.channelCount);
+	readTable(cooked.animations.keyTimes, header.keyTimeOffset, header.keyTimeCount);
+	readTable(cooked.animations.keyValues, header.keyValueOffset, header.keyValueCount);
+	readTable(cooked.animations.skins, header.skinTableOffset, header.skinCount);
+	readTable(cooked.animations.jointNodes, header.jointNodeOffset, header.jointCount);
+	readTable(cooked.animations.inverseBindMatrices, header.jointMatrixOffset, header.jointCount);
+
+	cooked.pointLights.resize(header.pointLightCount);
+	memcpy(cooked.pointLights.data(), base + header.pointLightOffset, sizeof(PointLightInfo) * header.pointLightCount);
+	cooked.directionalLight = header.directionalLight;
+
+	return cooked;
+}
+
+void ModelCache::processMeshes(ModelData& model, uint32_t flags) {
+	auto& meshes = model.meshData.meshes;
+	std::vector<std::pair<VertexCacheStats, VertexCacheStats>> stats(meshes.size());
+	std::vector<size_t> verticesBefore(meshes.size()), verticesAfter(meshes.size());
+	parallelFor(meshes.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			verticesBefore[i] = meshes[i].vertices.size();
+			if (flags & ModelCache::weldNearVerticesFlag)
+				MeshOptimizer::weldVertices(meshes[i], MeshOptimizer::weldTolerance);
+			else if (flags & ModelCache::weldVerticesFlag)
+				MeshOptimizer::weldVertices(meshes[i]);
+			if (flags & ModelCache::optimizeMeshesFlag)
+				stats[i] = MeshOptimizer::optimize(meshes[i]);
+			verticesAfter[i] = meshes[i].vertices.size();
+			//meshlets cover lod 0, which generateLods leaves at the front of the indices
+			if (flags & ModelCache::buildMeshletsFlag)
+				MeshOptimizer::buildMeshlets(meshes[i]);
+			if (flags & ModelCache::generateLodsFlag)
+				MeshOptimizer::generateLods(meshes[i]);
+		}
+		});
+
+	if (flags & (ModelCache::weldVerticesFlag | ModelCache::weldNearVerticesFlag)) {
+		size_t before = std::accumulate(verticesBefore.begin(), verticesBefore.end(), (size_t)0);
+		size_t after = std::accumulate(verticesAfter.begin(), verticesAfter.end(), (size_t)0);
+		std::cout << "Vertex welding: " << before << " -> " << after << " vertices" << std::endl;
+	}
+	if (flags & ModelCache::optimizeMeshesFlag) {
+		VertexCacheStats before, after;
+		for (auto& meshStats : stats) {
+			before += meshStats.first;
+			after += meshStats.second;
+		}
+		std::cout << "Mesh optimization: ACMR " << before.acmr << " -> " << after.acmr
+			<< ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+	}
+	if (flags & ModelCache::generateLodsFlag) {
+		size_t lodCount = 0;
+		for (auto& mesh : meshes)
+			lodCount += std::max<size_t>(mesh.lods.size(), 1);
+		std::cout << "Lod generation: " << lodCount << " lods for " << meshes.size() << " meshes" << std::endl;
+	}
+	if (flags & ModelCache::buildMeshletsFlag) {
+		size_t meshletCount = 0;
+		for (auto& mesh : meshes)
+			meshletCount += mesh.meshlets.size();
+		std::cout << "Meshlet building: " << meshletCount << " meshlets for " << meshes.size() << " meshes" << std::endl;
+	}
+}
+
+std::optional<CookedModel> ModelCache::load(const char* filepath, uint32_t flags) {
+	auto cooked = loadCooked(filepath, flags);
+	if (cooked.has_value())
+		return cooked;
+
+	if (flags & ModelCache::meshProcessingFlags) {
+		//welding and the optimizer rewrite meshes so they have to be loaded into memory
+		auto model = loadGLTF(filepath);
+		if (!model.has_value())
+			return std::nullopt;
+		processMeshes(model.value(), flags);
+		cook(filepath, model.value(), flags);
+		std::cout << "Cooked model: " << filepath << std::endl;
+	}
+	else {
+		//vertex data is gathered from the mapped gltf one primitive at a time
+		auto model = loadGLTFMapped(filepath);
+		if (!model.has_value())
+			return std::nullopt;
+		cook(filepath, model.value(), flags);
+		std::cout << "Cooked model: " << filepath << std::endl;
+	}
+
+	return loadCooked(filepath, flags);
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "MeshLoader.hpp"
+#include "MappedFile.hpp"
+
+//cooked models are flat binary snapshots of ModelData kept in the Store
+//the first load of a gltf parses it and writes the cooked file, later loads only map it
+//vertex and index blobs are used in place from the mapping and go straight to staging memory
+
+struct CookedModel {
+	//keeps the mesh views alive
+	std::shared_ptr<MappedFile> file;
+
+	//one per unique primitive, points into the mapped file, bounds are in mesh space
+	std::vector<MeshDataView> meshes;
+
+	//one per instance, all of same length
+	std::vector<glm::mat4> transforms;
+	std::vector<int> matIndex;
+	std::vector<uint32_t> meshIndex;
+	//hierarchy node the instance is attached to, nondecreasing
+	std::vector<uint32_t> nodeIndex;
+	//skin in animations.skins, -1 if not skinned
+	std::vector<int32_t> skinIndex;
+	//world space
+	std::vector<Bounds> bounds;
+
+	//world matrices are already updated, transforms hold the same matrices for the instance nodes
+	SceneHierarchy hierarchy;
+	AnimationSet animations;
+	std::vector<MaterialPBR> materials;
+	std::vector<PointLightInfo> pointLights;
+	DirectionalLightInfo directionalLight;
+};
+
+class ModelCache {
+public:
+	//bump whenever the layout of the cooked file changes
+	inline static const uint32_t version = 8;
+
+	//processing applied while cooking, a cooked file with different flags is stale
+	//runs MeshOptimizer on every mesh
+	inline static const uint32_t optimizeMeshesFlag = 1 << 0;
+	//welds bit identical vertices
+	inline static const uint32_t weldVerticesFlag = 1 << 1;
+	//welds vertices within MeshOptimizer::weldTolerance of each other, implies weldVerticesFlag
+	inline static const uint32_t weldNearVerticesFlag = 1 << 2;
+	//simplifies every mesh into a lod chain sharing its vertices
+	inline static const uint32_t generateLodsFlag = 1 << 3;
+	//splits lod 0 of every mesh into meshlets with bounds and normal cones for gpu culling
+	inline static const uint32_t buildMeshletsFlag = 1 << 4;
+	//flags that need the meshes in memory while cooking
+	inline static const uint32_t meshProcessingFlags = optimizeMeshesFlag | weldVerticesFlag | weldNearVerticesFlag | generateLodsFlag | buildMeshletsFlag;
+
+	//hash of the source path, its last write time and its size
+	static uint64_t sourceHash(const char* filepath);
+	//name of the cooked item in the Store, only depends on the path
+	static std::string storeName(const char* filepath);
+
+	static void cook(const char* filepath, const ModelData& model, uint32_t flags = 0);
+	static void cook(const char* filepath, const MappedModelData& model, uint32_t flags = 0);
+
+	//welds and optimizes all meshes in parallel as asked for by flags, reports the results
+	static void processMeshes(ModelData& model, uint32_t flags);
+
+	//nullopt if there is no cooked file or it is stale
+	static std::optional<CookedModel> loadCooked(const char* filepath, uint32_t flags = 0);
+
+	//cooks the gltf first if needed
+	static std::optional<CookedModel> load(const char* filepath, uint32_t flags = 0);
+};
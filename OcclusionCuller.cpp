@@ -0,0 +1,305 @@
+#include "OcclusionCuller.hpp"
+#include "parallel_helper.hpp"
+#include "simd_helper.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+	//vertices closer than this in clip w are treated as crossing the near plane
+	const float minClipW = 1e-4f;
+
+	glm::vec3 edgeFunction(glm::vec2 a, glm::vec2 b) {
+		//positive on the left of a to b with y down, zero on the edge
+		return glm::vec3(a.y - b.y, b.x - a.x, a.x * b.y - a.y * b.x);
+	}
+
+	float evaluate(const glm::vec3& plane, float x, float y) {
+		return plane.x * x + plane.y * y + plane.z;
+	}
+
+	glm::vec2 toScreen(glm::vec3 ndc) {
+		return glm::vec2(
+			(ndc.x * 0.5f + 0.5f) * OcclusionCuller::width,
+			(ndc.y * 0.5f + 0.5f) * OcclusionCuller::height
+		);
+	}
+
+#ifdef SIMD_HELPER_AVX2
+	AVX2_FUNCTION void rasterizeRowsAvx2(float* depth, const glm::vec3 edges[3], const glm::vec3& depthPlane, int minX, int maxX, int minY, int maxY) {
+		const __m256 laneX = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+		const __m256 zero = _mm256_setzero_ps();
+		__m256 edgeA[3];
+		for (int e = 0; e < 3; e++)
+			edgeA[e] = _mm256_set1_ps(edges[e].x);
+		__m256 depthA = _mm256_set1_ps(depthPlane.x);
+
+		for (int y = minY; y <= maxY; y++) {
+			float py = y + 0.5f;
+			__m256 edgeRow[3];
+			for (int e = 0; e < 3; e++)
+				edgeRow[e] = _mm256_set1_ps(edges[e].y * py + edges[e].z);
+			__m256 depthRow = _mm256_set1_ps(depthPlane.y * py + depthPlane.z);
+			float* row = depth + (size_t)y * OcclusionCuller::width;
+
+			//rows are a multiple of 8 wide, the edge functions reject the pixels outside the bounding box
+			for (int x = minX & ~7; x <= maxX; x += 8) {
+				__m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), laneX);
+				__m256 inside = _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(edgeA[0], px), edgeRow[0]), zero, _CMP_GE_OQ);
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(edgeA[1], px), edgeRow[1]), zero, _CMP_GE_OQ));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(edgeA[2], px), edgeRow[2]), zero, _CMP_GE_OQ));
+				if (_mm256_movemask_ps(inside) == 0)
+					continue;
+				__m256 z = _mm256_add_ps(_mm256_mul_ps(depthA, px), depthRow);
+				__m256 stored = _mm256_loadu_ps(row + x);
+				_mm256_storeu_ps(row + x, _mm256_blendv_ps(stored, _mm256_min_ps(stored, z), inside));
+			}
+		}
+	}
+
+	//true if any pixel of the tile row between the lanes is at or behind depth
+	AVX2_FUNCTION bool anyFartherAvx2(const float* depth, int minX, int maxX, int minY, int maxY, float boxDepth) {
+		int tileX = minX & ~7;
+		__m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		__m256i laneMask = _mm256_and_si256(
+			_mm256_cmpgt_epi32(lanes, _mm256_set1_epi32(minX - tileX - 1)),
+			_mm256_cmpgt_epi32(_mm256_set1_epi32(maxX - tileX + 1), lanes)
+		);
+		__m256 boxZ = _mm256_set1_ps(boxDepth);
+		for (int y = minY; y <= maxY; y++) {
+			__m256 stored = _mm256_loadu_ps(depth + (size_t)y * OcclusionCuller::width + tileX);
+			__m256 farther = _mm256_and_ps(_mm256_cmp_ps(stored, boxZ, _CMP_GE_OQ), _mm256_castsi256_ps(laneMask));
+			if (_mm256_movemask_ps(farther) != 0)
+				return true;
+		}
+		return false;
+	}
+#endif
+}
+
+OcclusionCuller::OcclusionCuller() {
+	depth.assign((size_t)width * height, 1.f);
+	tileMaxDepth.assign((size_t)tilesX * tilesY, 1.f);
+	bandTriangles.resize(height / bandHeight);
+}
+
+void OcclusionCuller::clearOccluders() {
+	occluderPositions.clear();
+	occluderIndices.clear();
+	meshPositions.clear();
+	occluderFirstVertex.clear();
+}
+
+uint32_t OcclusionCuller::addOccluder(const MeshDataView& mesh, const MeshLod& lod, const glm::mat4& transform) {
+	uint32_t baseVertex = (uint32_t)occluderPositions.size();
+	occluderFirstVertex.push_back(baseVertex);
+	for (size_t i = 0; i < mesh.vertexCount; i++) {
+		meshPositions.push_back(mesh.vertices[i].pos);
+		occluderPositions.push_back(glm::vec3(transform * glm::vec4(mesh.vertices[i].pos, 1.f)));
+	}
+	for (uint32_t i = lod.firstIndex; i < lod.firstIndex + lod.indexCount; i++)
+		occluderIndices.push_back(baseVertex + mesh.indices[i]);
+	return (uint32_t)occluderFirstVertex.size() - 1;
+}
+
+void OcclusionCuller::setOccluderTransform(uint32_t occluder, const glm::mat4& transform) {
+	uint32_t begin = occluderFirstVertex[occluder];
+	uint32_t end = occluder + 1 < occluderFirstVertex.size() ? occluderFirstVertex[occluder + 1] : (uint32_t)occluderPositions.size();
+	for (uint32_t v = begin; v < end; v++)
+		occluderPositions[v] = glm::vec3(transform * glm::vec4(meshPositions[v], 1.f));
+}
+
+void OcclusionCuller::render(const glm::mat4& projView) {
+	this->projView = projView;
+	std::fill(depth.begin(), depth.end(), 1.f);
+	std::fill(tileMaxDepth.begin(), tileMaxDepth.end(), 1.f);
+
+	clipPositions.resize(occluderPositions.size());
+	parallelFor(occluderPositions.size(), 8192, [&](size_t begin, size_t end) {
+		for (size_t v = begin; v < end; v++)
+			clipPositions[v] = projView * glm::vec4(occluderPositions[v], 1.f);
+		});
+
+	//triangle setup, both windings are drawn since any surface hides what is behind it
+	const size_t triangleCount = occluderTriangleCount();
+	triangles.resize(triangleCount);
+	parallelFor(triangleCount, 4096, [&](size_t begin, size_t end) {
+		for (size_t t = begin; t < end; t++) {
+			RasterTriangle& triangle = triangles[t];
+			triangle.valid = false;
+
+			glm::vec2 screen[3];
+			float z[3];
+			bool crossesNear = false;
+			for (int v = 0; v < 3; v++) {
+				const glm::vec4& clip = clipPositions[occluderIndices[t * 3 + v]];
+				crossesNear |= clip.w < minClipW || clip.z < 0;
+				glm::vec3 ndc = glm::vec3(clip) / clip.w;
+				screen[v] = toScreen(ndc);
+				z[v] = ndc.z;
+			}
+			if (crossesNear)
+				continue;
+
+			glm::vec2 screenMin = glm::min(glm::min(screen[0], screen[1]), screen[2]);
+			glm::vec2 screenMax = glm::max(glm::max(screen[0], screen[1]), screen[2]);
+			triangle.minX = std::max(0, (int)std::floor(screenMin.x));
+			triangle.minY = std::max(0, (int)std::floor(screenMin.y));
+			triangle.maxX = std::min((int)width - 1, (int)std::ceil(screenMax.x));
+			triangle.maxY = std::min((int)height - 1, (int)std::ceil(screenMax.y));
+			if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+				continue;
+
+			float area = evaluate(edgeFunction(screen[0], screen[1]), screen[2].x, screen[2].y);
+			if (std::abs(area) < 1e-6f)
+				continue;
+			if (area < 0) {
+				std::swap(screen[1], screen[2]);
+				std::swap(z[1], z[2]);
+				area = -area;
+			}
+			triangle.edges[0] = edgeFunction(screen[1], screen[2]);
+			triangle.edges[1] = edgeFunction(screen[2], screen[0]);
+			triangle.edges[2] = edgeFunction(screen[0], screen[1]);
+			//ndc depth is affine in screen space, so it interpolates exactly with the barycentrics
+			triangle.depth = (triangle.edges[0] * z[0] + triangle.edges[1] * z[1] + triangle.edges[2] * z[2]) / area;
+			triangle.valid = true;
+		}
+		});
+
+	for (auto& band : bandTriangles)
+		band.clear();
+	for (uint32_t t = 0; t < triangleCount; t++) {
+		if (!triangles[t].valid)
+			continue;
+		for (int band = triangles[t].minY / bandHeight; band <= triangles[t].maxY / (int)bandHeight; band++)
+			bandTriangles[band].push_back(t);
+	}
+
+	parallelFor(bandTriangles.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t band = begin; band < end; band++)
+			rasterizeBand((uint32_t)band);
+		});
+}
+
+void OcclusionCuller::rasterizeBand(uint32_t band) {
+	const int bandMinY = (int)(band * bandHeight);
+	const int bandMaxY = bandMinY + (int)bandHeight - 1;
+	for (uint32_t t : bandTriangles[band]) {
+		const RasterTriangle& triangle = triangles[t];
+		int minY = std::max(triangle.minY, bandMinY);
+		int maxY = std::min(triangle.maxY, bandMaxY);
+#ifdef SIMD_HELPER_AVX2
+		if (hasAvx2()) {
+			rasterizeRowsAvx2(depth.data(), triangle.edges, triangle.depth, triangle.minX, triangle.maxX, minY, maxY);
+			continue;
+		}
+#endif
+		for (int y = minY; y <= maxY; y++) {
+			float py = y + 0.5f;
+			float* row = depth.data() + (size_t)y * width;
+			for (int x = triangle.minX; x <= triangle.maxX; x++) {
+				float px = x + 0.5f;
+				if (evaluate(triangle.edges[0], px, py) < 0 || evaluate(triangle.edges[1], px, py) < 0 || evaluate(triangle.edges[2], px, py) < 0)
+					continue;
+				row[x] = std::min(row[x], evaluate(triangle.depth, px, py));
+			}
+		}
+	}
+
+	for (int tileY = bandMinY / (int)tileSize; tileY <= bandMaxY / (int)tileSize; tileY++) {
+		for (uint32_t tileX = 0; tileX < tilesX; tileX++) {
+			float farthest = 0.f;
+			for (uint32_t y = tileY * tileSize; y < (tileY + 1) * tileSize; y++) {
+				const float* row = depth.data() + (size_t)y * width + tileX * tileSize;
+				for (uint32_t x = 0; x < tileSize; x++)
+					farthest = std::max(farthest, row[x]);
+			}
+			tileMaxDepth[tileY * tilesX + tileX] = farthest;
+		}
+	}
+}
+
+bool OcclusionCuller::isBoxVisible(glm::vec3 aabbMin, glm::vec3 aabbMax) const {
+	glm::vec2 screenMin(std::numeric_limits<float>::max());
+	glm::vec2 screenMax(-std::numeric_limits<float>::max());
+	float nearestDepth = 1.f;
+	//corners are the min corner plus the box edges, each transformed once
+	glm::vec3 size = aabbMax - aabbMin;
+	glm::vec4 clipMin = projView * glm::vec4(aabbMin, 1.f);
+	glm::vec4 clipEdges[3] = { projView[0] * size.x, projView[1] * size.y, projView[2] * size.z };
+	for (int corner = 0; corner < 8; corner++) {
+		glm::vec4 clip = clipMin;
+		for (int axis = 0; axis < 3; axis++) {
+			if (corner & (1 << axis))
+				clip += clipEdges[axis];
+		}
+		//the box reaches behind the camera, its projection is unbounded
+		if (clip.w < minClipW || clip.z < 0)
+			return true;
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		glm::vec2 screen = toScreen(ndc);
+		screenMin = glm::min(screenMin, screen);
+		screenMax = glm::max(screenMax, screen);
+		nearestDepth = std::min(nearestDepth, ndc.z);
+	}
+
+	int minX = std::max(0, (int)std::floor(screenMin.x));
+	int minY = std::max(0, (int)std::floor(screenMin.y));
+	int maxX = std::min((int)width - 1, (int)std::floor(screenMax.x));
+	int maxY = std::min((int)height - 1, (int)std::floor(screenMax.y));
+	//off screen boxes are left to frustum culling
+	if (minX > maxX || minY > maxY)
+		return true;
+
+	for (int tileY = minY / (int)tileSize; tileY <= maxY / (int)tileSize; tileY++) {
+		for (int tileX = minX / (int)tileSize; tileX <= maxX / (int)tileSize; tileX++) {
+			if (tileMaxDepth[tileY * tilesX + tileX] < nearestDepth)
+				continue;
+			//the tile has something farther than the box, look at the covered pixels
+			int pixelMinX = std::max(minX, tileX * (int)tileSize);
+			int pixelMaxX = std::min(maxX, (tileX + 1) * (int)tileSize - 1);
+			int pixelMinY = std::max(minY, tileY * (int)tileSize);
+			int pixelMaxY = std::min(maxY, (tileY + 1) * (int)tileSize - 1);
+#ifdef SIMD_HELPER_AVX2
+			if (hasAvx2()) {
+				if (anyFartherAvx2(depth.data(), pixelMinX, pixelMaxX, pixelMinY, pixelMaxY, nearestDepth))
+					return true;
+				continue;
+			}
+#endif
+			for (int y = pixelMinY; y <= pixelMaxY; y++) {
+				for (int x = pixelMinX; x <= pixelMaxX; x++) {
+					if (depth[(size_t)y * width + x] >= nearestDepth)
+						return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+void OcclusionCuller::cullRange(const std::vector<Bounds>& bounds, const uint32_t* begin, const uint32_t* end, std::vector<uint32_t>& visible) const {
+	for (const uint32_t* instance = begin; instance != end; instance++) {
+		if (isBoxVisible(glm::vec3(bounds[*instance].aabbMin), glm::vec3(bounds[*instance].aabbMax)))
+			visible.push_back(*instance);
+	}
+}
+
+void OcclusionCuller::cull(const std::vector<Bounds>& bounds, std::vector<uint32_t>& visible) {
+	if (occluderIndices.empty())
+		return;
+	const size_t count = visible.size();
+	const size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+	chunkVisible.resize(chunkCount);
+	parallelFor(chunkCount, 1, [&](size_t begin, size_t end) {
+		for (size_t chunk = begin; chunk < end; chunk++) {
+			chunkVisible[chunk].clear();
+			cullRange(bounds, visible.data() + chunk * chunkSize, visible.data() + std::min(count, (chunk + 1) * chunkSize), chunkVisible[chunk]);
+		}
+		});
+	visible.clear();
+	for (auto& chunk : chunkVisible)
+		visible.insert(visible.end(), chunk.begin(), chunk.end());
+}
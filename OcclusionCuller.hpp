@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "MeshLoader.hpp"
+
+//cpu occlusion culling against a low resolution depth buffer of a few large occluders
+//occluders are rasterized every frame in horizontal bands, one band per task
+//boxes are tested against the farthest depth of each 8x8 tile first and the pixels only where that fails
+//needs no gpu, the depth buffer uses the same 0 to 1 depth as the renderer
+
+class OcclusionCuller {
+	struct RasterTriangle {
+		//edge functions and depth as a*x + b*y + c in pixels
+		glm::vec3 edges[3];
+		glm::vec3 depth;
+		int minX, maxX, minY, maxY;
+		bool valid;
+	};
+
+	//world space, transformed when added and again when an occluder moves
+	std::vector<glm::vec3> occluderPositions;
+	std::vector<uint32_t> occluderIndices;
+	//mesh space copies and the first vertex of every occluder, for moving them
+	std::vector<glm::vec3> meshPositions;
+	std::vector<uint32_t> occluderFirstVertex;
+
+	//rebuilt every render
+	std::vector<glm::vec4> clipPositions;
+	std::vector<RasterTriangle> triangles;
+	std::vector<std::vector<uint32_t>> bandTriangles;
+	std::vector<float> depth;
+	std::vector<float> tileMaxDepth;
+	glm::mat4 projView = glm::mat4(1);
+
+	std::vector<std::vector<uint32_t>> chunkVisible;
+
+	void rasterizeBand(uint32_t band);
+	void cullRange(const std::vector<Bounds>& bounds, const uint32_t* begin, const uint32_t* end, std::vector<uint32_t>& visible) const;
+
+public:
+	//width has to be a multiple of the tile size, height of the band height
+	inline static const uint32_t width = 320;
+	inline static const uint32_t height = 192;
+	inline static const uint32_t tileSize = 8;
+	inline static const uint32_t bandHeight = 16;
+	inline static const uint32_t tilesX = width / tileSize;
+	inline static const uint32_t tilesY = height / tileSize;
+	//boxes per parallel chunk when testing
+	inline static const size_t chunkSize = 2048;
+
+	OcclusionCuller();
+
+	void clearOccluders();
+	//appends one lod of the mesh placed with transform, returns the occluder index
+	uint32_t addOccluder(const MeshDataView& mesh, const MeshLod& lod, const glm::mat4& transform);
+	void setOccluderTransform(uint32_t occluder, const glm::mat4& transform);
+	size_t occluderTriangleCount() const { return occluderIndices.size() / 3; }
+
+	//rasterizes the occluders as seen through projView, triangles crossing the near plane are skipped
+	void render(const glm::mat4& projView);
+
+	//false only if the box is behind the occluders of the last render
+	bool isBoxVisible(glm::vec3 aabbMin, glm::vec3 aabbMax) const;
+	//removes occluded instances from visible, the rest keep their order
+	void cull(const std::vector<Bounds>& bounds, std::vector<uint32_t>& visible);
+
+	//width * height depths of the last render, rows top to bottom, 1 where nothing was drawn
+	const std::vector<float>& depthBuffer() const { return depth; }
+};
@@ -0,0 +1,262 @@
+#include "RadianceDecoder.hpp"
+#include "parallel_helper.hpp"
+#include "simd_helper.hpp"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace {
+	//scanlines in the run length encoding start with 2 2 and the width, it only exists for these widths
+	constexpr int minEncodedWidth = 8;
+	constexpr int maxEncodedWidth = 0x7fff;
+	constexpr int rowsPerChunk = 8;
+
+	//reads one header line without its newline, false at the end of the file
+	bool readLine(const unsigned char* bytes, size_t size, size_t& pos, std::string& line) {
+		if (pos >= size)
+			return false;
+		const unsigned char* end = (const unsigned char*)memchr(bytes + pos, '\n', size - pos);
+		if (!end)
+			return false;
+		line.assign((const char*)bytes + pos, (const char*)end);
+		pos = end - bytes + 1;
+		return true;
+	}
+
+	//end of the encoded scanline starting at pos, 0 if it isn't one or its run lengths don't add up to the width
+	size_t scanScanline(const unsigned char* bytes, size_t size, size_t pos, int width) {
+		if (pos + 4 > size || bytes[pos] != 2 || bytes[pos + 1] != 2 || (bytes[pos + 2] & 0x80))
+			return 0;
+		if (((bytes[pos + 2] << 8) | bytes[pos + 3]) != width)
+			return 0;
+		pos += 4;
+		for (int c = 0; c < 4; c++) {
+			int x = 0;
+			while (x < width) {
+				if (pos >= size)
+					return 0;
+				int count = bytes[pos++];
+				if (count > 128) {
+					count -= 128;
+					pos += 1;
+				}
+				else {
+					pos += count;
+				}
+				if (count == 0 || x + count > width || pos > size)
+					return 0;
+				x += count;
+			}
+		}
+		return pos;
+	}
+
+	//one run length encoded channel of a scanline, already checked by scanScanline
+	const unsigned char* decodeChannel(const unsigned char* src, int width, unsigned char* dst) {
+		int x = 0;
+		while (x < width) {
+			int count = *src++;
+			if (count > 128) {
+				count -= 128;
+				memset(dst + x, *src++, count);
+			}
+			else {
+				memcpy(dst + x, src, count);
+				src += count;
+			}
+			x += count;
+		}
+		return src;
+	}
+
+	//same arithmetic as stbi_loadf so both give the same floats
+	void convertPixel(unsigned char r, unsigned char g, unsigned char b, unsigned char e, int desiredComponents, float* out) {
+		if (e != 0) {
+			float f1 = std::ldexp(1.0f, e - (int)(128 + 8));
+			if (desiredComponents <= 2) {
+				out[0] = (r + g + b) * f1 / 3;
+			}
+			else {
+				out[0] = r * f1;
+				out[1] = g * f1;
+				out[2] = b * f1;
+			}
+			if (desiredComponents == 2)
+				out[1] = 1;
+			if (desiredComponents == 4)
+				out[3] = 1;
+		}
+		else {
+			switch (desiredComponents) {
+			case 4: out[3] = 1; [[fallthrough]];
+			case 3: out[0] = out[1] = out[2] = 0; break;
+			case 2: out[1] = 1; [[fallthrough]];
+			case 1: out[0] = 0; break;
+			}
+		}
+	}
+
+#ifdef SIMD_HELPER_AVX2
+	AVX2_FUNCTION __m256i loadEightBytes(const unsigned char* bytes) {
+		return _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(bytes)));
+	}
+
+	//eight pixels at a time from the channel planes, 2^(e - 136) is built from the exponent bits
+	//e = 0 gives a scale of 0 like the scalar path, small exponents come out as the same denormals
+	//returns where it stopped, the last pixels that don't fill a register are left to the caller
+	AVX2_FUNCTION int convertRowAvx2(const unsigned char* planes, int width, int desiredComponents, float* dst) {
+		const unsigned char* rPlane = planes;
+		const unsigned char* gPlane = planes + width;
+		const unsigned char* bPlane = planes + 2 * width;
+		const unsigned char* ePlane = planes + 3 * width;
+		const __m256 exponentScale = _mm256_set1_ps(1.f / 512.f);
+		const __m256 third = _mm256_set1_ps(3.f);
+		alignas(32) float channels[3][8];
+
+		int x = 0;
+		for (; x + 8 <= width; x += 8) {
+			__m256i r = loadEightBytes(rPlane + x);
+			__m256i g = loadEightBytes(gPlane + x);
+			__m256i b = loadEightBytes(bPlane + x);
+			__m256i e = loadEightBytes(ePlane + x);
+			__m256 scale = _mm256_mul_ps(_mm256_castsi256_ps(_mm256_slli_epi32(e, 23)), exponentScale);
+
+			if (desiredComponents <= 2) {
+				__m256 sum = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_add_epi32(r, g), b));
+				_mm256_store_ps(channels[0], _mm256_div_ps(_mm256_mul_ps(sum, scale), third));
+			}
+			else {
+				_mm256_store_ps(channels[0], _mm256_mul_ps(_mm256_cvtepi32_ps(r), scale));
+				_mm256_store_ps(channels[1], _mm256_mul_ps(_mm256_cvtepi32_ps(g), scale));
+				_mm256_store_ps(channels[2], _mm256_mul_ps(_mm256_cvtepi32_ps(b), scale));
+			}
+
+			float* out = dst + (size_t)x * desiredComponents;
+			for (int i = 0; i < 8; i++, out += desiredComponents) {
+				switch (desiredComponents) {
+				case 1: out[0] = channels[0][i]; break;
+				case 2: out[0] = channels[0][i]; out[1] = 1.f; break;
+				case 3: out[0] = channels[0][i]; out[1] = channels[1][i]; out[2] = channels[2][i]; break;
+				case 4: out[0] = channels[0][i]; out[1] = channels[1][i]; out[2] = channels[2][i]; out[3] = 1.f; break;
+				}
+			}
+		}
+		return x;
+	}
+#endif
+
+	void convertRow(const unsigned char* planes, int width, int desiredComponents, float* dst) {
+		int x = 0;
+#ifdef SIMD_HELPER_AVX2
+		if (hasAvx2())
+			x = convertRowAvx2(planes, width, desiredComponents, dst);
+#endif
+		for (; x < width; x++)
+			convertPixel(planes[x], planes[width + x], planes[2 * width + x], planes[3 * width + x], desiredComponents, dst + (size_t)x * desiredComponents);
+	}
+}
+
+std::unique_ptr<RadianceDecoder> RadianceDecoder::open(const char* filepath) {
+	std::unique_ptr<RadianceDecoder> decoder(new RadianceDecoder());
+	try {
+		decoder->file = MappedFile::open(filepath);
+	}
+	catch (const std::exception&) {
+		return nullptr;
+	}
+	const unsigned char* bytes = decoder->file->data();
+	const size_t size = decoder->file->size();
+
+	size_t pos = 0;
+	std::string line;
+	if (!readLine(bytes, size, pos, line) || (line != "#?RADIANCE" && line != "#?RGBE"))
+		return nullptr;
+	//variables up to an empty line, only the rgbe format is handled
+	while (true) {
+		if (!readLine(bytes, size, pos, line))
+			return nullptr;
+		if (line.empty())
+			break;
+		if (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe")
+			return nullptr;
+	}
+	if (!readLine(bytes, size, pos, line))
+		return nullptr;
+	int width, height;
+	char trailing;
+	if (sscanf(line.c_str(), "-Y %d +X %d%c", &height, &width, &trailing) != 2)
+		return nullptr;
+	if (width < minEncodedWidth || width > maxEncodedWidth || height <= 0)
+		return nullptr;
+	decoder->width = width;
+	decoder->height = height;
+
+	//sequential, but it only reads the run length bytes
+	decoder->scanlineOffsets.resize(height);
+	for (int y = 0; y < height; y++) {
+		decoder->scanlineOffsets[y] = pos;
+		pos = scanScanline(bytes, size, pos, width);
+		if (pos == 0)
+			return nullptr;
+	}
+	return decoder;
+}
+
+void RadianceDecoder::decodeRows(int desiredComponents, float* dst, int firstRow, int endRow) const {
+	std::vector<unsigned char> planes((size_t)width * 4);
+	for (int y = firstRow; y < endRow; y++) {
+		const unsigned char* src = file->data() + scanlineOffsets[y] + 4;
+		for (int c = 0; c < 4; c++)
+			src = decodeChannel(src, width, planes.data() + (size_t)c * width);
+		convertRow(planes.data(), width, desiredComponents, dst + (size_t)y * width * desiredComponents);
+	}
+}
+
+void RadianceDecoder::decode(int desiredComponents, float* dst) const {
+	assert(desiredComponents >= 1 && desiredComponents <= 4);
+	//every row writes its own part of dst
+	parallelFor(height, rowsPerChunk, [&](size_t begin, size_t end) {
+		decodeRows(desiredComponents, dst, (int)begin, (int)end);
+		});
+}
+
+void benchmarkRadianceDecoder(const char* filepath) {
+	const int components = 4;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	int width = 0, height = 0, fileComponents;
+	std::unique_ptr<float, void(*)(void*)> reference(
+		stbi_loadf(filepath, &width, &height, &fileComponents, components),
+		stbi_image_free
+	);
+	auto stbEnd = std::chrono::high_resolution_clock::now();
+	if (!reference) {
+		std::cerr << "Radiance benchmark: stb_image could not load " << filepath << std::endl;
+		return;
+	}
+
+	auto decoder = RadianceDecoder::open(filepath);
+	if (!decoder) {
+		std::cerr << "Radiance benchmark: " << filepath << " is not handled by RadianceDecoder" << std::endl;
+		return;
+	}
+	std::vector<float> pixels((size_t)decoder->getWidth() * decoder->getHeight() * components);
+	decoder->decode(components, pixels.data());
+	auto end = std::chrono::high_resolution_clock::now();
+
+	double stbMs = std::chrono::duration<double, std::milli>(stbEnd - start).count();
+	double parallelMs = std::chrono::duration<double, std::milli>(end - stbEnd).count();
+	bool matches = decoder->getWidth() == width && decoder->getHeight() == height &&
+		memcmp(pixels.data(), reference.get(), pixels.size() * sizeof(float)) == 0;
+	std::cout << "Radiance " << width << "x" << height << ": stbi_loadf " << stbMs << " ms, RadianceDecoder " << parallelMs << " ms ("
+		<< stbMs / parallelMs << "x, " << workerThreadCount() << " threads" << (hasAvx2() ? ", avx2" : "") << ")"
+		<< (matches ? "" : ", pixels differ!") << std::endl;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "MappedFile.hpp"
+
+//decodes radiance .hdr images with their scanlines split across threads
+//a scan pass walks the run lengths to find where every scanline starts, then each thread decodes and converts its own rows
+//only the -Y +X orientation and the per channel run length encoding every writer has used since 1991 are handled,
+//open returns null for anything else so the caller can fall back to stb_image
+
+class RadianceDecoder {
+private:
+	RadianceDecoder() = default;
+
+	std::shared_ptr<MappedFile> file;
+	int width = 0;
+	int height = 0;
+	//offset of every scanline in the file
+	std::vector<size_t> scanlineOffsets;
+
+	void decodeRows(int desiredComponents, float* dst, int firstRow, int endRow) const;
+
+public:
+	//null if the file is not a radiance image this decoder handles or its scanlines don't add up
+	static std::unique_ptr<RadianceDecoder> open(const char* filepath);
+
+	inline int getWidth() const { return width; }
+	inline int getHeight() const { return height; }
+
+	//dst holds width * height * desiredComponents floats, converted like stbi_loadf does:
+	//one and two components get the average of rgb, two and four an alpha of 1
+	void decode(int desiredComponents, float* dst) const;
+};
+
+//decodes the file with stbi_loadf and with RadianceDecoder, prints both times and whether the pixels match
+void benchmarkRadianceDecoder(const char* filepath);
@@ -0,0 +1,185 @@
+#include "SceneHierarchy.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define SCENE_HIERARCHY_SSE
+#endif
+
+namespace {
+	inline glm::mat4 composeTRS(glm::vec3 translation, glm::quat rotation, glm::vec3 scale) {
+		glm::mat3 basis = glm::mat3_cast(rotation);
+		glm::mat4 result;
+		result[0] = glm::vec4(basis[0] * scale.x, 0.f);
+		result[1] = glm::vec4(basis[1] * scale.y, 0.f);
+		result[2] = glm::vec4(basis[2] * scale.z, 0.f);
+		result[3] = glm::vec4(translation, 1.f);
+		return result;
+	}
+
+	//out = a * b, out may not alias either input
+	inline void multiply(const glm::mat4& a, const glm::mat4& b, glm::mat4& out) {
+#ifdef SCENE_HIERARCHY_SSE
+		const float* af = &a[0][0];
+		const float* bf = &b[0][0];
+		float* of = &out[0][0];
+		const __m128 a0 = _mm_loadu_ps(af);
+		const __m128 a1 = _mm_loadu_ps(af + 4);
+		const __m128 a2 = _mm_loadu_ps(af + 8);
+		const __m128 a3 = _mm_loadu_ps(af + 12);
+		//every column of the result is a's columns weighted by one column of b
+		for (int c = 0; c < 4; c++) {
+			__m128 column = _mm_mul_ps(a0, _mm_set1_ps(bf[4 * c]));
+			column = _mm_add_ps(column, _mm_mul_ps(a1, _mm_set1_ps(bf[4 * c + 1])));
+			column = _mm_add_ps(column, _mm_mul_ps(a2, _mm_set1_ps(bf[4 * c + 2])));
+			column = _mm_add_ps(column, _mm_mul_ps(a3, _mm_set1_ps(bf[4 * c + 3])));
+			_mm_storeu_ps(of + 4 * c, column);
+		}
+#else
+		out = a * b;
+#endif
+	}
+}
+
+uint32_t SceneHierarchy::appendNode(int32_t parent) {
+	uint32_t node = (uint32_t)parents.size();
+	assert(parent < (int32_t)node);
+	//the parent's subtree has to end right here or the new node would split another subtree
+	assert(parent == noParent || subtreeEnds[parent] == node);
+
+	parents.push_back(parent);
+	subtreeEnds.push_back(node + 1);
+	for (int32_t ancestor = parent; ancestor != noParent; ancestor = parents[ancestor])
+		subtreeEnds[ancestor] = node + 1;
+
+	localMatrices.emplace_back(1.f);
+	worldMatrices.emplace_back(1.f);
+	dirty.push_back(1);
+	if (dirtyBegin == dirtyEnd)
+		dirtyBegin = node;
+	dirtyEnd = node + 1;
+	return node;
+}
+
+uint32_t SceneHierarchy::addNode(int32_t parent, glm::vec3 translation, glm::quat rotation, glm::vec3 scale) {
+	uint32_t node = appendNode(parent);
+	translations.push_back(translation);
+	rotations.push_back(rotation);
+	scales.push_back(scale);
+	matrixNodes.push_back(0);
+	return node;
+}
+
+uint32_t SceneHierarchy::addNode(int32_t parent, const glm::mat4& localMatrix) {
+	uint32_t node = appendNode(parent);
+	localMatrices[node] = localMatrix;
+	matrixNodes.push_back(1);
+
+	//trs only backs the getters and later edits, skew and projection are dropped
+	glm::vec3 scale(
+		glm::length(glm::vec3(localMatrix[0])),
+		glm::length(glm::vec3(localMatrix[1])),
+		glm::length(glm::vec3(localMatrix[2]))
+	);
+	if (glm::determinant(glm::mat3(localMatrix)) < 0.f)
+		scale.x = -scale.x;
+	glm::mat3 basis(
+		scale.x != 0.f ? glm::vec3(localMatrix[0]) / scale.x : glm::vec3(1, 0, 0),
+		scale.y != 0.f ? glm::vec3(localMatrix[1]) / scale.y : glm::vec3(0, 1, 0),
+		scale.z != 0.f ? glm::vec3(localMatrix[2]) / scale.z : glm::vec3(0, 0, 1)
+	);
+	translations.push_back(glm::vec3(localMatrix[3]));
+	rotations.push_back(glm::normalize(glm::quat_cast(basis)));
+	scales.push_back(scale);
+	return node;
+}
+
+void SceneHierarchy::clear() {
+	parents.clear();
+	subtreeEnds.clear();
+	translations.clear();
+	rotations.clear();
+	scales.clear();
+	matrixNodes.clear();
+	localMatrices.clear();
+	worldMatrices.clear();
+	dirty.clear();
+	dirtyBegin = dirtyEnd = 0;
+}
+
+void SceneHierarchy::markDirty(uint32_t node) {
+	dirty[node] = 1;
+	if (dirtyBegin == dirtyEnd) {
+		dirtyBegin = node;
+		dirtyEnd = subtreeEnds[node];
+	}
+	else {
+		dirtyBegin = std::min(dirtyBegin, node);
+		dirtyEnd = std::max(dirtyEnd, subtreeEnds[node]);
+	}
+}
+
+void SceneHierarchy::setTranslation(uint32_t node, glm::vec3 translation) {
+	translations[node] = translation;
+	matrixNodes[node] = 0;
+	markDirty(node);
+}
+
+void SceneHierarchy::setRotation(uint32_t node, glm::quat rotation) {
+	rotations[node] = rotation;
+	matrixNodes[node] = 0;
+	markDirty(node);
+}
+
+void SceneHierarchy::setScale(uint32_t node, glm::vec3 scale) {
+	scales[node] = scale;
+	matrixNodes[node] = 0;
+	markDirty(node);
+}
+
+void SceneHierarchy::setLocalMatrix(uint32_t node, const glm::mat4& localMatrix) {
+	localMatrices[node] = localMatrix;
+	matrixNodes[node] = 1;
+	markDirty(node);
+}
+
+void SceneHierarchy::composeWorld(uint32_t begin, uint32_t end) {
+	//parents are either before begin and clean or earlier in the range and already composed
+	for (uint32_t node = begin; node < end; node++) {
+		int32_t parent = parents[node];
+		if (parent == noParent)
+			worldMatrices[node] = localMatrices[node];
+		else
+			multiply(worldMatrices[parent], localMatrices[node], worldMatrices[node]);
+	}
+}
+
+SceneRange SceneHierarchy::update() {
+	if (!isDirty())
+		return {};
+
+	const uint32_t begin = dirtyBegin;
+	const uint32_t end = dirtyEnd;
+	//clean nodes between dirty subtrees are skipped, dirty nodes inside a dirty subtree are handled with it
+	for (uint32_t node = begin; node < end;) {
+		if (!dirty[node]) {
+			node++;
+			continue;
+		}
+		const uint32_t subtreeEnd = subtreeEnds[node];
+		for (uint32_t child = node; child < subtreeEnd; child++) {
+			if (!dirty[child])
+				continue;
+			if (!matrixNodes[child])
+				localMatrices[child] = composeTRS(translations[child], rotations[child], scales[child]);
+			dirty[child] = 0;
+		}
+		composeWorld(node, subtreeEnd);
+		node = subtreeEnd;
+	}
+
+	dirtyBegin = dirtyEnd = 0;
+	return { begin, end - begin };
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+//flattened node hierarchy of a model, replaces walking parent pointers per node
+//nodes are stored depth first so parents come before their children and every subtree is a contiguous range
+//local transforms are split into translation, rotation and scale arrays
+//world matrices are composed in one linear pass over the dirty range, children read their parent's already updated matrix
+
+//nodes [first, first + count)
+struct SceneRange {
+	uint32_t first = 0;
+	uint32_t count = 0;
+};
+
+class SceneHierarchy {
+	//-1 for roots, always smaller than the node's own index otherwise
+	std::vector<int32_t> parents;
+	//one past the last node of each node's subtree
+	std::vector<uint32_t> subtreeEnds;
+
+	std::vector<glm::vec3> translations;
+	std::vector<glm::quat> rotations;
+	std::vector<glm::vec3> scales;
+	//nodes given as a matrix use it as is until one of their trs components is set
+	std::vector<uint8_t> matrixNodes;
+
+	std::vector<glm::mat4> localMatrices;
+	std::vector<glm::mat4> worldMatrices;
+	//local transform changed since the last update
+	std::vector<uint8_t> dirty;
+	//covers the subtrees of all dirty nodes, empty if nothing changed
+	uint32_t dirtyBegin = 0;
+	uint32_t dirtyEnd = 0;
+
+	uint32_t appendNode(int32_t parent);
+	void markDirty(uint32_t node);
+	void composeWorld(uint32_t begin, uint32_t end);
+
+public:
+	inline static const int32_t noParent = -1;
+
+	//the parent has to be the last added node or one of its ancestors, which is what a depth first walk does
+	uint32_t addNode(int32_t parent, glm::vec3 translation, glm::quat rotation, glm::vec3 scale);
+	uint32_t addNode(int32_t parent, const glm::mat4& localMatrix);
+	void clear();
+
+	size_t nodeCount() const { return parents.size(); }
+	int32_t getParent(uint32_t node) const { return parents[node]; }
+	uint32_t getSubtreeEnd(uint32_t node) const { return subtreeEnds[node]; }
+
+	glm::vec3 getTranslation(uint32_t node) const { return translations[node]; }
+	glm::quat getRotation(uint32_t node) const { return rotations[node]; }
+	glm::vec3 getScale(uint32_t node) const { return scales[node]; }
+	bool hasLocalMatrix(uint32_t node) const { return matrixNodes[node] != 0; }
+	const glm::mat4& getLocalMatrix(uint32_t node) const { return localMatrices[node]; }
+
+	//only valid after update
+	const glm::mat4& getWorldMatrix(uint32_t node) const { return worldMatrices[node]; }
+
+	//mark the node's subtree dirty, nothing is recomputed until update
+	void setTranslation(uint32_t node, glm::vec3 translation);
+	void setRotation(uint32_t node, glm::quat rotation);
+	void setScale(uint32_t node, glm::vec3 scale);
+	void setLocalMatrix(uint32_t node, const glm::mat4& localMatrix);
+
+	bool isDirty() const { return dirtyBegin < dirtyEnd; }
+	//recomputes the dirty local matrices and the world matrices of their subtrees
+	//returns the range of nodes whose world matrix may have changed, empty if nothing was dirty
+	SceneRange update();
+};
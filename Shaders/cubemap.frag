@@ -0,0 +1,19 @@
+#version 450
+
+layout(location = 0) in vec3 direction;
+
+layout(location = 0) out vec4 fragColor;
+
+layout(set = 0, binding = 0) uniform samplerCube skybox;
+
+void main(){
+    vec3 color = texture(skybox, normalize(direction)).rgb;
+
+    // HDR tonemapping, same as the shaded geometry
+    color = color / (color + vec3(1.0));
+
+    // gamma correct
+    color = pow(color, vec3(1.0/2.2));
+
+    fragColor = vec4(color, 1.0);
+}
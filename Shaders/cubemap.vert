@@ -0,0 +1,18 @@
+#version 450
+
+layout(location = 0) out vec3 direction;
+
+layout( push_constant ) uniform constants
+{
+	mat4 inverseProjView;
+} PushConstants;
+
+//fullscreen triangle on the far plane, the direction is the view ray through the vertex
+void main(){
+    vec2 uv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+    vec2 ndc = uv * 2.0 - 1.0;
+    gl_Position = vec4(ndc, 1.0, 1.0);
+    //a point on the near plane keeps w positive for any far plane
+    vec4 nearPoint = PushConstants.inverseProjView * vec4(ndc, 0.0, 1.0);
+    direction = nearPoint.xyz / nearPoint.w;
+}
@@ -0,0 +1,11 @@
+#version 450
+
+layout(location = 0) in flat uint instanceIndex;
+layout(location = 1) in flat uint firstTriangle;
+
+layout(location = 0) out uvec2 visibility;
+
+void main(){
+    //gl_PrimitiveID restarts at 0 for every draw
+    visibility = uvec2(instanceIndex, firstTriangle + gl_PrimitiveID);
+}
@@ -0,0 +1,28 @@
+#version 450
+
+layout(location = 0) in vec3 inPosition;
+
+layout(location = 0) out flat uint instanceIndex;
+layout(location = 1) out flat uint firstTriangle;
+
+//push constants block
+layout( push_constant ) uniform constants
+{
+	mat4 modelMatrix;
+	uint instanceIndex;
+} PushConstants;
+
+layout(set = 0, binding = 0) uniform  Matrices{
+    mat4 proj;
+    mat4 view;
+    mat4 projView;
+    vec4 cameraPos_time;
+	vec4 fovY_aspectRatio_zNear_zFar;
+} matrices;
+
+void main(){
+    instanceIndex = PushConstants.instanceIndex;
+    //draws pass the first triangle of their index range as firstInstance
+    firstTriangle = gl_InstanceIndex;
+    gl_Position = matrices.projView * PushConstants.modelMatrix * vec4(inPosition, 1.0);
+}
@@ -0,0 +1,321 @@
+#version 450 core
+#extension GL_EXT_nonuniform_qualifier : require
+
+//shades the pixels of the visibility buffer, attributes are rebuilt from the triangle under each pixel
+
+layout(location = 0) out vec4 fragColor;
+
+struct PL{
+	vec4 color;
+	vec4 position_radius;
+};
+
+struct MaterialInfo{
+	vec4 baseColorFactor;
+	vec4 metallicRoughness_waste2;
+	uvec4 baseTexId_metallicRoughessTexId_waste2;
+};
+
+struct Instance{
+    mat4 transform;
+    mat4 normalTransform;
+    uint meshIndex;
+    uint materialIndex;
+    uint index16;
+    uint skinnedVertexOffset;
+};
+
+layout( push_constant ) uniform constants{
+    vec2 screenSize;
+    uint skinnedFrame;
+} PC;
+
+layout(set = 0, binding = 0) uniform  Matrices{
+    mat4 proj;
+    mat4 view;
+    mat4 projView;
+    vec4 cameraPos_time;
+	vec4 fovY_aspectRatio_zNear_zFar;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer LightsCount{
+	int pointLightCount;
+};
+
+layout(std430, set = 1, binding = 1) readonly buffer LightsData{
+	PL arr[];
+} lights;
+
+layout(std430, set = 1, binding = 1) readonly buffer SunLight{
+	vec4 color_intensity;
+    vec4 direction;
+} sun;
+
+layout(set=2, binding=1) uniform sampler2D MaterialTextures[1024];
+
+layout(input_attachment_index = 0, set = 3, binding = 0) uniform usubpassInput visibilityInput;
+
+layout(std430, set = 3, binding = 1) readonly buffer Instances{
+    Instance arr[];
+} instances;
+
+layout(std430, set = 3, binding = 2) readonly buffer Materials{
+    MaterialInfo arr[];
+} materials;
+
+//Vertex3 is 8 floats, position normal uv
+layout(std430, set = 3, binding = 3) readonly buffer Vertices{
+    float arr[];
+} vertexBuffers[];
+
+layout(std430, set = 3, binding = 4) readonly buffer Indices{
+    uint arr[];
+} indexBuffers[];
+
+//skinned instances read the vertices the skinning pass wrote this frame, same layout as Vertices
+layout(std430, set = 3, binding = 5) readonly buffer SkinnedVertices{
+    float arr[];
+} skinnedVertexBuffers[];
+
+#define PI 3.14159265359
+
+float DistributionGGX(vec3 N, vec3 H, float roughness)
+{
+    float a = roughness*roughness;
+    float a2 = a*a;
+    float NdotH = max(dot(N, H), 0.0);
+    float NdotH2 = NdotH*NdotH;
+
+    float nom   = a2;
+    float denom = (NdotH2 * (a2 - 1.0) + 1.0);
+    denom = PI * denom * denom;
+
+    return nom / denom;
+}
+// ----------------------------------------------------------------------------
+float GeometrySchlickGGX(float NdotV, float roughness)
+{
+    float r = (roughness + 1.0);
+    float k = (r*r) / 8.0;
+
+    float nom   = NdotV;
+    float denom = NdotV * (1.0 - k) + k;
+
+    return nom / denom;
+}
+// ----------------------------------------------------------------------------
+float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness)
+{
+    float NdotV = max(dot(N, V), 0.0);
+    float NdotL = max(dot(N, L), 0.0);
+    float ggx2 = GeometrySchlickGGX(NdotV, roughness);
+    float ggx1 = GeometrySchlickGGX(NdotL, roughness);
+
+    return ggx1 * ggx2;
+}
+// ----------------------------------------------------------------------------
+vec3 fresnelSchlick(float cosTheta, vec3 F0)
+{
+    return F0 + (1.0 - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
+}
+
+
+uint loadIndex(uint mesh, uint index, bool index16){
+    if(!index16)
+        return indexBuffers[nonuniformEXT(mesh)].arr[index];
+    uint pair = indexBuffers[nonuniformEXT(mesh)].arr[index >> 1];
+    return (index & 1) != 0 ? pair >> 16 : pair & 0xFFFF;
+}
+
+//skinnedOffset is the instance's first skinned float, 0xFFFFFFFF to read the mesh's own vertices
+float loadFloat(uint mesh, uint skinnedOffset, uint offset){
+    if(skinnedOffset != 0xFFFFFFFFu)
+        return skinnedVertexBuffers[PC.skinnedFrame].arr[skinnedOffset + offset];
+    return vertexBuffers[nonuniformEXT(mesh)].arr[offset];
+}
+
+vec3 loadVec3(uint mesh, uint skinnedOffset, uint offset){
+    return vec3(
+        loadFloat(mesh, skinnedOffset, offset),
+        loadFloat(mesh, skinnedOffset, offset + 1),
+        loadFloat(mesh, skinnedOffset, offset + 2)
+    );
+}
+
+vec2 loadVec2(uint mesh, uint skinnedOffset, uint offset){
+    return vec2(
+        loadFloat(mesh, skinnedOffset, offset),
+        loadFloat(mesh, skinnedOffset, offset + 1)
+    );
+}
+
+//perspective correct barycentrics of the pixel and their screen space derivatives
+//from the clip positions of the triangle, the derivatives drive texture lod like the hardware ones would
+struct Barycentrics{
+    vec3 lambda;
+    vec3 ddx;
+    vec3 ddy;
+};
+
+Barycentrics computeBarycentrics(vec4 clip0, vec4 clip1, vec4 clip2, vec2 pixelNdc){
+    Barycentrics result;
+    vec3 invW = 1.0 / vec3(clip0.w, clip1.w, clip2.w);
+    vec2 ndc0 = clip0.xy * invW.x;
+    vec2 ndc1 = clip1.xy * invW.y;
+    vec2 ndc2 = clip2.xy * invW.z;
+
+    float invDet = 1.0 / determinant(mat2(ndc2 - ndc1, ndc0 - ndc1));
+    //gradients of lambda / w over ndc
+    result.ddx = vec3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;
+    result.ddy = vec3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;
+    float ddxSum = dot(result.ddx, vec3(1.0));
+    float ddySum = dot(result.ddy, vec3(1.0));
+
+    vec2 delta = pixelNdc - ndc0;
+    float interpInvW = invW.x + delta.x * ddxSum + delta.y * ddySum;
+    float interpW = 1.0 / interpInvW;
+    result.lambda = interpW * (vec3(invW.x, 0.0, 0.0) + delta.x * result.ddx + delta.y * result.ddy);
+
+    //one pixel steps, vulkan ndc y already points down like the pixels
+    result.ddx *= 2.0 / PC.screenSize.x;
+    result.ddy *= 2.0 / PC.screenSize.y;
+    ddxSum *= 2.0 / PC.screenSize.x;
+    ddySum *= 2.0 / PC.screenSize.y;
+
+    float interpWdx = 1.0 / (interpInvW + ddxSum);
+    float interpWdy = 1.0 / (interpInvW + ddySum);
+    result.ddx = interpWdx * (result.lambda * interpInvW + result.ddx) - result.lambda;
+    result.ddy = interpWdy * (result.lambda * interpInvW + result.ddy) - result.lambda;
+    return result;
+}
+
+void main(){
+    uvec2 visibility = subpassLoad(visibilityInput).xy;
+    if(visibility.x == 0xFFFFFFFFu)
+        discard;
+
+    Instance instance = instances.arr[visibility.x];
+    uint mesh = instance.meshIndex;
+    uint triangle = visibility.y;
+    uint skinnedOffset = instance.skinnedVertexOffset == 0xFFFFFFFFu ? 0xFFFFFFFFu : instance.skinnedVertexOffset * 8;
+
+    vec3 positions[3];
+    vec3 normals[3];
+    vec2 uvs[3];
+    vec4 clips[3];
+    for(int i = 0; i < 3; ++i){
+        uint vertexOffset = loadIndex(mesh, triangle * 3 + i, instance.index16 != 0) * 8;
+        positions[i] = (instance.transform * vec4(loadVec3(mesh, skinnedOffset, vertexOffset), 1.0)).xyz;
+        normals[i] = loadVec3(mesh, skinnedOffset, vertexOffset + 3);
+        uvs[i] = loadVec2(mesh, skinnedOffset, vertexOffset + 6);
+        clips[i] = projView * vec4(positions[i], 1.0);
+    }
+
+    vec2 pixelNdc = gl_FragCoord.xy / PC.screenSize * 2.0 - 1.0;
+    Barycentrics bary = computeBarycentrics(clips[0], clips[1], clips[2], pixelNdc);
+
+    vec3 worldPos = bary.lambda.x * positions[0] + bary.lambda.y * positions[1] + bary.lambda.z * positions[2];
+    vec3 meshNorm = bary.lambda.x * normals[0] + bary.lambda.y * normals[1] + bary.lambda.z * normals[2];
+    vec2 fragUV = bary.lambda.x * uvs[0] + bary.lambda.y * uvs[1] + bary.lambda.z * uvs[2];
+    vec2 uvDdx = bary.ddx.x * uvs[0] + bary.ddx.y * uvs[1] + bary.ddx.z * uvs[2];
+    vec2 uvDdy = bary.ddy.x * uvs[0] + bary.ddy.y * uvs[1] + bary.ddy.z * uvs[2];
+    vec3 cameraPos = cameraPos_time.xyz;
+
+    MaterialInfo material = materials.arr[instance.materialIndex];
+    uint baseTexId = material.baseTexId_metallicRoughessTexId_waste2.x;
+    uint metallicRoughnessTexId = material.baseTexId_metallicRoughessTexId_waste2.y;
+    vec3 albedo     = textureGrad(MaterialTextures[nonuniformEXT(baseTexId)], fragUV, uvDdx, uvDdy).rgb * material.baseColorFactor.rgb;
+	vec2 metallicRoughness = textureGrad(MaterialTextures[nonuniformEXT(metallicRoughnessTexId)], fragUV, uvDdx, uvDdy).rg * material.metallicRoughness_waste2.rg;
+    float metallic  = metallicRoughness.r;
+    float roughness = metallicRoughness.g;
+    float ao        = 0.3;
+
+    vec3 N = normalize(mat3(instance.normalTransform) * meshNorm);
+    vec3 V = normalize(cameraPos - worldPos);
+
+    // calculate reflectance at normal incidence; if dia-electric (like plastic) use F0 
+    // of 0.04 and if it's a metal, use the albedo color as F0 (metallic workflow)    
+    vec3 F0 = vec3(0.04); 
+    F0 = mix(F0, albedo, metallic);
+
+    // reflectance equation
+    vec3 Lo = vec3(0.0);
+
+	for(int i = 0; i < pointLightCount; i++){
+		PL cLight = lights.arr[i];
+        // calculate per-light radiance
+        vec3 L = normalize(cLight.position_radius.xyz - worldPos);
+        float dist = length(cLight.position_radius.xyz - worldPos);
+        float attenuation = 1.0 / (dist * dist);
+
+		
+        vec3 H = normalize(V + L);
+
+        vec3 radiance = 0.5 * cLight.color.rgb * attenuation;
+
+        // Cook-Torrance BRDF
+        float NDF = DistributionGGX(N, H, roughness);   
+        float G   = GeometrySmith(N, V, L, roughness);      
+        vec3 F    = fresnelSchlick(max(dot(H, V), 0.0), F0);
+           
+        vec3 numerator    = NDF * G * F; 
+        float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0) + 0.0001; // + 0.0001 to prevent divide by zero
+        vec3 specular = numerator / denominator;
+        
+        // kS is equal to Fresnel
+        vec3 kS = F;
+        // for energy conservation, the diffuse and specular light can't
+        // be above 1.0 (unless the surface emits light); to preserve this
+        // relationship the diffuse component (kD) should equal 1.0 - kS.
+        vec3 kD = vec3(1.0) - kS;
+        // multiply kD by the inverse metalness such that only non-metals 
+        // have diffuse lighting, or a linear blend if partly metal (pure metals
+        // have no diffuse light).
+        kD *= 1.0 - metallic;	  
+
+        // scale light by NdotL
+        float NdotL = max(dot(N, L), 0.0);        
+
+        // add to outgoing radiance Lo
+        Lo += (kD * albedo / PI + specular) * radiance * NdotL;  // note that we already multiplied the BRDF by the Fresnel (kS) so we won't multiply by kS again
+    }
+
+    {
+        //apply directional light from sun
+        vec3 L = normalize(sun.direction.xyz);		
+        vec3 H = normalize(V + L);
+        vec3 radiance = sun.color_intensity.rgb * 4.0;
+
+        // Cook-Torrance BRDF
+        float NDF = DistributionGGX(N, H, roughness);   
+        float G   = GeometrySmith(N, V, L, roughness);      
+        vec3 F    = fresnelSchlick(max(dot(H, V), 0.0), F0);
+           
+        vec3 numerator    = NDF * G * F; 
+        float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0) + 0.0001; // + 0.0001 to prevent divide by zero
+        vec3 specular = numerator / denominator;
+        
+        vec3 kS = F;
+        vec3 kD = vec3(1.0) - kS;
+        kD *= 1.0 - metallic;	  
+
+        float NdotL = max(dot(N, L), 0.0);        
+
+        // add to outgoing radiance Lo
+        Lo += (kD * albedo / PI + specular) * radiance * NdotL;
+    }
+    
+    // ambient lighting (note that the next IBL tutorial will replace 
+    // this ambient lighting with environment lighting).
+    vec3 ambient = vec3(0.02) * ao;
+    
+    vec3 color = ambient + Lo;
+
+    // HDR tonemapping
+    color = color / (color + vec3(1.0));
+
+    // gamma correct
+    color = pow(color, vec3(1.0/2.2)); 
+
+    fragColor = vec4(color, 1.0);
+}
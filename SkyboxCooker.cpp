@@ -0,0 +1,242 @@
+#include "SkyboxCooker.hpp"
+#include "ImageLoader.hpp"
+#include "parallel_helper.hpp"
+#include "CookedFile.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+	constexpr uint32_t cookedMagic = 0x58424B53; //"SKBX"
+	constexpr uint32_t texelBytes = 4;
+	constexpr float pi = 3.14159265358979f;
+
+	struct CookedSkyboxHeader {
+		CookedFileHeader file;
+
+		uint32_t faceSize;
+		uint32_t mipCount;
+
+		uint64_t mipTableOffset;
+		uint64_t dataOffset;
+		uint64_t dataSize;
+	};
+
+	//inverse of the vulkan cube face selection, s and t in [-1, 1] across the face
+	glm::vec3 faceDirection(uint32_t face, float s, float t) {
+		switch (face) {
+		case 0: return glm::vec3(1.f, -t, -s);
+		case 1: return glm::vec3(-1.f, -t, s);
+		case 2: return glm::vec3(s, 1.f, t);
+		case 3: return glm::vec3(s, -1.f, -t);
+		case 4: return glm::vec3(s, -t, 1.f);
+		default: return glm::vec3(-s, -t, -1.f);
+		}
+	}
+
+	//bilinear, wraps around horizontally and clamps at the poles
+	glm::vec3 sampleEquirect(const float* pixels, int width, int height, glm::vec3 direction) {
+		direction = glm::normalize(direction);
+		float u = std::atan2(direction.z, direction.x) / (2.f * pi) + 0.5f;
+		float v = std::acos(std::clamp(direction.y, -1.f, 1.f)) / pi;
+
+		float x = u * width - 0.5f;
+		float y = std::clamp(v * height - 0.5f, 0.f, (float)(height - 1));
+		int x0 = (int)std::floor(x);
+		int y0 = (int)y;
+		float fx = x - x0;
+		float fy = y - y0;
+		x0 = ((x0 % width) + width) % width;
+		int x1 = (x0 + 1) % width;
+		int y1 = std::min(y0 + 1, height - 1);
+
+		auto texel = [&](int tx, int ty) {
+			const float* p = pixels + ((size_t)ty * width + tx) * 3;
+			return glm::vec3(p[0], p[1], p[2]);
+		};
+		glm::vec3 top = glm::mix(texel(x0, y0), texel(x1, y0), fx);
+		glm::vec3 bottom = glm::mix(texel(x0, y1), texel(x1, y1), fx);
+		return glm::mix(top, bottom, fy);
+	}
+}
+
+uint32_t SkyboxCooker::packE5B9G9R9(float r, float g, float b) {
+	constexpr int mantissaBits = 9;
+	constexpr int exponentBias = 15;
+	constexpr int maxExponent = 31;
+	const float maxValue = (float)((1 << mantissaBits) - 1) / (1 << mantissaBits) * (float)(1 << (maxExponent - exponentBias));
+
+	//also turns nans into 0
+	r = r > 0.f ? std::min(r, maxValue) : 0.f;
+	g = g > 0.f ? std::min(g, maxValue) : 0.f;
+	b = b > 0.f ? std::min(b, maxValue) : 0.f;
+	float maxChannel = std::max({ r, g, b });
+	if (maxChannel == 0.f)
+		return 0;
+
+	//frexp gives maxChannel = m * 2^e with m in [0.5, 1), so floor(log2(maxChannel)) is e - 1
+	int e;
+	std::frexp(maxChannel, &e);
+	int sharedExponent = std::max(-exponentBias - 1, e - 1) + 1 + exponentBias;
+	float scale = std::ldexp(1.f, sharedExponent - exponentBias - mantissaBits);
+	if ((int)std::floor(maxChannel / scale + 0.5f) == (1 << mantissaBits)) {
+		sharedExponent++;
+		scale *= 2.f;
+	}
+
+	uint32_t rm = (uint32_t)std::floor(r / scale + 0.5f);
+	uint32_t gm = (uint32_t)std::floor(g / scale + 0.5f);
+	uint32_t bm = (uint32_t)std::floor(b / scale + 0.5f);
+	return rm | (gm << 9) | (bm << 18) | ((uint32_t)sharedExponent << 27);
+}
+
+std::vector<CookedMip> SkyboxCooker::mipLayout(uint32_t faceSize) {
+	std::vector<CookedMip> mips;
+	uint64_t offset = 0;
+	uint32_t size = faceSize;
+	while (true) {
+		CookedMip mip;
+		mip.offset = offset;
+		mip.size = (uint64_t)size * size * texelBytes * faceCount;
+		mip.width = size;
+		mip.height = size;
+		mips.push_back(mip);
+		offset += mip.size;
+		if (size == 1)
+			break;
+		size = std::max(size / 2, 1u);
+	}
+	return mips;
+}
+
+uint64_t SkyboxCooker::dataSize(uint32_t faceSize) {
+	const CookedMip& last = mipLayout(faceSize).back();
+	return last.offset + last.size;
+}
+
+std::string SkyboxCooker::storeName(const char* filepath, uint32_t faceSize) {
+	return cookedStoreName("skybox", filepath, faceSize);
+}
+
+void SkyboxCooker::cook(const char* filepath, uint32_t faceSize) {
+	FloatImagePtr equirect = loadFloatImageFromFile(filepath, 3);
+	const int width = equirect->getWidth();
+	const int height = equirect->getHeight();
+	const float* pixels = equirect->getData();
+	const std::vector<CookedMip> mips = mipLayout(faceSize);
+
+	CookedSkyboxHeader header{};
+	header.file = makeCookedFileHeader(cookedMagic, SkyboxCooker::version, filepath);
+	header.faceSize = faceSize;
+	header.mipCount = (uint32_t)mips.size();
+	header.mipTableOffset = alignUp(sizeof(header));
+	header.dataOffset = alignUp(header.mipTableOffset + sizeof(CookedMip) * mips.size());
+	header.dataSize = mips.back().offset + mips.back().size;
+	header.file.fileSize = header.dataOffset + header.dataSize;
+
+	//a face spans a quarter of the image's width, denser sources get a grid of samples per texel
+	const int samples = std::clamp((int)std::ceil(width / 4.f / faceSize), 1, 4);
+
+	std::vector<glm::vec3> level((size_t)faceSize * faceSize * faceCount);
+	parallelFor((size_t)faceSize * faceCount, 16, [&](size_t begin, size_t end) {
+		for (size_t row = begin; row < end; row++) {
+			uint32_t face = (uint32_t)(row / faceSize);
+			uint32_t y = (uint32_t)(row % faceSize);
+			for (uint32_t x = 0; x < faceSize; x++) {
+				glm::vec3 sum(0.f);
+				for (int sy = 0; sy < samples; sy++) {
+					for (int sx = 0; sx < samples; sx++) {
+						float s = ((x + (sx + 0.5f) / samples) / faceSize) * 2.f - 1.f;
+						float t = ((y + (sy + 0.5f) / samples) / faceSize) * 2.f - 1.f;
+						sum += sampleEquirect(pixels, width, height, faceDirection(face, s, t));
+					}
+				}
+				level[row * faceSize + x] = sum / (float)(samples * samples);
+			}
+		}
+		});
+	equirect.reset();
+
+	std::vector<unsigned char> data(header.dataSize);
+	for (size_t m = 0; m < mips.size(); m++) {
+		const uint32_t size = mips[m].width;
+		if (m > 0) {
+			//each face is box filtered on its own, the 1x1 levels only blur across the seams anyway
+			const uint32_t previousSize = mips[m - 1].width;
+			std::vector<glm::vec3> next((size_t)size * size * faceCount);
+			for (uint32_t face = 0; face < faceCount; face++) {
+				const glm::vec3* src = level.data() + (size_t)face * previousSize * previousSize;
+				glm::vec3* dst = next.data() + (size_t)face * size * size;
+				for (uint32_t y = 0; y < size; y++)
+					for (uint32_t x = 0; x < size; x++)
+						dst[y * size + x] = 0.25f * (
+							src[(2 * y) * previousSize + 2 * x] + src[(2 * y) * previousSize + 2 * x + 1] +
+							src[(2 * y + 1) * previousSize + 2 * x] + src[(2 * y + 1) * previousSize + 2 * x + 1]
+							);
+			}
+			level = std::move(next);
+		}
+
+		unsigned char* dst = data.data() + mips[m].offset;
+		for (size_t i = 0; i < level.size(); i++) {
+			uint32_t packed = packE5B9G9R9(level[i].r, level[i].g, level[i].b);
+			memcpy(dst + i * texelBytes, &packed, texelBytes);
+		}
+	}
+
+	std::string name = storeName(filepath, faceSize);
+	std::ofstream file = Store::openForWriting(name.c_str());
+	CookedWriter writer(file);
+	writer.write(&header, sizeof(header));
+	writer.padTo(header.mipTableOffset);
+	writer.write(mips.data(), sizeof(CookedMip) * mips.size());
+	writer.padTo(header.dataOffset);
+	writer.write(data.data(), data.size());
+	assert(writer.position == header.file.fileSize);
+
+	if (!file)
+		throw std::runtime_error("Failed to write cooked skybox for " + std::string(filepath));
+}
+
+std::optional<CookedSkybox> SkyboxCooker::loadCooked(const char* filepath, uint32_t faceSize) {
+	std::string name = storeName(filepath, faceSize);
+	if (!Store::itemInStore(name.c_str()))
+		return std::nullopt;
+
+	CookedSkybox cooked;
+	cooked.file = Store::mapBytes(name.c_str());
+	const unsigned char* base = cooked.file->data();
+	const size_t size = cooked.file->size();
+
+	CookedSkyboxHeader header;
+	if (!readCookedHeader(base, size, cookedMagic, SkyboxCooker::version, sourceFileHash(filepath), header) || header.faceSize != faceSize) {
+		std::cout << "Cooked skybox for " << filepath << " is stale" << std::endl;
+		return std::nullopt;
+	}
+
+	cooked.faceSize = header.faceSize;
+	const CookedMip* mips = reinterpret_cast<const CookedMip*>(base + header.mipTableOffset);
+	cooked.mips.assign(mips, mips + header.mipCount);
+	cooked.data = base + header.dataOffset;
+	cooked.dataSize = header.dataSize;
+	return cooked;
+}
+
+std::optional<CookedSkybox> SkyboxCooker::load(const char* filepath, uint32_t faceSize) {
+	if (auto cooked = loadCooked(filepath, faceSize))
+		return cooked;
+
+	try {
+		cook(filepath, faceSize);
+	}
+	catch (const std::exception& err) {
+		std::cerr << err.what() << std::endl;
+		return std::nullopt;
+	}
+	return loadCooked(filepath, faceSize);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "TextureCooker.hpp"
+#include "MappedFile.hpp"
+
+//equirectangular hdr images cooked into cubemap mip chains of shared exponent texels and kept in the Store
+//each level holds the six faces back to back in +x -x +y -y +z -z order, the layout one copy per level uploads
+
+struct CookedSkybox {
+	//keeps data alive
+	std::shared_ptr<MappedFile> file;
+
+	uint32_t faceSize;
+	//largest first, down to 1x1, offset and size cover all six faces of the level
+	std::vector<CookedMip> mips;
+	//E5B9G9R9 texels, mipLayout of the face size
+	const unsigned char* data;
+	uint64_t dataSize;
+};
+
+class SkyboxCooker {
+public:
+	//bump whenever the layout of the cooked file or the conversion changes
+	inline static const uint32_t version = 1;
+	inline static const uint32_t faceCount = 6;
+
+	static std::vector<CookedMip> mipLayout(uint32_t faceSize);
+	static uint64_t dataSize(uint32_t faceSize);
+
+	static std::string storeName(const char* filepath, uint32_t faceSize);
+
+	//resamples the image onto the faces, supersampled when the source is denser than them, box filters the mips
+	//faceSize is a power of two so every level halves evenly
+	//throws if the image can't be decoded
+	static void cook(const char* filepath, uint32_t faceSize);
+
+	//nullopt if there is no cooked file or it is stale
+	static std::optional<CookedSkybox> loadCooked(const char* filepath, uint32_t faceSize);
+
+	//cooks the image first if needed, nullopt if it can't be decoded
+	static std::optional<CookedSkybox> load(const char* filepath, uint32_t faceSize);
+
+	//VK_FORMAT_E5B9G9R9_UFLOAT_PACK32, negative values clamp to 0 and too large ones to the largest representable
+	static uint32_t packE5B9G9R9(float r, float g, float b);
+};
@@ -0,0 +1,157 @@
+#include "TextureCooker.hpp"
+#include "ImageLoader.hpp"
+#include "CookedFile.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+	constexpr uint32_t cookedMagic = 0x58544346; //"FCTX"
+
+	struct CookedTextureHeader {
+		CookedFileHeader file;
+
+		uint32_t format;
+		uint32_t isSRGB;
+		uint32_t desiredChannels;
+		uint32_t width;
+		uint32_t height;
+		uint32_t mipCount;
+
+		uint64_t mipTableOffset;
+		uint64_t dataOffset;
+		uint64_t dataSize;
+	};
+}
+
+BlockFormat TextureCooker::chooseFormat(int desiredChannels) {
+	switch (desiredChannels) {
+	case 1:
+		return BlockFormat::bc4;
+	case 2:
+		return BlockFormat::bc5;
+	case 3:
+		return BlockFormat::bc1;
+	default:
+		return BlockFormat::bc7;
+	}
+}
+
+std::vector<CookedMip> TextureCooker::mipLayout(BlockFormat format, uint32_t width, uint32_t height) {
+	std::vector<CookedMip> mips;
+	uint64_t offset = 0;
+	while (true) {
+		CookedMip mip;
+		mip.offset = offset;
+		mip.size = compressedSize(format, width, height);
+		mip.width = width;
+		mip.height = height;
+		mips.push_back(mip);
+		//sizes are whole blocks, so every level stays aligned to the block size
+		offset += mip.size;
+		if (width == 1 && height == 1)
+			break;
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+	return mips;
+}
+
+uint64_t TextureCooker::dataSize(BlockFormat format, uint32_t width, uint32_t height) {
+	const CookedMip& last = mipLayout(format, width, height).back();
+	return last.offset + last.size;
+}
+
+std::string TextureCooker::storeName(const char* filepath, int desiredChannels, bool isSRGB) {
+	return cookedStoreName("texture", filepath, desiredChannels, isSRGB);
+}
+
+void TextureCooker::cook(const char* filepath, int desiredChannels, bool isSRGB, BlockQuality quality) {
+	ImagePtr image = loadImageFromFile(filepath, isSRGB, desiredChannels);
+	const BlockFormat format = chooseFormat(desiredChannels);
+	const std::vector<CookedMip> mips = mipLayout(format, image->getWidth(), image->getHeight());
+
+	CookedTextureHeader header{};
+	header.file = makeCookedFileHeader(cookedMagic, TextureCooker::version, filepath);
+	header.format = (uint32_t)format;
+	header.isSRGB = isSRGB;
+	header.desiredChannels = desiredChannels;
+	header.width = image->getWidth();
+	header.height = image->getHeight();
+	header.mipCount = (uint32_t)mips.size();
+	header.mipTableOffset = alignUp(sizeof(header));
+	header.dataOffset = alignUp(header.mipTableOffset + sizeof(CookedMip) * mips.size());
+	header.dataSize = mips.back().offset + mips.back().size;
+	header.file.fileSize = header.dataOffset + header.dataSize;
+
+	std::vector<unsigned char> data(header.dataSize);
+	//every level is filtered from the one above, the resize handles srgb and alpha
+	ImagePtr level;
+	for (size_t m = 0; m < mips.size(); m++) {
+		if (m > 0)
+			level = (level ? level : image)->resize(mips[m].width, mips[m].height);
+		ImageData& pixels = m == 0 ? *image : *level;
+		compressBlocks(format, pixels.getData(), mips[m].width, mips[m].height, desiredChannels, data.data() + mips[m].offset, quality);
+	}
+
+	std::string name = storeName(filepath, desiredChannels, isSRGB);
+	std::ofstream file = Store::openForWriting(name.c_str());
+	CookedWriter writer(file);
+	writer.write(&header, sizeof(header));
+	writer.padTo(header.mipTableOffset);
+	writer.write(mips.data(), sizeof(CookedMip) * mips.size());
+	writer.padTo(header.dataOffset);
+	writer.write(data.data(), data.size());
+	assert(writer.position == header.file.fileSize);
+
+	if (!file)
+		throw std::runtime_error("Failed to write cooked texture for " + std::string(filepath));
+}
+
+std::optional<CookedTexture> TextureCooker::loadCooked(const char* filepath, int desiredChannels, bool isSRGB) {
+	std::string name = storeName(filepath, desiredChannels, isSRGB);
+	if (!Store::itemInStore(name.c_str()))
+		return std::nullopt;
+
+	CookedTexture cooked;
+	cooked.file = Store::mapBytes(name.c_str());
+	const unsigned char* base = cooked.file->data();
+	const size_t size = cooked.file->size();
+
+	CookedTextureHeader header;
+	if (
+		!readCookedHeader(base, size, cookedMagic, TextureCooker::version, sourceFileHash(filepath), header) ||
+		header.format != (uint32_t)chooseFormat(desiredChannels) ||
+		header.isSRGB != (uint32_t)isSRGB ||
+		header.desiredChannels != (uint32_t)desiredChannels
+		) {
+		std::cout << "Cooked texture for " << filepath << " is stale" << std::endl;
+		return std::nullopt;
+	}
+
+	cooked.format = (BlockFormat)header.format;
+	cooked.isSRGB = header.isSRGB != 0;
+	cooked.width = header.width;
+	cooked.height = header.height;
+	const CookedMip* mips = reinterpret_cast<const CookedMip*>(base + header.mipTableOffset);
+	cooked.mips.assign(mips, mips + header.mipCount);
+	cooked.data = base + header.dataOffset;
+	cooked.dataSize = header.dataSize;
+	return cooked;
+}
+
+std::optional<CookedTexture> TextureCooker::load(const char* filepath, int desiredChannels, bool isSRGB, BlockQuality cookQuality) {
+	if (auto cooked = loadCooked(filepath, desiredChannels, isSRGB))
+		return cooked;
+
+	try {
+		cook(filepath, desiredChannels, isSRGB, cookQuality);
+	}
+	catch (const std::exception& err) {
+		std::cerr << err.what() << std::endl;
+		return std::nullopt;
+	}
+	return loadCooked(filepath, desiredChannels, isSRGB);
+}
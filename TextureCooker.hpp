@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "BlockCompression.hpp"
+#include "MappedFile.hpp"
+
+//textures cooked into block compressed mip chains and kept in the Store
+//cooked levels are stored back to back so a loader copies all of them into staging at once
+
+//offset is relative to the first level
+struct CookedMip {
+	uint64_t offset;
+	uint64_t size;
+	uint32_t width;
+	uint32_t height;
+};
+
+struct CookedTexture {
+	//keeps data alive
+	std::shared_ptr<MappedFile> file;
+
+	BlockFormat format;
+	bool isSRGB;
+	uint32_t width;
+	uint32_t height;
+	//largest first, down to 1x1
+	std::vector<CookedMip> mips;
+	//every level, mipLayout of the texture
+	const unsigned char* data;
+	uint64_t dataSize;
+};
+
+class TextureCooker {
+public:
+	//bump whenever the layout of the cooked file or the encoders change
+	inline static const uint32_t version = 1;
+
+	//bc7 for color, bc5 for two channel data like metallic roughness, bc4 for one and bc1 for rgb without alpha
+	static BlockFormat chooseFormat(int desiredChannels);
+	//levels of a full mip chain, the layout cooked textures store their data in
+	static std::vector<CookedMip> mipLayout(BlockFormat format, uint32_t width, uint32_t height);
+	static uint64_t dataSize(BlockFormat format, uint32_t width, uint32_t height);
+
+	//name of the cooked item in the Store, only depends on the path and how the image is loaded
+	static std::string storeName(const char* filepath, int desiredChannels, bool isSRGB);
+
+	//decodes the image, filters every level from the one above, srgb images in linear space, and compresses them
+	//throws if the image can't be decoded
+	static void cook(const char* filepath, int desiredChannels, bool isSRGB, BlockQuality quality = BlockQuality::high);
+
+	//nullopt if there is no cooked file or it is stale
+	static std::optional<CookedTexture> loadCooked(const char* filepath, int desiredChannels, bool isSRGB);
+
+	//cooks the image first if needed with cookQuality, nullopt if it can't be decoded
+	static std::optional<CookedTexture> load(const char* filepath, int desiredChannels, bool isSRGB, BlockQuality cookQuality = BlockQuality::high);
+};
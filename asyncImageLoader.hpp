@@ -1,5 +1,7 @@
 #pragma once
 #include "ImageLoader.hpp"
+#include "TextureCooker.hpp"
+#include "SkyboxCooker.hpp"
 #include "ConcurrentQueue.hpp"
 #include "buffer.hpp"
 
@@ -7,13 +9,23 @@
 
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
 
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <vector>
 #include <functional>
+#include <cstring>
 
-//todo add multiple workers
+//shared by the caller and the loader, lets the caller reorder or drop a request it no longer needs
+struct ImageLoadTicket {
+	std::atomic<bool> cancelled{ false };
+	//higher loads first, guarded by the loader's mutex
+	float priority = 0.f;
+};
+typedef std::shared_ptr<ImageLoadTicket> ImageLoadHandle;
 
 struct ImageLoadRequest{
 	std::string path;
@@ -22,105 +34,188 @@ struct ImageLoadRequest{
 
 	bool isSRGB = true;
 	bool isFloat = false;
+	//staging holds the TextureCooker mip chain of the image instead of its pixels, resolution is the size of the image
+	bool cooked = false;
+	//staging holds the SkyboxCooker mip chain converted from an equirectangular image, resolution is face size x face size x 6
+	bool cubemap = false;
+	//higher loads first, like screen space importance or negated distance to the camera, equal ones in request order
+	float priority = 0.f;
 
 	std::function<void(ImageLoadRequest&, std::shared_ptr<Buffer>)> callback;
 
+	//where the pixels start in the staging buffer passed to the callback, set by the loader
+	size_t stagingOffset;
+
 	bool __isComplete;
 	bool __isSuccess;
-	
+
 	int __assigned_buffer__; //internal do not use
 	int __id__; //internal
+	ImageLoadHandle __ticket__; //internal
 };
 
+//decodes images on a pool of worker threads into ranges of persistent staging buffers
+//workers sleep until a request comes in and staging has room for it, results are handed back in completion order
+//requests are started highest priority first, cancelled ones are dropped before decode and before their callback
 class AsyncImageLoader {
 private:
+	struct StagingRange {
+		size_t offset;
+		size_t size;
+	};
+
+	//copies out of staging need offsets that are multiples of the texel size
+	inline static const size_t stagingAlignment = 16;
+
 	const glm::ivec3 maxDimensions;
 	const int maxNumComponents;
 	const size_t bufferSizeBytes;
 	const int numBuffers;
+	const int numWorkers;
 
 	std::vector<std::shared_ptr<Buffer>> stagingBuffers;
-	//boolean telling whether it is free or not (if free it is true)
-	std::vector<bool> isBufferFree;
 
-	ConcurrentQueue<ImageLoadRequest> requestQueue;
+	//guards everything below up to the result queue, workers wait on wakeWorkers
+	std::mutex mutex;
+	std::condition_variable wakeWorkers;
+	//free ranges of each staging buffer, sorted by offset
+	std::vector<std::vector<StagingRange>> freeRanges;
+	//unordered, workers pick the highest priority each time since priorities change while queued
+	std::vector<ImageLoadRequest> requestQueue;
+	bool stopWorkers = false;
+
 	ConcurrentQueue<ImageLoadRequest> resultQueue;
 
-	std::thread worker;
-	std::atomic<bool> stopWorker{ false };
+	std::vector<std::thread> workers;
 	bool isWorkerRunning = false;
-	
 
-	void workerThread() {
-		while (!stopWorker) {
-			if (requestQueue.empty())
-				continue;
+	static size_t requestSize(const ImageLoadRequest& req) {
+		if (req.cubemap)
+			return SkyboxCooker::dataSize(req.resolution.x);
+		if (req.cooked)
+			return TextureCooker::dataSize(TextureCooker::chooseFormat(req.desiredChannels), req.resolution.x, req.resolution.y);
+		return (size_t)req.resolution.x * req.resolution.y * req.resolution.z * req.desiredChannels *
+			(req.isFloat ? sizeof(float) : sizeof(unsigned char));
+	}
 
-			//allot staging buffer to request
-			int allotted = 0;
-			{
-				for (allotted; allotted < this->stagingBuffers.size(); allotted++) {
-					if (this->isBufferFree[allotted]) {
-						break;
-					}
-				}
-				if (allotted == stagingBuffers.size()) {
-					//could not allot
+	static size_t alignedSize(size_t size) {
+		return (size + stagingAlignment - 1) & ~(stagingAlignment - 1);
+	}
+
+	//first fit over all buffers, called with the mutex held
+	bool claimStaging(ImageLoadRequest& req) {
+		size_t size = alignedSize(requestSize(req));
+		for (int b = 0; b < numBuffers; b++) {
+			for (auto it = freeRanges[b].begin(); it != freeRanges[b].end(); ++it) {
+				if (it->size < size)
 					continue;
-				}
-				//mark not free anymore
-				this->isBufferFree[allotted] = false;
+				req.__assigned_buffer__ = b;
+				req.stagingOffset = it->offset;
+				it->offset += size;
+				it->size -= size;
+				if (it->size == 0)
+					freeRanges[b].erase(it);
+				return true;
 			}
+		}
+		return false;
+	}
 
-			auto req = requestQueue.pop();
-			std::cout << "Worker " << req.__id__ << " popped: " << req.path << " " << req.resolution.x << "x" << req.resolution.y  << " (" << req.desiredChannels << ")" << std::endl;
+	//drops cancelled requests and claims staging for the highest priority one, called with the mutex held
+	//a large request waiting for room holds back the lower priority ones
+	bool claimNext(size_t& index) {
+		requestQueue.erase(std::remove_if(requestQueue.begin(), requestQueue.end(), [](const ImageLoadRequest& req) {
+			return req.__ticket__->cancelled.load();
+			}), requestQueue.end());
+		if (requestQueue.empty())
+			return false;
+
+		auto next = std::max_element(requestQueue.begin(), requestQueue.end(), [](const ImageLoadRequest& a, const ImageLoadRequest& b) {
+			if (a.__ticket__->priority != b.__ticket__->priority)
+				return a.__ticket__->priority < b.__ticket__->priority;
+			return a.__id__ > b.__id__;
+			});
+		if (!claimStaging(*next))
+			return false;
+		index = next - requestQueue.begin();
+		return true;
+	}
 
-			std::shared_ptr<Buffer> staging = this->stagingBuffers[req.__assigned_buffer__];
+	//merges with the neighbouring free ranges, called with the mutex held
+	void releaseStaging(const ImageLoadRequest& req) {
+		auto& ranges = freeRanges[req.__assigned_buffer__];
+		StagingRange range{ req.stagingOffset, alignedSize(requestSize(req)) };
+		auto next = std::lower_bound(ranges.begin(), ranges.end(), range.offset, [](const StagingRange& r, size_t offset) {
+			return r.offset < offset;
+			});
+		if (next != ranges.end() && range.offset + range.size == next->offset) {
+			range.size += next->size;
+			next = ranges.erase(next);
+		}
+		if (next != ranges.begin()) {
+			auto prev = next - 1;
+			if (prev->offset + prev->size == range.offset) {
+				prev->size += range.size;
+				return;
+			}
+		}
+		ranges.insert(next, range);
+	}
+
+	//pixels are decoded and resized straight into staging, cooked mips are copied out of the mapped file
+	void decode(const ImageLoadRequest& req, unsigned char* dst) {
+		if (req.cubemap) {
+			auto skybox = SkyboxCooker::load(req.path.c_str(), req.resolution.x);
+			if (!skybox)
+				throw std::runtime_error("Could not cook " + req.path);
+			memcpy(dst, skybox->data, skybox->dataSize);
+		}
+		else if (req.cooked) {
+			//a texture not cooked yet is compressed here between decode and staging, at the fast quality to not hold up the load
+			auto texture = TextureCooker::load(req.path.c_str(), req.desiredChannels, req.isSRGB, BlockQuality::fast);
+			if (!texture)
+				throw std::runtime_error("Could not cook " + req.path);
+			if (texture->dataSize != requestSize(req))
+				throw std::runtime_error("Cooked texture " + req.path + " does not match the requested resolution");
+			memcpy(dst, texture->data, texture->dataSize);
+		}
+		else if (req.isFloat) {
+			loadFloatImageInto(req.path.c_str(), req.desiredChannels, glm::ivec2(req.resolution), reinterpret_cast<float*>(dst));
+		}
+		else {
+			loadImageInto(req.path.c_str(), req.isSRGB, req.desiredChannels, glm::ivec2(req.resolution), dst);
+		}
+	}
 
+	void workerThread() {
+		while (true) {
+			ImageLoadRequest req;
 			{
-				if (req.isFloat) {
-					FloatImagePtr imageData = loadFloatImageFromFile(
-						req.path.c_str(),
-						req.desiredChannels
-					);
-
-					if (imageData->getResolution() != glm::ivec2(req.resolution)) {
-						//need to resize image
-						imageData = std::move(imageData->resize(req.resolution.x, req.resolution.y));
-					}
-
-					memcpy(
-						staging->allocation->GetMappedData(),
-						imageData->getData(),
-						imageData->getSizeInBytes()
-					);
-					imageData.reset();
-				}
-				else
-				{
-					ImagePtr imageData = loadImageFromFile(
-						req.path.c_str(),
-						req.isSRGB,
-						req.desiredChannels
-					);
-
-					if (imageData->getResolution() != glm::ivec2(req.resolution)) {
-						//need to resize image
-						imageData = std::move(imageData->resize(req.resolution.x, req.resolution.y));
-					}
-
-					memcpy(
-						staging->allocation->GetMappedData(),
-						imageData->getData(),
-						imageData->getSizeInBytes()
-					);
-
-					imageData.reset();
-				}
+				std::unique_lock<std::mutex> lock(mutex);
+				size_t index = 0;
+				wakeWorkers.wait(lock, [this, &index] {
+					return stopWorkers || claimNext(index);
+					});
+				if (stopWorkers)
+					return;
+				req = std::move(requestQueue[index]);
+				requestQueue[index] = std::move(requestQueue.back());
+				requestQueue.pop_back();
+			}
+
+			std::cout << "Worker " << req.__id__ << " popped: " << req.path << " " << req.resolution.x << "x" << req.resolution.y << " (" << req.desiredChannels << ")" << std::endl;
+
+			unsigned char* staging = reinterpret_cast<unsigned char*>(this->stagingBuffers[req.__assigned_buffer__]->allocation->GetMappedData());
+			try {
+				decode(req, staging + req.stagingOffset);
+				req.__isSuccess = true;
+			}
+			catch (const std::exception& err) {
+				std::cerr << err.what() << std::endl;
+				req.__isSuccess = false;
 			}
 
 			req.__isComplete = true;
-			req.__isSuccess = true;
 			resultQueue.push(req);
 		}
 	}
@@ -130,8 +225,9 @@ public:
 	AsyncImageLoader(const AsyncImageLoader& loader) = delete;
 
 	//maxDimensions apply for float images, so normal byte per component images have a larger upper bound
-	AsyncImageLoader(glm::ivec3 maxDimensions, int maxNumComponents, int numBuffers)
-		: maxDimensions(maxDimensions), maxNumComponents(maxNumComponents), numBuffers(numBuffers),
+	//smaller images share staging buffers, so up to numWorkers of them decode at once
+	AsyncImageLoader(glm::ivec3 maxDimensions, int maxNumComponents, int numBuffers, int numWorkers)
+		: maxDimensions(maxDimensions), maxNumComponents(maxNumComponents), numBuffers(numBuffers), numWorkers(numWorkers),
 		bufferSizeBytes((size_t)maxDimensions.x * maxDimensions.y * maxDimensions.z * maxNumComponents * sizeof(float))
 	{}
 
@@ -146,7 +242,7 @@ public:
 			std::cout << "Warning Async Image Loader being destroyed with non empty results queue" << std::endl;
 		}
 	}
-	
+
 	void init() {
 		//create staging buffers
 		size_t maxSize = bufferSizeBytes;
@@ -155,68 +251,101 @@ public:
 			this->stagingBuffers.push_back(
 				prepareStagingBufferPersistant(VulkanUtils::utils().getCore(), maxSize)
 			);
-			this->isBufferFree.push_back(true);
+			this->freeRanges.push_back({ StagingRange{ 0, maxSize } });
 		}
 	}
 
 	void start() {
 		assert(isWorkerRunning == false);
-		
-		stopWorker = false;
- 		this->worker = std::move(std::thread(
-			&AsyncImageLoader::workerThread,
-			this
-		));
+
+		stopWorkers = false;
+		for (int i = 0; i < this->numWorkers; i++) {
+			this->workers.emplace_back(
+				&AsyncImageLoader::workerThread,
+				this
+			);
+		}
 		isWorkerRunning = true;
 	}
 
 	void stop() {
 		assert(isWorkerRunning == true);
-		
-		stopWorker = true;
-		worker.join();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopWorkers = true;
+		}
+		wakeWorkers.notify_all();
+		for (auto& worker : workers)
+			worker.join();
+		workers.clear();
 		isWorkerRunning = false;
 	}
 
 	int ids = 0;
-	void request(ImageLoadRequest req) {
-#ifndef NDEBUG
-		if (
-			(
-				(size_t)req.resolution.x *
-				req.resolution.y *
-				req.resolution.z *
-				(req.isFloat ? sizeof(float) : sizeof(unsigned char))
-			) > bufferSizeBytes
-		){
+	ImageLoadHandle request(ImageLoadRequest req) {
+		req.__ticket__ = std::make_shared<ImageLoadTicket>();
+		req.__ticket__->priority = req.priority;
+
+		//would never get staging and hold back every request after it
+		if (requestSize(req) > bufferSizeBytes) {
 			std::cerr << (
 				"ImageLoadRequest resolution too large! " +
 				req.path + ": " +
 				std::to_string(req.resolution.x) + "x" +
 				std::to_string(req.resolution.y) + "x" +
 				std::to_string(req.resolution.z)
-				);
+				) << std::endl;
 			assert(false);
+			req.__ticket__->cancelled = true;
+			return req.__ticket__;
 		}
-#endif
 
 		req.__id__ = ids++;
 		req.__isComplete = false;
 		req.__isSuccess = false;
-		
-		this->requestQueue.push(req);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			this->requestQueue.push_back(req);
+		}
+		wakeWorkers.notify_one();
+		return req.__ticket__;
+	}
+
+	//takes effect for requests not yet started
+	void setPriority(const ImageLoadHandle& handle, float priority) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			handle->priority = priority;
+		}
+		//a waiting worker may be able to start the new highest priority request
+		wakeWorkers.notify_all();
+	}
+
+	//queued requests are dropped, one already decoding is dropped before its callback
+	void cancel(const ImageLoadHandle& handle) {
+		handle->cancelled = true;
 	}
 
 	void processResults() {
+		bool released = false;
 		while (!resultQueue.empty()) {
 			auto result = resultQueue.pop();
-			if (result.__isComplete && result.__isSuccess) {
+			//cancelled while decoding, the staging just goes back
+			bool cancelled = result.__ticket__->cancelled;
+			if (!cancelled && result.__isComplete && result.__isSuccess) {
 				result.callback(result, this->stagingBuffers[result.__assigned_buffer__]);
 			}
-			else {
+			else if (!cancelled) {
 				std::cerr << "Could not service async image load request" << std::endl;
 			}
-			this->isBufferFree[result.__assigned_buffer__] = true;
+			std::lock_guard<std::mutex> lock(mutex);
+			releaseStaging(result);
+			released = true;
 		}
+		//any waiting request may fit now
+		if (released)
+			wakeWorkers.notify_all();
 	}
-};
\ No newline at end of file
+};
@@ -0,0 +1,352 @@
+#pragma once
+#include "ModelCache.hpp"
+#include "ConcurrentQueue.hpp"
+#include "mesh.hpp"
+#include "buffer.hpp"
+
+#include <glm/glm.hpp>
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <string>
+#include <iostream>
+#include <vector>
+#include <functional>
+
+//loads a model on a worker thread and streams its meshes to the gpu a few at a time
+//the worker cooks or maps the model, then writes meshes into staging nearest to the viewer first,
+//the main thread records the copies into the frames it is drawing anyway, so nothing waits on the upload
+//buffers the whole model needs, like culling data, go through the same per frame budget ahead of the meshes
+
+struct ModelLoadRequest {
+	std::string path;
+	//ModelCache flags
+	uint32_t cookFlags = 0;
+	//meshes of instances closest to it are uploaded first
+	glm::vec3 viewPos = glm::vec3(0.f);
+
+	//worker thread, once the model is loaded and before onModelLoaded gets it
+	//for cpu work on the model that would otherwise stall the frame that switches to it
+	std::function<void(const CookedModel&)> onWorkerLoaded;
+	//worker thread, once every mesh is staged, for background work nothing of the model waits on
+	//superseded turns true when a newer request or stop makes the work pointless
+	std::function<void(const std::function<bool()>& superseded)> onWorkerStaged;
+	//main thread, before any of the model's meshes are resident, null if the model could not be loaded
+	//the worker keeps reading the meshes and bounds while the rest of the model can be moved out
+	std::function<void(std::shared_ptr<CookedModel>)> onModelLoaded;
+	//main thread, while recording the first frame that may draw the mesh
+	std::function<void(uint32_t meshIndex, const Mesh&)> onMeshResident;
+
+	uint32_t __generation__; //internal
+};
+
+class AsyncModelLoader {
+private:
+	struct LoadedModel {
+		ModelLoadRequest request;
+		std::shared_ptr<CookedModel> model;
+	};
+
+	struct MeshUpload {
+		uint32_t generation;
+		uint32_t meshIndex;
+		Mesh mesh;
+		std::shared_ptr<Buffer> staging;
+		size_t stagingBytes;
+	};
+
+	//staging the worker may hold at once, a single mesh over it is still loaded on its own
+	const size_t stagingBudgetBytes;
+	//uploads recorded per frame stop once they pass this, at least one goes through every frame
+	const size_t uploadBytesPerFrame;
+
+	ConcurrentQueue<ModelLoadRequest> requestQueue;
+	ConcurrentQueue<LoadedModel> modelQueue;
+	ConcurrentQueue<MeshUpload> uploadQueue;
+
+	std::atomic<size_t> stagingBytesInUse{ 0 };
+	//bumped by every request, the worker drops work of older ones
+	std::atomic<uint32_t> generation{ 0 };
+	//the worker waits on it for staging budget, signalled when staging is released or the generation changes
+	std::mutex stagingMutex;
+	std::condition_variable stagingChanged;
+
+	//main thread only
+	//generation whose onModelLoaded ran, its uploads wait in pendingUploads until then
+	uint32_t loadedGeneration = 0;
+	std::function<void(uint32_t, const Mesh&)> onMeshResident;
+	std::deque<MeshUpload> pendingUploads;
+	//of the loaded model, all copied before any of its meshes
+	std::deque<BufferUpload> pendingBufferUploads;
+	size_t residentMeshes = 0;
+	size_t totalMeshes = 0;
+	//staging copied from by each frame in flight, freed when that frame is recorded again
+	std::vector<MeshUpload> retiredUploads[MAX_FRAMES_IN_FLIGHT];
+	std::vector<BufferUpload> retiredBufferUploads[MAX_FRAMES_IN_FLIGHT];
+
+	std::thread worker;
+	std::atomic<bool> stopWorker{ false };
+	bool isWorkerRunning = false;
+
+	bool isStale(uint32_t requestGeneration) const {
+		return stopWorker || requestGeneration != generation;
+	}
+
+	void releaseStaging(const MeshUpload& upload) {
+		{
+			std::lock_guard<std::mutex> lock(stagingMutex);
+			stagingBytesInUse -= upload.stagingBytes;
+		}
+		stagingChanged.notify_one();
+	}
+
+	//changes under the lock so the worker can't miss the wake up between its check and its wait
+	void notifyWorker(const std::function<void()>& change) {
+		{
+			std::lock_guard<std::mutex> lock(stagingMutex);
+			change();
+		}
+		stagingChanged.notify_one();
+	}
+
+	void runModelLoaded(LoadedModel& loaded) {
+		if (!loaded.model)
+			std::cerr << "Could not load model " << loaded.request.path << std::endl;
+		//the new model uploads all of its buffers again
+		else
+			pendingBufferUploads.clear();
+
+		loaded.request.onModelLoaded(loaded.model);
+		loadedGeneration = loaded.request.__generation__;
+		//on failure the previous model stays with whatever of it is resident
+		if (loaded.model) {
+			onMeshResident = loaded.request.onMeshResident;
+			residentMeshes = 0;
+			totalMeshes = loaded.model->meshes.size();
+		}
+		else {
+			totalMeshes = residentMeshes;
+		}
+	}
+
+	void workerThread() {
+		auto core = VulkanUtils::utils().getCore();
+		while (true) {
+			auto req = requestQueue.pop();
+			if (stopWorker)
+				break;
+			if (isStale(req.__generation__))
+				continue;
+
+			auto start = std::chrono::high_resolution_clock::now();
+			auto cooked = ModelCache::load(req.path.c_str(), req.cookFlags);
+			if (!cooked) {
+				modelQueue.push({ req, nullptr });
+				continue;
+			}
+			auto model = std::make_shared<CookedModel>(std::move(*cooked));
+			if (req.onWorkerLoaded) {
+				req.onWorkerLoaded(*model);
+				if (isStale(req.__generation__))
+					continue;
+			}
+
+			//distance from the viewer to the nearest instance of each mesh, read before the main thread gets the model
+			std::vector<float> meshDistances(model->meshes.size(), std::numeric_limits<float>::max());
+			for (size_t i = 0; i < model->meshIndex.size(); i++) {
+				const glm::vec4& sphere = model->bounds[i].sphere;
+				float distance = std::max(glm::distance(glm::vec3(sphere), req.viewPos) - sphere.w, 0.f);
+				float& meshDistance = meshDistances[model->meshIndex[i]];
+				meshDistance = std::min(meshDistance, distance);
+			}
+			std::vector<uint32_t> order(model->meshes.size());
+			for (uint32_t i = 0; i < order.size(); i++)
+				order[i] = i;
+			std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+				return meshDistances[a] < meshDistances[b];
+				});
+
+			modelQueue.push({ req, model });
+
+			for (uint32_t meshIndex : order) {
+				const MeshDataView& view = model->meshes[meshIndex];
+				size_t stagingBytes = std::max<size_t>(Mesh::stagingSize(view), 4);
+				{
+					std::unique_lock<std::mutex> lock(stagingMutex);
+					stagingChanged.wait(lock, [&]() {
+						return isStale(req.__generation__) || stagingBytesInUse == 0 || stagingBytesInUse + stagingBytes <= stagingBudgetBytes;
+						});
+					if (isStale(req.__generation__))
+						break;
+					stagingBytesInUse += stagingBytes;
+				}
+
+				auto staging = prepareStagingBufferPersistant(core, stagingBytes);
+				Mesh mesh(core, view, reinterpret_cast<unsigned char*>(staging->allocation->GetMappedData()));
+				uploadQueue.push({ req.__generation__, meshIndex, std::move(mesh), staging, stagingBytes });
+			}
+
+			auto end = std::chrono::high_resolution_clock::now();
+			std::cout << "Model " << req.path << " staged in " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms" << std::endl;
+
+			if (req.onWorkerStaged && !isStale(req.__generation__)) {
+				uint32_t requestGeneration = req.__generation__;
+				req.onWorkerStaged([this, requestGeneration]() { return isStale(requestGeneration); });
+			}
+		}
+	}
+
+public:
+	AsyncModelLoader() = delete;
+	AsyncModelLoader(const AsyncModelLoader& loader) = delete;
+
+	AsyncModelLoader(size_t stagingBudgetBytes, size_t uploadBytesPerFrame)
+		: stagingBudgetBytes(stagingBudgetBytes), uploadBytesPerFrame(uploadBytesPerFrame)
+	{}
+
+	~AsyncModelLoader() {
+		if (isWorkerRunning) {
+			this->stop();
+		}
+	}
+
+	void start() {
+		assert(isWorkerRunning == false);
+
+		stopWorker = false;
+		this->worker = std::thread(
+			&AsyncModelLoader::workerThread,
+			this
+		);
+		isWorkerRunning = true;
+	}
+
+	void stop() {
+		assert(isWorkerRunning == true);
+
+		notifyWorker([this]() { stopWorker = true; });
+		//wakes the worker if it waits for a request
+		requestQueue.push({});
+		worker.join();
+		isWorkerRunning = false;
+	}
+
+	//supersedes any model still loading, the current one keeps drawing until onModelLoaded
+	void request(ModelLoadRequest req) {
+		notifyWorker([this, &req]() { req.__generation__ = ++generation; });
+		this->requestQueue.push(req);
+	}
+
+	//runs onModelLoaded of the latest request once its model is loaded, returns true if it did
+	bool processModels() {
+		bool processed = false;
+		while (!modelQueue.empty()) {
+			auto loaded = modelQueue.pop();
+			if (loaded.request.__generation__ != generation)
+				continue;
+			runModelLoaded(loaded);
+			processed = true;
+		}
+		return processed;
+	}
+
+	//blocks until onModelLoaded of the latest request ran, for a first model nothing can be drawn without
+	void waitForModel() {
+		while (loadedGeneration != generation) {
+			auto loaded = modelQueue.pop();
+			if (loaded.request.__generation__ == generation)
+				runModelLoaded(loaded);
+		}
+	}
+
+	//main thread, from onModelLoaded, the buffers are written in place while older frames may still read them
+	void queueBufferUploads(std::vector<BufferUpload> uploads) {
+		for (auto& upload : uploads) {
+			if (upload.bytes.size > 0)
+				pendingBufferUploads.push_back(std::move(upload));
+		}
+	}
+
+	//records copies of staged buffers and meshes into the frame's command buffer before anything draws
+	//must come before the frame binds the descriptor sets onMeshResident writes
+	void processUploads(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+		//the frame's last copies are done
+		for (auto& upload : retiredUploads[frameIndex])
+			releaseStaging(upload);
+		retiredUploads[frameIndex].clear();
+		retiredBufferUploads[frameIndex].clear();
+
+		while (!uploadQueue.empty())
+			pendingUploads.push_back(uploadQueue.pop());
+
+		const VkPipelineStageFlags readStages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+
+		size_t uploadedBytes = 0;
+		if (!pendingBufferUploads.empty()) {
+			//frames still in flight read and write the old contents, the copies wait for them
+			barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			vkCmdPipelineBarrier(commandBuffer, readStages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+		}
+		while (!pendingBufferUploads.empty() && uploadedBytes < uploadBytesPerFrame) {
+			BufferUpload& upload = pendingBufferUploads.front();
+			VkBufferCopy region{};
+			region.size = upload.bytes.size;
+			vkCmdCopyBuffer(commandBuffer, upload.bytes.staging->buffer, upload.dst->buffer, 1, &region);
+			uploadedBytes += upload.bytes.size;
+			retiredBufferUploads[frameIndex].push_back(std::move(upload));
+			pendingBufferUploads.pop_front();
+		}
+
+		//none of the model's meshes is drawn before its buffers are in place
+		while (pendingBufferUploads.empty() && !pendingUploads.empty() && uploadedBytes < uploadBytesPerFrame) {
+			MeshUpload& upload = pendingUploads.front();
+			if (upload.generation == generation && upload.generation != loadedGeneration)
+				break;
+			if (upload.generation == loadedGeneration && upload.generation == generation) {
+				upload.mesh.recordUpload(commandBuffer, upload.staging->buffer);
+				uploadedBytes += upload.stagingBytes;
+				retiredUploads[frameIndex].push_back(std::move(upload));
+			}
+			else {
+				releaseStaging(upload);
+			}
+			pendingUploads.pop_front();
+		}
+		if (retiredUploads[frameIndex].empty() && retiredBufferUploads[frameIndex].empty())
+			return;
+
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, readStages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		for (const MeshUpload& upload : retiredUploads[frameIndex]) {
+			onMeshResident(upload.meshIndex, upload.mesh);
+			residentMeshes++;
+		}
+	}
+
+	//a request is still loading or the loaded model has buffers or meshes left to upload
+	bool isLoading() const {
+		return loadedGeneration != generation || hasPendingBufferUploads() || residentMeshes < totalMeshes;
+	}
+	//the loaded model's buffers are not all copied yet, nothing may write them meanwhile
+	bool hasPendingBufferUploads() const {
+		return !pendingBufferUploads.empty();
+	}
+	size_t residentMeshCount() const {
+		return residentMeshes;
+	}
+	size_t meshCount() const {
+		return totalMeshes;
+	}
+};
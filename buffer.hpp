@@ -1,4 +1,6 @@
 #pragma once
+#include <atomic>
+
 #include "core.hpp"
 
 struct BufferCopyInfo {
@@ -20,7 +22,8 @@ public:
 	VkBuffer buffer;
 	VmaAllocation allocation;
 
-	inline static int activeAllocatedCount = 0;
+	//buffers are also created on loader threads
+	inline static std::atomic<int> activeAllocatedCount{ 0 };
 
 	static std::shared_ptr<Buffer> create(VulkanCore core,
 		VkDeviceSize size,
@@ -65,6 +68,18 @@ inline void copyBuffer(VulkanCore core, VkCommandPool commandPool, std::vector<B
 	core->endSingleTimeCommands(commandPool, commandBuffer);
 }
 
+//records small updates inline in the command buffer, outside of render passes
+//offset and size have to be multiples of 4, the caller adds the barriers around it
+inline void cmdUpdateBuffer(VkCommandBuffer commandBuffer, VkBuffer dst, VkDeviceSize offset, const void* data, VkDeviceSize size) {
+	//vkCmdUpdateBuffer takes at most 64kb at once
+	constexpr VkDeviceSize maxUpdateSize = 65536;
+	const char* bytes = reinterpret_cast<const char*>(data);
+	for (VkDeviceSize done = 0; done < size; done += maxUpdateSize) {
+		VkDeviceSize chunk = std::min(maxUpdateSize, size - done);
+		vkCmdUpdateBuffer(commandBuffer, dst, offset + done, chunk, bytes + done);
+	}
+}
+
 inline auto prepareStagingBufferPersistant(VulkanCore core, size_t dataSize) {
 	auto stagingBuffer = Buffer::create(
 		core, dataSize,
@@ -89,3 +104,23 @@ inline auto prepareStagingBuffer(VulkanCore core, const void* data, size_t dataS
 	vmaUnmapMemory(core->allocator, stagingBuffer->allocation);
 	return stagingBuffer;
 }
+
+//host copy of data a frame's command buffer copies into a device buffer
+//vma is thread safe, so it can be staged on worker threads
+struct StagedBytes {
+	std::shared_ptr<Buffer> staging;
+	VkDeviceSize size = 0;
+};
+
+template<typename T>
+inline StagedBytes stageVector(VulkanCore core, const std::vector<T>& data) {
+	if (data.empty())
+		return {};
+	return { prepareStagingBuffer(core, data.data(), sizeof(T) * data.size()), sizeof(T) * data.size() };
+}
+
+//staged bytes copied to the start of dst
+struct BufferUpload {
+	StagedBytes bytes;
+	std::shared_ptr<Buffer> dst;
+};
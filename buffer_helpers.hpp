@@ -1,4 +1,7 @@
 #pragma once
+#include <algorithm>
+#include <vector>
+
 #include "buffer.hpp"
 #include "vulkan_utils.hpp"
 
@@ -306,3 +309,122 @@ public:
 		return descriptor;
 	}
 };
+
+//device local storage buffer, filled by copies
+inline RC<Buffer> createDeviceBuffer(VkDeviceSize size, VkBufferUsageFlags extraUsage = 0) {
+	return Buffer::create(
+		VulkanUtils::utils().getCore(), size,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | extraUsage,
+		(VmaAllocationCreateFlagBits)0,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+	);
+}
+
+//host visible storage buffer the cpu rewrites every frame
+inline RC<Buffer> createMappedBuffer(VkDeviceSize size) {
+	return Buffer::create(
+		VulkanUtils::utils().getCore(), size,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		(VmaAllocationCreateFlagBits)(VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT),
+		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+	);
+}
+
+//replaces a shared buffer too small for count elements, frames in flight keep the old one until they are done
+//buffers can't be empty, so capacities stay at least one
+inline void reserveDeviceBuffer(RC<Buffer>& buffer, uint32_t& capacity, uint32_t count, VkDeviceSize elementSize, VkBufferUsageFlags extraUsage = 0) {
+	if (buffer && count <= capacity)
+		return;
+	if (buffer)
+		VulkanUtils::utils().retire(buffer);
+	capacity = std::max({ count, capacity, 1u });
+	buffer = createDeviceBuffer(elementSize * capacity, extraUsage);
+}
+
+struct StorageBufferWrite {
+	uint32_t binding;
+	uint32_t element;
+	VkBuffer buffer;
+};
+
+//binds whole buffers
+inline void writeStorageBuffers(VkDescriptorSet descriptor, const std::vector<StorageBufferWrite>& buffers) {
+	if (buffers.empty())
+		return;
+	std::vector<VkDescriptorBufferInfo> infos(buffers.size());
+	std::vector<VkWriteDescriptorSet> writes(buffers.size());
+	for (size_t i = 0; i < buffers.size(); i++) {
+		infos[i].buffer = buffers[i].buffer;
+		infos[i].offset = 0;
+		infos[i].range = VK_WHOLE_SIZE;
+
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].descriptorCount = 1;
+		writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writes[i].dstSet = descriptor;
+		writes[i].dstBinding = buffers[i].binding;
+		writes[i].dstArrayElement = buffers[i].element;
+		writes[i].pBufferInfo = &infos[i];
+	}
+	vkUpdateDescriptorSets(VulkanUtils::utils().getCore()->device, (uint32_t)writes.size(), writes.data(), 0, nullptr);
+}
+
+//frames in flight keep the sets and per frame buffers they were recorded with when shared state changes
+//each frame takes the change on in its beginFrame, once its fence was waited on and nothing reads them anymore
+class FrameStaleness {
+	bool stale[MAX_FRAMES_IN_FLIGHT] = {};
+
+public:
+	void markAll() {
+		for (bool& frame : stale)
+			frame = true;
+	}
+
+	//true once per frame after markAll
+	bool take(uint32_t frameIndex) {
+		bool wasStale = stale[frameIndex];
+		stale[frameIndex] = false;
+		return wasStale;
+	}
+};
+
+//host buffer per frame in flight for writes too big to record inline
+class FrameStaging {
+	struct {
+		RC<Buffer> buffer;
+		VkDeviceSize capacity = 0;
+		VkDeviceSize used = 0;
+	} perFrame[MAX_FRAMES_IN_FLIGHT];
+
+public:
+	//writes up to this size go through cmdUpdateBuffer
+	inline static const VkDeviceSize maxInlineSize = 16384;
+
+	void beginFrame(uint32_t frameIndex) {
+		perFrame[frameIndex].used = 0;
+	}
+
+	//outside of render passes, the caller adds the barriers around it
+	void write(VkCommandBuffer commandBuffer, uint32_t frameIndex, VkBuffer dst, VkDeviceSize offset, const void* data, VkDeviceSize size) {
+		if (size <= maxInlineSize) {
+			cmdUpdateBuffer(commandBuffer, dst, offset, data, size);
+			return;
+		}
+		auto& frame = perFrame[frameIndex];
+		if (frame.used + size > frame.capacity) {
+			//copies already recorded from the old buffer keep it alive until the frame is done
+			if (frame.buffer)
+				VulkanUtils::utils().retire(frame.buffer);
+			frame.capacity = std::max(frame.capacity * 2, size);
+			frame.buffer = prepareStagingBufferPersistant(VulkanUtils::utils().getCore(), frame.capacity);
+			frame.used = 0;
+		}
+		memcpy(reinterpret_cast<char*>(frame.buffer->allocation->GetMappedData()) + frame.used, data, size);
+		VkBufferCopy region{};
+		region.srcOffset = frame.used;
+		region.dstOffset = offset;
+		region.size = size;
+		vkCmdCopyBuffer(commandBuffer, frame.buffer->buffer, dst, 1, &region);
+		frame.used += size;
+	}
+};
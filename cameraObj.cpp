@@ -1,5 +1,6 @@
 #include "cameraObj.h"
 #include "GLFW/glfw3.h"
+#include <algorithm>
 // Default camera values
 
 //All angle values in terms of float are converted into radians in the constructor funcs
@@ -206,3 +207,18 @@ void CamHandler::lookAround()
     this->cam.mouseLookProcess(xOffset, yOffset, true);
 }
 
+void CamHandler::cursorRay(const glm::mat4& projView, glm::vec3& origin, glm::vec3& direction)
+{
+    double xPos, yPos;
+    int width, height;
+    glfwGetCursorPos(this->currentWindow, &xPos, &yPos);
+    glfwGetWindowSize(this->currentWindow, &width, &height);
+
+    //vulkan ndc y points down like window coordinates, depth goes 0 to 1
+    glm::vec2 ndc = glm::vec2(2.0 * xPos / std::max(width, 1) - 1.0, 2.0 * yPos / std::max(height, 1) - 1.0);
+    glm::mat4 inverseProjView = glm::inverse(projView);
+    glm::vec4 nearPoint = inverseProjView * glm::vec4(ndc, 0.0f, 1.0f);
+    glm::vec4 farPoint = inverseProjView * glm::vec4(ndc, 1.0f, 1.0f);
+    origin = glm::vec3(nearPoint) / nearPoint.w;
+    direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+}
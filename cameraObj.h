@@ -131,4 +131,6 @@ public:
         //front has to be normalized
         this->cam.changeCameraFront(front);
     }
+    //world space ray through the cursor, projView has to be the one the frame is drawn with
+    void cursorRay(const glm::mat4& projView, glm::vec3& origin, glm::vec3& direction);
 };
\ No newline at end of file
@@ -77,8 +77,9 @@ public:
 class VulkanCore_T {
 private:
 	bool checkDeviceIndexingFeatureSupport(VkPhysicalDevice device) {
-		VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures{};
-		indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+		//vulkan 1.2 features include the descriptor indexing ones
+		VkPhysicalDeviceVulkan12Features indexingFeatures{};
+		indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
 		indexingFeatures.pNext = NULL;
 		
 		VkPhysicalDeviceFeatures2 deviceFeatures{};
@@ -88,9 +89,17 @@ private:
 
 		if (
 				deviceFeatures.features.samplerAnisotropy &&
+				deviceFeatures.features.multiDrawIndirect &&
+				deviceFeatures.features.drawIndirectFirstInstance &&
+				deviceFeatures.features.geometryShader &&
+				deviceFeatures.features.textureCompressionBC &&
 				indexingFeatures.descriptorBindingPartiallyBound &&
+				indexingFeatures.descriptorBindingUpdateUnusedWhilePending &&
 				indexingFeatures.runtimeDescriptorArray &&
-				indexingFeatures.shaderSampledImageArrayNonUniformIndexing
+				indexingFeatures.shaderSampledImageArrayNonUniformIndexing &&
+				indexingFeatures.shaderStorageBufferArrayNonUniformIndexing &&
+				indexingFeatures.drawIndirectCount &&
+				indexingFeatures.samplerFilterMinmax
 			)
 		{
 			// all set to use unbound arrays of textures
@@ -173,14 +182,27 @@ private:
 
 		VkPhysicalDeviceFeatures deviceFeatures{};
 		deviceFeatures.samplerAnisotropy = VK_TRUE;	
+		//meshlet culling draws a variable number of commands per instance
+		deviceFeatures.multiDrawIndirect = VK_TRUE;
+		//visibility buffer: draws carry their first triangle in firstInstance, fragments read gl_PrimitiveID
+		deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+		deviceFeatures.geometryShader = VK_TRUE;
+		//material textures are cooked to bc formats
+		deviceFeatures.textureCompressionBC = VK_TRUE;
 
-		VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures{};
+		VkPhysicalDeviceVulkan12Features indexingFeatures{};
 
-		indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+		indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
 		indexingFeatures.pNext = nullptr;
 		indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+		//streamed meshes are bound into arrays that frames in flight read other elements of
+		indexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
 		indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+		indexingFeatures.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
 		indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+		indexingFeatures.drawIndirectCount = VK_TRUE;
+		//the hi-z pyramid is reduced with max filtering samplers
+		indexingFeatures.samplerFilterMinmax = VK_TRUE;
 
 		VkDeviceCreateInfo createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -227,14 +249,18 @@ private:
 		VkDescriptorPoolCreateInfo info{};
 		info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 		info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
-		info.maxSets = 16;
-		info.poolSizeCount = 4;
+		info.maxSets = 64;
+		info.poolSizeCount = 6;
 		VkDescriptorPoolSize sizes[] =
 		{
 			{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10},
-			{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10},
-			{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 150},
-			{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 10}
+			//visibility buffer shading binds the vertex and index buffers of up to 1024 meshes
+			//skinning binds the vertex and skin buffers of up to 256 meshes per frame in flight
+			{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 64 + 2048 + 1024},
+			{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 180},
+			{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 10},
+			{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 16},
+			{VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 4}
 		};
 		info.pPoolSizes = sizes;
 
@@ -0,0 +1,524 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+
+#include "vulkan_utils.hpp"
+#include "buffer.hpp"
+#include "buffer_helpers.hpp"
+#include "image.hpp"
+#include "MeshLoader.hpp"
+
+//two phase occlusion culling, instances visible last frame are drawn early into a depth pass the pyramid is reduced from
+//then every instance is tested against the pyramid and the result becomes next frame's visibility
+class HiZCuller {
+public:
+	//matches Slot in hizCull.comp
+	struct Slot {
+		uint32_t instanceIndex;
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		uint32_t waste;
+	};
+
+	struct CullPushConstants {
+		glm::mat4 projView;
+		glm::vec2 pyramidSize;
+		uint32_t slotCount;
+		uint32_t phase;
+	};
+
+	struct ReducePushConstants {
+		glm::vec2 outSize;
+		glm::vec2 inSize;
+	};
+
+	inline static const uint32_t cullGroupSize = 64;
+	inline static const uint32_t reduceGroupSize = 16;
+	inline static const uint32_t maxPyramidLevels = 16;
+
+private:
+	struct {
+		VkPipeline pipe;
+		VkPipelineLayout layout;
+	} cull, reduce;
+
+	VkRenderPass earlyPass = VK_NULL_HANDLE;
+	VkFramebuffer earlyFramebuffer = VK_NULL_HANDLE;
+	VkExtent2D extent{};
+
+	//power of two below the depth size, the first reduction takes up to 3x3 depth texels so none is skipped
+	std::shared_ptr<Image> pyramid;
+	UniqueImageView pyramidView;
+	std::vector<UniqueImageView> pyramidLevelViews;
+	uint32_t pyramidWidth = 0, pyramidHeight = 0, pyramidLevels = 0;
+	UniqueSampler reduceSampler;
+	VkDescriptorSet reduceDescriptors[maxPyramidLevels];
+
+	//world space Bounds of every instance, owned by the scene
+	RC<Buffer> boundsBuffer;
+	RC<Buffer> visibilityBuffer;
+	uint32_t visibilityCapacity = 0;
+	uint32_t requiredSlots = 0;
+
+	struct {
+		RC<Buffer> slotBuffer;
+		RC<Buffer> earlyDrawBuffer;
+		RC<Buffer> lateDrawBuffer;
+		RC<Buffer> shadeDrawBuffer;
+		uint32_t slotCapacity = 0;
+		VkDescriptorSet earlyDescriptor;
+		VkDescriptorSet lateDescriptor;
+
+		std::vector<Slot> slots;
+	} perFrame[MAX_FRAMES_IN_FLIGHT];
+	FrameStaleness stale;
+
+	static std::vector<VkDescriptorSetLayoutBinding> getCullBindings() {
+		std::vector<VkDescriptorSetLayoutBinding> bindings(6);
+		for (uint32_t i = 0; i < bindings.size(); i++) {
+			bindings[i].binding = i;
+			bindings[i].descriptorCount = 1;
+			bindings[i].descriptorType = i == 4 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+		return bindings;
+	}
+
+	static std::vector<VkDescriptorSetLayoutBinding> getReduceBindings() {
+		std::vector<VkDescriptorSetLayoutBinding> bindings(2);
+		for (uint32_t i = 0; i < bindings.size(); i++) {
+			bindings[i].binding = i;
+			bindings[i].descriptorCount = 1;
+			bindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+		return bindings;
+	}
+
+	void writeCullDescriptorSet(VkDescriptorSet descriptor, RC<Buffer> slotBuffer, RC<Buffer> drawBuffer, RC<Buffer> shadeDrawBuffer) {
+		writeStorageBuffers(descriptor, {
+			{ 0, 0, slotBuffer->buffer },
+			{ 1, 0, boundsBuffer->buffer },
+			{ 2, 0, drawBuffer->buffer },
+			{ 3, 0, visibilityBuffer->buffer },
+			{ 5, 0, shadeDrawBuffer->buffer }
+		});
+
+		//binding 4 is the pyramid, before the first resize there is none to bind yet
+		if (!pyramidView)
+			return;
+		VkDescriptorImageInfo imageInfo{};
+		imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+		imageInfo.imageView = pyramidView->view;
+		imageInfo.sampler = reduceSampler->sampler;
+
+		VkWriteDescriptorSet write{};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		write.dstSet = descriptor;
+		write.dstBinding = 4;
+		write.pImageInfo = &imageInfo;
+		vkUpdateDescriptorSets(VulkanUtils::utils().getCore()->device, 1, &write, 0, nullptr);
+	}
+
+	void writeDescriptorSets(uint32_t frameIndex) {
+		auto& frame = perFrame[frameIndex];
+		writeCullDescriptorSet(frame.earlyDescriptor, frame.slotBuffer, frame.earlyDrawBuffer, frame.shadeDrawBuffer);
+		writeCullDescriptorSet(frame.lateDescriptor, frame.slotBuffer, frame.lateDrawBuffer, frame.shadeDrawBuffer);
+	}
+
+	void writeReduceDescriptorSet(uint32_t level, VkImageView depthView) {
+		VkDescriptorImageInfo sourceInfo{};
+		sourceInfo.sampler = reduceSampler->sampler;
+		sourceInfo.imageView = level == 0 ? depthView : pyramidLevelViews[level - 1]->view;
+		sourceInfo.imageLayout = level == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+		VkDescriptorImageInfo targetInfo{};
+		targetInfo.imageView = pyramidLevelViews[level]->view;
+		targetInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		VkWriteDescriptorSet writes[2]{};
+		for (uint32_t i = 0; i < 2; i++) {
+			writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[i].descriptorCount = 1;
+			writes[i].dstSet = reduceDescriptors[level];
+			writes[i].dstBinding = i;
+		}
+		writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		writes[0].pImageInfo = &sourceInfo;
+		writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		writes[1].pImageInfo = &targetInfo;
+		vkUpdateDescriptorSets(VulkanUtils::utils().getCore()->device, 2, writes, 0, nullptr);
+	}
+
+	void createFrameBuffers(uint32_t frameIndex, uint32_t slotCapacity) {
+		auto& frame = perFrame[frameIndex];
+		frame.slotCapacity = std::max(slotCapacity, 1u);
+
+		frame.slotBuffer = createMappedBuffer(sizeof(Slot) * frame.slotCapacity);
+		for (RC<Buffer>* drawBuffer : { &frame.earlyDrawBuffer, &frame.lateDrawBuffer, &frame.shadeDrawBuffer })
+			*drawBuffer = createDeviceBuffer(sizeof(VkDrawIndexedIndirectCommand) * frame.slotCapacity, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+	}
+
+	template<typename PushConstants>
+	static void createComputePipeline(const char* shaderPath, VkDescriptorSet descriptor, VkPipeline& pipe, VkPipelineLayout& pipeLayout) {
+		auto core = VulkanUtils::utils().getCore();
+
+		auto computeShaderCode = VulkanUtils::utils().compileGlslToSpv(shaderPath, shaderc_shader_kind::shaderc_compute_shader);
+		VkShaderModule computeShaderModule = VulkanUtils::utils().createShaderModule(computeShaderCode);
+
+		VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
+		computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		computeShaderStageInfo.module = computeShaderModule;
+		computeShaderStageInfo.pName = "main";
+
+		VkDescriptorSetLayout layout = core->getLayout(descriptor);
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &layout;
+
+		VkPushConstantRange pushConstantRange{};
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(PushConstants);
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+		pipeLayout = core->createPipelineLayout(pipelineLayoutInfo);
+
+		VkComputePipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.layout = pipeLayout;
+		pipelineInfo.stage = computeShaderStageInfo;
+		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
+		pipelineInfo.basePipelineIndex = -1; // Optional
+
+		pipe = core->createComputePipeline(pipelineInfo);
+
+		vkDestroyShaderModule(core->device, computeShaderModule, nullptr);
+	}
+
+	void createEarlyRenderPass() {
+		VkAttachmentDescription depthAttachment{};
+		depthAttachment.format = VulkanUtils::utils().getCore()->findDepthFormat();
+		depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+		VkAttachmentReference depthAttachmentRef{};
+		depthAttachmentRef.attachment = 0;
+		depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		VkSubpassDescription subpass{};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = 0;
+		subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+		//the previous frame's main pass and reductions may still use the depth image
+		VkSubpassDependency inDependency{};
+		inDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+		inDependency.dstSubpass = 0;
+		inDependency.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		inDependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		inDependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		inDependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+		VkSubpassDependency outDependency{};
+		outDependency.srcSubpass = 0;
+		outDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+		outDependency.srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		outDependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		outDependency.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		outDependency.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		VkSubpassDependency dependencies[2] = { inDependency, outDependency };
+
+		VkRenderPassCreateInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassInfo.attachmentCount = 1;
+		renderPassInfo.pAttachments = &depthAttachment;
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpass;
+		renderPassInfo.dependencyCount = 2;
+		renderPassInfo.pDependencies = dependencies;
+
+		earlyPass = VulkanUtils::utils().getCore()->createRenderPass(renderPassInfo);
+	}
+
+	static uint32_t previousPowerOfTwo(uint32_t value) {
+		uint32_t result = 1;
+		while (result * 2 <= value)
+			result *= 2;
+		return result;
+	}
+
+	static void computeBarrier(VkCommandBuffer commandBuffer, VkAccessFlags srcAccess, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = dstAccess;
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dstStage, 0,
+			1, &barrier, 0, nullptr, 0, nullptr
+		);
+	}
+
+	void dispatchCull(VkCommandBuffer commandBuffer, uint32_t frameIndex, const glm::mat4& projView, uint32_t phase) {
+		auto& frame = perFrame[frameIndex];
+		CullPushConstants constants{};
+		constants.projView = projView;
+		constants.pyramidSize = glm::vec2(pyramidWidth, pyramidHeight);
+		constants.slotCount = (uint32_t)frame.slots.size();
+		constants.phase = phase;
+
+		VkDescriptorSet descriptor = phase == 0 ? frame.earlyDescriptor : frame.lateDescriptor;
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull.pipe);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull.layout, 0, 1, &descriptor, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, cull.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+		vkCmdDispatch(commandBuffer, (constants.slotCount + cullGroupSize - 1) / cullGroupSize, 1, 1);
+	}
+
+	void buildPyramid(VkCommandBuffer commandBuffer) {
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, reduce.pipe);
+		for (uint32_t level = 0; level < pyramidLevels; level++) {
+			ReducePushConstants constants{};
+			uint32_t levelWidth = std::max(pyramidWidth >> level, 1u);
+			uint32_t levelHeight = std::max(pyramidHeight >> level, 1u);
+			constants.outSize = glm::vec2(levelWidth, levelHeight);
+			constants.inSize = level == 0
+				? glm::vec2(extent.width, extent.height)
+				: glm::vec2(std::max(pyramidWidth >> (level - 1), 1u), std::max(pyramidHeight >> (level - 1), 1u));
+
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, reduce.layout, 0, 1, &reduceDescriptors[level], 0, nullptr);
+			vkCmdPushConstants(commandBuffer, reduce.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+			vkCmdDispatch(commandBuffer,
+				(levelWidth + reduceGroupSize - 1) / reduceGroupSize,
+				(levelHeight + reduceGroupSize - 1) / reduceGroupSize,
+				1
+			);
+			computeBarrier(commandBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+		}
+	}
+
+public:
+	void initialize(RC<Buffer> instanceBounds) {
+		auto core = VulkanUtils::utils().getCore();
+
+		VkSamplerCreateInfo samplerInfo = Sampler::makeCreateInfo(
+			{ VK_FILTER_LINEAR, VK_FILTER_LINEAR },
+			{ VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE },
+			{ 0.0f, 0.0f, (float)maxPyramidLevels },
+			VK_SAMPLER_MIPMAP_MODE_NEAREST
+		);
+		VkSamplerReductionModeCreateInfo reductionInfo{};
+		reductionInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_REDUCTION_MODE_CREATE_INFO;
+		reductionInfo.reductionMode = VK_SAMPLER_REDUCTION_MODE_MAX;
+		samplerInfo.pNext = &reductionInfo;
+		reduceSampler = Sampler::create(core, samplerInfo);
+
+		for (uint32_t level = 0; level < maxPyramidLevels; level++)
+			reduceDescriptors[level] = core->createDescriptorSet(getReduceBindings());
+
+		boundsBuffer = instanceBounds;
+		reserveDeviceBuffer(visibilityBuffer, visibilityCapacity, 1, sizeof(uint32_t));
+		for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			perFrame[i].earlyDescriptor = core->createDescriptorSet(getCullBindings());
+			perFrame[i].lateDescriptor = core->createDescriptorSet(getCullBindings());
+			createFrameBuffers(i, 1);
+			writeDescriptorSets(i);
+		}
+
+		createComputePipeline<CullPushConstants>("Shaders/hizCull.comp", perFrame[0].earlyDescriptor, cull.pipe, cull.layout);
+		createComputePipeline<ReducePushConstants>("Shaders/depthReduce.comp", reduceDescriptors[0], reduce.pipe, reduce.layout);
+		createEarlyRenderPass();
+	}
+
+	VkRenderPass getEarlyRenderPass() const {
+		return earlyPass;
+	}
+
+	//must not be called while frames are in flight
+	void resize(std::shared_ptr<Image> depthImage, VkImageView depthView, VkExtent2D extent) {
+		auto core = VulkanUtils::utils().getCore();
+		this->extent = extent;
+
+		if (earlyFramebuffer != VK_NULL_HANDLE)
+			vkDestroyFramebuffer(core->device, earlyFramebuffer, nullptr);
+		VkFramebufferCreateInfo framebufferInfo{};
+		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferInfo.renderPass = earlyPass;
+		framebufferInfo.attachmentCount = 1;
+		framebufferInfo.pAttachments = &depthView;
+		framebufferInfo.width = extent.width;
+		framebufferInfo.height = extent.height;
+		framebufferInfo.layers = 1;
+		if (vkCreateFramebuffer(core->device, &framebufferInfo, nullptr, &earlyFramebuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create framebuffer!");
+		}
+
+		pyramidWidth = previousPowerOfTwo(extent.width);
+		pyramidHeight = previousPowerOfTwo(extent.height);
+		VkExtent3D pyramidExtent{ pyramidWidth, pyramidHeight, 1 };
+		pyramidLevels = std::min(Image::getMipLevelsForFull(pyramidExtent), maxPyramidLevels);
+
+		pyramidLevelViews.clear();
+		pyramidView.reset();
+		VkImageCreateInfo imageInfo = Image::makeCreateInfo(VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, pyramidExtent);
+		imageInfo.mipLevels = pyramidLevels;
+		pyramid = Image::create(core, imageInfo, (VmaAllocationCreateFlagBits)0);
+
+		VkImageViewCreateInfo viewInfo{};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.image = pyramid->image;
+		viewInfo.format = VK_FORMAT_R32_SFLOAT;
+		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = pyramidLevels;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+		pyramidView = getImageView(pyramid, viewInfo);
+		for (uint32_t level = 0; level < pyramidLevels; level++) {
+			viewInfo.subresourceRange.baseMipLevel = level;
+			viewInfo.subresourceRange.levelCount = 1;
+			pyramidLevelViews.push_back(getImageView(pyramid, viewInfo));
+		}
+
+		VkCommandBuffer commandBuffer = core->beginSingleTimeCommands(VulkanUtils::utils().getCommandPool());
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = pyramid->image;
+		barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, pyramidLevels, 0, 1 };
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &barrier
+		);
+		core->endSingleTimeCommands(VulkanUtils::utils().getCommandPool(), commandBuffer);
+		pyramid->layout = VK_IMAGE_LAYOUT_GENERAL;
+
+		for (uint32_t level = 0; level < pyramidLevels; level++)
+			writeReduceDescriptorSet(level, depthView);
+		for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+			writeDescriptorSets(i);
+	}
+
+	//everything visible, so the first early pass of a model draws all of it
+	static StagedBytes stageVisibility(VulkanCore core, size_t instanceCount) {
+		return stageVector(core, std::vector<uint32_t>(instanceCount, 1));
+	}
+
+	//slotCapacity is the most instances a frame can submit
+	std::vector<BufferUpload> setGeometry(StagedBytes visibility, uint32_t slotCapacity) {
+		reserveDeviceBuffer(visibilityBuffer, visibilityCapacity, (uint32_t)(visibility.size / sizeof(uint32_t)), sizeof(uint32_t));
+		requiredSlots = slotCapacity;
+		stale.markAll();
+		return { { visibility, visibilityBuffer } };
+	}
+
+	void setBoundsBuffer(RC<Buffer> instanceBounds) {
+		boundsBuffer = instanceBounds;
+		stale.markAll();
+	}
+
+	void beginFrame(uint32_t frameIndex) {
+		auto& frame = perFrame[frameIndex];
+		if (stale.take(frameIndex)) {
+			if (requiredSlots > frame.slotCapacity)
+				createFrameBuffers(frameIndex, requiredSlots);
+			writeDescriptorSets(frameIndex);
+		}
+		frame.slots.clear();
+	}
+
+	//returns the slot to draw the instance with
+	uint32_t addInstance(uint32_t frameIndex, uint32_t instanceIndex, uint32_t firstIndex, uint32_t indexCount) {
+		auto& frame = perFrame[frameIndex];
+		assert(frame.slots.size() < frame.slotCapacity && instanceIndex < visibilityCapacity);
+		frame.slots.push_back(Slot{ instanceIndex, firstIndex, indexCount, 0 });
+		return (uint32_t)frame.slots.size() - 1;
+	}
+
+	//must be outside a render pass
+	void recordEarlyCulling(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+		auto& frame = perFrame[frameIndex];
+		if (frame.slots.empty())
+			return;
+		memcpy(frame.slotBuffer->allocation->GetMappedData(), frame.slots.data(), sizeof(Slot) * frame.slots.size());
+
+		computeBarrier(commandBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+		dispatchCull(commandBuffer, frameIndex, glm::mat4(1), 0);
+		computeBarrier(commandBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+	}
+
+	void beginEarlyPass(VkCommandBuffer commandBuffer) {
+		VkClearValue clearValue{};
+		clearValue.depthStencil = { 1.0f, 0 };
+
+		VkRenderPassBeginInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = earlyPass;
+		renderPassInfo.framebuffer = earlyFramebuffer;
+		renderPassInfo.renderArea.offset = { 0, 0 };
+		renderPassInfo.renderArea.extent = extent;
+		renderPassInfo.clearValueCount = 1;
+		renderPassInfo.pClearValues = &clearValue;
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	}
+
+	void endEarlyPass(VkCommandBuffer commandBuffer) {
+		vkCmdEndRenderPass(commandBuffer);
+	}
+
+	//must be outside a render pass and before the late draws
+	void recordLateCulling(VkCommandBuffer commandBuffer, uint32_t frameIndex, const glm::mat4& projView) {
+		auto& frame = perFrame[frameIndex];
+		if (frame.slots.empty())
+			return;
+
+		buildPyramid(commandBuffer);
+		dispatchCull(commandBuffer, frameIndex, projView, 1);
+		//late draws and meshlet culling read the results, the main pass writes the depth the pyramid was read from
+		computeBarrier(commandBuffer, VK_ACCESS_SHADER_WRITE_BIT,
+			VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+			VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT
+		);
+	}
+
+	void drawEarly(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t slot) {
+		vkCmdDrawIndexedIndirect(commandBuffer, perFrame[frameIndex].earlyDrawBuffer->buffer, sizeof(VkDrawIndexedIndirectCommand) * slot, 1, sizeof(VkDrawIndexedIndirectCommand));
+	}
+
+	//visible now but not drawn early
+	void drawLate(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t slot) {
+		vkCmdDrawIndexedIndirect(commandBuffer, perFrame[frameIndex].lateDrawBuffer->buffer, sizeof(VkDrawIndexedIndirectCommand) * slot, 1, sizeof(VkDrawIndexedIndirectCommand));
+	}
+
+	void drawShade(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t slot) {
+		vkCmdDrawIndexedIndirect(commandBuffer, perFrame[frameIndex].shadeDrawBuffer->buffer, sizeof(VkDrawIndexedIndirectCommand) * slot, 1, sizeof(VkDrawIndexedIndirectCommand));
+	}
+
+	//one uint per instance, bit 0 set if the late pass found it visible, bit 1 if the early pass drew it
+	RC<Buffer> getVisibilityBuffer() const {
+		return visibilityBuffer;
+	}
+
+	glm::uvec2 getPyramidSize() const {
+		return glm::uvec2(pyramidWidth, pyramidHeight);
+	}
+
+	uint32_t instanceCount(uint32_t frameIndex) const {
+		return (uint32_t)perFrame[frameIndex].slots.size();
+	}
+};
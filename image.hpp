@@ -1,11 +1,11 @@
 #pragma once
+#include <algorithm>
 #include <array>
 #include <optional>
+#include <vector>
 #include "vulkan_utils.hpp"
 #include "buffer.hpp"
 
-//todo MAJOR write a generate mip maps function
-
 //forward declaration
 class ImageView;
 class Image;
@@ -64,6 +64,8 @@ public:
 	uint32_t arrayLayers;
 
 	VmaAllocation allocation;
+	//bytes of device memory the image takes
+	VkDeviceSize allocationSize;
 
 	inline static int imageAllocattedCount = 0;
 	struct ImageDeleter {
@@ -100,16 +102,14 @@ public:
 			throw std::runtime_error("Could not create image resource!");
 		}
 
+		img.allocationSize = allocationInfo.size;
 		imageAllocattedCount++;
 		return std::unique_ptr<Image, ImageDeleter>(new Image(img));
 	}
 
-	void transitionImageLayout(VkImageLayout newLayout) {
-		VulkanCore core = VulkanUtils::utils().getCore();
-		VkCommandBuffer commandBuffer = core->beginSingleTimeCommands(VulkanUtils::utils().getCommandPool());
-
-		VkImageLayout oldLayout = layout;
-
+	//records a barrier moving levels [baseMipLevel, baseMipLevel + levelCount) of every layer from oldLayout to newLayout
+	//layout is left alone, callers moving only some levels keep track of them
+	void recordTransition(VkCommandBuffer commandBuffer, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t baseMipLevel, uint32_t levelCount) {
 		VkImageMemoryBarrier barrier{};
 		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 		barrier.oldLayout = oldLayout;
@@ -118,10 +118,10 @@ public:
 		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 		barrier.image = image;
 		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		barrier.subresourceRange.baseMipLevel = 0;
-		barrier.subresourceRange.levelCount = 1;
+		barrier.subresourceRange.baseMipLevel = baseMipLevel;
+		barrier.subresourceRange.levelCount = levelCount;
 		barrier.subresourceRange.baseArrayLayer = 0;
-		barrier.subresourceRange.layerCount = 1;
+		barrier.subresourceRange.layerCount = arrayLayers;
 
 		VkPipelineStageFlags sourceStage;
 		VkPipelineStageFlags destinationStage;
@@ -154,6 +154,21 @@ public:
 			sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
 			destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
 		}
+		else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
+			//a level written by a copy or blit becomes the source of the next blit
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+			sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+			destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		}
+		else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+			sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+			destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		}
 		else {
 			throw std::invalid_argument("unsupported layout transition!");
 		}
@@ -166,17 +181,83 @@ public:
 			0, nullptr,
 			1, &barrier
 		);
+	}
 
+	//moves every level and layer
+	void transitionImageLayout(VkImageLayout newLayout) {
+		VulkanCore core = VulkanUtils::utils().getCore();
+		VkCommandBuffer commandBuffer = core->beginSingleTimeCommands(VulkanUtils::utils().getCommandPool());
+		recordTransition(commandBuffer, layout, newLayout, 0, mipLevels);
 		core->endSingleTimeCommands(VulkanUtils::utils().getCommandPool(), commandBuffer);
 
 		this->layout = newLayout;
 	}
 
+	//formats mips can be blitted for with linear filtering, the image also needs transfer src usage
+	static bool canGenerateMipmaps(VkFormat format) {
+		VkFormatProperties props;
+		vkGetPhysicalDeviceFormatProperties(VulkanUtils::utils().getCore()->physicalDevice, format, &props);
+		const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+		return (props.optimalTilingFeatures & required) == required;
+	}
+
+	//fills every level below the first by halving the one above with a linear blit
+	//every level has to be in transfer dst with the first one written, all of them end up shader read only
+	void recordGenerateMipmaps(VkCommandBuffer commandBuffer) {
+		int32_t width = extent.width;
+		int32_t height = extent.height;
+		for (uint32_t level = 1; level < mipLevels; level++) {
+			recordTransition(commandBuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, level - 1, 1);
+
+			int32_t nextWidth = std::max(width / 2, 1);
+			int32_t nextHeight = std::max(height / 2, 1);
+			VkImageBlit blit{};
+			blit.srcOffsets[1] = { width, height, 1 };
+			blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			blit.srcSubresource.mipLevel = level - 1;
+			blit.srcSubresource.baseArrayLayer = 0;
+			blit.srcSubresource.layerCount = arrayLayers;
+			blit.dstOffsets[1] = { nextWidth, nextHeight, 1 };
+			blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			blit.dstSubresource.mipLevel = level;
+			blit.dstSubresource.baseArrayLayer = 0;
+			blit.dstSubresource.layerCount = arrayLayers;
+			vkCmdBlitImage(
+				commandBuffer,
+				image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				1, &blit,
+				VK_FILTER_LINEAR
+			);
+
+			recordTransition(commandBuffer, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, level - 1, 1);
+			width = nextWidth;
+			height = nextHeight;
+		}
+		recordTransition(commandBuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels - 1, 1);
+		this->layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+
 	void copyFromBuffer(RC<Buffer> buffer, VkBufferImageCopy region) {
+		copyFromBuffer(buffer, std::vector<VkBufferImageCopy>{ region });
+	}
+
+	//one submit for all regions, like every mip of a cooked texture
+	void copyFromBuffer(RC<Buffer> buffer, const std::vector<VkBufferImageCopy>& regions) {
 		auto& vku = VulkanUtils::utils();
 		assert((layout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL || layout == VK_IMAGE_LAYOUT_GENERAL), "");
 		VkCommandBuffer commandBuffer = vku.getCore()->beginSingleTimeCommands(vku.getCommandPool());
+		vkCmdCopyBufferToImage(commandBuffer, buffer->buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+		vku.getCore()->endSingleTimeCommands(vku.getCommandPool(), commandBuffer);
+	}
+
+	//uploads the first level and blits the rest in one submit, the image has to be in transfer dst
+	void copyFromBufferAndGenerateMipmaps(RC<Buffer> buffer, VkBufferImageCopy region) {
+		auto& vku = VulkanUtils::utils();
+		assert((layout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL), "");
+		VkCommandBuffer commandBuffer = vku.getCore()->beginSingleTimeCommands(vku.getCommandPool());
 		vkCmdCopyBufferToImage(commandBuffer, buffer->buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+		recordGenerateMipmaps(commandBuffer);
 		vku.getCore()->endSingleTimeCommands(vku.getCommandPool(), commandBuffer);
 	}
 
@@ -235,7 +316,7 @@ inline std::unique_ptr<ImageView, ImageView::ImageViewDeleter> getImageView(
 	info.image = image->image;
 	info.format = viewFormat;
 	info.subresourceRange.baseMipLevel = 0;
-	info.subresourceRange.levelCount = 1;
+	info.subresourceRange.levelCount = image->mipLevels;
 	info.subresourceRange.baseArrayLayer = 0;
 	info.subresourceRange.layerCount = 1;
 	info.subresourceRange.aspectMask = aspectFlags;
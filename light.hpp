@@ -65,6 +65,25 @@ public:
 		this->pointLightCount += lightsCount;
 	}
 
+	//every point light of the scene, replacing the previous ones, can be staged on any thread
+	//lights past the buffer's capacity are dropped
+	StagedBytes stagePointLights(VulkanCore core, const std::vector<PointLightInfo>& lights) const {
+		size_t lightsCount = std::min<size_t>(lights.size(), this->pointLightsBuffer.maxLength);
+		PointLightLength length;
+		length.length = (int)lightsCount;
+		std::vector<char> bytes(sizeof(PointLightLength) + sizeof(PointLightInfo) * lightsCount);
+		memcpy(bytes.data(), &length, sizeof(PointLightLength));
+		memcpy(bytes.data() + sizeof(PointLightLength), lights.data(), sizeof(PointLightInfo) * lightsCount);
+		return stageVector(core, bytes);
+	}
+
+	//the upload has to be copied before the lights are read
+	BufferUpload setPointLights(StagedBytes staged) {
+		this->pointLightCount = (staged.size - sizeof(PointLightLength)) / sizeof(PointLightInfo);
+		return { staged, this->pointLightsBuffer.resourceBuf };
+	}
+
+	//the frame's fence must have been waited on
 	void setSunLight(SunLightType sunInfo, uint32_t frameIndex) {
 		//sunlight buffer is mapped as it may change frequently
 		memcpy(
@@ -24,7 +24,10 @@
 
 #include "vulkan_utils.hpp"
 #include "MeshLoader.hpp"
+#include "ModelCache.hpp"
 #include "ImageLoader.hpp"
+#include "RadianceDecoder.hpp"
+#include "ImageInfoIndex.hpp"
 #include "cameraObj.h"
 #include "material.hpp"
 #include "light.hpp"
@@ -34,7 +37,18 @@
 #include "mesh.hpp"
 #include "frame.hpp"
 #include "skybox.hpp"
+#include "texture_cache.hpp"
+#include "meshlet_culling.hpp"
+#include "hiz_culling.hpp"
+#include "visibility_buffer.hpp"
+#include "asyncModelLoader.hpp"
+#include "skinning.hpp"
+#include "FrustumCuller.hpp"
+#include "InstanceBvh.hpp"
+#include "OcclusionCuller.hpp"
+#include "simd_helper.hpp"
 #include "asyncImageLoader.hpp"
+#include "parallel_helper.hpp"
 
 constexpr int lightCount = 10;
 
@@ -101,6 +115,52 @@ struct FrameData {
 
 typedef FrameBase<FrameData> Frame;
 
+//what the model loader's worker works out for a model before the main thread switches to it
+struct PreparedModel {
+	//every texture of the model that is a readable image, the rest fall back to the blank texture
+	std::unordered_map<std::string, ImageInfo> textureInfos;
+
+	struct Texture {
+		std::string path;
+		int desiredChannels;
+		bool isSRGB;
+		float priority;
+	};
+	//in the order the material images are added, 0 is the blank texture
+	std::vector<Texture> textures;
+	std::vector<MaterialInfo> materialInfos;
+
+	//placeholders with bounds, lods and meshlet ranges
+	std::vector<Mesh> meshes;
+	//world space, skinned instances around every joint
+	std::vector<Bounds> instanceBounds;
+	std::vector<uint8_t> instanceConeCulling;
+	std::vector<uint8_t> instanceSingleSided;
+	Skinner::Layout skinning;
+	std::vector<uint32_t> skinnedInstances;
+	uint32_t maxMeshletsPerInstance = 0;
+	uint32_t cullInstanceCapacity = 0;
+	uint32_t cullDrawCapacity = 0;
+
+	FrustumCuller frustumCuller;
+	InstanceBvh instanceBvh;
+	OcclusionCuller occlusionCuller;
+	std::vector<uint32_t> instanceOccluders;
+
+	std::vector<VisibilityBufferRenderer::Instance> visibilityInstances;
+
+	//copied into the renderers' buffers by the frames, through the model loader's upload budget
+	struct {
+		StagedBytes meshlets;
+		StagedBytes instanceBounds;
+		StagedBytes hizVisibility;
+		StagedBytes visibilityInstances;
+		StagedBytes visibilityMaterials;
+		StagedBytes materialInfos;
+		StagedBytes pointLights;
+	} staged;
+};
+
 class Application {
 public:
 	Application() {}
@@ -114,6 +174,9 @@ public:
 		meshes.clear();
 		meshes.shrink_to_fit();
 		materials.clear();
+		textureCache.clear();
+		//the device is idle after the main loop
+		VulkanUtils::utils().releaseRetired();
 
 		for (auto& frame : frames)
 			frame.cleanup(core->device);
@@ -123,12 +186,17 @@ public:
 		vkDestroyPipeline(core->device, graphicsPipeline, nullptr);
 		vkDestroyPipelineLayout(core->device, pipelineLayout, nullptr);
 		vkDestroyPipeline(core->device, depthPrePass.pipe, nullptr);
+		vkDestroyPipeline(core->device, depthPrePass.earlyPipe, nullptr);
 		vkDestroyPipelineLayout(core->device, depthPrePass.layout, nullptr);
 		vkDestroyPipeline(core->device, clusterComp.pipe, nullptr);
 		vkDestroyPipelineLayout(core->device, clusterComp.layout, nullptr);
+		visibilityRenderer.destroy();
+		skinner.destroy();
+		vkDestroyQueryPool(core->device, passTimestamps, nullptr);
 		this->imgui.destroy();
 
 		vkDestroyRenderPass(core->device, renderPass, nullptr);
+		vkDestroyRenderPass(core->device, earlyDepthRenderPass, nullptr);
 
 		swapChain.cleanupFramebuffers();
 		swapChain.cleanupSwapChain();
@@ -141,12 +209,16 @@ private:
 	uint32_t current_frame = 0;
 
 	VkRenderPass renderPass;
+	//renderPass over the depth of the HiZCuller early pass instead of a cleared one, shares its framebuffers and pipelines
+	VkRenderPass earlyDepthRenderPass;
 	VkPipelineLayout pipelineLayout;
 	VkPipeline graphicsPipeline;
 
 	struct {
 		VkPipelineLayout layout;
 		VkPipeline pipe;
+		//same pipeline in the hi-z early pass
+		VkPipeline earlyPipe;
 	} depthPrePass;
 
 	struct {
@@ -158,58 +230,149 @@ private:
 
 	VkCommandPool commandPool;
 
+	//one per unique primitive
 	std::vector<Mesh> meshes;
 
 	Materials materials;
+	//one per instance
 	std::vector<uint32_t> meshMatIndices;
+	std::vector<uint32_t> instanceMeshIndices;
 	std::vector<glm::mat4> transforms;
+	//lod drawn last frame, kept for hysteresis
+	std::vector<uint8_t> instanceLods;
+	//world space, one per instance
+	std::vector<Bounds> instanceBounds;
+	//device copy of instanceBounds, both culling passes read it
+	RC<Buffer> instanceBoundsBuffer;
+	uint32_t instanceBoundsCapacity = 0;
+	//moved instances are written to the device buffers through it
+	FrameStaging sceneStaging;
+	//back facing meshlets are only culled for single sided materials without non uniform scale
+	std::vector<uint8_t> instanceConeCulling;
+	std::vector<uint8_t> instanceSingleSided;
+	//node hierarchy of the model, instances follow their node when it is edited
+	SceneHierarchy sceneHierarchy;
+	//hierarchy node of each instance, nondecreasing so the instances of a subtree are a contiguous range
+	std::vector<uint32_t> instanceNodes;
+	//plays the model's clips into sceneHierarchy
+	AnimationPlayer animationPlayer;
+	//skin of each instance in the player's animations, -1 if not skinned
+	std::vector<int32_t> instanceSkins;
+	//instances the skinner deforms, ascending
+	std::vector<uint32_t> skinnedInstances;
+	Skinner skinner;
+	//MeshletCuller slot of each instance this frame, noCullSlot if drawn directly
+	std::vector<uint32_t> instanceCullSlots;
+	inline static const uint32_t noCullSlot = std::numeric_limits<uint32_t>::max();
 
 	std::vector<PointLightInfo> pointLights;
 	LightsBuffer lightsBuffer;
-
-	VkDescriptorSet materialsDescriptorSet;
+	DirectionalLightInfo sunLight{};
 
 	//RC<Buffer> buffer;
 	MyImgui imgui;
 
 	CamHandler camera;
 
+	//ModelCache flags models are cooked with
+	uint32_t modelCookFlags = ModelCache::optimizeMeshesFlag | ModelCache::weldVerticesFlag | ModelCache::generateLodsFlag | ModelCache::buildMeshletsFlag;
+	//material textures are loaded as TextureCooker mip chains instead of uncompressed single levels
+	bool cookTextures = true;
+
+	bool lodsEnabled = true;
+	//largest simplification error allowed on screen, in pixels
+	float lodPixelError = 1.f;
+	//a coarser lod is only picked once its error is this much below the limit
+	const float lodHysteresis = 1.25f;
+	size_t drawnTriangles = 0;
+
+	FrustumCuller frustumCuller;
+	bool frustumCullingEnabled = true;
+	//hierarchical culling through the bvh, the linear culler only wins on small scenes
+	InstanceBvh instanceBvh;
+	bool bvhCullingEnabled = true;
+	//instances drawn this frame, consumed by both passes
+	std::vector<uint32_t> visibleInstances;
+	Frustum viewFrustum;
+	//instance under the cursor on the last click with the mouse shown
+	std::optional<BvhRayHit> pickedInstance;
+
+	OcclusionCuller occlusionCuller;
+	bool occlusionCullingEnabled = true;
+	size_t occludedInstances = 0;
+	//occluders are the largest instances whose lod under occluderLodError fits maxOccluderTriangles
+	const uint32_t maxOccluders = 32;
+	const uint32_t maxOccluderTriangles = 4096;
+	const float occluderLodError = 0.01f;
+	//OcclusionCuller occluder of each instance, noCullSlot if it isn't one
+	std::vector<uint32_t> instanceOccluders;
+
+	MeshletCuller meshletCuller;
+	//lod 0 of meshes with meshlets is culled per meshlet on the gpu
+	bool meshletCullingEnabled = true;
+
+	HiZCuller hizCuller;
+	//visible instances are tested against a depth pyramid of last frame's survivors on the gpu
+	bool hizCullingEnabled = true;
+	//HiZCuller slot of each instance this frame, noCullSlot if drawn directly
+	std::vector<uint32_t> instanceHizSlots;
+
+	VisibilityBufferRenderer visibilityRenderer;
+	//shade through the visibility buffer instead of the forward subpass
+	bool visibilityBufferEnabled = false;
+	//start and end of the main render pass per frame in flight, for comparing the shading modes
+	VkQueryPool passTimestamps = VK_NULL_HANDLE;
+	std::array<bool, MAX_FRAMES_IN_FLIGHT> passTimestampsWritten{};
+	float mainPassMs = 0.f;
+
 	float nearPlane = 0.1f;
 	float farPlane = 200.f;
 
 	uint32_t numFramesInFlight = MAX_FRAMES_IN_FLIGHT;
 
-	void initMeshesMaterialsLights() {
-		this->meshes.clear();
-		this->transforms.clear();
-		this->meshMatIndices.clear();
-		this->materials.clear();
-		this->pointLights.clear();
+	inline static const char* blankTexturePath = R"(C:\Users\munee\source\repos\VulkanRenderer\3DModels\blankVaibhav.png)";
 
-		auto loadedModel = loadGLTF(gltfModelSelector.loadedModelPath.c_str()).value();
-
-		meshes.reserve(loadedModel.meshData.meshes.size());
-		materials.reserve(loadedModel.meshData.meshes.size());
-		transforms = loadedModel.meshData.transforms;
-		meshMatIndices = std::vector<uint32_t>(
-			loadedModel.meshData.matIndex.begin(),
-			loadedModel.meshData.matIndex.end()
+	//textures the materials of a model may load, sorted and without duplicates
+	static std::vector<std::string> modelTexturePaths(const CookedModel& model) {
+		std::vector<std::string> texturePaths = { blankTexturePath };
+#ifndef NO_TEXTURES
+		for (auto& mat : model.materials) {
+			if (mat.isMetallicRoughness) {
+				texturePaths.push_back(mat.metallicRoughness.baseColorTex);
+				texturePaths.push_back(mat.metallicRoughness.metallicRoughnessTex);
+			}
+		}
+		texturePaths.erase(
+			std::remove(texturePaths.begin(), texturePaths.end(), std::string()),
+			texturePaths.end()
 		);
+		std::sort(texturePaths.begin(), texturePaths.end());
+		texturePaths.erase(std::unique(texturePaths.begin(), texturePaths.end()), texturePaths.end());
+#endif
+		return texturePaths;
+	}
+
+	//works out everything of the model that doesn't need the device, on the model loader's worker
+	void prepareModel(const CookedModel& model, PreparedModel& prepared, glm::vec3 viewPos) const {
+		size_t instanceCount = model.transforms.size();
 
-		materials.addMaterialImage(
-			loadImage(
-				R"(C:\Users\munee\source\repos\VulkanRenderer\3DModels\blankVaibhav.png)",
-				4,
-				true
-			), vSampler
-		);
-																			
 		std::unordered_map<std::string, unsigned int> imagePathToIndex;
-		std::vector<std::string> imagePaths = { R"(C:\Users\munee\source\repos\VulkanRenderer\3DModels\blankVaibhav.png)" };
+		prepared.textures = { { blankTexturePath, 4, true, 0.f } };
 		//empty path means default 0 texture
 		imagePathToIndex[""] = 0;
 #ifndef NO_TEXTURES
-		for (auto& mat : loadedModel.materials) {
+		//textures of materials near the camera load first
+		std::vector<float> materialDistances(model.materials.size(), std::numeric_limits<float>::max());
+		for (size_t i = 0; i < instanceCount; ++i) {
+			int matIndex = model.matIndex[i];
+			if (matIndex < 0)
+				continue;
+			const glm::vec4& sphere = model.bounds[i].sphere;
+			float distance = std::max(glm::distance(glm::vec3(sphere), viewPos) - sphere.w, 0.f);
+			materialDistances[matIndex] = std::min(materialDistances[matIndex], distance);
+		}
+		for (size_t matIndex = 0; matIndex < model.materials.size(); ++matIndex) {
+			auto& mat = model.materials[matIndex];
 			std::string textures[2];
 			if (mat.isMetallicRoughness) {
 				textures[0] = mat.metallicRoughness.baseColorTex;
@@ -220,36 +383,29 @@ private:
 				textures[0] = mat.diffuseSpecular.diffuseTex;
 				textures[1] = mat.diffuseSpecular.specularGlossTex;
 			}
-			
+
 			for (int i = 0; i < 2; i++) {
-				std::string tex = textures[i];
-				if (
-					imagePathToIndex.find(tex) == imagePathToIndex.end()
-					) {
-					imagePaths.push_back(tex);
-					imagePathToIndex[tex] =
-						materials.addMaterialImage(
-							loadImage(
-								tex.c_str(),
-								i == 0 ? 4 : 2,
-								false,
-								std::nullopt
-							), vSampler
-						);
+				const std::string& tex = textures[i];
+				if (imagePathToIndex.find(tex) != imagePathToIndex.end())
+					continue;
+				if (prepared.textureInfos.find(tex) == prepared.textureInfos.end()) {
+					imagePathToIndex[tex] = 0;
+					continue;
 				}
-				//std::cout << std::endl << std::endl;
+				imagePathToIndex[tex] = (unsigned int)prepared.textures.size();
+				//gltf base color is srgb, metallic roughness linear
+				prepared.textures.push_back({ tex, i == 0 ? 4 : 2, i == 0, -materialDistances[matIndex] });
 			}
 		}
 #endif
-		
-		for (MaterialPBR& loadedMat : loadedModel.materials) {
+		//without textures every path falls back to the blank texture
+		auto textureIndex = [&imagePathToIndex](const std::string& path) {
+			auto it = imagePathToIndex.find(path);
+			return it == imagePathToIndex.end() ? 0u : it->second;
+		};
+
+		for (const MaterialPBR& loadedMat : model.materials) {
 			MaterialInfo matInf{};
-#ifdef NO_TEXTURES
-			loadedMat.metallicRoughness.baseColorTex = "";
-			loadedMat.metallicRoughness.metallicRoughnessTex = "";
-			loadedMat.diffuseSpecular.diffuseTex = "";
-			loadedMat.diffuseSpecular.specularGlossTex = "";
-#endif
 			matInf.baseColorFactor = loadedMat.isMetallicRoughness ?
 				loadedMat.metallicRoughness.baseColorFactor :
 				loadedMat.diffuseSpecular.diffuseFactor;
@@ -266,46 +422,176 @@ private:
 					loadedMat.diffuseSpecular.glossinessFactor
 				);
 
-				matInf.baseTexId_metallicRoughessTexId_waste2 =
-					glm::uvec4(
-						loadedMat.isMetallicRoughness ?
-						imagePathToIndex[
-							loadedMat.metallicRoughness.baseColorTex
-						] :
-						imagePathToIndex[
-							loadedMat.diffuseSpecular.diffuseTex
-						],
-						loadedMat.isMetallicRoughness ?
-						imagePathToIndex[
-							loadedMat.metallicRoughness.metallicRoughnessTex
-						] :
-						imagePathToIndex[
-							loadedMat.diffuseSpecular.specularGlossTex
-						],
-						0,
-						0
-					);
-			//std::cout << std::endl << "Material: " << matIndex;
-			//std::cout << imagePaths[matInf.baseTexId_metallicRoughessTexId_waste2.x] << " ";
-			//std::cout << imagePaths[matInf.baseTexId_metallicRoughessTexId_waste2.y] << std::endl;
-
-			materials.addMaterial(core, commandPool, matInf);
+			matInf.baseTexId_metallicRoughessTexId_waste2 =
+				glm::uvec4(
+					textureIndex(loadedMat.isMetallicRoughness ? loadedMat.metallicRoughness.baseColorTex : loadedMat.diffuseSpecular.diffuseTex),
+					textureIndex(loadedMat.isMetallicRoughness ? loadedMat.metallicRoughness.metallicRoughnessTex : loadedMat.diffuseSpecular.specularGlossTex),
+					0,
+					0
+				);
+			prepared.materialInfos.push_back(matInf);
 		}
 
-		for (size_t i = 0; i < loadedModel.meshData.meshes.size(); ++i)
-			meshes.push_back(Mesh(core, commandPool, loadedModel.meshData.meshes[i]));
+		//cooked mesh blobs are copied straight from the mapping into staging by the model loader
+		std::vector<Meshlet> meshlets;
+		prepared.meshes.resize(model.meshes.size());
+		for (size_t i = 0; i < model.meshes.size(); ++i) {
+			const MeshDataView& meshData = model.meshes[i];
+			prepared.meshes[i].setInfo(meshData);
+			prepared.meshes[i].firstMeshlet = (uint32_t)meshlets.size();
+			prepared.meshes[i].meshletCount = (uint32_t)meshData.meshletCount;
+			meshlets.insert(meshlets.end(), meshData.meshlets, meshData.meshlets + meshData.meshletCount);
+		}
 
-		this->pointLights = std::move(loadedModel.pointLights);
-		for (int i = 0; i < frames.size(); i++) {
-			auto& frame = frames[i];
-			
-			this->lightsBuffer.setSunLight(loadedModel.directionalLight, i);
+		//every instance of a mesh with meshlets may be culled in the same frame
+		prepared.instanceConeCulling.resize(instanceCount);
+		prepared.instanceSingleSided.resize(instanceCount);
+		for (size_t i = 0; i < instanceCount; ++i) {
+			const Mesh& mesh = prepared.meshes[model.meshIndex[i]];
+			if (mesh.meshletCount > 0) {
+				prepared.maxMeshletsPerInstance = std::max(prepared.maxMeshletsPerInstance, mesh.meshletCount);
+				prepared.cullInstanceCapacity++;
+				prepared.cullDrawCapacity += mesh.meshletCount;
+			}
 
-			this->lightsBuffer.addPointLights(
-				core, commandPool,
-				this->pointLights.data(), this->pointLights.size()
+			int matIndex = model.matIndex[i];
+			bool doubleSided = matIndex >= 0 && model.materials[matIndex].doubleSided;
+			prepared.instanceSingleSided[i] = !doubleSided;
+			prepared.instanceConeCulling[i] = !doubleSided && hasUniformScale(model.transforms[i]);
+		}
+
+		//skinned instances get bounds around every joint before the cullers see them
+		std::vector<uint32_t> instanceJointCounts(instanceCount, 0);
+		for (size_t i = 0; i < instanceCount; ++i) {
+			if (model.skinIndex[i] >= 0)
+				instanceJointCounts[i] = model.animations.skins[model.skinIndex[i]].jointCount;
+		}
+		prepared.skinning = Skinner::planLayout(prepared.meshes, model.meshIndex, instanceJointCounts);
+		std::vector<uint32_t> skinnedVertexOffsets(instanceCount);
+		for (uint32_t i = 0; i < instanceCount; ++i) {
+			skinnedVertexOffsets[i] = prepared.skinning.outputOffset(i);
+			if (prepared.skinning.isSkinned(i))
+				prepared.skinnedInstances.push_back(i);
+		}
+		prepared.instanceBounds = model.bounds;
+		parallelFor(prepared.skinnedInstances.size(), 16, [&](size_t begin, size_t end) {
+			for (size_t s = begin; s < end; s++) {
+				uint32_t i = prepared.skinnedInstances[s];
+				glm::mat4* joints = prepared.skinning.instanceJoints(i);
+				computeJointMatrices(model.animations, model.hierarchy, model.skinIndex[i], model.nodeIndex[i], joints);
+				prepared.instanceBounds[i] = skinnedBounds(prepared.meshes[model.meshIndex[i]].bounds, model.transforms[i], joints, instanceJointCounts[i]);
+			}
+			});
+
+		prepared.frustumCuller.setBounds(prepared.instanceBounds);
+		prepared.instanceBvh.build(prepared.instanceBounds);
+		selectOccluders(model, prepared);
+
+		std::vector<uint32_t> instanceMaterialIndices(model.matIndex.begin(), model.matIndex.end());
+		if (model.meshes.size() <= VisibilityBufferRenderer::maxMeshes) {
+			prepared.visibilityInstances = VisibilityBufferRenderer::buildInstances(
+				prepared.meshes, model.transforms, model.meshIndex, instanceMaterialIndices, skinnedVertexOffsets
 			);
 		}
+
+		prepared.staged.meshlets = stageVector(core, meshlets);
+		prepared.staged.instanceBounds = stageVector(core, prepared.instanceBounds);
+		prepared.staged.hizVisibility = HiZCuller::stageVisibility(core, instanceCount);
+		prepared.staged.visibilityInstances = stageVector(core, prepared.visibilityInstances);
+		prepared.staged.visibilityMaterials = stageVector(core, prepared.materialInfos);
+		prepared.staged.materialInfos = materials.stageInfos(core, prepared.materialInfos);
+		prepared.staged.pointLights = lightsBuffer.stagePointLights(core, model.pointLights);
+	}
+
+	//switches to the prepared model without waiting for the frames in flight, what they still read is retired
+	//meshes start out as placeholders with bounds and lods, setMeshResident gives them buffers once uploaded
+	void initMeshesMaterialsLights(CookedModel& loadedModel, PreparedModel& prepared) {
+		VulkanUtils::utils().retire(std::make_shared<std::vector<Mesh>>(std::move(this->meshes)));
+		this->meshes = std::move(prepared.meshes);
+		this->residentMeshCount = 0;
+		//textures of the previous model that are still queued or decoding will never be shown
+		for (auto& load : materialImageLoads)
+			imageLoader->cancel(load);
+		this->materialImageLoads.clear();
+
+		transforms = loadedModel.transforms;
+		meshMatIndices = std::vector<uint32_t>(
+			loadedModel.matIndex.begin(),
+			loadedModel.matIndex.end()
+		);
+		instanceMeshIndices = loadedModel.meshIndex;
+		instanceBounds = std::move(prepared.instanceBounds);
+		instanceConeCulling = std::move(prepared.instanceConeCulling);
+		instanceSingleSided = std::move(prepared.instanceSingleSided);
+		instanceNodes = loadedModel.nodeIndex;
+		sceneHierarchy = std::move(loadedModel.hierarchy);
+		instanceSkins = loadedModel.skinIndex;
+		skinnedInstances = std::move(prepared.skinnedInstances);
+		animationPlayer.setAnimations(std::move(loadedModel.animations));
+		pickedInstance.reset();
+		instanceLods.assign(transforms.size(), 0);
+		instanceCullSlots.assign(transforms.size(), noCullSlot);
+		instanceHizSlots.assign(transforms.size(), noCullSlot);
+
+		//every image below is created from the headers the worker read
+		if (prepared.textureInfos.find(blankTexturePath) == prepared.textureInfos.end())
+			throw std::runtime_error("Image: " + std::string(blankTexturePath) + " could not be read");
+		materials.clear();
+		for (size_t i = 0; i < prepared.textures.size(); i++) {
+			const PreparedModel::Texture& texture = prepared.textures[i];
+			ImageLoadHandle handle;
+			materials.addMaterialImage(
+				loadImage(
+					texture.path.c_str(),
+					prepared.textureInfos.at(texture.path),
+					texture.desiredChannels,
+					texture.isSRGB,
+					std::nullopt,
+					texture.priority,
+					&handle
+				), vSampler
+			);
+			if (i > 0)
+				materialImageLoads.push_back(handle);
+		}
+		//textures of the previous model the new one didn't take are only held by the cache now
+		textureCache.trim();
+
+		skinner.setLayout(std::move(prepared.skinning));
+		frustumCuller = std::move(prepared.frustumCuller);
+		instanceBvh = std::move(prepared.instanceBvh);
+		occlusionCuller = std::move(prepared.occlusionCuller);
+		instanceOccluders = std::move(prepared.instanceOccluders);
+
+		//the frames copy these before any mesh of the model becomes resident
+		std::vector<BufferUpload> uploads;
+		auto addUploads = [&uploads](const std::vector<BufferUpload>& added) {
+			uploads.insert(uploads.end(), added.begin(), added.end());
+		};
+		uploads.push_back(materials.setInfos(std::move(prepared.materialInfos), prepared.staged.materialInfos));
+		RC<Buffer> oldBounds = instanceBoundsBuffer;
+		reserveDeviceBuffer(instanceBoundsBuffer, instanceBoundsCapacity, (uint32_t)instanceBounds.size(), sizeof(Bounds));
+		if (instanceBoundsBuffer != oldBounds) {
+			meshletCuller.setBoundsBuffer(instanceBoundsBuffer);
+			hizCuller.setBoundsBuffer(instanceBoundsBuffer);
+		}
+		uploads.push_back({ prepared.staged.instanceBounds, instanceBoundsBuffer });
+		addUploads(meshletCuller.setGeometry(
+			prepared.staged.meshlets,
+			prepared.maxMeshletsPerInstance, prepared.cullInstanceCapacity, prepared.cullDrawCapacity
+		));
+		addUploads(hizCuller.setGeometry(prepared.staged.hizVisibility, (uint32_t)transforms.size()));
+		meshletCuller.setVisibilityBuffer(hizCuller.getVisibilityBuffer());
+		addUploads(visibilityRenderer.setGeometry(
+			std::move(prepared.visibilityInstances), prepared.staged.visibilityInstances, prepared.staged.visibilityMaterials,
+			(uint32_t)meshes.size()
+		));
+		uploads.push_back(lightsBuffer.setPointLights(prepared.staged.pointLights));
+		modelLoader.queueBufferUploads(std::move(uploads));
+		prepared.staged = {};
+
+		this->pointLights = std::move(loadedModel.pointLights);
+		this->sunLight = loadedModel.directionalLight;
 	}
 
 	RC<Sampler> vSampler;
@@ -313,6 +599,76 @@ private:
 	SkyboxRenderer skyboxR;
 
 	RC<AsyncImageLoader> imageLoader;
+	//texture loads of the current model, cancelled when it is replaced
+	std::vector<ImageLoadHandle> materialImageLoads;
+	//sizes and content hashes of texture files, only used by the model loader's worker, which is stopped before it goes
+	ImageInfoIndex imageInfoIndex;
+	//staging the model loader may fill ahead of the uploads and upload bytes recorded per frame
+	AsyncModelLoader modelLoader{ 256ull << 20, 32ull << 20 };
+	//textures stay resident across model switches up to the budget, once hashed found by content so copies under other paths load once
+	TextureCache textureCache{ 512ull << 20 };
+	//meshes of the current model with buffers, instances of the others are not drawn yet
+	size_t residentMeshCount = 0;
+	//images created since the last frame, moved out of the undefined layout in the next frame's command buffer
+	std::vector<RC<Image>> pendingImageTransitions;
+
+	void setMeshResident(uint32_t meshIndex, const Mesh& uploaded) {
+		Mesh& mesh = meshes[meshIndex];
+		mesh.vertexBuffer = uploaded.vertexBuffer;
+		mesh.indexBuffer = uploaded.indexBuffer;
+		mesh.skinBuffer = uploaded.skinBuffer;
+		visibilityRenderer.setMeshResident(meshIndex, mesh);
+		skinner.setMeshResident(meshIndex, mesh);
+		residentMeshCount++;
+	}
+
+	//the current model keeps drawing until the new one is loaded, its meshes then stream in nearest first
+	void requestModel() {
+		ModelLoadRequest req{};
+		req.path = gltfModelSelector.loadedModelPath;
+		req.cookFlags = modelCookFlags;
+		req.viewPos = camera.get_pos();
+		auto prepared = std::make_shared<PreparedModel>();
+		req.onWorkerLoaded = [this, prepared, viewPos = req.viewPos](const CookedModel& model) {
+			//headers of new or changed textures are read in parallel, the images are created from them on the main thread
+			std::vector<std::string> texturePaths = modelTexturePaths(model);
+			imageInfoIndex.prefetch(texturePaths);
+			for (const std::string& path : texturePaths) {
+				try {
+					prepared->textureInfos[path] = imageInfoIndex.get(path.c_str());
+				}
+				catch (const std::exception& err) {
+					std::cerr << err.what() << std::endl;
+				}
+			}
+			imageInfoIndex.save();
+			prepareModel(model, *prepared, viewPos);
+		};
+		req.onWorkerStaged = [this, prepared](const std::function<bool()>& superseded) {
+			//whole files are only read once nothing waits on the worker, later models find shared textures by these
+			std::vector<std::string> texturePaths;
+			for (const auto& [path, info] : prepared->textureInfos)
+				texturePaths.push_back(path);
+			imageInfoIndex.hashContents(texturePaths, superseded);
+			imageInfoIndex.save();
+		};
+		req.onModelLoaded = [this, prepared](std::shared_ptr<CookedModel> model) {
+			if (!model) {
+				if (meshes.empty())
+					throw std::runtime_error("failed to load model!");
+				return;
+			}
+			auto start = std::chrono::high_resolution_clock::now();
+			this->initMeshesMaterialsLights(*model, *prepared);
+			auto end = std::chrono::high_resolution_clock::now();
+			auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+			std::cout << "Switching to the new model took: " << duration.count() << " ms" << std::endl;
+		};
+		req.onMeshResident = [this](uint32_t meshIndex, const Mesh& mesh) {
+			setMeshResident(meshIndex, mesh);
+		};
+		modelLoader.request(req);
+	}
 
 	void initVulkan() {
 		core = VulkanUtils::utils().getCore();
@@ -338,21 +694,39 @@ private:
 		auto swapPresentMode = chooseSwapPresentMode(swapCapabilities.presentModes);
 		
 		materials.init(1000);
-		materialsDescriptorSet = materials.getDescriptorSet();
 		
 		vSampler = Sampler::create(core, Sampler::makeCreateInfo(
 			{ VK_FILTER_LINEAR, VK_FILTER_LINEAR },
 			{VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT, VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT },
-			{},
+			//cooked textures come with their mips
+			{ 0.f, 0.f, VK_LOD_CLAMP_NONE },
 			VK_SAMPLER_MIPMAP_MODE_LINEAR,
 			core->gpuProperties.limits.maxSamplerAnisotropy
 		));
 
 		createRenderPass(swapChainFormat.format);
 		createGraphicsPipeline();
+		visibilityRenderer.initialize(
+			renderPass,
+			core->getLayout(frames.front().data.globalDS),
+			core->getLayout(frames.front().data.pointLightsDS),
+			core->getLayout(materials.getDescriptorSet(0))
+		);
+		reserveDeviceBuffer(instanceBoundsBuffer, instanceBoundsCapacity, 1, sizeof(Bounds));
+		hizCuller.initialize(instanceBoundsBuffer);
 		createDepthPrePassPipeline();
 		createClusterComputePipeline();
 		swapChain = SwapChain(core, swapChainFormat, swapPresentMode, chooseSwapExtent(swapCapabilities.capabilities), renderPass);
+		hizCuller.resize(swapChain.depthImage, swapChain.depthImageView->view, swapChain.swapChainExtent);
+		visibilityRenderer.setVisibilityView(swapChain.visibilityImageView->view);
+
+		VkQueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = 2 * MAX_FRAMES_IN_FLIGHT;
+		if (vkCreateQueryPool(core->device, &queryPoolInfo, nullptr, &passTimestamps) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create query pool!");
+		}
 		
 		camera = CamHandler(core->window);
 		if (Store::itemInStore("cameraMovementSpeed")) {
@@ -361,15 +735,27 @@ private:
 			memcpy(&loadedMovementSpeed, loadedBytes.get(), sizeof(loadedMovementSpeed));
 			camera.movementSpeed() = loadedMovementSpeed;
 		}
+		if (Store::itemInStore("modelCookFlags")) {
+			auto loadedBytes = Store::fetchBytes("modelCookFlags");
+			memcpy(&modelCookFlags, loadedBytes.get(), sizeof(modelCookFlags));
+		}
 
+		//decoding is cpu bound, leave a core to the render thread
+		//staging fits a 4k rgba32f image, the skybox only stages its cooked cube faces
 		imageLoader = std::make_shared<AsyncImageLoader>(
-			glm::ivec3(8192, 4096, 1), 4, 2
+			glm::ivec3(4096, 4096, 1), 4, 2,
+			(int)std::max(2u, std::thread::hardware_concurrency()) - 1
 		);
 		imageLoader->init();
 		imageLoader->start();
 
 		skyboxR.initialize(imageLoader, renderPass, 1);
-		initMeshesMaterialsLights();
+		meshletCuller.initialize(instanceBoundsBuffer);
+		skinner.initialize();
+		//the first frame needs a scene to cull, later loads keep drawing the old one meanwhile
+		modelLoader.start();
+		requestModel();
+		modelLoader.waitForModel();
 
 		imgui.init(core, this->renderPass, this->frames[0].commandBuffer, 1);		
 	}
@@ -515,6 +901,9 @@ private:
 		// this frame is currently not in flight
 		// next image has not yet been acquired
 
+		//nothing in flight is older than this frame's last submission anymore
+		VulkanUtils::utils().frameWaited();
+
 		memcpy(
 			transferFrameData.globalDescBufferMappedPointer,
 			&gDescValue,
@@ -524,6 +913,292 @@ private:
 		PointLightLength length;
 		length.length = 0;
 		transferFrameData.lightIndexBuffer.updateBase(core, commandPool, length);
+
+		this->lightsBuffer.setSunLight(sunLight, current_frame);
+	}
+
+	static bool hasUniformScale(const glm::mat4& transform) {
+		glm::mat3 basis = glm::mat3(transform);
+		float scale = glm::length(basis[0]);
+		return
+			std::abs(glm::length(basis[1]) - scale) <= scale * 1e-3f &&
+			std::abs(glm::length(basis[2]) - scale) <= scale * 1e-3f &&
+			std::abs(glm::dot(basis[0], basis[1])) <= scale * scale * 1e-3f &&
+			std::abs(glm::dot(basis[0], basis[2])) <= scale * scale * 1e-3f &&
+			std::abs(glm::dot(basis[1], basis[2])) <= scale * scale * 1e-3f;
+	}
+
+	//skinned instances whose node or any joint is in nodes, ascending
+	std::vector<uint32_t> movedSkinnedInstances(SceneRange nodes) const {
+		const AnimationSet& animations = animationPlayer.getAnimations();
+		auto inRange = [&](uint32_t node) {
+			return node >= nodes.first && node < nodes.first + nodes.count;
+		};
+		std::vector<int8_t> skinMoved(animations.skins.size(), -1);
+		std::vector<uint32_t> moved;
+		for (uint32_t i : skinnedInstances) {
+			int8_t& skin = skinMoved[instanceSkins[i]];
+			if (skin < 0) {
+				const Skin& s = animations.skins[instanceSkins[i]];
+				skin = 0;
+				for (uint32_t j = 0; j < s.jointCount && !skin; j++)
+					skin = inRange(animations.jointNodes[s.firstJoint + j]);
+			}
+			if (skin || inRange(instanceNodes[i]))
+				moved.push_back(i);
+		}
+		return moved;
+	}
+
+	//joint matrices for the skinner and bounds holding every vertex the joints can move, from the current world matrices
+	void updateSkinnedInstances(const std::vector<uint32_t>& instances) {
+		const AnimationSet& animations = animationPlayer.getAnimations();
+		parallelFor(instances.size(), 16, [&](size_t begin, size_t end) {
+			for (size_t s = begin; s < end; s++) {
+				uint32_t i = instances[s];
+				glm::mat4* joints = skinner.instanceJoints(i);
+				computeJointMatrices(animations, sceneHierarchy, instanceSkins[i], instanceNodes[i], joints);
+				instanceBounds[i] = skinnedBounds(meshes[instanceMeshIndices[i]].bounds, transforms[i], joints, animations.skins[instanceSkins[i]].jointCount);
+			}
+			});
+	}
+
+	void updateSceneTransforms(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+		//only instances under edited nodes are recomputed and uploaded again
+		SceneRange nodes = sceneHierarchy.update();
+		if (nodes.count == 0)
+			return;
+		uint32_t first = (uint32_t)(std::lower_bound(instanceNodes.begin(), instanceNodes.end(), nodes.first) - instanceNodes.begin());
+		uint32_t end = (uint32_t)(std::lower_bound(instanceNodes.begin(), instanceNodes.end(), nodes.first + nodes.count) - instanceNodes.begin());
+
+		for (uint32_t i = first; i < end; i++) {
+			transforms[i] = sceneHierarchy.getWorldMatrix(instanceNodes[i]);
+			instanceBounds[i] = transformBounds(meshes[instanceMeshIndices[i]].bounds, transforms[i]);
+			instanceConeCulling[i] = instanceSingleSided[i] && hasUniformScale(transforms[i]);
+			if (instanceOccluders[i] != noCullSlot)
+				occlusionCuller.setOccluderTransform(instanceOccluders[i], transforms[i]);
+		}
+		//joints can be anywhere in the hierarchy, skinned instances outside the range move with any of theirs
+		std::vector<uint32_t> movedSkinned = movedSkinnedInstances(nodes);
+		updateSkinnedInstances(movedSkinned);
+
+		//moved instances as ascending disjoint ranges [first, end)
+		std::vector<std::pair<uint32_t, uint32_t>> ranges;
+		auto addRange = [&ranges](uint32_t rangeFirst, uint32_t rangeEnd) {
+			if (!ranges.empty() && rangeFirst <= ranges.back().second)
+				ranges.back().second = std::max(ranges.back().second, rangeEnd);
+			else
+				ranges.emplace_back(rangeFirst, rangeEnd);
+		};
+		auto skinned = movedSkinned.begin();
+		for (; skinned != movedSkinned.end() && *skinned < first; skinned++)
+			addRange(*skinned, *skinned + 1);
+		if (first < end)
+			addRange(first, end);
+		for (; skinned != movedSkinned.end(); skinned++)
+			addRange(*skinned, *skinned + 1);
+		if (ranges.empty())
+			return;
+
+		uint32_t movedCount = 0;
+		for (auto [rangeFirst, rangeEnd] : ranges) {
+			frustumCuller.updateBounds(instanceBounds, rangeFirst, rangeEnd - rangeFirst);
+			movedCount += rangeEnd - rangeFirst;
+		}
+		//one bottom up refit beats walking up from many instances
+		if (movedCount > instanceBounds.size() / 4) {
+			instanceBvh.refit(instanceBounds);
+		}
+		else {
+			for (auto [rangeFirst, rangeEnd] : ranges)
+				for (uint32_t i = rangeFirst; i < rangeEnd; i++)
+					instanceBvh.updateInstance(i, instanceBounds[i]);
+		}
+
+		//frames still in flight read the old values, everything recorded after this reads the new ones
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		const VkPipelineStageFlags readStages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		vkCmdPipelineBarrier(commandBuffer, readStages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		for (auto [rangeFirst, rangeEnd] : ranges) {
+			sceneStaging.write(commandBuffer, frameIndex, instanceBoundsBuffer->buffer,
+				sizeof(Bounds) * rangeFirst, instanceBounds.data() + rangeFirst, sizeof(Bounds) * (rangeEnd - rangeFirst));
+			visibilityRenderer.updateTransforms(commandBuffer, sceneStaging, frameIndex, transforms, rangeFirst, rangeEnd - rangeFirst);
+		}
+
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, readStages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+
+	void selectOccluders(const CookedModel& model, PreparedModel& prepared) const {
+		//big instances hide the most, a coarse lod keeps them cheap to rasterize every frame
+		prepared.instanceOccluders.assign(model.transforms.size(), noCullSlot);
+		std::vector<uint32_t> candidates(model.transforms.size());
+		std::iota(candidates.begin(), candidates.end(), 0);
+		std::sort(candidates.begin(), candidates.end(), [&prepared](uint32_t a, uint32_t b) {
+			return prepared.instanceBounds[a].sphere.w > prepared.instanceBounds[b].sphere.w;
+			});
+
+		uint32_t occluderCount = 0;
+		for (uint32_t i : candidates) {
+			if (occluderCount == maxOccluders)
+				break;
+			const Mesh& mesh = prepared.meshes[model.meshIndex[i]];
+			//the software rasterizer only knows the bind pose
+			if (prepared.skinning.isSkinned(i))
+				continue;
+			//lods only grow coarser, lod 0 has no error
+			uint32_t lod = 0;
+			while (lod + 1 < mesh.lods.size() && mesh.lods[lod + 1].error <= occluderLodError)
+				lod++;
+			if (mesh.lods[lod].indexCount / 3 > maxOccluderTriangles)
+				continue;
+			prepared.instanceOccluders[i] = prepared.occlusionCuller.addOccluder(model.meshes[model.meshIndex[i]], mesh.lods[lod], model.transforms[i]);
+			occluderCount++;
+		}
+		std::cout << "Occlusion culling: " << occluderCount << " occluders, " << prepared.occlusionCuller.occluderTriangleCount() << " triangles" << std::endl;
+	}
+
+	void cullInstances() {
+		viewFrustum = Frustum::fromProjView(gDescValue.projView);
+		if (frustumCullingEnabled && bvhCullingEnabled) {
+			instanceBvh.cullFrustum(viewFrustum, visibleInstances);
+		}
+		else if (frustumCullingEnabled) {
+			frustumCuller.cull(viewFrustum, visibleInstances);
+		}
+		else {
+			visibleInstances.resize(transforms.size());
+			std::iota(visibleInstances.begin(), visibleInstances.end(), 0);
+		}
+		//instances of meshes still streaming in are skipped until their buffers are uploaded
+		if (residentMeshCount < meshes.size()) {
+			visibleInstances.erase(std::remove_if(visibleInstances.begin(), visibleInstances.end(), [this](uint32_t i) {
+				return !meshes[instanceMeshIndices[i]].isResident();
+				}), visibleInstances.end());
+		}
+
+		occludedInstances = 0;
+		if (occlusionCullingEnabled) {
+			size_t unoccluded = visibleInstances.size();
+			occlusionCuller.render(gDescValue.projView);
+			occlusionCuller.cull(instanceBounds, visibleInstances);
+			occludedInstances = unoccluded - visibleInstances.size();
+		}
+	}
+
+	void selectLods() {
+		//picks per instance the coarsest lod whose error projected on screen is under lodPixelError
+		//both passes draw the same lods so the prepass depth matches
+		float projectionScale = swapChain.swapChainExtent.height / (2.f * std::tan(gDescValue.fovY_aspectRatio_zNear_zFar.x * 0.5f));
+		glm::vec3 cameraPos = glm::vec3(gDescValue.cameraPos_time);
+		drawnTriangles = 0;
+		for (uint32_t i : visibleInstances) {
+			const Mesh& mesh = meshes[instanceMeshIndices[i]];
+			uint32_t lod = std::min<uint32_t>(instanceLods[i], (uint32_t)mesh.lods.size() - 1);
+			if (!lodsEnabled) {
+				lod = 0;
+			}
+			else if (mesh.lods.size() > 1) {
+				glm::vec3 center = glm::vec3(instanceBounds[i].sphere);
+				float radius = instanceBounds[i].sphere.w;
+				float distance = std::max(glm::distance(center, cameraPos) - radius, nearPlane);
+				//lod errors are relative to the radius, so this converts them to pixels
+				float projectedRadius = radius / distance * projectionScale;
+
+				while (lod > 0 && mesh.lods[lod].error * projectedRadius > lodPixelError)
+					lod--;
+				while (lod + 1 < mesh.lods.size() && mesh.lods[lod + 1].error * projectedRadius * lodHysteresis <= lodPixelError)
+					lod++;
+			}
+			instanceLods[i] = lod;
+			drawnTriangles += mesh.lods[lod].indexCount / 3;
+		}
+	}
+
+	void cullHiZ(Frame& activeFrame) {
+		//early: draw depth of what was visible last frame, late: test everything against its pyramid
+		hizCuller.beginFrame(current_frame);
+		for (uint32_t i : visibleInstances) {
+			const MeshLod& lod = meshes[instanceMeshIndices[i]].lods[instanceLods[i]];
+			instanceHizSlots[i] = hizCuller.addInstance(current_frame, i, lod.firstIndex, lod.indexCount);
+		}
+		hizCuller.recordEarlyCulling(activeFrame.commandBuffer, current_frame);
+
+		hizCuller.beginEarlyPass(activeFrame.commandBuffer);
+		vkCmdBindPipeline(activeFrame.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrePass.earlyPipe);
+		vkCmdBindDescriptorSets(activeFrame.commandBuffer,
+			VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrePass.layout,
+			0, 1, &activeFrame.data.globalDS,
+			0, nullptr
+		);
+
+		VkViewport viewport{};
+		viewport.width = static_cast<float>(swapChain.swapChainExtent.width);
+		viewport.height = static_cast<float>(swapChain.swapChainExtent.height);
+		viewport.minDepth = 0.0f;
+		viewport.maxDepth = 1.0f;
+		vkCmdSetViewport(activeFrame.commandBuffer, 0, 1, &viewport);
+
+		VkRect2D scissor{};
+		scissor.extent = swapChain.swapChainExtent;
+		vkCmdSetScissor(activeFrame.commandBuffer, 0, 1, &scissor);
+
+		for (uint32_t i : visibleInstances) {
+			MeshPushConstants constants{ transforms[i] };
+			vkCmdPushConstants(activeFrame.commandBuffer, depthPrePass.layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+
+			bindInstanceGeometry(activeFrame.commandBuffer, i);
+			hizCuller.drawEarly(activeFrame.commandBuffer, current_frame, instanceHizSlots[i]);
+		}
+		hizCuller.endEarlyPass(activeFrame.commandBuffer);
+
+		hizCuller.recordLateCulling(activeFrame.commandBuffer, current_frame, gDescValue.projView);
+	}
+
+	void skinInstances(VkCommandBuffer commandBuffer) {
+		//only what is drawn this frame is skinned into this frame's buffer
+		skinner.beginFrame(current_frame);
+		for (uint32_t i : visibleInstances) {
+			if (skinner.isSkinned(i))
+				skinner.addInstance(current_frame, i);
+		}
+		skinner.recordSkinning(commandBuffer, current_frame);
+	}
+
+	//skinned instances draw this frame's skinned vertices with their mesh's indices
+	void bindInstanceGeometry(VkCommandBuffer commandBuffer, uint32_t instance) {
+		const Mesh& mesh = meshes[instanceMeshIndices[instance]];
+		if (skinner.isSkinned(instance)) {
+			skinner.bindVertices(commandBuffer, current_frame, instance);
+		}
+		else {
+			VkDeviceSize offset = 0;
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &mesh.vertexBuffer->buffer, &offset);
+		}
+		vkCmdBindIndexBuffer(commandBuffer, mesh.indexBuffer->buffer, 0, mesh.indexType);
+	}
+
+	void cullMeshlets(VkCommandBuffer commandBuffer) {
+		//instances drawn at full detail go through the meshlet culling pass, coarser lods are cheap enough as is
+		meshletCuller.beginFrame(current_frame);
+		for (uint32_t i : visibleInstances) {
+			const Mesh& mesh = meshes[instanceMeshIndices[i]];
+			instanceCullSlots[i] = noCullSlot;
+			//meshlet bounds and cones are in bind pose, skinned instances are drawn whole
+			if (meshletCullingEnabled && instanceLods[i] == 0 && mesh.meshletCount > 0 && !skinner.isSkinned(i)) {
+				instanceCullSlots[i] = meshletCuller.addInstance(
+					current_frame, i, transforms[i],
+					mesh.firstMeshlet, mesh.meshletCount,
+					instanceConeCulling[i]
+				);
+			}
+		}
+		meshletCuller.recordCulling(commandBuffer, current_frame, viewFrustum, glm::vec3(gDescValue.cameraPos_time), hizCullingEnabled);
 	}
 
 	void frameActions(Frame& activeFrame,
@@ -538,7 +1213,31 @@ private:
 		{
 			if(ImGui::CollapsingHeader("Model Selection Menu"))
 			{
+				bool cookFlagsChanged = false;
+				cookFlagsChanged |= ImGui::CheckboxFlags("Optimize meshes", &modelCookFlags, ModelCache::optimizeMeshesFlag);
+				cookFlagsChanged |= ImGui::CheckboxFlags("Weld vertices", &modelCookFlags, ModelCache::weldVerticesFlag);
+				cookFlagsChanged |= ImGui::CheckboxFlags("Weld nearby vertices", &modelCookFlags, ModelCache::weldNearVerticesFlag);
+				cookFlagsChanged |= ImGui::CheckboxFlags("Generate lods", &modelCookFlags, ModelCache::generateLodsFlag);
+				cookFlagsChanged |= ImGui::CheckboxFlags("Build meshlets", &modelCookFlags, ModelCache::buildMeshletsFlag);
+				if (cookFlagsChanged) {
+					Store::storeBytes("modelCookFlags", (char*)&modelCookFlags, sizeof(modelCookFlags));
+					hasModelChanged = true;
+				}
+				if (ImGui::Checkbox("Cook textures", &cookTextures))
+					hasModelChanged = true;
+				if (ImGui::Button("Benchmark texture compression"))
+					benchmarkBlockCompression();
+				ImGui::Text(
+					"texture cache: %zu textures, %zu unused, %.1f / %.1f MB, %zu hits, %zu misses",
+					textureCache.size(), textureCache.unusedCount(),
+					textureCache.getResidentBytes() / 1048576.0, textureCache.getBudgetBytes() / 1048576.0,
+					textureCache.getHits(), textureCache.getMisses()
+				);
+				if (ImGui::Button("Benchmark hdr decoding"))
+					benchmarkRadianceDecoder(SkyboxRenderer::environmentPath);
 				gltfModelSelector.render([this]() { hasModelChanged = true; });
+				if (modelLoader.isLoading())
+					ImGui::Text("streaming meshes: %zu / %zu", modelLoader.residentMeshCount(), modelLoader.meshCount());
 			}
 
 			if (ImGui::CollapsingHeader("Camera settings"))
@@ -558,6 +1257,97 @@ private:
 				}
 			}
 
+			if (ImGui::CollapsingHeader("Level of detail"))
+			{
+				ImGui::Checkbox("enable lods", &lodsEnabled);
+				ImGui::SliderFloat("max pixel error", &lodPixelError, 0.25f, 16.f);
+				ImGui::Text("drawn triangles: %zu", drawnTriangles);
+			}
+
+			if (ImGui::CollapsingHeader("Frustum culling"))
+			{
+				ImGui::Checkbox("enable frustum culling", &frustumCullingEnabled);
+				ImGui::Text("visible instances: %zu / %zu", visibleInstances.size(), transforms.size());
+				ImGui::Text("avx2: %s", hasAvx2() ? "yes" : "no");
+				ImGui::Checkbox("cull through bvh", &bvhCullingEnabled);
+				ImGui::Text("bvh nodes: %zu", instanceBvh.nodeCount());
+			}
+
+			if (ImGui::CollapsingHeader("Occlusion culling"))
+			{
+				ImGui::Checkbox("enable occlusion culling", &occlusionCullingEnabled);
+				ImGui::Text("occluder triangles: %zu", occlusionCuller.occluderTriangleCount());
+				ImGui::Text("occluded instances: %zu", occludedInstances);
+			}
+
+			if (ImGui::CollapsingHeader("Hi-Z culling"))
+			{
+				ImGui::Checkbox("enable hi-z culling", &hizCullingEnabled);
+				glm::uvec2 pyramidSize = hizCuller.getPyramidSize();
+				ImGui::Text("depth pyramid: %ux%u", pyramidSize.x, pyramidSize.y);
+				ImGui::Text("instances tested: %u", hizCuller.instanceCount(current_frame));
+			}
+
+			if (ImGui::CollapsingHeader("Shading"))
+			{
+				if (visibilityRenderer.isAvailable())
+					ImGui::Checkbox("visibility buffer", &visibilityBufferEnabled);
+				else
+					ImGui::Text("visibility buffer unavailable, more than %u meshes", VisibilityBufferRenderer::maxMeshes);
+				ImGui::Text("main pass: %.3f ms", mainPassMs);
+			}
+
+			if (ImGui::CollapsingHeader("Picking"))
+			{
+				ImGui::Text("show the mouse with escape and click an object");
+				if (pickedInstance) {
+					uint32_t instance = pickedInstance->instance;
+					ImGui::Text("instance: %u", instance);
+					ImGui::Text("mesh: %u, material: %u", instanceMeshIndices[instance], meshMatIndices[instance]);
+					ImGui::Text("distance: %.2f", pickedInstance->distance);
+					//moves the whole subtree of the instance's node
+					uint32_t node = instanceNodes[instance];
+					ImGui::Text("node: %u, subtree: %u nodes", node, sceneHierarchy.getSubtreeEnd(node) - node);
+					glm::vec3 translation = sceneHierarchy.getTranslation(node);
+					if (ImGui::DragFloat3("node translation", &translation.x, 0.01f))
+						sceneHierarchy.setTranslation(node, translation);
+					glm::vec3 scale = sceneHierarchy.getScale(node);
+					if (ImGui::DragFloat3("node scale", &scale.x, 0.01f))
+						sceneHierarchy.setScale(node, scale);
+				}
+				else {
+					ImGui::Text("nothing picked");
+				}
+			}
+
+			if (ImGui::CollapsingHeader("Animation"))
+			{
+				if (animationPlayer.clipCount() == 0) {
+					ImGui::Text("no animations");
+				}
+				else {
+					ImGui::Checkbox("play", &animationPlayer.playing);
+					ImGui::SliderFloat("speed", &animationPlayer.speed, -2.f, 2.f);
+					for (uint32_t c = 0; c < animationPlayer.clipCount(); c++) {
+						const AnimationClip& clip = animationPlayer.getClip(c);
+						bool clipPlaying = animationPlayer.isClipPlaying(c);
+						ImGui::PushID(c);
+						if (ImGui::Checkbox(clip.name.empty() ? "unnamed clip" : clip.name.c_str(), &clipPlaying))
+							animationPlayer.setClipPlaying(c, clipPlaying);
+						ImGui::SameLine();
+						ImGui::Text("%.2f / %.2f s", animationPlayer.getClipTime(c), clip.duration);
+						ImGui::PopID();
+					}
+				}
+				ImGui::Text("skinned instances: %zu", skinnedInstances.size());
+			}
+
+			if (ImGui::CollapsingHeader("Meshlet culling"))
+			{
+				ImGui::Checkbox("enable meshlet culling", &meshletCullingEnabled);
+				ImGui::Text("instances culled per meshlet: %u", meshletCuller.instanceCount(current_frame));
+			}
+
 			if (ImGui::Button("Rebuild Shading Pipeline")) {
 				this->rebuildShadingPipe = true;
 			}
@@ -612,32 +1402,75 @@ private:
 			throw std::runtime_error("failed to begin recording command buffer!");
 		}
 
+		//the frame's last timestamps are done
+		if (passTimestampsWritten[current_frame]) {
+			uint64_t timestamps[2];
+			if (vkGetQueryPoolResults(core->device, passTimestamps, 2 * current_frame, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+				mainPassMs = float(timestamps[1] - timestamps[0]) * core->gpuProperties.limits.timestampPeriod * 1e-6f;
+		}
+		vkCmdResetQueryPool(activeFrame.commandBuffer, passTimestamps, 2 * current_frame, 2);
+
+		modelLoader.processUploads(activeFrame.commandBuffer, current_frame);
+		//new material images are moved to the layout they are sampled in here instead of one submit each
+		for (auto& image : pendingImageTransitions) {
+			//an image whose load already finished was moved by it
+			if (image->layout != VK_IMAGE_LAYOUT_UNDEFINED)
+				continue;
+			image->recordTransition(activeFrame.commandBuffer, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 0, image->mipLevels);
+			image->layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		}
+		pendingImageTransitions.clear();
+		materials.beginFrame(current_frame);
+		//in place transform writes would be overwritten by the new model's buffers still waiting to be copied
+		sceneStaging.beginFrame(current_frame);
+		if (!modelLoader.hasPendingBufferUploads())
+			updateSceneTransforms(activeFrame.commandBuffer, current_frame);
+		cullInstances();
+		selectLods();
+		skinInstances(activeFrame.commandBuffer);
+		visibilityRenderer.beginFrame(current_frame, skinner.getOutputBuffer(current_frame));
+		std::fill(instanceHizSlots.begin(), instanceHizSlots.end(), noCullSlot);
+		if (hizCullingEnabled)
+			cullHiZ(activeFrame);
+		cullMeshlets(activeFrame.commandBuffer);
+
 		auto activeSwapChainFramebuffer = swapChain.swapChainFramebuffers[activeFrame.imageIndex.value()];
 
 
+		bool visibilityPass = visibilityBufferEnabled && visibilityRenderer.isAvailable();
+		//the prepass only adds what the early pass didn't draw, the visibility prepass needs ids of everything so it starts over
+		bool loadEarlyDepth = hizCullingEnabled && !visibilityPass;
+
 		VkRenderPassBeginInfo renderPassInfo{};
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassInfo.renderPass = renderPass;
+		renderPassInfo.renderPass = loadEarlyDepth ? earlyDepthRenderPass : renderPass;
 		renderPassInfo.framebuffer = activeSwapChainFramebuffer;
 
 		renderPassInfo.renderArea.offset = { 0, 0 };
 		renderPassInfo.renderArea.extent = swapChain.swapChainExtent;
 
-		std::array<VkClearValue, 2> clearValues{};
+		std::array<VkClearValue, 3> clearValues{};
 		clearValues[0].color = { {0.0f, 0.0f, 0.0f, 1.0f} };
 		clearValues[1].depthStencil = { 1.0f, 0 };
+		clearValues[2].color.uint32[0] = VisibilityBufferRenderer::noInstance;
 		renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
 		renderPassInfo.pClearValues = clearValues.data();
 
+		vkCmdWriteTimestamp(activeFrame.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, passTimestamps, 2 * current_frame);
 		vkCmdBeginRenderPass(activeFrame.commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 		//Start of depth prepass
 
-		vkCmdBindPipeline(activeFrame.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrePass.pipe);
-		vkCmdBindDescriptorSets(activeFrame.commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
-			0, 1, &activeFrame.data.globalDS,
-			0, nullptr
-		);
+		if (visibilityPass) {
+			visibilityRenderer.beginPrepass(activeFrame.commandBuffer, activeFrame.data.globalDS);
+		}
+		else {
+			vkCmdBindPipeline(activeFrame.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrePass.pipe);
+			vkCmdBindDescriptorSets(activeFrame.commandBuffer,
+				VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
+				0, 1, &activeFrame.data.globalDS,
+				0, nullptr
+			);
+		}
 
 		VkViewport viewport{};
 		viewport.x = 0.0f;
@@ -653,14 +1486,26 @@ private:
 		scissor.extent = swapChain.swapChainExtent;
 		vkCmdSetScissor(activeFrame.commandBuffer, 0, 1, &scissor);
 
-		VkDeviceSize offset = 0;
-		for (int i = 0; i < meshes.size(); ++i) {
-			MeshPushConstants constants{ transforms[i] };
-			vkCmdPushConstants(activeFrame.commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+		for (uint32_t i : visibleInstances) {
+			const Mesh& mesh = meshes[instanceMeshIndices[i]];
+			const MeshLod& lod = mesh.lods[instanceLods[i]];
+			if (visibilityPass) {
+				visibilityRenderer.pushInstance(activeFrame.commandBuffer, transforms[i], i);
+			}
+			else {
+				MeshPushConstants constants{ transforms[i] };
+				vkCmdPushConstants(activeFrame.commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+			}
 
-			vkCmdBindVertexBuffers(activeFrame.commandBuffer, 0, 1, &meshes[i].vertexBuffer->buffer, &offset);
-			vkCmdBindIndexBuffer(activeFrame.commandBuffer, meshes[i].indexBuffer->buffer, 0, meshes[i].indexType);
-			vkCmdDrawIndexed(activeFrame.commandBuffer, meshes[i].numIndices, 1, 0, 0, 0);
+			bindInstanceGeometry(activeFrame.commandBuffer, i);
+			if (instanceCullSlots[i] != noCullSlot)
+				meshletCuller.drawInstance(activeFrame.commandBuffer, current_frame, instanceCullSlots[i], loadEarlyDepth);
+			else if (instanceHizSlots[i] != noCullSlot && loadEarlyDepth)
+				hizCuller.drawLate(activeFrame.commandBuffer, current_frame, instanceHizSlots[i]);
+			else if (instanceHizSlots[i] != noCullSlot)
+				hizCuller.drawShade(activeFrame.commandBuffer, current_frame, instanceHizSlots[i]);
+			else
+				vkCmdDrawIndexed(activeFrame.commandBuffer, lod.indexCount, 1, lod.firstIndex, 0, lod.firstIndex / 3);
 		}
 
 
@@ -684,21 +1529,33 @@ private:
 		//make a model view matrix for rendering the object
 		//camera position
 
-		offset = 0;
-		for (int i = 0; i < meshes.size(); ++i) {
-			int matIndex = meshMatIndices[i];
-			uint32_t dynamicOffset = materials.getResourceOffset(meshMatIndices[i]);
-			vkCmdBindDescriptorSets(
-				activeFrame.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-				pipelineLayout, 2, 1, &materialsDescriptorSet, 1, &dynamicOffset
-			);
+		if (visibilityPass) {
+			VkDescriptorSet forwardSets[3] = { activeFrame.data.globalDS, activeFrame.data.pointLightsDS, materials.getDescriptorSet(current_frame) };
+			visibilityRenderer.shade(activeFrame.commandBuffer, forwardSets, glm::vec2(swapChain.swapChainExtent.width, swapChain.swapChainExtent.height), current_frame);
+		}
+		else {
+			for (uint32_t i : visibleInstances) {
+				const Mesh& mesh = meshes[instanceMeshIndices[i]];
+				const MeshLod& lod = mesh.lods[instanceLods[i]];
+				int matIndex = meshMatIndices[i];
+				uint32_t dynamicOffset = materials.getResourceOffset(meshMatIndices[i]);
+				VkDescriptorSet materialsDescriptorSet = materials.getDescriptorSet(current_frame);
+				vkCmdBindDescriptorSets(
+					activeFrame.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+					pipelineLayout, 2, 1, &materialsDescriptorSet, 1, &dynamicOffset
+				);
 
-			MeshPushConstants constants{ transforms[i] };
-			vkCmdPushConstants(activeFrame.commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+				MeshPushConstants constants{ transforms[i] };
+				vkCmdPushConstants(activeFrame.commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
 
-			vkCmdBindVertexBuffers(activeFrame.commandBuffer, 0, 1, &meshes[i].vertexBuffer->buffer, &offset);
-			vkCmdBindIndexBuffer(activeFrame.commandBuffer, meshes[i].indexBuffer->buffer, 0, meshes[i].indexType);
-			vkCmdDrawIndexed(activeFrame.commandBuffer, meshes[i].numIndices, 1, 0, 0, 0);
+				bindInstanceGeometry(activeFrame.commandBuffer, i);
+				if (instanceCullSlots[i] != noCullSlot)
+					meshletCuller.drawInstance(activeFrame.commandBuffer, current_frame, instanceCullSlots[i]);
+				else if (instanceHizSlots[i] != noCullSlot)
+					hizCuller.drawShade(activeFrame.commandBuffer, current_frame, instanceHizSlots[i]);
+				else
+					vkCmdDrawIndexed(activeFrame.commandBuffer, lod.indexCount, 1, lod.firstIndex, 0, lod.firstIndex / 3);
+			}
 		}
 
 		skyboxR.beginRender(activeFrame.commandBuffer, viewport, scissor);
@@ -715,6 +1572,8 @@ private:
 		imgui.drawWithinRenderPass(activeFrame.commandBuffer);
 
 		vkCmdEndRenderPass(activeFrame.commandBuffer);
+		vkCmdWriteTimestamp(activeFrame.commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, passTimestamps, 2 * current_frame + 1);
+		passTimestampsWritten[current_frame] = true;
 
 		if (vkEndCommandBuffer(activeFrame.commandBuffer) != VK_SUCCESS) {
 			throw std::runtime_error("failed to record command buffer!");
@@ -743,6 +1602,7 @@ private:
 		double startTime = glfwGetTime();
 		bool shouldShowMouse = false;
 		double lastCursorPos[2];
+		int lastMouseButtonState = GLFW_RELEASE;
 		inputManager->addCallback(GLFW_KEY_ESCAPE, "shouldShowMouseToggle", [&shouldShowMouse, this, &lastCursorPos](int state, int mods) {
 			if (state == GLFW_PRESS) {
 				if (mods & GLFW_MOD_SHIFT) {
@@ -780,17 +1640,11 @@ private:
 		while (!glfwWindowShouldClose(core->window)) {
 			try {
 				if (hasModelChanged) {
-					//wait for meshes to go out of use
-					vkDeviceWaitIdle(core->device);
-
-					auto start = std::chrono::high_resolution_clock::now();
-					// Reload the models
-					this->initMeshesMaterialsLights();
-					auto end = std::chrono::high_resolution_clock::now();
-					auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-					std::cout << "Loading new model took: " << duration.count() << " ms" << std::endl;
+					requestModel();
 					hasModelChanged = false;
 				}
+				//swaps in a newly loaded model, its meshes are uploaded over the next frames
+				this->modelLoader.processModels();
 
 				if (rebuildShadingPipe) {
 					vkDeviceWaitIdle(core->device);
@@ -822,6 +1676,7 @@ private:
 					camera.moveAround(deltaTime);
 					camera.lookAround();
 				}
+				animationPlayer.advance((float)deltaTime, sceneHierarchy);
 
 				gDescValue.updateValues(
 					projection,
@@ -834,6 +1689,15 @@ private:
 					(float)glfwGetTime()
 				);
 
+				//picks on press, clicks on the ui don't reach the scene
+				int mouseButtonState = glfwGetMouseButton(core->window, GLFW_MOUSE_BUTTON_LEFT);
+				if (shouldShowMouse && mouseButtonState == GLFW_PRESS && lastMouseButtonState == GLFW_RELEASE && !ImGui::GetIO().WantCaptureMouse) {
+					glm::vec3 rayOrigin, rayDirection;
+					camera.cursorRay(gDescValue.projView, rayOrigin, rayDirection);
+					pickedInstance = instanceBvh.raycast(rayOrigin, rayDirection, farPlane);
+				}
+				lastMouseButtonState = mouseButtonState;
+
 				frames[current_frame].performFrame(
 					swapChain,
 					dataTransferActionsBound,
@@ -853,15 +1717,30 @@ private:
 
 	RC<Image> loadImage(
 		const char* filepath,
+		const ImageInfo& info,
 		int desiredChannels,
 		bool isSRGB,
-		std::optional<glm::ivec2> desiredResolution = {}
+		std::optional<glm::ivec2> desiredResolution = {},
+		float priority = 0.f,
+		ImageLoadHandle* handle = nullptr
 	) {
 		assert(desiredChannels == 4 || desiredChannels == 2 || desiredChannels == 1);
 		//loads images from files and then
 		//creates a VkImage trying its best to find the right format
 
-		glm::ivec3 info = getImageInfo(filepath);
+		//the content hash is worked out in the background, until then only an unchanged file under the same path is found
+		std::vector<TextureCache::Key> cacheKeys;
+		if (info.contentHash != 0)
+			cacheKeys.push_back({ info.contentHash, true, desiredChannels, isSRGB, cookTextures });
+		cacheKeys.push_back({ info.sourceHash, false, desiredChannels, isSRGB, cookTextures });
+		if (auto cached = textureCache.find(cacheKeys)) {
+			//still loading for another material or model, it now loads as early as the most urgent user needs
+			if (!*cached->uploaded)
+				imageLoader->setPriority(cached->load, std::max(cached->load->priority, priority));
+			if (handle)
+				*handle = cached->load;
+			return cached->image;
+		}
 
 		constexpr VkFormat formats[4][2] = {
 			{
@@ -881,31 +1760,87 @@ private:
 				VK_FORMAT_R8G8B8A8_SRGB
 			}
 		};
+		//indexed by BlockFormat, bc4 and bc5 have no srgb variant
+		constexpr VkFormat blockFormats[4][2] = {
+			{
+				VK_FORMAT_BC1_RGB_UNORM_BLOCK,
+				VK_FORMAT_BC1_RGB_SRGB_BLOCK
+			},
+			{
+				VK_FORMAT_BC4_UNORM_BLOCK,
+				VK_FORMAT_BC4_UNORM_BLOCK
+			},
+			{
+				VK_FORMAT_BC5_UNORM_BLOCK,
+				VK_FORMAT_BC5_UNORM_BLOCK
+			},
+			{
+				VK_FORMAT_BC7_UNORM_BLOCK,
+				VK_FORMAT_BC7_SRGB_BLOCK
+			}
+		};
 
 		auto iCreateInf = Image::makeCreateInfo(
 			formats[desiredChannels - 1][isSRGB],
 			VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-			VkExtent3D{ (unsigned int)info.x, (unsigned int)info.y, 1 }
+			VkExtent3D{ (unsigned int)info.width, (unsigned int)info.height, 1 }
 		);
 
+		//the worker cooks the texture on its first load, the layout is known up front
+		std::vector<CookedMip> cookedMips;
+		if (cookTextures) {
+			BlockFormat blockFormat = TextureCooker::chooseFormat(desiredChannels);
+			cookedMips = TextureCooker::mipLayout(blockFormat, info.width, info.height);
+			iCreateInf.format = blockFormats[(uint32_t)blockFormat][isSRGB];
+			iCreateInf.mipLevels = (uint32_t)cookedMips.size();
+		}
+		//uncompressed textures get their mips blitted on the gpu after the first level is uploaded
+		else if (Image::canGenerateMipmaps(iCreateInf.format)) {
+			iCreateInf.mipLevels = Image::getMipLevelsForFull(iCreateInf.extent);
+			iCreateInf.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		}
+
 		RC<Image> vImage = Image::create(
 			core,
 			iCreateInf,
 			VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT
 		);
-		vImage->transitionImageLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		pendingImageTransitions.push_back(vImage);
 
 		ImageLoadRequest imageLoadRequest{};
 		imageLoadRequest.desiredChannels = desiredChannels;
-		imageLoadRequest.resolution = glm::ivec3(info.x, info.y, 1);
+		imageLoadRequest.resolution = glm::ivec3(info.width, info.height, 1);
 		imageLoadRequest.path = filepath;
 		imageLoadRequest.isSRGB = isSRGB;
+		imageLoadRequest.cooked = cookTextures;
+		imageLoadRequest.priority = priority;
 
-		imageLoadRequest.callback = [vImage](ImageLoadRequest& request, RC<Buffer> stagingBuf) {
+		RC<bool> uploaded = std::make_shared<bool>(false);
+		imageLoadRequest.callback = [vImage, cookedMips, uploaded](ImageLoadRequest& request, RC<Buffer> stagingBuf) {
 			//std::cout << "doing callback for: " << request.path << std::endl;
+			*uploaded = true;
+
+			if (request.cooked) {
+				std::vector<VkBufferImageCopy> regions;
+				for (uint32_t m = 0; m < cookedMips.size(); m++) {
+					VkBufferImageCopy region{};
+					region.bufferOffset = request.stagingOffset + cookedMips[m].offset;
+					region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+					region.imageSubresource.mipLevel = m;
+					region.imageSubresource.baseArrayLayer = 0;
+					region.imageSubresource.layerCount = 1;
+					region.imageExtent = { cookedMips[m].width, cookedMips[m].height, 1 };
+					regions.push_back(region);
+				}
+
+				vImage->transitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+				vImage->copyFromBuffer(stagingBuf, regions);
+				vImage->transitionImageLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+				return;
+			}
 
 			VkBufferImageCopy region{};
-			region.bufferOffset = 0;
+			region.bufferOffset = request.stagingOffset;
 			region.bufferRowLength = 0;
 			region.bufferImageHeight = 0;
 
@@ -918,12 +1853,14 @@ private:
 			region.imageExtent = vImage->extent;
 
 			vImage->transitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-			vImage->copyFromBuffer(stagingBuf, region);
-			vImage->transitionImageLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			vImage->copyFromBufferAndGenerateMipmaps(stagingBuf, region);
 		};
 
-		imageLoader->request(imageLoadRequest);
+		ImageLoadHandle loadHandle = imageLoader->request(imageLoadRequest);
+		if (handle)
+			*handle = loadHandle;
 
+		textureCache.insert(cacheKeys, CachedTexture{ vImage, loadHandle, uploaded });
 		return vImage;
 	}
 
@@ -1034,6 +1971,17 @@ private:
 		depthStencilCI.depthBoundsTestEnable = VK_FALSE;
 		depthStencilCI.stencilTestEnable = VK_FALSE;
 
+		//the visibility attachment is only written in visibility buffer mode
+		VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+		colorBlendAttachment.colorWriteMask = 0;
+		colorBlendAttachment.blendEnable = VK_FALSE;
+
+		VkPipelineColorBlendStateCreateInfo colorBlending{};
+		colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		colorBlending.logicOpEnable = VK_FALSE;
+		colorBlending.attachmentCount = 1;
+		colorBlending.pAttachments = &colorBlendAttachment;
+
 		std::vector<VkDynamicState> dynamicStates = {
 			VK_DYNAMIC_STATE_VIEWPORT,
 			VK_DYNAMIC_STATE_SCISSOR
@@ -1075,7 +2023,7 @@ private:
 		pipelineInfo.pRasterizationState = &rasterizer;
 		pipelineInfo.pMultisampleState = &multisampling;
 		pipelineInfo.pDepthStencilState = nullptr; // Optional
-		//pipelineInfo.pColorBlendState = &colorBlending;
+		pipelineInfo.pColorBlendState = &colorBlending;
 		pipelineInfo.pDepthStencilState = &depthStencilCI;
 		pipelineInfo.pDynamicState = &dynamicState;
 
@@ -1088,6 +2036,9 @@ private:
 
 		this->depthPrePass.pipe = core->createGraphicsPipeline(pipelineInfo);
 
+		pipelineInfo.renderPass = hizCuller.getEarlyRenderPass();
+		this->depthPrePass.earlyPipe = core->createGraphicsPipeline(pipelineInfo);
+
 		vkDestroyShaderModule(core->device, fragShaderModule, nullptr);
 		vkDestroyShaderModule(core->device, vertShaderModule, nullptr);
 	}
@@ -1113,6 +2064,17 @@ private:
 		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 		depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
 
+		//only read within the pass by the visibility buffer shading
+		VkAttachmentDescription visibilityAttachment{};
+		visibilityAttachment.format = VisibilityBufferRenderer::format;
+		visibilityAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		visibilityAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		visibilityAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		visibilityAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		visibilityAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		visibilityAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		visibilityAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
 		VkAttachmentReference colorAttachmentRef{};
 		colorAttachmentRef.attachment = 0;
 		colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
@@ -1121,9 +2083,19 @@ private:
 		depthAttachmentRef.attachment = 1;
 		depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
+		VkAttachmentReference visibilityAttachmentRef{};
+		visibilityAttachmentRef.attachment = 2;
+		visibilityAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+		VkAttachmentReference visibilityInputRef{};
+		visibilityInputRef.attachment = 2;
+		visibilityInputRef.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		//the forward prepass masks the visibility attachment out
 		VkSubpassDescription prePass{};
 		prePass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-		prePass.colorAttachmentCount = 0;
+		prePass.colorAttachmentCount = 1;
+		prePass.pColorAttachments = &visibilityAttachmentRef;
 		prePass.pDepthStencilAttachment = &depthAttachmentRef;
 
 		VkSubpassDescription subpass{};
@@ -1131,6 +2103,8 @@ private:
 		subpass.colorAttachmentCount = 1;
 		subpass.pColorAttachments = &colorAttachmentRef;
 		subpass.pDepthStencilAttachment = &depthAttachmentRef;
+		subpass.inputAttachmentCount = 1;
+		subpass.pInputAttachments = &visibilityInputRef;
 
 		VkSubpassDependency depthDependency = {};
 		depthDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
@@ -1157,10 +2131,18 @@ private:
 		passDependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
 		passDependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
+		VkSubpassDependency visibilityDependency{};
+		visibilityDependency.srcSubpass = 0;
+		visibilityDependency.dstSubpass = 1;
+		visibilityDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		visibilityDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		visibilityDependency.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		visibilityDependency.dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+		visibilityDependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
-		VkSubpassDependency dependencies[3] = { dependency, depthDependency, passDependency };
+		VkSubpassDependency dependencies[4] = { dependency, depthDependency, passDependency, visibilityDependency };
 
-		VkAttachmentDescription attachments[2] = { colorAttachment, depthAttachment };
+		VkAttachmentDescription attachments[3] = { colorAttachment, depthAttachment, visibilityAttachment };
 
 		VkSubpassDescription subpasses[2] = { prePass, subpass };
 
@@ -1170,14 +2152,25 @@ private:
 
 		VkRenderPassCreateInfo renderPassInfo{};
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		renderPassInfo.attachmentCount = 2;
+		renderPassInfo.attachmentCount = 3;
 		renderPassInfo.pAttachments = attachments;
 		renderPassInfo.subpassCount = 2;
 		renderPassInfo.pSubpasses = subpasses;
-		renderPassInfo.dependencyCount = 3;
+		renderPassInfo.dependencyCount = 4;
 		renderPassInfo.pDependencies = dependencies;
 
 		renderPass = core->createRenderPass(renderPassInfo);
+
+		//only load ops, layouts and dependencies differ, so it stays compatible with renderPass
+		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		attachments[1] = depthAttachment;
+		//the early pass wrote the depth and the pyramid reduction read it
+		depthDependency.srcStageMask |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		depthDependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		depthDependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependencies[1] = depthDependency;
+		earlyDepthRenderPass = core->createRenderPass(renderPassInfo);
 	}
 
 	void createGraphicsPipeline() {
@@ -1282,7 +2275,7 @@ private:
 		VkDescriptorSetLayout layouts[3] = {
 			core->getLayout(frames.front().data.globalDS),
 			core->getLayout(frames.front().data.pointLightsDS),
-			core->getLayout(this->materialsDescriptorSet)
+			core->getLayout(materials.getDescriptorSet(0))
 		};
 		pipelineLayoutInfo.pSetLayouts = layouts;
 		pipelineLayoutInfo.pushConstantRangeCount = 1;
@@ -1400,6 +2393,8 @@ private:
 			//todo Recreate renderpass
 		}
 		swapChain = SwapChain(core, swapChainFormat, swapPresentMode, chooseSwapExtent(swapCapabilities.capabilities), renderPass);
+		hizCuller.resize(swapChain.depthImage, swapChain.depthImageView->view, swapChain.swapChainExtent);
+		visibilityRenderer.setVisibilityView(swapChain.visibilityImageView->view);
 	}
 };
 
@@ -9,9 +9,16 @@ struct MaterialInfo {
 	glm::uvec4 baseTexId_metallicRoughessTexId_waste2;
 };
 
+//one descriptor set per frame in flight
 class Materials : public DUResource<MaterialInfo> {
 private:
-	void createMaterialsDescriptorSet() {
+	struct {
+		VkDescriptorSet descriptorSet;
+		//materialImages written to the set so far
+		size_t boundImages = 0;
+	} perFrame[MAX_FRAMES_IN_FLIGHT];
+
+	VkDescriptorSet createMaterialsDescriptorSet() {
 		VkDescriptorSetLayoutBinding binding0{};
 		{
 			binding0.binding = 0;
@@ -50,7 +57,7 @@ private:
 			write0.pBufferInfo = &inf;
 		}
 		vkUpdateDescriptorSets(VulkanUtils::utils().getCore()->device, 1, &write0, 0, nullptr);
-		descriptorSet = descriptor;
+		return descriptor;
 	}
 
 public:
@@ -59,22 +66,42 @@ public:
 
 	std::vector<MaterialInfo> materialInfos;
 
-	VkDescriptorSet descriptorSet;
-
 	void init(size_t maxMaterialsCount) {
 		DUResource<MaterialInfo>::init(maxMaterialsCount);
-		createMaterialsDescriptorSet();
+		for (auto& frame : perFrame)
+			frame.descriptorSet = createMaterialsDescriptorSet();
 	}
 	
+	//frames in flight may still sample the views, they are released once those are done
 	void clear() {
+		for (auto& view : this->materialImages)
+			VulkanUtils::utils().retire(std::shared_ptr<ImageView>(std::move(view)));
 		this->materialImages.clear();
+		this->materialSamplers.clear();
 		this->materialInfos.clear();
-		this->materialInfos.clear();
+		for (auto& frame : perFrame)
+			frame.boundImages = 0;
 		this->clearBuffer();
 	}
 
-	VkDescriptorSet getDescriptorSet() {
-		return descriptorSet;
+	VkDescriptorSet getDescriptorSet(uint32_t frameIndex) {
+		return perFrame[frameIndex].descriptorSet;
+	}
+
+	//every material of a model padded to the dynamic offset alignment, can be staged on any thread
+	StagedBytes stageInfos(VulkanCore core, const std::vector<MaterialInfo>& infos) const {
+		assert(infos.size() <= maximumResources);
+		std::vector<char> padded(paddedElementSize * infos.size());
+		for (size_t i = 0; i < infos.size(); i++)
+			memcpy(padded.data() + paddedElementSize * i, &infos[i], sizeof(MaterialInfo));
+		return stageVector(core, padded);
+	}
+
+	//replaces the materials with ones staged by stageInfos, the upload has to be copied before they are drawn
+	BufferUpload setInfos(std::vector<MaterialInfo> infos, StagedBytes staged) {
+		this->materialInfos = std::move(infos);
+		this->storedResources = this->materialInfos.size();
+		return { staged, this->resourceBuf };
 	}
 
 	void addMaterial(VulkanCore core, VkCommandPool pool, MaterialInfo info) {
@@ -119,22 +146,36 @@ public:
 				info
 			)
 		);
+		//each frame writes it into its own set in beginFrame
+		return index;
+	}
+
+	//writes the images added since the frame last began, the frame's fence must have been waited on
+	//images are sampled in shader read only layout, the owner moves them there before the frame's draws
+	void beginFrame(uint32_t frameIndex) {
+		auto& frame = perFrame[frameIndex];
+		if (frame.boundImages == materialImages.size())
+			return;
+
+		std::vector<VkDescriptorImageInfo> imageInfos;
+		for (size_t i = frame.boundImages; i < materialImages.size(); i++) {
+			VkDescriptorImageInfo imageInfo{};
+			imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			imageInfo.imageView = materialImages[i]->view;
+			imageInfo.sampler = materialSamplers[i]->sampler;
+			imageInfos.push_back(imageInfo);
+		}
 
 		VkWriteDescriptorSet write1{};
 		write1.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		write1.descriptorCount = 1;
+		write1.descriptorCount = (uint32_t)imageInfos.size();
 		write1.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		write1.dstSet = descriptorSet;
+		write1.dstSet = frame.descriptorSet;
 		write1.dstBinding = 1;
-		write1.dstArrayElement = index;
-
-		VkDescriptorImageInfo imageInfo{};
-		imageInfo.imageLayout = vImage->layout;
-		imageInfo.imageView = materialImages[index]->view;
-		imageInfo.sampler = materialSamplers[index]->sampler;
-		write1.pImageInfo = &imageInfo;
+		write1.dstArrayElement = (uint32_t)frame.boundImages;
+		write1.pImageInfo = imageInfos.data();
 		vkUpdateDescriptorSets(VulkanUtils::utils().getCore()->device, 1, &write1, 0, nullptr);
-		return index;
+		frame.boundImages = materialImages.size();
 	}
 };
 
@@ -42,69 +42,136 @@ class Mesh {
 public:
 	std::shared_ptr<Buffer> vertexBuffer;
 	std::shared_ptr<Buffer> indexBuffer;
+	//SkinVertex per vertex, read by the skinning compute shader, null if the mesh is not skinned
+	std::shared_ptr<Buffer> skinBuffer;
+	uint32_t vertexCount = 0;
 	uint32_t numIndices;
 	VkIndexType indexType;
+	bool skinned = false;
+	//ranges of the index buffer, lod 0 is full detail
+	std::vector<MeshLod> lods;
+	//mesh space
+	Bounds bounds;
+	//range of the MeshletCuller meshlet buffer, empty if lod 0 is not split
+	uint32_t firstMeshlet = 0;
+	uint32_t meshletCount = 0;
 
 	Mesh() = default;
-	Mesh(VulkanCore core, const VkCommandPool commandPool, MeshData<Vertex3>& meshData) {
-		const auto& vertexData = meshData.vertices;
-		size_t vertexDataSize = vertexData.size() * sizeof(Vertex3);
+	Mesh(VulkanCore core, const VkCommandPool commandPool, MeshData<Vertex3>& meshData) : Mesh(core, commandPool, MeshDataView(meshData)) {}
+
+	//MeshSource is MeshDataView or GltfPrimitiveView, anything with vertexCount, indexCount,
+	//writeVertices(Vertex3*) and writeIndices(uint16_t*/uint32_t*), isSkinned() and writeSkinVertices(SkinVertex*)
+	//uploads right away through a temporary staging buffer
+	template<typename MeshSource>
+	Mesh(VulkanCore core, const VkCommandPool commandPool, const MeshSource& meshData) {
+		//vertices and indices share one staging buffer, the source writes into it directly so no intermediate copies are made
+		auto stagingBuffer = Buffer::create(
+			core, stagingSize(meshData),
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+		);
+		void* stagingData;
+		vmaMapMemory(core->allocator, stagingBuffer->allocation, &stagingData);
+		*this = Mesh(core, meshData, reinterpret_cast<unsigned char*>(stagingData));
+		vmaUnmapMemory(core->allocator, stagingBuffer->allocation);
+
+		VkCommandBuffer commandBuffer = core->beginSingleTimeCommands(commandPool);
+		recordUpload(commandBuffer, stagingBuffer->buffer);
+		core->endSingleTimeCommands(commandPool, commandBuffer);
+	}
+
+	//creates the device buffers and writes the mesh into stagingSize bytes of mapped staging memory
+	//nothing is uploaded until recordUpload, so this can run on a loader thread
+	template<typename MeshSource>
+	Mesh(VulkanCore core, const MeshSource& meshData, unsigned char* staging) {
+		setInfo(meshData);
 		this->vertexBuffer = Buffer::create(
-			core, vertexDataSize,
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			core, vertexDataSize(),
+			//storage for the visibility buffer shading fetches
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 			(VmaAllocationCreateFlagBits)0,
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
 		);
-		auto vertexStagingBuffer = prepareStagingBuffer(core, vertexData.data(), vertexDataSize);
-
-		if (meshData.vertices.size() < std::numeric_limits<uint16_t>::max()) {
-			//if max vertex index can fit in 16 bits use 16 bit index
-			indexType = VK_INDEX_TYPE_UINT16;
-
-			std::vector<uint16_t> indexData(meshData.indices.begin(), meshData.indices.end());
-			size_t indexDataSize = indexData.size() * sizeof(uint16_t);
-			this->numIndices = indexData.size();
-			this->indexBuffer = Buffer::create(
-				core, indexDataSize,
-				VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		//whole words, shaders read 16 bit indices in pairs
+		this->indexBuffer = Buffer::create(
+			core, (indexDataSize() + 3) & ~size_t(3),
+			VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			(VmaAllocationCreateFlagBits)0,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+		);
+		if (skinned) {
+			this->skinBuffer = Buffer::create(
+				core, skinDataSize(),
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 				(VmaAllocationCreateFlagBits)0,
 				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
 			);
+		}
 
-			auto indexStagingBuffer = prepareStagingBuffer(core, indexData.data(), indexDataSize);
+		//skin vertices go first, 16 byte aligned unlike the end of the indices
+		if (skinned)
+			meshData.writeSkinVertices(reinterpret_cast<SkinVertex*>(staging));
+		staging += skinDataSize();
+		meshData.writeVertices(reinterpret_cast<Vertex3*>(staging));
+		staging += vertexDataSize();
+		if (indexType == VK_INDEX_TYPE_UINT16)
+			meshData.writeIndices(reinterpret_cast<uint16_t*>(staging));
+		else
+			meshData.writeIndices(reinterpret_cast<uint32_t*>(staging));
+	}
 
-			VkBufferCopy copier{};
-			copier.dstOffset = 0; copier.srcOffset = 0;
-			copier.size = vertexDataSize;
-			BufferCopyInfo vBufferCI(vertexStagingBuffer->buffer, vertexBuffer->buffer, copier);
-			copier.size = indexDataSize;
-			BufferCopyInfo iBufferCI(indexStagingBuffer->buffer, indexBuffer->buffer, copier);
+	//sizes, lods and bounds of the source without any buffers, enough to cull and place the mesh before it is resident
+	template<typename MeshSource>
+	void setInfo(const MeshSource& meshData) {
+		this->vertexCount = (uint32_t)meshData.vertexCount;
+		this->numIndices = (uint32_t)meshData.indexCount;
+		//if max vertex index can fit in 16 bits use 16 bit index
+		this->indexType = meshData.vertexCount < std::numeric_limits<uint16_t>::max() ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+		this->skinned = meshData.isSkinned();
+		this->bounds = meshData.bounds;
+		if (meshData.lodCount == 0)
+			this->lods = { MeshLod{ 0, (uint32_t)meshData.indexCount, 0.f } };
+		else
+			this->lods.assign(meshData.lods, meshData.lods + meshData.lodCount);
+	}
 
-			copyBuffer(core, commandPool, { vBufferCI, iBufferCI });
-		}
-		else {
-			//use 32 bit index
-			indexType = VK_INDEX_TYPE_UINT32;
-
-			size_t indexDataSize =  meshData.indices.size() * sizeof(uint32_t);
-			this->numIndices = meshData.indices.size();
-			this->indexBuffer = Buffer::create(
-				core, indexDataSize,
-				VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-				(VmaAllocationCreateFlagBits)0,
-				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-			);
+	//staging memory the loader thread constructor writes
+	template<typename MeshSource>
+	static size_t stagingSize(const MeshSource& meshData) {
+		Mesh info;
+		info.setInfo(meshData);
+		return info.skinDataSize() + info.vertexDataSize() + info.indexDataSize();
+	}
 
-			auto indexStagingBuffer = prepareStagingBuffer(core, meshData.indices.data(), indexDataSize);
+	size_t vertexDataSize() const {
+		return vertexCount * sizeof(Vertex3);
+	}
+	size_t indexDataSize() const {
+		return numIndices * (indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t));
+	}
+	size_t skinDataSize() const {
+		return skinned ? vertexCount * sizeof(SkinVertex) : 0;
+	}
 
-			VkBufferCopy copier{};
-			copier.dstOffset = 0; copier.srcOffset = 0;
-			copier.size = vertexDataSize;
-			BufferCopyInfo vBufferCI(vertexStagingBuffer->buffer, vertexBuffer->buffer, copier);
-			copier.size = indexDataSize;
-			BufferCopyInfo iBufferCI(indexStagingBuffer->buffer, indexBuffer->buffer, copier);
+	bool isResident() const {
+		return vertexBuffer != nullptr;
+	}
 
-			copyBuffer(core, commandPool, { vBufferCI, iBufferCI });
+	//copies out of the staging memory the loader thread constructor wrote
+	//the caller adds a barrier before the mesh is read
+	void recordUpload(VkCommandBuffer commandBuffer, VkBuffer staging, VkDeviceSize stagingOffset = 0) const {
+		VkBufferCopy copier{};
+		copier.srcOffset = stagingOffset + skinDataSize(); copier.dstOffset = 0;
+		copier.size = vertexDataSize();
+		vkCmdCopyBuffer(commandBuffer, staging, vertexBuffer->buffer, 1, &copier);
+		copier.srcOffset += vertexDataSize();
+		copier.size = indexDataSize();
+		vkCmdCopyBuffer(commandBuffer, staging, indexBuffer->buffer, 1, &copier);
+		if (skinned) {
+			copier.srcOffset = stagingOffset;
+			copier.size = skinDataSize();
+			vkCmdCopyBuffer(commandBuffer, staging, skinBuffer->buffer, 1, &copier);
 		}
 	}
 };
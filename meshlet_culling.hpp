@@ -0,0 +1,271 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+
+#include "vulkan_utils.hpp"
+#include "buffer.hpp"
+#include "buffer_helpers.hpp"
+#include "MeshLoader.hpp"
+#include "FrustumCuller.hpp"
+
+//culls meshlets against the frustum and their normal cones in a compute pass, survivors are drawn with vkCmdDrawIndexedIndirectCount
+class MeshletCuller {
+public:
+	//matches Instance in meshletCull.comp
+	struct Instance {
+		glm::mat4 transform;
+		uint32_t firstMeshlet;
+		uint32_t meshletCount;
+		uint32_t firstDraw;
+		uint32_t coneCulling;
+		uint32_t instanceIndex;
+		uint32_t waste[3];
+	};
+
+	struct CullPushConstants {
+		//xyz normal pointing inside, w distance
+		glm::vec4 frustumPlanes[6];
+		glm::vec3 cameraPos;
+		uint32_t instanceCount;
+		//nonzero skips instances HiZCuller found occluded
+		uint32_t useVisibility;
+		uint32_t waste[3];
+	};
+
+	inline static const uint32_t workGroupSize = 64;
+
+private:
+	struct {
+		VkPipeline pipe;
+		VkPipelineLayout layout;
+	} cull;
+
+	RC<Buffer> meshletBuffer;
+	uint32_t meshletCapacity = 0;
+	//world space Bounds of every instance, owned by the scene
+	RC<Buffer> boundsBuffer;
+	uint32_t maxMeshletsPerInstance = 0;
+	RC<Buffer> visibilityBuffer;
+	uint32_t requiredInstances = 0;
+	uint32_t requiredDraws = 0;
+
+	struct {
+		RC<Buffer> instanceBuffer;
+		RC<Buffer> drawBuffer;
+		RC<Buffer> countBuffer;
+		uint32_t instanceCapacity = 0;
+		uint32_t drawCapacity = 0;
+		VkDescriptorSet descriptor;
+
+		std::vector<Instance> instances;
+		uint32_t drawCount = 0;
+	} perFrame[MAX_FRAMES_IN_FLIGHT];
+	FrameStaleness stale;
+
+	static std::vector<VkDescriptorSetLayoutBinding> getBindings() {
+		std::vector<VkDescriptorSetLayoutBinding> bindings(6);
+		for (uint32_t i = 0; i < bindings.size(); i++) {
+			bindings[i].binding = i;
+			bindings[i].descriptorCount = 1;
+			bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+		return bindings;
+	}
+
+	void writeDescriptorSet(uint32_t frameIndex) {
+		auto& frame = perFrame[frameIndex];
+		writeStorageBuffers(frame.descriptor, {
+			{ 0, 0, meshletBuffer->buffer },
+			{ 1, 0, frame.instanceBuffer->buffer },
+			{ 2, 0, frame.drawBuffer->buffer },
+			{ 3, 0, frame.countBuffer->buffer },
+			{ 4, 0, boundsBuffer->buffer },
+			{ 5, 0, visibilityBuffer->buffer }
+		});
+	}
+
+	void createFrameBuffers(uint32_t frameIndex, uint32_t instanceCapacity, uint32_t drawCapacity) {
+		auto& frame = perFrame[frameIndex];
+		frame.instanceCapacity = std::max(instanceCapacity, 1u);
+		frame.drawCapacity = std::max(drawCapacity, 1u);
+
+		frame.instanceBuffer = createMappedBuffer(sizeof(Instance) * frame.instanceCapacity);
+		frame.drawBuffer = createDeviceBuffer(sizeof(VkDrawIndexedIndirectCommand) * frame.drawCapacity, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+		//one draw count per instance for shading, then one per instance for the depth prepass
+		frame.countBuffer = createDeviceBuffer(2 * sizeof(uint32_t) * frame.instanceCapacity, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+	}
+
+	static void upload(VkCommandPool commandPool, RC<Buffer> dst, const void* data, size_t dataSize) {
+		auto core = VulkanUtils::utils().getCore();
+		auto stagingBuffer = Buffer::create(
+			core, dataSize,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+		);
+		void* stagingData;
+		vmaMapMemory(core->allocator, stagingBuffer->allocation, &stagingData);
+		memcpy(stagingData, data, dataSize);
+		vmaUnmapMemory(core->allocator, stagingBuffer->allocation);
+
+		VkBufferCopy copier{};
+		copier.srcOffset = 0; copier.dstOffset = 0;
+		copier.size = dataSize;
+		copyBuffer(core, commandPool, { BufferCopyInfo(stagingBuffer->buffer, dst->buffer, copier) });
+	}
+
+	void createPipeline() {
+		auto core = VulkanUtils::utils().getCore();
+
+		auto computeShaderCode = VulkanUtils::utils().compileGlslToSpv("Shaders/meshletCull.comp", shaderc_shader_kind::shaderc_compute_shader);
+		VkShaderModule computeShaderModule = VulkanUtils::utils().createShaderModule(computeShaderCode);
+
+		VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
+		computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		computeShaderStageInfo.module = computeShaderModule;
+		computeShaderStageInfo.pName = "main";
+
+		VkDescriptorSetLayout layout = core->getLayout(perFrame[0].descriptor);
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &layout;
+
+		VkPushConstantRange pushConstantRange{};
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(CullPushConstants);
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+		this->cull.layout = core->createPipelineLayout(pipelineLayoutInfo);
+
+		VkComputePipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.layout = this->cull.layout;
+		pipelineInfo.stage = computeShaderStageInfo;
+		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
+		pipelineInfo.basePipelineIndex = -1; // Optional
+
+		this->cull.pipe = core->createComputePipeline(pipelineInfo);
+
+		vkDestroyShaderModule(core->device, computeShaderModule, nullptr);
+	}
+
+public:
+	void initialize(RC<Buffer> instanceBounds) {
+		reserveDeviceBuffer(meshletBuffer, meshletCapacity, 1, sizeof(Meshlet));
+		boundsBuffer = instanceBounds;
+		//everything visible until a real buffer is set
+		uint32_t visible = 1;
+		visibilityBuffer = createDeviceBuffer(sizeof(uint32_t));
+		upload(VulkanUtils::utils().getCommandPool(), visibilityBuffer, &visible, sizeof(visible));
+		auto core = VulkanUtils::utils().getCore();
+		for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			perFrame[i].descriptor = core->createDescriptorSet(getBindings());
+			createFrameBuffers(i, 1, 1);
+			writeDescriptorSet(i);
+		}
+		createPipeline();
+	}
+
+	//instanceCapacity and drawCapacity are the most instances and meshlet draws a frame can submit
+	std::vector<BufferUpload> setGeometry(StagedBytes meshlets, uint32_t maxMeshletsPerInstance, uint32_t instanceCapacity, uint32_t drawCapacity) {
+		this->maxMeshletsPerInstance = maxMeshletsPerInstance;
+		reserveDeviceBuffer(meshletBuffer, meshletCapacity, (uint32_t)(meshlets.size / sizeof(Meshlet)), sizeof(Meshlet));
+
+		requiredInstances = instanceCapacity;
+		requiredDraws = drawCapacity;
+		stale.markAll();
+		return { { meshlets, meshletBuffer } };
+	}
+
+	void setBoundsBuffer(RC<Buffer> instanceBounds) {
+		boundsBuffer = instanceBounds;
+		stale.markAll();
+	}
+
+	void setVisibilityBuffer(RC<Buffer> visibility) {
+		visibilityBuffer = visibility;
+		stale.markAll();
+	}
+
+	void beginFrame(uint32_t frameIndex) {
+		auto& frame = perFrame[frameIndex];
+		if (stale.take(frameIndex)) {
+			if (requiredInstances > frame.instanceCapacity || requiredDraws > frame.drawCapacity)
+				createFrameBuffers(frameIndex, std::max(requiredInstances, frame.instanceCapacity), std::max(requiredDraws, frame.drawCapacity));
+			writeDescriptorSet(frameIndex);
+		}
+		frame.instances.clear();
+		frame.drawCount = 0;
+	}
+
+	//returns the slot to draw the instance with
+	uint32_t addInstance(uint32_t frameIndex, uint32_t instanceIndex, const glm::mat4& transform, uint32_t firstMeshlet, uint32_t meshletCount, bool coneCulling) {
+		auto& frame = perFrame[frameIndex];
+		assert(frame.instances.size() < frame.instanceCapacity && frame.drawCount + meshletCount <= frame.drawCapacity);
+		frame.instances.push_back(Instance{ transform, firstMeshlet, meshletCount, frame.drawCount, coneCulling ? 1u : 0u, instanceIndex });
+		frame.drawCount += meshletCount;
+		return (uint32_t)frame.instances.size() - 1;
+	}
+
+	//must be outside a render pass and before the draws
+	void recordCulling(VkCommandBuffer commandBuffer, uint32_t frameIndex, const Frustum& frustum, glm::vec3 cameraPos, bool useVisibility = false) {
+		auto& frame = perFrame[frameIndex];
+		if (frame.instances.empty())
+			return;
+
+		memcpy(frame.instanceBuffer->allocation->GetMappedData(), frame.instances.data(), sizeof(Instance) * frame.instances.size());
+
+		vkCmdFillBuffer(commandBuffer, frame.countBuffer->buffer, 0, 2 * sizeof(uint32_t) * frame.instances.size(), 0);
+
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			1, &barrier, 0, nullptr, 0, nullptr
+		);
+
+		CullPushConstants constants{};
+		for (int i = 0; i < 6; i++)
+			constants.frustumPlanes[i] = frustum.planes[i];
+		constants.cameraPos = cameraPos;
+		constants.instanceCount = (uint32_t)frame.instances.size();
+		constants.useVisibility = useVisibility ? 1u : 0u;
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull.pipe);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull.layout, 0, 1, &frame.descriptor, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, cull.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+		//the shader strides over instances, so y only has to stay within the dispatch limits
+		uint32_t groupsX = (maxMeshletsPerInstance + workGroupSize - 1) / workGroupSize;
+		uint32_t groupsY = std::min<uint32_t>(constants.instanceCount, VulkanUtils::utils().getCore()->gpuProperties.limits.maxComputeWorkGroupCount[1]);
+		vkCmdDispatch(commandBuffer, std::max(groupsX, 1u), groupsY, 1);
+
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0,
+			1, &barrier, 0, nullptr, 0, nullptr
+		);
+	}
+
+	//prepass draws leave out what the HiZCuller early pass drew
+	void drawInstance(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t slot, bool prepass = false) {
+		auto& frame = perFrame[frameIndex];
+		const Instance& instance = frame.instances[slot];
+		size_t countIndex = prepass ? frame.instances.size() + slot : slot;
+		vkCmdDrawIndexedIndirectCount(commandBuffer,
+			frame.drawBuffer->buffer, sizeof(VkDrawIndexedIndirectCommand) * instance.firstDraw,
+			frame.countBuffer->buffer, sizeof(uint32_t) * countIndex,
+			instance.meshletCount, sizeof(VkDrawIndexedIndirectCommand)
+		);
+	}
+
+	uint32_t instanceCount(uint32_t frameIndex) const {
+		return (uint32_t)perFrame[frameIndex].instances.size();
+	}
+};
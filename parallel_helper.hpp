@@ -0,0 +1,161 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+inline unsigned int workerThreadCount() {
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+//threads that live for the whole run and take chunks of parallelFor calls, the per frame calls don't start threads
+//a parallelFor called from one of its threads or from several threads at once works like any other,
+//the calling thread always works on its own call so it can't wait on a pool busy elsewhere
+class WorkerPool {
+public:
+	struct Job {
+		//calls the caller's fn, which lives on the caller's stack until every chunk is done
+		void (*run)(void* fn, size_t begin, size_t end);
+		void* fn;
+		size_t count;
+		size_t chunkSize;
+		size_t chunkCount;
+
+		std::atomic<size_t> nextChunk{ 0 };
+		std::atomic<size_t> doneChunks{ 0 };
+		std::mutex mutex;
+		std::condition_variable done;
+		//first exception thrown by any chunk, guarded by mutex
+		std::exception_ptr error;
+	};
+
+private:
+	std::mutex mutex;
+	std::condition_variable wake;
+	//jobs that may still have chunks to claim, oldest first
+	std::deque<std::shared_ptr<Job>> jobs;
+	std::vector<std::thread> threads;
+	bool stopping = false;
+
+	WorkerPool() {
+		//the thread calling parallelFor is the last worker
+		for (unsigned int i = 1; i < workerThreadCount(); i++)
+			threads.emplace_back([this]() { workerLoop(); });
+	}
+
+	void workerLoop() {
+		while (true) {
+			std::shared_ptr<Job> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (stopping)
+					return;
+				job = jobs.front();
+			}
+			runChunks(*job);
+			retire(job);
+		}
+	}
+
+	//claims chunks until there are none left
+	static void runChunks(Job& job) {
+		size_t chunk;
+		while ((chunk = job.nextChunk.fetch_add(1)) < job.chunkCount) {
+			size_t begin = chunk * job.chunkSize;
+			size_t end = std::min(begin + job.chunkSize, job.count);
+			try {
+				job.run(job.fn, begin, end);
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(job.mutex);
+				if (!job.error)
+					job.error = std::current_exception();
+			}
+			if (job.doneChunks.fetch_add(1) + 1 == job.chunkCount) {
+				std::lock_guard<std::mutex> lock(job.mutex);
+				job.done.notify_all();
+			}
+		}
+	}
+
+	//every chunk is claimed, nobody needs to find the job anymore
+	void retire(const std::shared_ptr<Job>& job) {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = std::find(jobs.begin(), jobs.end(), job);
+		if (it != jobs.end())
+			jobs.erase(it);
+	}
+
+public:
+	WorkerPool(const WorkerPool&) = delete;
+
+	~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& thread : threads)
+			thread.join();
+	}
+
+	static WorkerPool& pool() {
+		static WorkerPool instance;
+		return instance;
+	}
+
+	inline size_t threadCount() const { return threads.size() + 1; }
+
+	//returns once every chunk ran, rethrows the first exception of any of them
+	void run(const std::shared_ptr<Job>& job) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(job);
+		}
+		if (job->chunkCount > 2)
+			wake.notify_all();
+		else
+			wake.notify_one();
+
+		runChunks(*job);
+		retire(job);
+
+		std::unique_lock<std::mutex> lock(job->mutex);
+		job->done.wait(lock, [&]() { return job->doneChunks.load() == job->chunkCount; });
+		if (job->error)
+			std::rethrow_exception(job->error);
+	}
+};
+
+//splits [0, count) into chunks of chunkSize that the WorkerPool threads take turns claiming
+//fn(begin, end) is called once per chunk, the calling thread works too
+//the first exception thrown by any chunk is rethrown on the calling thread
+template<typename Fn>
+void parallelFor(size_t count, size_t chunkSize, Fn&& fn) {
+	if (count == 0)
+		return;
+	chunkSize = std::max<size_t>(chunkSize, 1);
+	const size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+	//nothing to share, skips the pool's locks
+	if (chunkCount == 1 || workerThreadCount() == 1) {
+		for (size_t begin = 0; begin < count; begin += chunkSize)
+			fn(begin, std::min(begin + chunkSize, count));
+		return;
+	}
+
+	using FnType = std::remove_reference_t<Fn>;
+	auto job = std::make_shared<WorkerPool::Job>();
+	job->run = [](void* f, size_t begin, size_t end) { (*static_cast<FnType*>(f))(begin, end); };
+	job->fn = const_cast<void*>(static_cast<const void*>(&fn));
+	job->count = count;
+	job->chunkSize = chunkSize;
+	job->chunkCount = chunkCount;
+	WorkerPool::pool().run(job);
+}
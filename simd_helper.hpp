@@ -0,0 +1,59 @@
+#pragma once
+
+//avx2 code paths are compiled in on x64 and only taken after hasAvx2 said yes at runtime
+#if defined(_M_X64) || defined(__x86_64__)
+#define SIMD_HELPER_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+//msvc emits avx2 intrinsics without /arch:AVX2, the function is only called after the cpuid check
+#define AVX2_FUNCTION
+#else
+#include <cpuid.h>
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+#endif
+
+#ifdef SIMD_HELPER_AVX2
+inline bool detectAvx2() {
+	int leaf7[4] = {};
+	int leaf1[4] = {};
+#ifdef _MSC_VER
+	__cpuid(leaf1, 1);
+	__cpuidex(leaf7, 7, 0);
+#else
+	unsigned int a, b, c, d;
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return false;
+	leaf1[2] = (int)c;
+	if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+		return false;
+	leaf7[1] = (int)b;
+#endif
+	//the os has to save ymm registers, checked through osxsave and xcr0
+	bool osxsave = (leaf1[2] & (1 << 27)) != 0;
+	bool avx = (leaf1[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx)
+		return false;
+#ifdef _MSC_VER
+	unsigned long long xcr0 = _xgetbv(0);
+#else
+	unsigned int xcr0Low, xcr0High;
+	__asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+	unsigned long long xcr0 = ((unsigned long long)xcr0High << 32) | xcr0Low;
+#endif
+	if ((xcr0 & 0x6) != 0x6)
+		return false;
+	return (leaf7[1] & (1 << 5)) != 0;
+}
+#endif
+
+//true if the cpu and os support avx2, checked once
+inline bool hasAvx2() {
+#ifdef SIMD_HELPER_AVX2
+	static const bool supported = detectAvx2();
+	return supported;
+#else
+	return false;
+#endif
+}
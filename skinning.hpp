@@ -0,0 +1,302 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+
+#include "vulkan_utils.hpp"
+#include "buffer.hpp"
+#include "buffer_helpers.hpp"
+#include "mesh.hpp"
+
+//skins animated instances in a compute pass into their own range of a per frame Vertex3 buffer
+//which is then drawn like any other vertex buffer
+class Skinner {
+public:
+	struct PushConstants {
+		uint32_t meshSlot;
+		uint32_t vertexCount;
+		uint32_t firstJoint;
+		uint32_t jointCount;
+		uint32_t outputOffset;
+	};
+
+	inline static const uint32_t workGroupSize = 64;
+	//size of the vertex and skin buffer arrays, models with more skinned meshes are drawn unskinned
+	inline static const uint32_t maxSkinnedMeshes = 256;
+	//output offset of instances that are not skinned
+	inline static const uint32_t notSkinned = std::numeric_limits<uint32_t>::max();
+
+	struct SkinnedInstance {
+		uint32_t meshSlot;
+		uint32_t vertexCount;
+		uint32_t firstJoint;
+		uint32_t jointCount;
+		uint32_t outputOffset;
+	};
+
+	//which instances are skinned and where their joints and vertices go, planned off the render thread
+	struct Layout {
+		std::vector<uint32_t> instanceSlots;
+		//array element of each mesh in the vertex and skin buffer bindings, notSkinned for unskinned meshes
+		std::vector<uint32_t> meshSlots;
+		std::vector<SkinnedInstance> skinnedInstances;
+		std::vector<glm::mat4> jointMatrices;
+		uint32_t outputVertexCount = 0;
+		bool available = false;
+
+		bool isSkinned(uint32_t instance) const {
+			return instanceSlots[instance] != notSkinned;
+		}
+
+		uint32_t outputOffset(uint32_t instance) const {
+			uint32_t slot = instanceSlots[instance];
+			return slot == notSkinned ? notSkinned : skinnedInstances[slot].outputOffset;
+		}
+
+		glm::mat4* instanceJoints(uint32_t instance) {
+			return jointMatrices.data() + skinnedInstances[instanceSlots[instance]].firstJoint;
+		}
+	};
+
+private:
+	struct {
+		VkPipeline pipe;
+		VkPipelineLayout layout;
+	} skin;
+
+	Layout layout;
+
+	struct MeshBinding {
+		uint32_t slot;
+		RC<Buffer> vertexBuffer;
+		RC<Buffer> skinBuffer;
+	};
+	std::vector<MeshBinding> meshBindings;
+
+	struct {
+		RC<Buffer> jointBuffer;
+		RC<Buffer> outputBuffer;
+		uint32_t jointCapacity = 0;
+		uint32_t outputCapacity = 0;
+		VkDescriptorSet descriptor;
+		size_t boundMeshes = 0;
+
+		std::vector<uint32_t> queued;
+	} perFrame[MAX_FRAMES_IN_FLIGHT];
+	FrameStaleness stale;
+
+	static std::vector<VkDescriptorSetLayoutBinding> getBindings() {
+		std::vector<VkDescriptorSetLayoutBinding> bindings(4);
+		for (uint32_t i = 0; i < bindings.size(); i++) {
+			bindings[i].binding = i;
+			bindings[i].descriptorCount = i < 2 ? maxSkinnedMeshes : 1;
+			bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+		return bindings;
+	}
+
+	void createFrameBuffers(uint32_t frameIndex, uint32_t jointCapacity, uint32_t outputCapacity) {
+		auto& frame = perFrame[frameIndex];
+		frame.jointCapacity = std::max(jointCapacity, 1u);
+		frame.outputCapacity = std::max(outputCapacity, 1u);
+
+		frame.jointBuffer = createMappedBuffer(sizeof(glm::mat4) * frame.jointCapacity);
+		//storage for the visibility buffer shading fetches
+		frame.outputBuffer = createDeviceBuffer(sizeof(Vertex3) * frame.outputCapacity, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	}
+
+	void writeDescriptorSet(uint32_t frameIndex) {
+		auto& frame = perFrame[frameIndex];
+		std::vector<StorageBufferWrite> writes = { { 2, 0, frame.jointBuffer->buffer }, { 3, 0, frame.outputBuffer->buffer } };
+		for (size_t i = frame.boundMeshes; i < meshBindings.size(); i++) {
+			writes.push_back({ 0, meshBindings[i].slot, meshBindings[i].vertexBuffer->buffer });
+			writes.push_back({ 1, meshBindings[i].slot, meshBindings[i].skinBuffer->buffer });
+		}
+		frame.boundMeshes = meshBindings.size();
+		writeStorageBuffers(frame.descriptor, writes);
+	}
+
+	void createPipeline() {
+		auto core = VulkanUtils::utils().getCore();
+
+		auto computeShaderCode = VulkanUtils::utils().compileGlslToSpv("Shaders/skinning.comp", shaderc_shader_kind::shaderc_compute_shader);
+		VkShaderModule computeShaderModule = VulkanUtils::utils().createShaderModule(computeShaderCode);
+
+		VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
+		computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		computeShaderStageInfo.module = computeShaderModule;
+		computeShaderStageInfo.pName = "main";
+
+		VkDescriptorSetLayout layout = core->getLayout(perFrame[0].descriptor);
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &layout;
+
+		VkPushConstantRange pushConstantRange{};
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(PushConstants);
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+		this->skin.layout = core->createPipelineLayout(pipelineLayoutInfo);
+
+		VkComputePipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.layout = this->skin.layout;
+		pipelineInfo.stage = computeShaderStageInfo;
+		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
+		pipelineInfo.basePipelineIndex = -1; // Optional
+
+		this->skin.pipe = core->createComputePipeline(pipelineInfo);
+
+		vkDestroyShaderModule(core->device, computeShaderModule, nullptr);
+	}
+
+public:
+	void initialize() {
+		auto core = VulkanUtils::utils().getCore();
+		//meshes streamed in later are bound while frames that never read them are in flight
+		const VkDescriptorBindingFlags meshBindFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+		VkDescriptorBindingFlags bindFlags[4] = { meshBindFlags, meshBindFlags, 0, 0 };
+		VkDescriptorSetLayoutBindingFlagsCreateInfo extendedInfo{};
+		extendedInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+		extendedInfo.pNext = nullptr;
+		extendedInfo.bindingCount = 4;
+		extendedInfo.pBindingFlags = bindFlags;
+		for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			perFrame[i].descriptor = core->createDescriptorSet(getBindings(), 0, &extendedInfo);
+			createFrameBuffers(i, 1, 1);
+			writeDescriptorSet(i);
+		}
+		createPipeline();
+	}
+
+	void destroy() {
+		auto core = VulkanUtils::utils().getCore();
+		vkDestroyPipeline(core->device, skin.pipe, nullptr);
+		vkDestroyPipelineLayout(core->device, skin.layout, nullptr);
+	}
+
+	//instanceJointCounts is 0 for instances that are not skinned, runs on the model loader's worker
+	static Layout planLayout(const std::vector<Mesh>& meshes, const std::vector<uint32_t>& instanceMeshIndices, const std::vector<uint32_t>& instanceJointCounts) {
+		Layout layout;
+		layout.instanceSlots.assign(instanceMeshIndices.size(), notSkinned);
+		uint32_t jointCount = 0;
+		uint32_t slotCount = 0;
+
+		layout.meshSlots.assign(meshes.size(), notSkinned);
+		for (size_t i = 0; i < instanceMeshIndices.size(); i++) {
+			const Mesh& mesh = meshes[instanceMeshIndices[i]];
+			if (instanceJointCounts[i] == 0 || !mesh.skinned)
+				continue;
+			uint32_t& slot = layout.meshSlots[instanceMeshIndices[i]];
+			if (slot == notSkinned)
+				slot = slotCount++;
+			layout.instanceSlots[i] = (uint32_t)layout.skinnedInstances.size();
+			layout.skinnedInstances.push_back({ slot, mesh.vertexCount, jointCount, instanceJointCounts[i], layout.outputVertexCount });
+			jointCount += instanceJointCounts[i];
+			layout.outputVertexCount += mesh.vertexCount;
+		}
+
+		layout.available = slotCount <= maxSkinnedMeshes;
+		if (!layout.available) {
+			std::cout << "Skinning: " << slotCount << " skinned meshes exceed the limit of " << maxSkinnedMeshes << ", drawing them in bind pose" << std::endl;
+			layout.instanceSlots.assign(instanceMeshIndices.size(), notSkinned);
+			layout.skinnedInstances.clear();
+			layout.meshSlots.assign(meshes.size(), notSkinned);
+			jointCount = layout.outputVertexCount = 0;
+		}
+		layout.jointMatrices.assign(jointCount, glm::mat4(1.f));
+		return layout;
+	}
+
+	void setLayout(Layout newLayout) {
+		layout = std::move(newLayout);
+		meshBindings.clear();
+		stale.markAll();
+		for (auto& frame : perFrame)
+			frame.queued.clear();
+	}
+
+	void setMeshResident(uint32_t meshIndex, const Mesh& mesh) {
+		uint32_t slot = layout.meshSlots[meshIndex];
+		if (slot == notSkinned)
+			return;
+		meshBindings.push_back({ slot, mesh.vertexBuffer, mesh.skinBuffer });
+	}
+
+	bool isSkinned(uint32_t instance) const {
+		return layout.isSkinned(instance);
+	}
+
+	bool hasSkinnedInstances() const {
+		return !layout.skinnedInstances.empty();
+	}
+
+	//jointCount matrices, the caller writes them after its nodes moved
+	glm::mat4* instanceJoints(uint32_t instance) {
+		return layout.instanceJoints(instance);
+	}
+
+	uint32_t outputOffset(uint32_t instance) const {
+		return layout.outputOffset(instance);
+	}
+
+	RC<Buffer> getOutputBuffer(uint32_t frameIndex) const {
+		return perFrame[frameIndex].outputBuffer;
+	}
+
+	void beginFrame(uint32_t frameIndex) {
+		auto& frame = perFrame[frameIndex];
+		if (stale.take(frameIndex)) {
+			uint32_t jointCount = (uint32_t)layout.jointMatrices.size();
+			if (jointCount > frame.jointCapacity || layout.outputVertexCount > frame.outputCapacity)
+				createFrameBuffers(frameIndex, std::max(jointCount, frame.jointCapacity), std::max(layout.outputVertexCount, frame.outputCapacity));
+			frame.boundMeshes = 0;
+			writeDescriptorSet(frameIndex);
+		}
+		else if (frame.boundMeshes < meshBindings.size())
+			writeDescriptorSet(frameIndex);
+		frame.queued.clear();
+	}
+
+	//skinned instances that are drawn this frame, others keep stale vertices in this frame's buffer
+	void addInstance(uint32_t frameIndex, uint32_t instance) {
+		perFrame[frameIndex].queued.push_back(layout.instanceSlots[instance]);
+	}
+
+	//records the skinning dispatches, must be outside a render pass and before the draws
+	void recordSkinning(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+		auto& frame = perFrame[frameIndex];
+		if (frame.queued.empty())
+			return;
+
+		memcpy(frame.jointBuffer->allocation->GetMappedData(), layout.jointMatrices.data(), sizeof(glm::mat4) * layout.jointMatrices.size());
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, skin.pipe);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, skin.layout, 0, 1, &frame.descriptor, 0, nullptr);
+		for (uint32_t slot : frame.queued) {
+			const SkinnedInstance& instance = layout.skinnedInstances[slot];
+			PushConstants constants{ instance.meshSlot, instance.vertexCount, instance.firstJoint, instance.jointCount, instance.outputOffset };
+			vkCmdPushConstants(commandBuffer, skin.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+			vkCmdDispatch(commandBuffer, (instance.vertexCount + workGroupSize - 1) / workGroupSize, 1, 1);
+		}
+
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+			1, &barrier, 0, nullptr, 0, nullptr
+		);
+	}
+
+	//binds the instance's skinned vertices instead of its mesh's vertex buffer, the index buffer stays the mesh's
+	void bindVertices(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t instance) {
+		VkDeviceSize offset = sizeof(Vertex3) * outputOffset(instance);
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &perFrame[frameIndex].outputBuffer->buffer, &offset);
+	}
+};
@@ -10,6 +10,8 @@ public:
 	struct CubemapPushConstants {
 		glm::mat4 inverseProjView;
 	};
+	inline static const char* environmentPath =
+		R"(C:\Users\munee\source\repos\VulkanRenderer\3DModels\meadow_2_8k.hdr)";
 private:
 
 	RC<Image> image;
@@ -156,27 +158,30 @@ private:
 		vkDestroyShaderModule(core->device, fragShaderModule, nullptr);
 		vkDestroyShaderModule(core->device, vertShaderModule, nullptr);
 	}
-	void createCubemap(RC<AsyncImageLoader> iLoader) {
+	//the equirectangular image is converted to cube faces on a loader worker and cached in the Store
+	//an 8k rgba32f image was 512 MB, 1024 faces of shared exponent texels with mips are 32 MB
+	void createCubemap(RC<AsyncImageLoader> iLoader, uint32_t faceSize) {
 
 		ImageLoadRequest req{};
-		req.desiredChannels = 4;
-		req.isFloat = true;
-		req.path = 
-			R"(C:\Users\munee\source\repos\VulkanRenderer\3DModels\meadow_2_8k.hdr)";
-		auto sizeInfo = getImageInfo(req.path.c_str());
-		req.resolution = glm::ivec3(sizeInfo.x, sizeInfo.y, 1);
-
-		//equirectangular image
+		req.desiredChannels = 3;
+		req.cubemap = true;
+		req.path = environmentPath;
+		req.resolution = glm::ivec3(faceSize, faceSize, SkyboxCooker::faceCount);
+
 		VkExtent3D extent{};
-		extent.width = sizeInfo.x;
-		extent.height = sizeInfo.y;
+		extent.width = faceSize;
+		extent.height = faceSize;
 		extent.depth = 1;
 
 		auto CI = Image::makeCreateInfo(
-			VK_FORMAT_R32G32B32A32_SFLOAT,
+			VK_FORMAT_E5B9G9R9_UFLOAT_PACK32,
 			VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
 			extent
 		);
+		std::vector<CookedMip> mips = SkyboxCooker::mipLayout(faceSize);
+		CI.mipLevels = (uint32_t)mips.size();
+		CI.arrayLayers = SkyboxCooker::faceCount;
+		CI.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
 
 		auto core = VulkanUtils::utils().getCore();
 		
@@ -187,29 +192,41 @@ private:
 		);
 
 		image->transitionImageLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-		this->cubemap = getImageView(
-			image,
-			VK_FORMAT_R32G32B32A32_SFLOAT,
-			VK_IMAGE_ASPECT_COLOR_BIT
-		);
 
-		req.callback = [weak_image=std::weak_ptr<Image>(image)](ImageLoadRequest& request, RC<Buffer> staging) {
+		VkImageViewCreateInfo viewInfo{};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_CUBE;
+		viewInfo.image = image->image;
+		viewInfo.format = image->format;
+		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = image->mipLevels;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = image->arrayLayers;
+		this->cubemap = getImageView(image, viewInfo);
+
+		req.callback = [weak_image=std::weak_ptr<Image>(image), mips](ImageLoadRequest& request, RC<Buffer> staging) {
 			auto image = weak_image.lock();
-			VkBufferImageCopy region{};
-			region.bufferOffset = 0;
-			region.bufferRowLength = 0;
-			region.bufferImageHeight = 0;
-
-			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			region.imageSubresource.mipLevel = 0;
-			region.imageSubresource.baseArrayLayer = 0;
-			region.imageSubresource.layerCount = 1;
-
-			region.imageOffset = { 0, 0, 0 };
-			region.imageExtent = image->extent;
+			//the six faces of a level follow each other in staging, one copy per level
+			std::vector<VkBufferImageCopy> regions;
+			for (uint32_t m = 0; m < mips.size(); m++) {
+				VkBufferImageCopy region{};
+				region.bufferOffset = request.stagingOffset + mips[m].offset;
+				region.bufferRowLength = 0;
+				region.bufferImageHeight = 0;
+
+				region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				region.imageSubresource.mipLevel = m;
+				region.imageSubresource.baseArrayLayer = 0;
+				region.imageSubresource.layerCount = SkyboxCooker::faceCount;
+
+				region.imageOffset = { 0, 0, 0 };
+				region.imageExtent = { mips[m].width, mips[m].height, 1 };
+				regions.push_back(region);
+			}
 
 			image->transitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-			image->copyFromBuffer(staging, region);
+			image->copyFromBuffer(staging, regions);
 			image->transitionImageLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 		};
 
@@ -219,7 +236,10 @@ private:
 		this->sampler = Sampler::create(
 			VulkanUtils::utils().getCore(),
 			Sampler::makeCreateInfo(
-
+				{ VK_FILTER_LINEAR, VK_FILTER_LINEAR },
+				{ VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE },
+				{ 0.f, 0.f, VK_LOD_CLAMP_NONE },
+				VK_SAMPLER_MIPMAP_MODE_LINEAR
 			)
 		);
 	}
@@ -261,8 +281,8 @@ private:
 	}
 
 public:
-	void initialize(RC<AsyncImageLoader> iLoader, VkRenderPass renderPass, uint32_t subpassIndex) {
-		this->createCubemap(iLoader);
+	void initialize(RC<AsyncImageLoader> iLoader, VkRenderPass renderPass, uint32_t subpassIndex, uint32_t faceSize = 1024) {
+		this->createCubemap(iLoader, faceSize);
 		this->createSampler();
 		this->createDescriptorSet();
 		this->createPipeline(renderPass, subpassIndex);
@@ -302,7 +322,7 @@ public:
 			sizeof(inverseProjView),
 			&inverseProjView
 		);
-		vkCmdDraw(commandBuffer, 36, 1, 0, 0);
+		vkCmdDraw(commandBuffer, 3, 1, 0, 0);
 	}
 
 };
\ No newline at end of file
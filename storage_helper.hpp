@@ -3,9 +3,60 @@
 #include <filesystem>
 #include <fstream>
 #include <memory>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "MappedFile.hpp"
 
 namespace fs = std::filesystem;
 
+//64 bit FNV-1a, used for store keys and cache validation
+inline uint64_t hashBytes(const void* bytes, size_t size, uint64_t seed = 14695981039346656037ull) {
+	const unsigned char* ptr = reinterpret_cast<const unsigned char*>(bytes);
+	uint64_t hash = seed;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= ptr[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+//hash of large blobs like whole files, four independent lanes of 8 byte words so it isn't held up by one multiply chain
+//not the same value as hashBytes of the blob
+inline uint64_t hashContents(const void* bytes, size_t size) {
+	constexpr uint64_t prime = 0x9E3779B97F4A7C15ull;
+	const unsigned char* ptr = reinterpret_cast<const unsigned char*>(bytes);
+	uint64_t lanes[4] = { prime, prime + 1, prime + 2, prime + 3 };
+	size_t i = 0;
+	for (; i + sizeof(lanes) <= size; i += sizeof(lanes)) {
+		for (int l = 0; l < 4; l++) {
+			uint64_t word;
+			memcpy(&word, ptr + i + l * sizeof(word), sizeof(word));
+			lanes[l] = (lanes[l] ^ word) * prime;
+			lanes[l] ^= lanes[l] >> 29;
+		}
+	}
+	uint64_t hash = hashBytes(ptr + i, size - i);
+	hash = hashBytes(lanes, sizeof(lanes), hash);
+	uint64_t size64 = size;
+	return hashBytes(&size64, sizeof(size64), hash);
+}
+
+//hash of a file's absolute path, its size and last write time, cooked items go stale when it changes
+inline uint64_t sourceFileHash(const char* filepath) {
+	std::error_code ec;
+	fs::path path = fs::absolute(filepath, ec);
+	std::string pathStr = path.generic_string();
+	uint64_t size = fs::file_size(path, ec);
+	int64_t writeTime = (int64_t)fs::last_write_time(path, ec).time_since_epoch().count();
+
+	uint64_t hash = hashBytes(pathStr.data(), pathStr.size());
+	hash = hashBytes(&size, sizeof(size), hash);
+	hash = hashBytes(&writeTime, sizeof(writeTime), hash);
+	return hash;
+}
+
 class Store {
 private:
 	inline static fs::path directory = fs::path("ObjectStore");
@@ -19,15 +70,22 @@ public:
 		return fs::is_regular_file(getStorePath(name));
 	}
 
-	void static storeBytes(const char* name, const char* bytes, unsigned int size) {
+	static std::ofstream openForWriting(const char* name) {
+		//for large items that are written piece by piece
+		fs::create_directories(directory);
 		std::ofstream file(
 			getStorePath(name),
 			std::ios::binary
 		);
-		
+
 		if (!file)
 			throw std::runtime_error("Failed to open file for writing");
 
+		return file;
+	}
+
+	void static storeBytes(const char* name, const char* bytes, size_t size) {
+		std::ofstream file = openForWriting(name);
 		file.write(bytes, size);
 	}
 
@@ -57,4 +115,10 @@ public:
 
 		return bytes;
 	}
+
+	static std::shared_ptr<MappedFile> mapBytes(const char* name) {
+		//maps the item instead of reading it, use for large items
+		assert(itemInStore(name));
+		return MappedFile::open(getStorePath(name));
+	}
 };
\ No newline at end of file
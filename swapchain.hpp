@@ -12,6 +12,9 @@ public:
 
 	std::shared_ptr<Image> depthImage;
 	UniqueImageView depthImageView;
+	//(instance, triangle) per pixel, written by the prepass and read by the visibility buffer shading
+	std::shared_ptr<Image> visibilityImage;
+	UniqueImageView visibilityImageView;
 	
 	std::vector<VkFramebuffer> swapChainFramebuffers;
 	uint32_t framesInFlight = 0;
@@ -32,6 +35,8 @@ public:
 		}
 		depthImage.reset();
 		depthImageView.reset();
+		visibilityImageView.reset();
+		visibilityImage.reset();
 		vkDestroySwapchainKHR(core->device, swapChain, nullptr);
 	}
 
@@ -132,7 +137,18 @@ private:
 			core,
 			Image::makeCreateInfo(
 				core->findDepthFormat(),
-				VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+				//sampled by the hi-z reduction
+				VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+				VkExtent3D{ swapChainExtent.width, swapChainExtent.height, 1 }
+			),
+			VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT
+		);
+
+		visibilityImage = Image::create(
+			core,
+			Image::makeCreateInfo(
+				VK_FORMAT_R32G32_UINT,
+				VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
 				VkExtent3D{ swapChainExtent.width, swapChainExtent.height, 1 }
 			),
 			VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT
@@ -164,20 +180,22 @@ private:
 		}
 
 		depthImageView = getImageView(depthImage, depthImage->format, VK_IMAGE_ASPECT_DEPTH_BIT);
+		visibilityImageView = getImageView(visibilityImage, visibilityImage->format, VK_IMAGE_ASPECT_COLOR_BIT);
 	}
 
 	void createFramebuffers(const VkDevice& device, const VkRenderPass& renderPass) {
 		swapChainFramebuffers.resize(swapChainImageViews.size());
 		for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-			VkImageView attachments[2] = {
+			VkImageView attachments[3] = {
 				swapChainImageViews[i],
-				depthImageView->view
+				depthImageView->view,
+				visibilityImageView->view
 			};
 
 			VkFramebufferCreateInfo framebufferInfo{};
 			framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
 			framebufferInfo.renderPass = renderPass;
-			framebufferInfo.attachmentCount = 2;
+			framebufferInfo.attachmentCount = 3;
 			framebufferInfo.pAttachments = attachments;
 			framebufferInfo.width = swapChainExtent.width;
 			framebufferInfo.height = swapChainExtent.height;
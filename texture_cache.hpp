@@ -0,0 +1,155 @@
+#pragma once
+
+#include "vulkan_utils.hpp"
+#include "image.hpp"
+#include "asyncImageLoader.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+//material textures shared across materials and models, keyed by the content of the file where its hash is known
+//and by the path and last write of the file until then, a texture found under one key is also found under the others
+//an entry is in use while anything besides the cache holds its image, unused ones stay resident
+//for the next model until the cache outgrows its budget, then the least recently used go first
+struct CachedTexture {
+	RC<Image> image;
+	ImageLoadHandle load;
+	//set by the load's callback, an image whose load was cancelled before that is never filled
+	RC<bool> uploaded;
+};
+
+class TextureCache {
+public:
+	//the same file makes different images depending on how it is loaded
+	struct Key {
+		//ImageInfo contentHash if byContent, its sourceHash otherwise
+		uint64_t fileHash;
+		bool byContent;
+		int32_t desiredChannels;
+		bool isSRGB;
+		bool cooked;
+
+		bool operator==(const Key& other) const {
+			return fileHash == other.fileHash && byContent == other.byContent && desiredChannels == other.desiredChannels &&
+				isSRGB == other.isSRGB && cooked == other.cooked;
+		}
+	};
+
+private:
+	struct KeyHash {
+		size_t operator()(const Key& key) const {
+			return (size_t)(key.fileHash ^ ((uint64_t)key.desiredChannels << 3) ^ ((uint64_t)key.byContent << 2) ^ ((uint64_t)key.isSRGB << 1) ^ (uint64_t)key.cooked);
+		}
+	};
+
+	struct Entry {
+		CachedTexture texture;
+		uint64_t lastUsed;
+	};
+
+	std::vector<std::shared_ptr<Entry>> entries;
+	//several keys lead to the same entry once they were found to be the same file
+	std::unordered_map<Key, std::shared_ptr<Entry>, KeyHash> keys;
+	VkDeviceSize budgetBytes;
+	VkDeviceSize residentBytes = 0;
+	uint64_t useCounter = 0;
+
+	size_t hits = 0;
+	size_t misses = 0;
+
+	static bool inUse(const Entry& entry) {
+		return entry.texture.image.use_count() > 1;
+	}
+
+	void erase(std::shared_ptr<Entry> entry) {
+		residentBytes -= entry->texture.image->allocationSize;
+		entries.erase(std::find(entries.begin(), entries.end(), entry));
+		for (auto it = keys.begin(); it != keys.end();) {
+			if (it->second == entry)
+				it = keys.erase(it);
+			else
+				++it;
+		}
+	}
+
+public:
+	explicit TextureCache(VkDeviceSize budgetBytes) : budgetBytes(budgetBytes) {}
+
+	//the cached texture under the first of the keys that has one that is or will be filled
+	//the other keys lead to it from then on
+	std::optional<CachedTexture> find(const std::vector<Key>& fileKeys) {
+		std::shared_ptr<Entry> entry;
+		for (const Key& key : fileKeys) {
+			auto it = keys.find(key);
+			if (it == keys.end())
+				continue;
+			if (!*it->second->texture.uploaded && it->second->texture.load->cancelled) {
+				erase(it->second);
+				continue;
+			}
+			entry = it->second;
+			break;
+		}
+		if (!entry) {
+			misses++;
+			return std::nullopt;
+		}
+		hits++;
+		for (const Key& key : fileKeys)
+			keys[key] = entry;
+		entry->lastUsed = ++useCounter;
+		return entry->texture;
+	}
+
+	//the texture is found under any of the keys
+	void insert(const std::vector<Key>& fileKeys, CachedTexture texture) {
+		auto entry = std::make_shared<Entry>(Entry{ std::move(texture), ++useCounter });
+		for (const Key& key : fileKeys) {
+			auto it = keys.find(key);
+			if (it != keys.end())
+				erase(it->second);
+		}
+		for (const Key& key : fileKeys)
+			keys[key] = entry;
+		residentBytes += entry->texture.image->allocationSize;
+		entries.push_back(std::move(entry));
+	}
+
+	//drops textures nothing else uses, least recently used first, until the cache fits its budget
+	//textures in use stay even over budget
+	void trim() {
+		while (residentBytes > budgetBytes) {
+			std::shared_ptr<Entry> oldest;
+			for (const auto& entry : entries) {
+				if (!inUse(*entry) && (!oldest || entry->lastUsed < oldest->lastUsed))
+					oldest = entry;
+			}
+			if (!oldest)
+				break;
+			erase(oldest);
+		}
+	}
+
+	void clear() {
+		keys.clear();
+		entries.clear();
+		residentBytes = 0;
+	}
+
+	inline size_t size() const { return entries.size(); }
+	inline VkDeviceSize getResidentBytes() const { return residentBytes; }
+	inline VkDeviceSize getBudgetBytes() const { return budgetBytes; }
+	inline size_t getHits() const { return hits; }
+	inline size_t getMisses() const { return misses; }
+
+	size_t unusedCount() const {
+		size_t count = 0;
+		for (const auto& entry : entries)
+			count += inUse(*entry) ? 0 : 1;
+		return count;
+	}
+};
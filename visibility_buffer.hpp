@@ -0,0 +1,424 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+
+#include "vulkan_utils.hpp"
+#include "buffer.hpp"
+#include "buffer_helpers.hpp"
+#include "material.hpp"
+#include "mesh.hpp"
+
+//alternative to forward shading, the prepass writes (instance, triangle) per pixel
+//and a fullscreen triangle rebuilds the attributes from barycentrics to shade every pixel once
+class VisibilityBufferRenderer {
+public:
+	struct PrepassPushConstants {
+		glm::mat4 transform;
+		uint32_t instanceIndex;
+	};
+
+	struct ShadePushConstants {
+		glm::vec2 screenSize;
+		uint32_t skinnedFrame;
+	};
+
+	//matches Instance in visibilityShade.frag
+	struct Instance {
+		glm::mat4 transform;
+		glm::mat4 normalTransform;
+		uint32_t meshIndex;
+		uint32_t materialIndex;
+		uint32_t index16;
+		//start of the instance's vertices in the skinned vertex buffers, ~0 if it is not skinned
+		uint32_t skinnedVertexOffset;
+	};
+
+	inline static const VkFormat format = VK_FORMAT_R32G32_UINT;
+	//cleared value of pixels without geometry
+	inline static const uint32_t noInstance = std::numeric_limits<uint32_t>::max();
+	//size of the vertex and index buffer arrays, models with more meshes fall back to forward shading
+	inline static const uint32_t maxMeshes = 1024;
+
+private:
+	struct {
+		VkPipeline pipe;
+		VkPipelineLayout layout;
+	} prepass, shading;
+
+	struct MeshBinding {
+		uint32_t meshIndex;
+		RC<Buffer> vertexBuffer;
+		RC<Buffer> indexBuffer;
+	};
+	std::vector<MeshBinding> meshBindings;
+
+	//set 3 of the shading pipeline
+	struct {
+		VkDescriptorSet descriptor;
+		size_t boundMeshes = 0;
+		RC<Buffer> skinnedVertices;
+	} perFrame[MAX_FRAMES_IN_FLIGHT];
+	FrameStaleness stale;
+
+	RC<Buffer> instanceBuffer;
+	uint32_t instanceCapacity = 0;
+	//mirrors instanceBuffer so moved ranges can be rewritten whole
+	std::vector<Instance> instances;
+	RC<Buffer> materialBuffer;
+	uint32_t materialCapacity = 0;
+	bool available = false;
+
+	static void setTransform(Instance& instance, const glm::mat4& transform) {
+		instance.transform = transform;
+		instance.normalTransform = glm::mat4(glm::transpose(glm::inverse(glm::mat3(transform))));
+	}
+
+	static std::vector<VkDescriptorSetLayoutBinding> getBindings() {
+		std::vector<VkDescriptorSetLayoutBinding> bindings(6);
+		for (uint32_t i = 0; i < bindings.size(); i++) {
+			bindings[i].binding = i;
+			bindings[i].descriptorCount = i == 5 ? MAX_FRAMES_IN_FLIGHT : i >= 3 ? maxMeshes : 1;
+			bindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		}
+		return bindings;
+	}
+
+	void writeBufferBindings(uint32_t frameIndex) {
+		auto& frame = perFrame[frameIndex];
+		std::vector<StorageBufferWrite> writes;
+		if (stale.take(frameIndex)) {
+			frame.boundMeshes = 0;
+			writes.push_back({ 1, 0, instanceBuffer->buffer });
+			writes.push_back({ 2, 0, materialBuffer->buffer });
+		}
+		for (size_t i = frame.boundMeshes; i < meshBindings.size(); i++) {
+			writes.push_back({ 3, meshBindings[i].meshIndex, meshBindings[i].vertexBuffer->buffer });
+			writes.push_back({ 4, meshBindings[i].meshIndex, meshBindings[i].indexBuffer->buffer });
+		}
+		frame.boundMeshes = meshBindings.size();
+		writeStorageBuffers(frame.descriptor, writes);
+	}
+
+	static VkPipeline createPipeline(
+		const char* vertPath, const char* fragPath,
+		VkPipelineLayout layout, VkRenderPass renderPass, uint32_t subpassIndex,
+		bool meshInput, VkColorComponentFlags colorWriteMask, VkBool32 depthTest
+	) {
+		auto core = VulkanUtils::utils().getCore();
+
+		auto vertShaderCode = VulkanUtils::utils().compileGlslToSpv(vertPath, shaderc_shader_kind::shaderc_vertex_shader);
+		auto fragShaderCode = VulkanUtils::utils().compileGlslToSpv(fragPath, shaderc_shader_kind::shaderc_fragment_shader);
+
+		VkShaderModule vertShaderModule = VulkanUtils::utils().createShaderModule(vertShaderCode);
+		VkShaderModule fragShaderModule = VulkanUtils::utils().createShaderModule(fragShaderCode);
+
+		VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
+		vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+		vertShaderStageInfo.module = vertShaderModule;
+		vertShaderStageInfo.pName = "main";
+
+		VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
+		fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		fragShaderStageInfo.module = fragShaderModule;
+		fragShaderStageInfo.pName = "main";
+
+		VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+
+		//only taking position attribute
+		auto bindingDescription = VertexInputDescription::getBindingDescription();
+		auto attributeDescriptions = VertexInputDescription::getAttributeDescriptions()[0];
+		VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+		vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+		if (meshInput) {
+			vertexInputInfo.vertexBindingDescriptionCount = 1;
+			vertexInputInfo.vertexAttributeDescriptionCount = 1;
+			vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+			vertexInputInfo.pVertexAttributeDescriptions = &attributeDescriptions;
+		}
+
+		VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+		inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+		VkPipelineViewportStateCreateInfo viewportState{};
+		viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		viewportState.viewportCount = 1;
+		viewportState.scissorCount = 1;
+
+		VkPipelineRasterizationStateCreateInfo rasterizer{};
+		rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		rasterizer.depthClampEnable = VK_FALSE;
+		rasterizer.rasterizerDiscardEnable = VK_FALSE;
+		rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+		rasterizer.lineWidth = 1.0f;
+		rasterizer.cullMode = VK_CULL_MODE_NONE;
+		rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+		rasterizer.depthBiasEnable = VK_FALSE;
+
+		VkPipelineMultisampleStateCreateInfo multisampling{};
+		multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		multisampling.sampleShadingEnable = VK_FALSE;
+		multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+		VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+		colorBlendAttachment.colorWriteMask = colorWriteMask;
+		colorBlendAttachment.blendEnable = VK_FALSE;
+
+		VkPipelineColorBlendStateCreateInfo colorBlending{};
+		colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		colorBlending.logicOpEnable = VK_FALSE;
+		colorBlending.logicOp = VK_LOGIC_OP_COPY;
+		colorBlending.attachmentCount = 1;
+		colorBlending.pAttachments = &colorBlendAttachment;
+
+		VkPipelineDepthStencilStateCreateInfo depthStencilCI{};
+		depthStencilCI.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		depthStencilCI.depthTestEnable = depthTest;
+		depthStencilCI.depthWriteEnable = depthTest;
+		depthStencilCI.depthCompareOp = VK_COMPARE_OP_LESS;
+		depthStencilCI.depthBoundsTestEnable = VK_FALSE;
+		depthStencilCI.stencilTestEnable = VK_FALSE;
+
+		std::vector<VkDynamicState> dynamicStates = {
+			VK_DYNAMIC_STATE_VIEWPORT,
+			VK_DYNAMIC_STATE_SCISSOR
+		};
+		VkPipelineDynamicStateCreateInfo dynamicState{};
+		dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+		dynamicState.pDynamicStates = dynamicStates.data();
+
+		VkGraphicsPipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipelineInfo.stageCount = 2;
+		pipelineInfo.pStages = shaderStages;
+
+		pipelineInfo.pVertexInputState = &vertexInputInfo;
+		pipelineInfo.pInputAssemblyState = &inputAssembly;
+		pipelineInfo.pViewportState = &viewportState;
+		pipelineInfo.pRasterizationState = &rasterizer;
+		pipelineInfo.pMultisampleState = &multisampling;
+		pipelineInfo.pColorBlendState = &colorBlending;
+		pipelineInfo.pDepthStencilState = &depthStencilCI;
+		pipelineInfo.pDynamicState = &dynamicState;
+
+		pipelineInfo.layout = layout;
+
+		pipelineInfo.renderPass = renderPass;
+		pipelineInfo.subpass = subpassIndex;
+		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
+		pipelineInfo.basePipelineIndex = -1; // Optional
+
+		VkPipeline pipe = core->createGraphicsPipeline(pipelineInfo);
+
+		vkDestroyShaderModule(core->device, fragShaderModule, nullptr);
+		vkDestroyShaderModule(core->device, vertShaderModule, nullptr);
+		return pipe;
+	}
+
+	void createPipelines(VkRenderPass renderPass, VkDescriptorSetLayout globalLayout, VkDescriptorSetLayout lightsLayout, VkDescriptorSetLayout materialsLayout) {
+		auto core = VulkanUtils::utils().getCore();
+
+		VkPushConstantRange prepassPushConstant{};
+		prepassPushConstant.offset = 0;
+		prepassPushConstant.size = sizeof(PrepassPushConstants);
+		prepassPushConstant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &globalLayout;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &prepassPushConstant;
+		prepass.layout = core->createPipelineLayout(pipelineLayoutInfo);
+
+		VkPushConstantRange shadePushConstant{};
+		shadePushConstant.offset = 0;
+		shadePushConstant.size = sizeof(ShadePushConstants);
+		shadePushConstant.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+		VkDescriptorSetLayout shadeLayouts[4] = { globalLayout, lightsLayout, materialsLayout, core->getLayout(perFrame[0].descriptor) };
+		pipelineLayoutInfo.setLayoutCount = 4;
+		pipelineLayoutInfo.pSetLayouts = shadeLayouts;
+		pipelineLayoutInfo.pPushConstantRanges = &shadePushConstant;
+		shading.layout = core->createPipelineLayout(pipelineLayoutInfo);
+
+		prepass.pipe = createPipeline(
+			"Shaders/visibility.vert", "Shaders/visibility.frag",
+			prepass.layout, renderPass, 0,
+			true, VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT, VK_TRUE
+		);
+		shading.pipe = createPipeline(
+			"Shaders/visibilityShade.vert", "Shaders/visibilityShade.frag",
+			shading.layout, renderPass, 1,
+			false, VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT, VK_FALSE
+		);
+	}
+
+public:
+	//the prepass is subpass 0 of renderPass, shading reads its attachment in subpass 1
+	void initialize(VkRenderPass renderPass, VkDescriptorSetLayout globalLayout, VkDescriptorSetLayout lightsLayout, VkDescriptorSetLayout materialsLayout) {
+		auto core = VulkanUtils::utils().getCore();
+
+		//meshes streamed in later are bound while frames that never read them are in flight
+		const VkDescriptorBindingFlags meshBindFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+		VkDescriptorBindingFlags bindFlags[6] = { 0, 0, 0, meshBindFlags, meshBindFlags, VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT };
+		VkDescriptorSetLayoutBindingFlagsCreateInfo extendedInfo{};
+		extendedInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+		extendedInfo.pNext = nullptr;
+		extendedInfo.bindingCount = 6;
+		extendedInfo.pBindingFlags = bindFlags;
+		reserveDeviceBuffer(instanceBuffer, instanceCapacity, 1, sizeof(Instance));
+		reserveDeviceBuffer(materialBuffer, materialCapacity, 1, sizeof(MaterialInfo));
+		stale.markAll();
+		for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			perFrame[i].descriptor = core->createDescriptorSet(getBindings(), 0, &extendedInfo);
+			writeBufferBindings(i);
+		}
+
+		createPipelines(renderPass, globalLayout, lightsLayout, materialsLayout);
+	}
+
+	void destroy() {
+		auto core = VulkanUtils::utils().getCore();
+		vkDestroyPipeline(core->device, prepass.pipe, nullptr);
+		vkDestroyPipelineLayout(core->device, prepass.layout, nullptr);
+		vkDestroyPipeline(core->device, shading.pipe, nullptr);
+		vkDestroyPipelineLayout(core->device, shading.layout, nullptr);
+	}
+
+	//must not be called while frames are in flight
+	void setVisibilityView(VkImageView view) {
+		VkDescriptorImageInfo imageInfo{};
+		imageInfo.imageView = view;
+		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		VkWriteDescriptorSet writes[MAX_FRAMES_IN_FLIGHT]{};
+		for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[i].descriptorCount = 1;
+			writes[i].descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			writes[i].dstSet = perFrame[i].descriptor;
+			writes[i].dstBinding = 0;
+			writes[i].pImageInfo = &imageInfo;
+		}
+		vkUpdateDescriptorSets(VulkanUtils::utils().getCore()->device, MAX_FRAMES_IN_FLIGHT, writes, 0, nullptr);
+	}
+
+	//skinnedVertexOffsets has Skinner::outputOffset of every instance, runs on the model loader's worker
+	static std::vector<Instance> buildInstances(
+		const std::vector<Mesh>& meshes,
+		const std::vector<glm::mat4>& transforms,
+		const std::vector<uint32_t>& instanceMeshIndices,
+		const std::vector<uint32_t>& instanceMaterialIndices,
+		const std::vector<uint32_t>& skinnedVertexOffsets
+	) {
+		std::vector<Instance> instances(transforms.size(), Instance{});
+		for (size_t i = 0; i < transforms.size(); i++) {
+			const Mesh& mesh = meshes[instanceMeshIndices[i]];
+			setTransform(instances[i], transforms[i]);
+			instances[i].meshIndex = instanceMeshIndices[i];
+			instances[i].materialIndex = instanceMaterialIndices[i];
+			instances[i].index16 = mesh.indexType == VK_INDEX_TYPE_UINT16 ? 1u : 0u;
+			instances[i].skinnedVertexOffset = skinnedVertexOffsets[i];
+		}
+		return instances;
+	}
+
+	//the mode is unavailable when the model has too many meshes
+	std::vector<BufferUpload> setGeometry(std::vector<Instance> newInstances, StagedBytes stagedInstances, StagedBytes stagedMaterials, uint32_t meshCount) {
+		meshBindings.clear();
+		stale.markAll();
+
+		available = meshCount <= maxMeshes;
+		if (!available) {
+			std::cout << "Visibility buffer: " << meshCount << " meshes exceed the limit of " << maxMeshes << ", using forward shading" << std::endl;
+			instances.clear();
+			return {};
+		}
+
+		instances = std::move(newInstances);
+		reserveDeviceBuffer(instanceBuffer, instanceCapacity, (uint32_t)instances.size(), sizeof(Instance));
+		reserveDeviceBuffer(materialBuffer, materialCapacity, (uint32_t)(stagedMaterials.size / sizeof(MaterialInfo)), sizeof(MaterialInfo));
+		return { { stagedInstances, instanceBuffer }, { stagedMaterials, materialBuffer } };
+	}
+
+	//outside of render passes
+	void updateTransforms(VkCommandBuffer commandBuffer, FrameStaging& staging, uint32_t frameIndex, const std::vector<glm::mat4>& transforms, uint32_t first, uint32_t count) {
+		if (!available)
+			return;
+		for (uint32_t i = first; i < first + count; i++)
+			setTransform(instances[i], transforms[i]);
+		staging.write(commandBuffer, frameIndex, instanceBuffer->buffer, sizeof(Instance) * first, instances.data() + first, sizeof(Instance) * count);
+	}
+
+	//none of the mesh's instances may have been drawn before
+	void setMeshResident(uint32_t meshIndex, const Mesh& mesh) {
+		if (!available)
+			return;
+		meshBindings.push_back({ meshIndex, mesh.vertexBuffer, mesh.indexBuffer });
+	}
+
+	//skinnedVertices is the frame's Skinner output buffer
+	void beginFrame(uint32_t frameIndex, RC<Buffer> skinnedVertices) {
+		auto& frame = perFrame[frameIndex];
+		writeBufferBindings(frameIndex);
+		if (frame.skinnedVertices == skinnedVertices)
+			return;
+		frame.skinnedVertices = skinnedVertices;
+
+		VkDescriptorBufferInfo info{};
+		info.buffer = skinnedVertices->buffer;
+		info.offset = 0;
+		info.range = VK_WHOLE_SIZE;
+		VkWriteDescriptorSet write{};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		write.dstSet = frame.descriptor;
+		write.dstBinding = 5;
+		write.dstArrayElement = frameIndex;
+		write.pBufferInfo = &info;
+		vkUpdateDescriptorSets(VulkanUtils::utils().getCore()->device, 1, &write, 0, nullptr);
+	}
+
+	bool isAvailable() const {
+		return available;
+	}
+
+	//in subpass 0, viewport and scissor should be set after this
+	void beginPrepass(VkCommandBuffer commandBuffer, VkDescriptorSet globalDescriptor) {
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, prepass.pipe);
+		vkCmdBindDescriptorSets(commandBuffer,
+			VK_PIPELINE_BIND_POINT_GRAPHICS, prepass.layout,
+			0, 1, &globalDescriptor,
+			0, nullptr
+		);
+	}
+
+	void pushInstance(VkCommandBuffer commandBuffer, const glm::mat4& transform, uint32_t instanceIndex) {
+		PrepassPushConstants constants{ transform, instanceIndex };
+		vkCmdPushConstants(commandBuffer, prepass.layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
+	}
+
+	//in subpass 1, sets are the forward shading pipeline's sets 0 to 2, viewport and scissor should be set
+	void shade(VkCommandBuffer commandBuffer, const VkDescriptorSet(&forwardSets)[3], glm::vec2 screenSize, uint32_t frameIndex) {
+		VkDescriptorSet sets[4] = { forwardSets[0], forwardSets[1], forwardSets[2], perFrame[frameIndex].descriptor };
+		//the dynamic material uniform is not read, material infos come from set 3
+		uint32_t dynamicOffset = 0;
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shading.pipe);
+		vkCmdBindDescriptorSets(commandBuffer,
+			VK_PIPELINE_BIND_POINT_GRAPHICS, shading.layout,
+			0, 4, sets,
+			1, &dynamicOffset
+		);
+
+		ShadePushConstants constants{ screenSize, frameIndex };
+		vkCmdPushConstants(commandBuffer, shading.layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(constants), &constants);
+		vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+	}
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <deque>
 #include <fstream>
 
 #include <shaderc/shaderc.hpp>
@@ -15,6 +16,9 @@ class VulkanUtils {
 	VulkanCore core;
 	VkCommandPool commandPool;
 	shaderc::Compiler compiler = shaderc::Compiler();
+	//resources frames in flight may still use, each with the frameWaited count it was retired at
+	std::deque<std::pair<uint64_t, std::shared_ptr<void>>> retired;
+	uint64_t waitedFrames = 0;
 
 	void createCommandPool() {
 		QueueFamilyIndices queueFamilyIndices = core->findQueueFamilies();
@@ -45,6 +49,24 @@ public:
 	inline VulkanCore getCore() { return core; }
 	inline VkCommandPool getCommandPool() { return commandPool; }
 
+	//keeps a resource recorded frames may still read alive until they are done, instead of waiting for the device
+	//main thread only
+	void retire(std::shared_ptr<void> resource) {
+		retired.emplace_back(waitedFrames, std::move(resource));
+	}
+
+	//after a frame's fence was waited on, once every frame in flight is newer than a retired resource it goes
+	void frameWaited() {
+		waitedFrames++;
+		while (!retired.empty() && retired.front().first + MAX_FRAMES_IN_FLIGHT <= waitedFrames)
+			retired.pop_front();
+	}
+
+	//only once the device is idle
+	void releaseRetired() {
+		retired.clear();
+	}
+
 	std::string readFile(std::string filePath) {
 		std::ifstream file;
 		std::string text;